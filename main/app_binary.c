@@ -0,0 +1,80 @@
+#include <string.h>
+
+#include "app_binary.h"
+
+// fields are written byte by byte, the layout does not depend on
+// the compiler struct packing or on the cpu endianness
+static unsigned char * put_u16(unsigned char *p, unsigned short v)
+{
+  p[0] = v & 0xff;
+  p[1] = v >> 8;
+  return p + 2;
+}
+
+static unsigned char * put_u32(unsigned char *p, unsigned int v)
+{
+  p[0] = v & 0xff;
+  p[1] = (v >> 8) & 0xff;
+  p[2] = (v >> 16) & 0xff;
+  p[3] = v >> 24;
+  return p + 4;
+}
+
+static unsigned char * put_header(unsigned char *p, enum BinaryPayloadType type)
+{
+  p[0] = BINARY_PAYLOAD_VERSION;
+  p[1] = type;
+  return p + BINARY_HEADER_LEN;
+}
+
+int binary_encode_sensor(unsigned char *buf, short value)
+{
+  unsigned char *p = put_header(buf, BINARY_PAYLOAD_SENSOR);
+  p = put_u16(p, value);
+  return p - buf;
+}
+
+int binary_encode_thermostats(unsigned char *buf, const struct BinaryThermostat *thermostats, int nb)
+{
+  unsigned char *p = put_header(buf, BINARY_PAYLOAD_THERMOSTATS);
+  *p++ = nb;
+  for (int i = 0; i < nb; i++) {
+    p = put_u16(p, thermostats[i].currentTemperature);
+    p = put_u16(p, thermostats[i].targetTemperature);
+    p = put_u16(p, thermostats[i].temperatureTolerance);
+    *p++ = thermostats[i].mode;
+    *p++ = thermostats[i].action;
+  }
+  return p - buf;
+}
+
+int binary_encode_ops(unsigned char *buf, const unsigned int *fields)
+{
+  unsigned char *p = put_header(buf, BINARY_PAYLOAD_OPS);
+  for (int i = 0; i < BINARY_OPS_FIELDS_NB; i++) {
+    p = put_u32(p, fields[i]);
+  }
+  return p - buf;
+}
+
+// duty holds the relay and heating percents of the hours then the days
+int binary_encode_duty(unsigned char *buf, const unsigned char *duty, int hoursNb, int daysNb,
+                       unsigned int total, const struct BinaryDutyTransition *transitions,
+                       int transitionsNb)
+{
+  unsigned char *p = put_header(buf, BINARY_PAYLOAD_THERMOSTAT_DUTY);
+  *p++ = hoursNb;
+  *p++ = daysNb;
+  memcpy(p, duty, (hoursNb + daysNb) * 2);
+  p += (hoursNb + daysNb) * 2;
+  p = put_u32(p, total);
+  *p++ = transitionsNb;
+  for (int i = 0; i < transitionsNb; i++) {
+    p = put_u32(p, transitions[i].ts);
+    *p++ = transitions[i].thermostatId;
+    *p++ = transitions[i].channel;
+    *p++ = transitions[i].on;
+    *p++ = transitions[i].reason;
+  }
+  return p - buf;
+}
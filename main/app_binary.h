@@ -0,0 +1,71 @@
+#ifndef APP_BINARY_H
+#define APP_BINARY_H
+
+/* compact payloads used instead of text when CONFIG_MQTT_BINARY_PAYLOAD
+   is set, every payload starts with the version and type bytes and
+   multi byte fields are little endian */
+#define BINARY_PAYLOAD_VERSION 1
+#define BINARY_HEADER_LEN 2
+
+enum BinaryPayloadType {
+  BINARY_PAYLOAD_SENSOR = 1,
+  BINARY_PAYLOAD_THERMOSTATS = 2,
+  BINARY_PAYLOAD_OPS = 3,
+  BINARY_PAYLOAD_THERMOSTAT_DUTY = 4,
+};
+
+enum BinaryThermostatAction {
+  BINARY_ACTION_OFF = 0,
+  BINARY_ACTION_IDLE = 1,
+  BINARY_ACTION_HEATING = 2,
+};
+
+/* temperatures in tenths of degree, SHRT_MIN when unknown */
+struct BinaryThermostat {
+  short currentTemperature;
+  short targetTemperature;
+  short temperatureTolerance;
+  unsigned char mode;
+  unsigned char action;
+};
+#define BINARY_THERMOSTAT_LEN 8
+
+/* thermostat relay and circuit heating transition, ts in seconds
+   since epoch */
+struct BinaryDutyTransition {
+  unsigned int ts;
+  unsigned char thermostatId;
+  unsigned char channel;
+  unsigned char on;
+  unsigned char reason;
+};
+#define BINARY_DUTY_TRANSITION_LEN 8
+
+enum BinaryOpsField {
+  BINARY_OPS_FREE_HEAP = 0,
+  BINARY_OPS_MIN_FREE_HEAP,
+  BINARY_OPS_PUB_FAILED,
+  BINARY_OPS_PUB_DROPPED,
+  BINARY_OPS_PUB_OVERFLOW,
+  BINARY_OPS_OUTBOX_EVICTED,
+  BINARY_OPS_OUTBOX_REJECTED,
+  BINARY_OPS_SENSOR_FILTERED,
+  BINARY_OPS_FIELDS_NB
+};
+
+#define BINARY_SENSOR_LEN (BINARY_HEADER_LEN + 2)
+#define BINARY_THERMOSTATS_LEN(nb) (BINARY_HEADER_LEN + 1 + (nb) * BINARY_THERMOSTAT_LEN)
+#define BINARY_OPS_LEN (BINARY_HEADER_LEN + BINARY_OPS_FIELDS_NB * 4)
+/* hours and days nb, a relay and a heating duty in percent per bucket,
+   transitions recorded since boot, transitions nb and the transitions */
+#define BINARY_DUTY_LEN(buckets, transitions) \
+  (BINARY_HEADER_LEN + 2 + (buckets) * 2 + 4 + 1 + (transitions) * BINARY_DUTY_TRANSITION_LEN)
+
+int binary_encode_sensor(unsigned char *buf, short value);
+int binary_encode_thermostats(unsigned char *buf, const struct BinaryThermostat *thermostats, int nb);
+int binary_encode_ops(unsigned char *buf, const unsigned int *fields);
+int binary_encode_duty(unsigned char *buf, const unsigned char *duty, int hoursNb, int daysNb,
+                       unsigned int total, const struct BinaryDutyTransition *transitions,
+                       int transitionsNb);
+
+#endif /* APP_BINARY_H */
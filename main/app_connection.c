@@ -0,0 +1,212 @@
+#include "esp_system.h"
+#include "esp_log.h"
+#include "esp_wifi.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "mqtt_client.h"
+
+#include "app_mqtt.h"
+#include "app_mqtt_topics.h"
+#include "app_connection.h"
+
+extern esp_mqtt_client_handle_t client;
+extern QueueHandle_t connectionQueue;
+
+static const char *TAG = "MQTTS_CONNECTION";
+
+struct ConnManager connManager;
+
+#define MS_TO_TICKS(ms) ((ms) / portTICK_PERIOD_MS)
+#define TICKS_TO_MS(t) ((t) * portTICK_PERIOD_MS)
+
+// exponential backoff with equal jitter: half of the delay is fixed,
+// the other half is random so a fleet restarted by the same AP reboot
+// spreads its reconnects
+unsigned int conn_backoff_delay(unsigned int failures, unsigned int random)
+{
+  unsigned int delay = CONN_BACKOFF_MIN;
+  while (failures-- > 1 && delay < CONN_BACKOFF_MAX) {
+    delay *= 2;
+  }
+  if (delay > CONN_BACKOFF_MAX) {
+    delay = CONN_BACKOFF_MAX;
+  }
+  return delay / 2 + random % (delay / 2 + 1);
+}
+
+static void schedule(struct ConnManager *m, enum ConnAction action,
+                     TickType_t now, unsigned int delay)
+{
+  m->pending = action;
+  m->deadline = now + MS_TO_TICKS(delay);
+}
+
+static void outage_start(struct ConnManager *m, unsigned char cause,
+                         unsigned char reason, TickType_t now)
+{
+  if (m->downAt) {
+    return;
+  }
+  m->downAt = now ? now : 1;
+  memset(&m->report, 0, sizeof(m->report));
+  m->report.cause = cause;
+  m->report.wifiReason = reason;
+}
+
+// event handling without side effects, returns what has to be done now,
+// what has to be done later is left in pending until deadline
+enum ConnAction conn_step(struct ConnManager *m, const struct ConnEvent *e,
+                          TickType_t now, unsigned int random)
+{
+  switch (e->type) {
+  case CONN_EVENT_WIFI_START:
+    m->state = CONN_STATE_WIFI_DOWN;
+    m->pending = CONN_ACTION_NONE;
+    return CONN_ACTION_WIFI_CONNECT;
+
+  case CONN_EVENT_WIFI_DOWN:
+    outage_start(m, CONN_EVENT_WIFI_DOWN, e->reason, now);
+    m->state = CONN_STATE_WIFI_DOWN;
+    m->wifiFailures += 1;
+    m->report.wifiAttempts += 1;
+    schedule(m, CONN_ACTION_WIFI_CONNECT, now, conn_backoff_delay(m->wifiFailures, random));
+    // no broker to talk to without ip, the mqtt client would spin on tls connects
+    return m->mqttManaged ? CONN_ACTION_MQTT_STOP : CONN_ACTION_NONE;
+
+  case CONN_EVENT_IP_UP:
+    m->state = CONN_STATE_IP_UP;
+    m->wifiFailures = 0;
+    m->ipAt = now;
+    if (m->downAt && m->report.cause == CONN_EVENT_WIFI_DOWN) {
+      m->report.wifiMs = TICKS_TO_MS(now - m->downAt);
+    }
+    if (m->mqttManaged) {
+      // only jitter, every device of the AP gets its ip back at once
+      schedule(m, CONN_ACTION_MQTT_START, now, random % CONN_BACKOFF_MIN);
+    } else {
+      m->pending = CONN_ACTION_NONE;
+    }
+    return CONN_ACTION_NONE;
+
+  case CONN_EVENT_MQTT_UP:
+    m->state = CONN_STATE_MQTT_UP;
+    m->mqttManaged = true;
+    m->mqttFailures = 0;
+    m->pending = CONN_ACTION_NONE;
+    if (m->downAt) {
+      m->report.downMs = TICKS_TO_MS(now - m->downAt);
+      m->report.mqttMs = TICKS_TO_MS(now - (m->ipAt > m->downAt ? m->ipAt : m->downAt));
+      m->downAt = 0;
+      m->reportReady = true;
+    }
+    return CONN_ACTION_NONE;
+
+  case CONN_EVENT_MQTT_DOWN:
+    // the client reconnects by itself until the first connect, the
+    // disconnect following our own stop is not a failure
+    if (!m->mqttManaged ||
+        (m->state != CONN_STATE_MQTT_UP && m->state != CONN_STATE_MQTT_CONNECTING)) {
+      return CONN_ACTION_NONE;
+    }
+    outage_start(m, CONN_EVENT_MQTT_DOWN, 0, now);
+    m->state = CONN_STATE_IP_UP;
+    m->mqttFailures += 1;
+    m->report.mqttAttempts += 1;
+    if (m->mqttFailures >= CONN_MQTT_FAILURES_WIFI_RESTART) {
+      m->mqttFailures = 0;
+      schedule(m, CONN_ACTION_WIFI_RESTART, now, 0);
+    } else {
+      schedule(m, CONN_ACTION_MQTT_START, now, conn_backoff_delay(m->mqttFailures, random));
+    }
+    return CONN_ACTION_MQTT_STOP;
+  }
+  return CONN_ACTION_NONE;
+}
+
+// pending action once its deadline is reached
+enum ConnAction conn_timeout(struct ConnManager *m, TickType_t now)
+{
+  if (m->pending == CONN_ACTION_NONE || (int)(now - m->deadline) < 0) {
+    return CONN_ACTION_NONE;
+  }
+  enum ConnAction action = m->pending;
+  m->pending = CONN_ACTION_NONE;
+  if (action == CONN_ACTION_MQTT_START) {
+    m->state = CONN_STATE_MQTT_CONNECTING;
+  }
+  return action;
+}
+
+// called from the wifi and mqtt event handlers, never blocks
+void conn_post(unsigned char type, unsigned char reason)
+{
+  struct ConnEvent e = {type, reason};
+  if (xQueueSend(connectionQueue, &e, 0) != pdPASS) {
+    ESP_LOGE(TAG, "Cannot send to connectionQueue");
+  }
+}
+
+static void run_action(enum ConnAction action)
+{
+  switch (action) {
+  case CONN_ACTION_WIFI_CONNECT:
+    ESP_LOGI(TAG, "wifi connect");
+    esp_wifi_connect();
+    break;
+  case CONN_ACTION_WIFI_RESTART:
+    // the disconnect event schedules the next connect
+    ESP_LOGW(TAG, "mqtt keeps failing, restarting wifi");
+    esp_wifi_disconnect();
+    break;
+  case CONN_ACTION_MQTT_START:
+    ESP_LOGI(TAG, "mqtt start");
+    esp_mqtt_client_start(client);
+    break;
+  case CONN_ACTION_MQTT_STOP:
+    ESP_LOGI(TAG, "mqtt stop");
+    esp_mqtt_client_stop(client);
+    break;
+  default:
+    break;
+  }
+}
+
+void publish_connection_report()
+{
+  struct ConnReport *r = &connManager.report;
+  char data[160];
+
+  if (!connManager.reportReady) {
+    return;
+  }
+  connManager.reportReady = false;
+  sprintf(data, "{\"cause\":\"%s\",\"wifi_reason\":%u,\"wifi_attempts\":%u,\"mqtt_attempts\":%u,"
+          "\"down_ms\":%u,\"wifi_ms\":%u,\"mqtt_ms\":%u}",
+          r->cause == CONN_EVENT_WIFI_DOWN ? "wifi" : "mqtt",
+          r->wifiReason, r->wifiAttempts, r->mqttAttempts,
+          r->downMs, r->wifiMs, r->mqttMs);
+  mqtt_publish_data(MQTT_EVT_TOPIC("connection"), data, QOS_1, NO_RETAIN);
+}
+
+void connection_task(void* pvParameters)
+{
+  ESP_LOGI(TAG, "connection_task started");
+  struct ConnEvent e;
+  while(1) {
+    TickType_t wait = portMAX_DELAY;
+    if (connManager.pending != CONN_ACTION_NONE) {
+      TickType_t now = xTaskGetTickCount();
+      wait = (int)(connManager.deadline - now) > 0 ? connManager.deadline - now : 0;
+    }
+    if (xQueueReceive(connectionQueue, &e, wait)) {
+      run_action(conn_step(&connManager, &e, xTaskGetTickCount(), esp_random()));
+    }
+    run_action(conn_timeout(&connManager, xTaskGetTickCount()));
+  }
+}
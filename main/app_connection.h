@@ -0,0 +1,85 @@
+#ifndef APP_CONNECTION_H
+#define APP_CONNECTION_H
+
+#include <stdbool.h>
+
+#ifdef CONFIG_MQTT_RECONNECT_BACKOFF_MIN
+#define CONN_BACKOFF_MIN CONFIG_MQTT_RECONNECT_BACKOFF_MIN
+#else //CONFIG_MQTT_RECONNECT_BACKOFF_MIN
+#define CONN_BACKOFF_MIN 1000
+#endif //CONFIG_MQTT_RECONNECT_BACKOFF_MIN
+
+#ifdef CONFIG_MQTT_RECONNECT_BACKOFF_MAX
+#define CONN_BACKOFF_MAX CONFIG_MQTT_RECONNECT_BACKOFF_MAX
+#else //CONFIG_MQTT_RECONNECT_BACKOFF_MAX
+#define CONN_BACKOFF_MAX 120000
+#endif //CONFIG_MQTT_RECONNECT_BACKOFF_MAX
+
+/* mqtt connect failures with wifi up before wifi is restarted */
+#define CONN_MQTT_FAILURES_WIFI_RESTART 8
+
+enum ConnState {
+  CONN_STATE_WIFI_DOWN = 0,
+  CONN_STATE_IP_UP,           // waiting for the mqtt backoff
+  CONN_STATE_MQTT_CONNECTING,
+  CONN_STATE_MQTT_UP,
+};
+
+enum ConnEventType {
+  CONN_EVENT_WIFI_START = 1,
+  CONN_EVENT_WIFI_DOWN,
+  CONN_EVENT_IP_UP,
+  CONN_EVENT_MQTT_UP,
+  CONN_EVENT_MQTT_DOWN,
+};
+
+enum ConnAction {
+  CONN_ACTION_NONE = 0,
+  CONN_ACTION_WIFI_CONNECT,
+  CONN_ACTION_WIFI_RESTART,
+  CONN_ACTION_MQTT_START,
+  CONN_ACTION_MQTT_STOP,
+};
+
+/* posted by the wifi and mqtt event handlers, reason is the wifi
+   disconnect reason */
+struct ConnEvent {
+  unsigned char type;
+  unsigned char reason;
+};
+
+/* what the last outage was made of, times in ms */
+struct ConnReport {
+  unsigned char cause; // CONN_EVENT_WIFI_DOWN or CONN_EVENT_MQTT_DOWN
+  unsigned char wifiReason;
+  unsigned short wifiAttempts;
+  unsigned short mqttAttempts;
+  unsigned int downMs;
+  unsigned int wifiMs; // lost to ip up again, 0 when wifi stayed up
+  unsigned int mqttMs; // ip up to mqtt connected
+};
+
+struct ConnManager {
+  enum ConnState state;
+  bool mqttManaged;       // set once the boot time connect went through
+  enum ConnAction pending;
+  TickType_t deadline;
+  unsigned int wifiFailures;
+  unsigned int mqttFailures;
+  TickType_t downAt;      // 0 when connected
+  TickType_t ipAt;
+  struct ConnReport report;
+  bool reportReady;
+};
+
+extern struct ConnManager connManager;
+
+unsigned int conn_backoff_delay(unsigned int failures, unsigned int random);
+enum ConnAction conn_step(struct ConnManager *m, const struct ConnEvent *e,
+                          TickType_t now, unsigned int random);
+enum ConnAction conn_timeout(struct ConnManager *m, TickType_t now);
+void conn_post(unsigned char type, unsigned char reason);
+void publish_connection_report();
+void connection_task(void* pvParameters);
+
+#endif /* APP_CONNECTION_H */
@@ -0,0 +1,125 @@
+#include "esp_system.h"
+#include "esp_log.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+
+#include <string.h>
+
+#include "app_event_bus.h"
+
+static const char *TAG = "EVENT_BUS";
+
+// an event is free when nobody holds a reference on it
+struct AppEvent eventPool[EVENT_BUS_POOL_SIZE];
+QueueHandle_t eventSubscribers[EVENT_ID_NB][EVENT_BUS_MAX_SUBSCRIBERS];
+unsigned char eventSubscribersNb[EVENT_ID_NB];
+struct EventBusStats eventBusStats;
+
+SemaphoreHandle_t eventBusMutex;
+// counts the free events, publishers wait on it like they would on a
+// full queue
+SemaphoreHandle_t eventPoolFree;
+
+void event_bus_init()
+{
+  memset(eventPool, 0, sizeof(eventPool));
+  memset(eventSubscribers, 0, sizeof(eventSubscribers));
+  memset(eventSubscribersNb, 0, sizeof(eventSubscribersNb));
+  memset(&eventBusStats, 0, sizeof(eventBusStats));
+  eventBusMutex = xSemaphoreCreateMutex();
+  eventPoolFree = xSemaphoreCreateCounting(EVENT_BUS_POOL_SIZE, EVENT_BUS_POOL_SIZE);
+}
+
+// subscribers are wired once at startup, before any task publishes
+bool event_bus_subscribe(enum AppEventId id, QueueHandle_t inbox)
+{
+  if (eventSubscribersNb[id] >= EVENT_BUS_MAX_SUBSCRIBERS) {
+    ESP_LOGE(TAG, "too many subscribers for event %d", id);
+    return false;
+  }
+  eventSubscribers[id][eventSubscribersNb[id]++] = inbox;
+  return true;
+}
+
+static struct AppEvent *event_alloc(enum AppEventId id, int refs, TickType_t timeout)
+{
+  struct AppEvent *event = NULL;
+  if (xSemaphoreTake(eventPoolFree, timeout) != pdTRUE) {
+    return NULL;
+  }
+  xSemaphoreTake(eventBusMutex, portMAX_DELAY);
+  for (int i = 0; i < EVENT_BUS_POOL_SIZE; i++) {
+    if (eventPool[i].refs == 0) {
+      event = &eventPool[i];
+      event->id = id;
+      event->refs = refs;
+      break;
+    }
+  }
+  xSemaphoreGive(eventBusMutex);
+  return event;
+}
+
+void event_bus_release(struct AppEvent *event)
+{
+  bool freed = false;
+  xSemaphoreTake(eventBusMutex, portMAX_DELAY);
+  if (event->refs > 0) {
+    event->refs--;
+    freed = event->refs == 0;
+  }
+  xSemaphoreGive(eventBusMutex);
+  if (freed) {
+    xSemaphoreGive(eventPoolFree);
+  }
+}
+
+int event_bus_pool_free()
+{
+  int free = 0;
+  xSemaphoreTake(eventBusMutex, portMAX_DELAY);
+  for (int i = 0; i < EVENT_BUS_POOL_SIZE; i++) {
+    if (eventPool[i].refs == 0) {
+      free++;
+    }
+  }
+  xSemaphoreGive(eventBusMutex);
+  return free;
+}
+
+// data is copied once in a pooled event, each subscriber inbox gets
+// the same pointer, timeout applies to getting a free event and to
+// each inbox
+bool event_bus_publish(enum AppEventId id, const void *data, size_t size, TickType_t timeout)
+{
+  int subscribersNb = eventSubscribersNb[id];
+  if (subscribersNb == 0) {
+    return true;
+  }
+  if (size > EVENT_BUS_DATA_SIZE) {
+    ESP_LOGE(TAG, "event %d too big: %d", id, (int)size);
+    return false;
+  }
+
+  struct AppEvent *event = event_alloc(id, subscribersNb, timeout);
+  if (event == NULL) {
+    ESP_LOGE(TAG, "event pool empty, dropping event %d", id);
+    eventBusStats.dropped++;
+    return false;
+  }
+  memcpy(event->payload.data, data, size);
+  eventBusStats.published++;
+
+  bool sent = true;
+  for (int i = 0; i < subscribersNb; i++) {
+    if (xQueueSend(eventSubscribers[id][i], &event, timeout) != pdPASS) {
+      ESP_LOGE(TAG, "inbox %d full, dropping event %d", i, id);
+      eventBusStats.dropped++;
+      event_bus_release(event);
+      sent = false;
+    }
+  }
+  return sent;
+}
@@ -0,0 +1,57 @@
+#ifndef APP_EVENT_BUS_H
+#define APP_EVENT_BUS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
+/* events exchanged between tasks, producers publish by id and do not
+   know who consumes them */
+enum AppEventId {
+  EVENT_RELAY_CMD = 0,      // struct RelayMessage
+  EVENT_THERMOSTAT_CMD,     // struct ThermostatMessage
+  EVENT_SCHEDULER_CFG,      // struct SchedulerCfgMessage
+  EVENT_OTA_CMD,            // struct OtaMessage
+  EVENT_SENSOR_SAMPLE,      // struct SensorSample
+  EVENT_ID_NB,
+};
+
+/* largest payload is struct OtaMessage */
+#define EVENT_BUS_DATA_SIZE 64
+#define EVENT_BUS_MAX_SUBSCRIBERS 2
+
+#ifdef CONFIG_MQTT_EVENT_BUS_POOL_SIZE
+#define EVENT_BUS_POOL_SIZE CONFIG_MQTT_EVENT_BUS_POOL_SIZE
+#else //CONFIG_MQTT_EVENT_BUS_POOL_SIZE
+#define EVENT_BUS_POOL_SIZE 24
+#endif //CONFIG_MQTT_EVENT_BUS_POOL_SIZE
+
+/* pooled event, subscribers get a pointer to it in their inbox
+   and hand it back with event_bus_release once done */
+struct AppEvent {
+  unsigned char id;
+  unsigned char refs;
+  union {
+    long long align;
+    unsigned char data[EVENT_BUS_DATA_SIZE];
+  } payload;
+};
+
+#define EVENT_DATA(event) ((void *)(event)->payload.data)
+
+struct EventBusStats {
+  unsigned int published;
+  unsigned int dropped; // pool empty or inbox full
+};
+
+extern struct EventBusStats eventBusStats;
+
+void event_bus_init();
+bool event_bus_subscribe(enum AppEventId id, QueueHandle_t inbox);
+bool event_bus_publish(enum AppEventId id, const void *data, size_t size, TickType_t timeout);
+void event_bus_release(struct AppEvent *event);
+int event_bus_pool_free();
+
+#endif /* APP_EVENT_BUS_H */
@@ -0,0 +1,273 @@
+#include <string.h>
+#include <stdint.h>
+
+#include "app_json.h"
+
+// in the style of jsmn: tokens only hold offsets in the parsed buffer,
+// open containers are tracked on a small stack instead of parent links
+#define JSON_MAX_DEPTH 8
+
+enum JsonExpect {
+  JSON_EXPECT_VALUE,
+  JSON_EXPECT_KEY,
+  JSON_EXPECT_COLON,
+  JSON_EXPECT_COMMA,
+};
+
+static int new_token(struct JsonToken *tokens, int tokensNb, int *count,
+                     enum JsonType type, int start, int end)
+{
+  if (*count >= tokensNb) {
+    return JSON_ERROR_NOMEM;
+  }
+  struct JsonToken *t = &tokens[*count];
+  t->type = type;
+  t->start = start;
+  t->end = end;
+  t->size = 0;
+  return (*count)++;
+}
+
+static bool is_space(char c)
+{
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+int json_parse(const char *js, int len, struct JsonToken *tokens, int tokensNb)
+{
+  int stack[JSON_MAX_DEPTH];
+  int depth = 0;
+  int count = 0;
+  bool done = false;
+  enum JsonExpect expect = JSON_EXPECT_VALUE;
+
+  for (int pos = 0; pos < len && js[pos]; pos++) {
+    char c = js[pos];
+    if (is_space(c)) {
+      continue;
+    }
+    if (done) {
+      return JSON_ERROR_INVAL;
+    }
+    struct JsonToken *parent = depth ? &tokens[stack[depth - 1]] : NULL;
+    int t;
+    switch (c) {
+    case '{':
+    case '[':
+      if (expect != JSON_EXPECT_VALUE) {
+        return JSON_ERROR_INVAL;
+      }
+      if (depth >= JSON_MAX_DEPTH) {
+        return JSON_ERROR_NOMEM;
+      }
+      t = new_token(tokens, tokensNb, &count, c == '{' ? JSON_OBJECT : JSON_ARRAY, pos, -1);
+      if (t < 0) {
+        return t;
+      }
+      if (parent && parent->type == JSON_ARRAY) {
+        parent->size++;
+      }
+      stack[depth++] = t;
+      expect = (c == '{') ? JSON_EXPECT_KEY : JSON_EXPECT_VALUE;
+      break;
+    case '}':
+    case ']':
+      if (!parent || parent->type != (c == '}' ? JSON_OBJECT : JSON_ARRAY)) {
+        return JSON_ERROR_INVAL;
+      }
+      if (expect != JSON_EXPECT_COMMA && parent->size != 0) {
+        return JSON_ERROR_INVAL;
+      }
+      parent->end = pos + 1;
+      depth--;
+      done = (depth == 0);
+      expect = JSON_EXPECT_COMMA;
+      break;
+    case ',':
+      if (!parent || expect != JSON_EXPECT_COMMA) {
+        return JSON_ERROR_INVAL;
+      }
+      expect = (parent->type == JSON_OBJECT) ? JSON_EXPECT_KEY : JSON_EXPECT_VALUE;
+      break;
+    case ':':
+      if (expect != JSON_EXPECT_COLON) {
+        return JSON_ERROR_INVAL;
+      }
+      expect = JSON_EXPECT_VALUE;
+      break;
+    case '"': {
+      if (expect != JSON_EXPECT_VALUE && expect != JSON_EXPECT_KEY) {
+        return JSON_ERROR_INVAL;
+      }
+      int end = pos + 1;
+      while (end < len && js[end] && js[end] != '"') {
+        if (js[end] == '\\') {
+          end++;
+        }
+        end++;
+      }
+      if (end >= len || js[end] != '"') {
+        return JSON_ERROR_PART;
+      }
+      t = new_token(tokens, tokensNb, &count, JSON_STRING, pos + 1, end);
+      if (t < 0) {
+        return t;
+      }
+      if (expect == JSON_EXPECT_KEY) {
+        parent->size++;
+        expect = JSON_EXPECT_COLON;
+      } else {
+        if (parent && parent->type == JSON_ARRAY) {
+          parent->size++;
+        }
+        done = (depth == 0);
+        expect = JSON_EXPECT_COMMA;
+      }
+      pos = end;
+      break;
+    }
+    default: {
+      if (expect != JSON_EXPECT_VALUE || !strchr("-0123456789tfn", c)) {
+        return JSON_ERROR_INVAL;
+      }
+      int end = pos;
+      while (end < len && js[end] && !is_space(js[end]) &&
+             js[end] != ',' && js[end] != ']' && js[end] != '}') {
+        if (js[end] < 32 || js[end] == '"' || js[end] == ':' ||
+            js[end] == '[' || js[end] == '{') {
+          return JSON_ERROR_INVAL;
+        }
+        end++;
+      }
+      t = new_token(tokens, tokensNb, &count, JSON_PRIMITIVE, pos, end);
+      if (t < 0) {
+        return t;
+      }
+      if (parent && parent->type == JSON_ARRAY) {
+        parent->size++;
+      }
+      done = (depth == 0);
+      expect = JSON_EXPECT_COMMA;
+      pos = end - 1;
+      break;
+    }
+    }
+  }
+
+  if (!done) {
+    return JSON_ERROR_PART;
+  }
+  return count;
+}
+
+// index of the first token after the value at i and all its children
+static int skip_value(const struct JsonToken *tokens, int tokensNb, int i)
+{
+  int pending = 1;
+  while (pending && i < tokensNb) {
+    if (tokens[i].type == JSON_OBJECT) {
+      pending += 2 * tokens[i].size;
+    } else if (tokens[i].type == JSON_ARRAY) {
+      pending += tokens[i].size;
+    }
+    pending--;
+    i++;
+  }
+  return i;
+}
+
+int json_object_get(const char *js, const struct JsonToken *tokens, int tokensNb,
+                    int object, const char *path)
+{
+  while (*path) {
+    const char *end = strchr(path, '.');
+    int keyLen = end ? end - path : strlen(path);
+    if (object < 0 || object >= tokensNb || tokens[object].type != JSON_OBJECT) {
+      return -1;
+    }
+    int members = tokens[object].size;
+    int i = object + 1;
+    object = -1;
+    for (int m = 0; m < members && i + 1 < tokensNb; m++) {
+      const struct JsonToken *key = &tokens[i];
+      if (key->end - key->start == keyLen &&
+          memcmp(js + key->start, path, keyLen) == 0) {
+        object = i + 1;
+        break;
+      }
+      i = skip_value(tokens, tokensNb, i + 1);
+    }
+    if (object < 0) {
+      return -1;
+    }
+    path = end ? end + 1 : path + keyLen;
+  }
+  return object;
+}
+
+// integer part of numbers, true and false are 1 and 0
+bool json_token_int(const char *js, const struct JsonToken *token, long *value)
+{
+  if (token->type != JSON_PRIMITIVE) {
+    return false;
+  }
+  const char *p = js + token->start;
+  int len = token->end - token->start;
+  if (len == 4 && memcmp(p, "true", 4) == 0) {
+    *value = 1;
+    return true;
+  }
+  if (len == 5 && memcmp(p, "false", 5) == 0) {
+    *value = 0;
+    return true;
+  }
+
+  int i = 0;
+  bool negative = false;
+  if (p[i] == '-') {
+    negative = true;
+    i++;
+  }
+  if (i >= len || p[i] < '0' || p[i] > '9') {
+    return false;
+  }
+  long v = 0;
+  for (; i < len && p[i] >= '0' && p[i] <= '9'; i++) {
+    v = v * 10 + (p[i] - '0');
+  }
+  *value = negative ? -v : v;
+  return true;
+}
+
+int json_bind(const char *js, const struct JsonToken *tokens, int tokensNb,
+              const struct JsonBinding *bindings, int bindingsNb, void *dst)
+{
+  int bound = 0;
+  for (int b = 0; b < bindingsNb; b++) {
+    int t = json_object_get(js, tokens, tokensNb, 0, bindings[b].path);
+    long value;
+    if (t < 0 || bindings[b].type != JSON_BIND_INT ||
+        !json_token_int(js, &tokens[t], &value)) {
+      continue;
+    }
+    char *field = (char *)dst + bindings[b].offset;
+    switch (bindings[b].size) {
+    case 1:
+      *(int8_t *)field = value;
+      break;
+    case 2:
+      *(int16_t *)field = value;
+      break;
+    case 4:
+      *(int32_t *)field = value;
+      break;
+    case 8:
+      *(int64_t *)field = value;
+      break;
+    default:
+      continue;
+    }
+    bound++;
+  }
+  return bound;
+}
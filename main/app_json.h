@@ -0,0 +1,50 @@
+#ifndef APP_JSON_H
+#define APP_JSON_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* tokens available to parse one payload, they live on the caller stack */
+#define JSON_MAX_TOKENS 32
+
+#define JSON_ERROR_NOMEM -1 // more tokens than JSON_MAX_TOKENS
+#define JSON_ERROR_INVAL -2 // not valid json
+#define JSON_ERROR_PART -3  // payload ended in the middle of a value
+
+enum JsonType {
+  JSON_UNDEFINED = 0,
+  JSON_OBJECT,
+  JSON_ARRAY,
+  JSON_STRING,
+  JSON_PRIMITIVE, // number, true, false or null
+};
+
+/* token points in the parsed buffer, nothing is copied */
+struct JsonToken {
+  unsigned char type;
+  short start;
+  short end;
+  short size; // members for objects (key/value pairs), items for arrays
+};
+
+#define JSON_BIND_INT 1
+
+/* binds the value found at path ("key" or "key.subkey") to a field of dst */
+struct JsonBinding {
+  const char *path;
+  unsigned char type;
+  unsigned char size;
+  size_t offset;
+};
+
+#define JSON_BIND_FIELD(path, type, s, field) \
+  {path, type, sizeof(((s *)0)->field), offsetof(s, field)}
+
+int json_parse(const char *js, int len, struct JsonToken *tokens, int tokensNb);
+int json_object_get(const char *js, const struct JsonToken *tokens, int tokensNb,
+                    int object, const char *path);
+bool json_token_int(const char *js, const struct JsonToken *token, long *value);
+int json_bind(const char *js, const struct JsonToken *tokens, int tokensNb,
+              const struct JsonBinding *bindings, int bindingsNb, void *dst);
+
+#endif /* APP_JSON_H */
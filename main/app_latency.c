@@ -0,0 +1,60 @@
+#include "esp_system.h"
+
+#include <string.h>
+
+#include "app_latency.h"
+
+const char *latencyStageNames[LATENCY_STAGES_NB] = {
+  "relay_dispatch",
+  "relay_queue",
+  "relay_gpio",
+  "relay_publish",
+  "relay_total",
+  "thermostat_dispatch",
+  "thermostat_queue",
+  "thermostat_handle",
+  "mqtt_connect",
+  "mqtt_init",
+};
+
+#ifdef CONFIG_MQTT_OPS_LATENCY
+
+#include "esp_timer.h"
+
+// each stage is recorded by a single task, the ops task only copies and
+// clears them so a sample may land in the next report
+struct LatencyHistogram latencyHistograms[LATENCY_STAGES_NB];
+
+unsigned int latency_now()
+{
+  unsigned int now = esp_timer_get_time();
+  // 0 marks untraced messages
+  return now ? now : 1;
+}
+
+void latency_record(enum LatencyStage stage, unsigned int start, unsigned int end)
+{
+  if (!start || stage >= LATENCY_STAGES_NB) {
+    return;
+  }
+  unsigned int elapsed = end - start;
+  unsigned int limit = 100;
+  int bucket = 0;
+  while (bucket < LATENCY_BUCKETS_NB - 1 && elapsed >= limit) {
+    limit *= 10;
+    bucket++;
+  }
+  struct LatencyHistogram *h = &latencyHistograms[stage];
+  h->buckets[bucket] += 1;
+  if (elapsed > h->max) {
+    h->max = elapsed;
+  }
+}
+
+void latency_snapshot(struct LatencyHistogram *histograms)
+{
+  memcpy(histograms, latencyHistograms, sizeof(latencyHistograms));
+  memset(latencyHistograms, 0, sizeof(latencyHistograms));
+}
+
+#endif //CONFIG_MQTT_OPS_LATENCY
@@ -0,0 +1,44 @@
+#ifndef APP_LATENCY_H
+#define APP_LATENCY_H
+
+/* timestamps in microseconds carried by queued messages,
+   received is 0 for messages not coming from mqtt */
+struct LatencyTrace {
+  unsigned int received;
+  unsigned int queued;
+};
+
+enum LatencyStage {
+  LATENCY_RELAY_DISPATCH = 0, // MQTT_EVENT_DATA to relay inbox
+  LATENCY_RELAY_QUEUE,        // waiting in relay inbox
+  LATENCY_RELAY_GPIO,         // dequeued to gpio level set
+  LATENCY_RELAY_PUBLISH,      // gpio level set to status publish queued
+  LATENCY_RELAY_TOTAL,        // MQTT_EVENT_DATA to status publish queued
+  LATENCY_THERMOSTAT_DISPATCH,
+  LATENCY_THERMOSTAT_QUEUE,
+  LATENCY_THERMOSTAT_HANDLE,
+  LATENCY_MQTT_CONNECT,       // MQTT_EVENT_BEFORE_CONNECT to CONNECTED, tcp, tls and CONNACK
+  LATENCY_MQTT_INIT,          // MQTT_EVENT_CONNECTED to subscriptions acked
+  LATENCY_STAGES_NB
+};
+
+/* decade buckets: <100us, <1ms, <10ms, <100ms, <1s, >=1s */
+#define LATENCY_BUCKETS_NB 6
+
+struct LatencyHistogram {
+  unsigned int buckets[LATENCY_BUCKETS_NB];
+  unsigned int max;
+};
+
+extern const char *latencyStageNames[LATENCY_STAGES_NB];
+
+#ifdef CONFIG_MQTT_OPS_LATENCY
+unsigned int latency_now();
+void latency_record(enum LatencyStage stage, unsigned int start, unsigned int end);
+void latency_snapshot(struct LatencyHistogram *histograms);
+#else //CONFIG_MQTT_OPS_LATENCY
+#define latency_now() 0
+#define latency_record(stage, start, end) do { (void)(start); (void)(end); } while (0)
+#endif //CONFIG_MQTT_OPS_LATENCY
+
+#endif /* APP_LATENCY_H */
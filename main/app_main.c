@@ -15,7 +15,10 @@
 
 #include "app_wifi.h"
 #include "app_mqtt.h"
+#include "app_mqtt_publisher.h"
 #include "app_nvs.h"
+#include "app_event_bus.h"
+#include "app_timer_wheel.h"
 
 #if CONFIG_MQTT_SWITCHES_NB
 #include "app_switch.h"
@@ -27,22 +30,22 @@
 
 #if CONFIG_MQTT_THERMOSTATS_NB > 0
 #include "app_thermostat.h"
-QueueHandle_t thermostatQueue;
+QueueHandle_t thermostatInbox;
 #endif // CONFIG_MQTT_THERMOSTATS_NB > 0
 
 #if CONFIG_MQTT_RELAYS_NB
 #include "app_relay.h"
-QueueHandle_t relayQueue;
+QueueHandle_t relayInbox;
 #endif//CONFIG_MQTT_RELAYS_NB
 
 #ifdef CONFIG_MQTT_SCHEDULERS
 #include "app_scheduler.h"
-QueueHandle_t schedulerCfgQueue;
+QueueHandle_t schedulerInbox;
 #endif // CONFIG_MQTT_SCHEDULERS
 
 #ifdef CONFIG_MQTT_OTA
 #include "app_ota.h"
-QueueHandle_t otaQueue;
+QueueHandle_t otaInbox;
 #endif //CONFIG_MQTT_OTA
 
 #ifdef CONFIG_MQTT_OPS
@@ -63,6 +66,9 @@ extern int smartconfigFlag;
 
 QueueHandle_t mqttQueue;
 
+#include "app_connection.h"
+QueueHandle_t connectionQueue;
+
 SemaphoreHandle_t xSemaphore;
 
 static const char *TAG = "MQTT(S?)_MAIN";
@@ -129,23 +135,34 @@ void app_main(void)
   mqtt_event_group = xEventGroupCreate();
   wifi_event_group = xEventGroupCreate();
 
+  // each consumer task reads pooled events from its own inbox
+  event_bus_init();
+  // relay sleeps, thermostat and scheduler ticks share one kernel timer
+  timer_wheel_init();
+
 #if CONFIG_MQTT_THERMOSTATS_NB > 0
-  thermostatQueue = xQueueCreate(3, sizeof(struct ThermostatMessage) );
+  thermostatInbox = xQueueCreate(6, sizeof(struct AppEvent *) );
+  event_bus_subscribe(EVENT_THERMOSTAT_CMD, thermostatInbox);
+  event_bus_subscribe(EVENT_SENSOR_SAMPLE, thermostatInbox);
 #endif // CONFIG_MQTT_THERMOSTATS_NB > 0
 
 #if CONFIG_MQTT_RELAYS_NB
-  relayQueue = xQueueCreate(32, sizeof(struct RelayMessage) );
+  relayInbox = xQueueCreate(RELAY_BATCH_MAX, sizeof(struct AppEvent *) );
+  event_bus_subscribe(EVENT_RELAY_CMD, relayInbox);
 #endif //CONFIG_MQTT_RELAYS_NB
 
 #ifdef CONFIG_MQTT_SCHEDULERS
-  schedulerCfgQueue = xQueueCreate(8, sizeof(struct SchedulerCfgMessage) );
+  schedulerInbox = xQueueCreate(8, sizeof(struct AppEvent *) );
+  event_bus_subscribe(EVENT_SCHEDULER_CFG, schedulerInbox);
 #endif // CONFIG_MQTT_SCHEDULERS
 
 
 #ifdef CONFIG_MQTT_OTA
-  otaQueue = xQueueCreate(1, sizeof(struct OtaMessage) );
+  otaInbox = xQueueCreate(1, sizeof(struct AppEvent *) );
+  event_bus_subscribe(EVENT_OTA_CMD, otaInbox);
 #endif //CONFIG_MQTT_OTA
   mqttQueue = xQueueCreate(1, sizeof(void *) );
+  connectionQueue = xQueueCreate(8, sizeof(struct ConnEvent) );
   xSemaphore = xSemaphoreCreateMutex();
 
   xTaskCreate(blink_task, "blink_task", configMINIMAL_STACK_SIZE * 3, NULL, 3, NULL);
@@ -166,9 +183,13 @@ void app_main(void)
 #endif // CONFIG_MQTT_RELAYS_NB
 
 #if CONFIG_MQTT_THERMOSTATS_NB > 0
-  read_nvs_thermostat_data();
+  thermostats_init();
 #endif // CONFIG_MQTT_THERMOSTATS_NB > 0
 
+#ifdef CONFIG_MQTT_SENSOR
+  sensors_init();
+#endif //CONFIG_MQTT_SENSOR
+
 
   smartconfigQueue = xQueueCreate(3, sizeof(struct SmartConfigMessage) );
   err=read_nvs_integer(smartconfigTAG, &smartconfigFlag);
@@ -187,7 +208,7 @@ void app_main(void)
 
 
 #if CONFIG_MQTT_RELAYS_NB
-    xTaskCreate(handle_relay_task, "handle_relay_task", configMINIMAL_STACK_SIZE * 3, NULL, 5, NULL);
+    xTaskCreate(handle_relay_task, "handle_relay_task", configMINIMAL_STACK_SIZE * 3, relayInbox, 5, NULL);
 #endif //CONFIG_MQTT_RELAYS_NB
 
 #if CONFIG_MQTT_SWITCHES_NB
@@ -195,13 +216,16 @@ void app_main(void)
 #endif //CONFIG_MQTT_SWITCHES_NB
 
 #ifdef CONFIG_MQTT_OTA
-   xTaskCreate(handle_ota_update_task, "handle_ota_update_task", configMINIMAL_STACK_SIZE * 7, NULL, 5, NULL);
+   xTaskCreate(handle_ota_update_task, "handle_ota_update_task", configMINIMAL_STACK_SIZE * 7, otaInbox, 5, NULL);
 #endif //CONFIG_MQTT_OTA
 
 #if CONFIG_MQTT_THERMOSTATS_NB > 0
-  xTaskCreate(handle_thermostat_cmd_task, "handle_thermostat_cmd_task", configMINIMAL_STACK_SIZE * 9, NULL, 5, NULL);
+  xTaskCreate(handle_thermostat_cmd_task, "handle_thermostat_cmd_task", configMINIMAL_STACK_SIZE * 9, thermostatInbox, 5, NULL);
 #endif // CONFIG_MQTT_THERMOSTATS_NB > 0
     xTaskCreate(handle_mqtt_sub_pub, "handle_mqtt_sub_pub", configMINIMAL_STACK_SIZE * 3, NULL, 5, NULL);
+    xTaskCreate(handle_mqtt_publish_task, "handle_mqtt_publish_task", configMINIMAL_STACK_SIZE * 3, NULL, 5, NULL);
+
+    xTaskCreate(connection_task, "connection_task", configMINIMAL_STACK_SIZE * 3, NULL, 5, NULL);
 
     wifi_init();
     mqtt_init_and_start();
@@ -211,7 +235,7 @@ void app_main(void)
 #endif // CONFIG_MQTT_OPS
 
 #ifdef CONFIG_MQTT_SCHEDULERS
-    xTaskCreate(handle_scheduler, "handle_scheduler", configMINIMAL_STACK_SIZE * 3, NULL, 5, NULL);
+    xTaskCreate(handle_scheduler, "handle_scheduler", configMINIMAL_STACK_SIZE * 3, schedulerInbox, 5, NULL);
 #endif // CONFIG_MQTT_SCHEDULERS
 
   }
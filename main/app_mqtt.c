@@ -1,8 +1,8 @@
 #include "esp_system.h"
 #include "esp_log.h"
-#include "esp_wifi.h"
 
 #include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #include "freertos/event_groups.h"
 #include "freertos/queue.h"
 #include "freertos/semphr.h"
@@ -16,13 +16,20 @@
 
 #include "app_sensors.h"
 #include "app_mqtt.h"
-
-#include "cJSON.h"
+#include "app_mqtt_router.h"
+#include "app_mqtt_publisher.h"
+#include "app_mqtt_topics.h"
+#include "app_connection.h"
+#ifdef CONFIG_MQTT_OUTBOX
+#include "app_mqtt_outbox.h"
+#endif //CONFIG_MQTT_OUTBOX
+#include "app_json.h"
+#include "app_latency.h"
+#include "app_event_bus.h"
 
 #ifdef CONFIG_MQTT_SCHEDULERS
 
 #include "app_scheduler.h"
-extern QueueHandle_t schedulerCfgQueue;
 //FIXME hack until decide if queue+thread really usefull
 extern struct SchedulerCfgMessage schedulerCfg;
 //FIXME end hack until decide if queue+thread really usefull
@@ -37,9 +44,8 @@ extern struct SchedulerCfgMessage schedulerCfg;
 
 #if CONFIG_MQTT_RELAYS_NB
 #include "app_relay.h"
-extern QueueHandle_t relayQueue;
 
-#define RELAYS_TOPICS_NB 1 //
+#define RELAYS_TOPICS_NB 2 // one relay and all relays
 
 #else //CONFIG_MQTT_RELAYS_NB
 
@@ -50,7 +56,6 @@ extern QueueHandle_t relayQueue;
 #ifdef CONFIG_MQTT_OTA
 
 #include "app_ota.h"
-extern QueueHandle_t otaQueue;
 #define OTA_TOPIC CONFIG_MQTT_DEVICE_TYPE "/" CONFIG_MQTT_CLIENT_ID "/cmd/ota"
 #define OTA_TOPICS_NB 1
 
@@ -63,10 +68,10 @@ extern QueueHandle_t otaQueue;
 #if CONFIG_MQTT_THERMOSTATS_NB > 0
 
 #include "app_thermostat.h"
-extern QueueHandle_t thermostatQueue;
 
-#define THERMOSTAT_TOPICS_NB 1
+#define THERMOSTAT_TOPICS_NB 2
 #define CMD_THERMOSTAT_TOPIC CONFIG_MQTT_DEVICE_TYPE "/" CONFIG_MQTT_CLIENT_ID "/cmd/+/thermostat/+"
+#define CMD_THERMOSTATS_DUTY_TOPIC CONFIG_MQTT_DEVICE_TYPE "/" CONFIG_MQTT_CLIENT_ID "/cmd/duty/thermostats"
 
 #else // CONFIG_MQTT_THERMOSTATS_NB > 0
 
@@ -86,13 +91,19 @@ const int MQTT_CONNECTED_BIT = BIT0;
 const int MQTT_SUBSCRIBED_BIT = BIT1;
 const int MQTT_PUBLISHED_BIT = BIT2;
 const int MQTT_INIT_FINISHED_BIT = BIT3;
+const int MQTT_PUBLISH_PENDING_BIT = BIT4;
+
 
-int mqtt_reconnect_counter;
+// per field state topics are refreshed on connect unless replaced by snapshots
+#if !defined(CONFIG_MQTT_STATE_SNAPSHOT) || defined(CONFIG_MQTT_STATE_FIELD_TOPICS)
+#define MQTT_STATE_FIELD_TOPICS 1
+#else //!CONFIG_MQTT_STATE_SNAPSHOT || CONFIG_MQTT_STATE_FIELD_TOPICS
+#define MQTT_STATE_FIELD_TOPICS 0
+#endif //!CONFIG_MQTT_STATE_SNAPSHOT || CONFIG_MQTT_STATE_FIELD_TOPICS
 
 #define FW_VERSION "0.02.12u"
 
 extern QueueHandle_t mqttQueue;
-extern SemaphoreHandle_t xSemaphore;
 
 static const char *TAG = "MQTTS_MQTTS";
 
@@ -120,11 +131,19 @@ static const char *TAG = "MQTTS_MQTTS";
 #define CONFIG_MQTT_THERMOSTATS_NB3_SENSOR_MQTT 0
 #endif //CONFIG_MQTT_THERMOSTATS_NB3_SENSOR_TYPE_MQTT
 
-#define CONFIG_MQTT_THERMOSTATS_MQTT_SENSORS (CONFIG_MQTT_THERMOSTATS_NB0_SENSOR_MQTT + CONFIG_MQTT_THERMOSTATS_NB1_SENSOR_MQTT + CONFIG_MQTT_THERMOSTATS_NB2_SENSOR_MQTT + CONFIG_MQTT_THERMOSTATS_NB3_SENSOR_MQTT)
+#ifdef CONFIG_MQTT_THERMOSTATS_ZONE_SENSOR_TOPIC
+#define CONFIG_MQTT_THERMOSTATS_ZONE_SENSOR_MQTT 1
+#else //CONFIG_MQTT_THERMOSTATS_ZONE_SENSOR_TOPIC
+#define CONFIG_MQTT_THERMOSTATS_ZONE_SENSOR_MQTT 0
+#endif //CONFIG_MQTT_THERMOSTATS_ZONE_SENSOR_TOPIC
+
+#define CONFIG_MQTT_THERMOSTATS_MQTT_SENSORS (CONFIG_MQTT_THERMOSTATS_NB0_SENSOR_MQTT + CONFIG_MQTT_THERMOSTATS_NB1_SENSOR_MQTT + CONFIG_MQTT_THERMOSTATS_NB2_SENSOR_MQTT + CONFIG_MQTT_THERMOSTATS_NB3_SENSOR_MQTT + CONFIG_MQTT_THERMOSTATS_ZONE_SENSOR_MQTT)
 
 #define NB_SUBSCRIPTIONS  (OTA_TOPICS_NB + THERMOSTAT_TOPICS_NB + RELAYS_TOPICS_NB + SCHEDULER_TOPICS_NB + CONFIG_MQTT_THERMOSTATS_MQTT_SENSORS)
 
-#define CMD_RELAY_TOPIC CONFIG_MQTT_DEVICE_TYPE "/" CONFIG_MQTT_CLIENT_ID "/cmd/+/relay/+"
+#define CMD_TOPIC_PREFIX CONFIG_MQTT_DEVICE_TYPE "/" CONFIG_MQTT_CLIENT_ID "/cmd/"
+#define CMD_RELAY_TOPIC CMD_TOPIC_PREFIX "+/relay/+"
+#define CMD_RELAYS_TOPIC CMD_TOPIC_PREFIX "status/relays"
 
 #define SCHEDULER_CFG_TOPIC CONFIG_MQTT_DEVICE_TYPE"/"CONFIG_MQTT_CLIENT_ID"/cfg/scheduler/"
 
@@ -138,9 +157,11 @@ const char *SUBSCRIPTIONS[NB_SUBSCRIPTIONS] =
 #endif // CONFIG_MQTT_SCHEDULERS
 #if CONFIG_MQTT_RELAYS_NB
     CMD_RELAY_TOPIC,
+    CMD_RELAYS_TOPIC,
 #endif //CONFIG_MQTT_RELAYS_NB
 #if CONFIG_MQTT_THERMOSTATS_NB > 0
     CMD_THERMOSTAT_TOPIC,
+    CMD_THERMOSTATS_DUTY_TOPIC,
 #endif // CONFIG_MQTT_THERMOSTATS_NB > 0
 #ifdef CONFIG_MQTT_THERMOSTATS_NB0_SENSOR_TYPE_MQTT
     CONFIG_MQTT_THERMOSTATS_NB0_MQTT_SENSOR_TOPIC,
@@ -154,159 +175,72 @@ const char *SUBSCRIPTIONS[NB_SUBSCRIPTIONS] =
 #ifdef CONFIG_MQTT_THERMOSTATS_NB3_SENSOR_TYPE_MQTT
     CONFIG_MQTT_THERMOSTATS_NB3_MQTT_SENSOR_TOPIC,
 #endif //CONFIG_MQTT_THERMOSTATS_NB3_SENSOR_TYPE_MQTT
+#ifdef CONFIG_MQTT_THERMOSTATS_ZONE_SENSOR_TOPIC
+    CONFIG_MQTT_THERMOSTATS_ZONE_SENSOR_TOPIC "+",
+#endif //CONFIG_MQTT_THERMOSTATS_ZONE_SENSOR_TOPIC
   };
 
 
 extern const char mqtt_iot_cipex_ro_pem_start[] asm("_binary_mqtt_iot_cipex_ro_pem_start");
 
-unsigned char get_topic_id(esp_mqtt_event_handle_t event, int maxTopics, const char * topic)
-{
-  char fullTopic[MQTT_MAX_TOPIC_LEN];
-  memset(fullTopic,0,MQTT_MAX_TOPIC_LEN);
-
-  unsigned char topicId = 0;
-  bool found = false;
-  while (!found && topicId <= maxTopics) {
-    sprintf(fullTopic, "%s%d", topic, topicId);
-    if (strncmp(event->topic, fullTopic, strlen(fullTopic)) == 0) {
-      found = true;
-    } else {
-      topicId++;
-    }
-  }
-  if (!found) {
-    topicId = JSON_BAD_TOPIC_ID;
-  }
-  return topicId;
-}
+// MQTT_EVENT_DATA time of the message being handled
+unsigned int payloadReceivedAt;
 
-bool handle_scheduler_mqtt_event(esp_mqtt_event_handle_t event)
+void trace_queued(struct LatencyTrace *trace)
 {
-#ifdef CONFIG_MQTT_SCHEDULERS
-  unsigned char schedulerId = get_topic_id(event, MAX_SCHEDULER_NB, SCHEDULER_CFG_TOPIC);
-
-  if (schedulerId != JSON_BAD_TOPIC_ID) {
-    if (event->data_len >= MAX_MQTT_DATA_SCHEDULER) {
-      ESP_LOGI(TAG, "unexpected scheduler cfg payload length");
-      return true;
-    }
-    struct SchedulerCfgMessage s = {0, 0, 0, 0, {{0}}};
-    s.schedulerId = schedulerId;
-
-    char tmpBuf[MAX_MQTT_DATA_SCHEDULER];
-    memcpy(tmpBuf, event->data, event->data_len);
-    tmpBuf[event->data_len] = 0;
-    cJSON * root   = cJSON_Parse(tmpBuf);
-    if (root) {
-      cJSON * timestamp = cJSON_GetObjectItem(root,"ts");
-      if (timestamp) {
-        s.timestamp = timestamp->valueint;
-      }
-      cJSON * actionId = cJSON_GetObjectItem(root,"aId");
-      if (actionId) {
-        s.actionId = actionId->valueint;
-      }
-      cJSON * actionState = cJSON_GetObjectItem(root,"aState");
-      if (actionState) {
-        s.actionState = actionState->valueint;
-      }
-      cJSON * data = cJSON_GetObjectItem(root,"data");
-      if (data) {
-        if (s.actionId == ADD_RELAY_ACTION) {
-          cJSON * relayId = cJSON_GetObjectItem(data,"relayId");
-          if (relayId) {
-            s.data.relayActionData.relayId = relayId->valueint;
-          }
-          cJSON * relayValue = cJSON_GetObjectItem(data,"relayValue");
-          if (relayValue) {
-            s.data.relayActionData.data = relayValue->valueint;
-          }
-        }
-      }
-      cJSON_Delete(root);
-
-      if (xQueueSend(schedulerCfgQueue
-                     ,( void * )&s
-                     ,MQTT_QUEUE_TIMEOUT) != pdPASS) {
-        ESP_LOGE(TAG, "Cannot send to scheduleCfgQueue");
-      }
-    }
-    return true;
-  }
-#endif // CONFIG_MQTT_SCHEDULERS
-  return false;
+  trace->received = payloadReceivedAt;
+  trace->queued = latency_now();
 }
 
-
-bool handle_ota_mqtt_event(esp_mqtt_event_handle_t event)
+#ifdef CONFIG_MQTT_SCHEDULERS
+static const struct JsonBinding SCHEDULER_CFG_BINDINGS[] = {
+  JSON_BIND_FIELD("ts", JSON_BIND_INT, struct SchedulerCfgMessage, timestamp),
+  JSON_BIND_FIELD("aId", JSON_BIND_INT, struct SchedulerCfgMessage, actionId),
+  JSON_BIND_FIELD("aState", JSON_BIND_INT, struct SchedulerCfgMessage, actionState),
+};
+
+static const struct JsonBinding SCHEDULER_RELAY_ACTION_BINDINGS[] = {
+  JSON_BIND_FIELD("data.relayId", JSON_BIND_INT, struct SchedulerCfgMessage, data.relayActionData.relayId),
+  JSON_BIND_FIELD("data.relayValue", JSON_BIND_INT, struct SchedulerCfgMessage, data.relayActionData.data),
+};
+
+void handle_scheduler_mqtt_cfg(int schedulerId, const char *data, int data_len)
 {
-#ifdef CONFIG_MQTT_OTA
-  if (strncmp(event->topic, OTA_TOPIC, strlen(OTA_TOPIC)) == 0) {
-    struct OtaMessage o={"https://sw.iot.cipex.ro:8911/" CONFIG_MQTT_CLIENT_ID ".bin"};
-    if (xQueueSend( otaQueue
-                    ,( void * )&o
-                    ,MQTT_QUEUE_TIMEOUT) != pdPASS) {
-      ESP_LOGE(TAG, "Cannot send to otaQueue");
+  struct SchedulerCfgMessage s = {0, 0, 0, 0, {{0}}};
+  s.schedulerId = schedulerId;
 
-    }
-    return true;
+  struct JsonToken tokens[JSON_MAX_TOKENS];
+  int tokensNb = json_parse(data, data_len, tokens, JSON_MAX_TOKENS);
+  if (tokensNb < 0) {
+    ESP_LOGE(TAG, "bad scheduler cfg json, error %d", tokensNb);
+    return;
   }
-#endif //CONFIG_MQTT_OTA
-  return false;
-}
-
-char* getToken(char* buffer, const char* topic, int topic_len, unsigned char place)
-{
-  if (topic == NULL)
-    return NULL;
-
-  if (topic_len >= 64)
-    return NULL;
-
-  char str[64];
-  memcpy(str, topic, topic_len);
-  str[topic_len] = 0;
-
-  char *token = strtok(str, "/");
-  int i = 0;
-  while(i < place && token) {
-    token = strtok(NULL, "/");
-    i += 1;
+  json_bind(data, tokens, tokensNb, SCHEDULER_CFG_BINDINGS,
+            sizeof(SCHEDULER_CFG_BINDINGS) / sizeof(SCHEDULER_CFG_BINDINGS[0]), &s);
+  if (s.actionId == ADD_RELAY_ACTION) {
+    json_bind(data, tokens, tokensNb, SCHEDULER_RELAY_ACTION_BINDINGS,
+              sizeof(SCHEDULER_RELAY_ACTION_BINDINGS) / sizeof(SCHEDULER_RELAY_ACTION_BINDINGS[0]), &s);
   }
-  if (!token)
-    return NULL;
-
-  return strcpy(buffer, token);
-}
 
-char* getActionType(char* actionType, const char* topic, int topic_len)
-{
-  return getToken(actionType, topic, topic_len, 2);
-}
-char* getAction(char* action, const char* topic, int topic_len)
-{
-  return getToken(action, topic, topic_len, 3);
-}
-
-char* getService(char* service, const char* topic, int topic_len)
-{
-  return getToken(service, topic, topic_len, 4);
+  if (!event_bus_publish(EVENT_SCHEDULER_CFG, &s, sizeof(s), MQTT_QUEUE_TIMEOUT)) {
+    ESP_LOGE(TAG, "Cannot publish scheduler cfg");
+  }
 }
+#endif // CONFIG_MQTT_SCHEDULERS
 
-signed char getServiceId(const char* topic, int topic_len)
+#ifdef CONFIG_MQTT_OTA
+void handle_ota_mqtt_cmd(int id, const char *data, int data_len)
 {
-  signed char serviceId=-1;
-  char buffer[8];
-  char* s = getToken(buffer, topic, topic_len, 5);
-  if (s) {
-    serviceId = atoi(s);
+  struct OtaMessage o={"https://sw.iot.cipex.ro:8911/" CONFIG_MQTT_CLIENT_ID ".bin"};
+  if (!event_bus_publish(EVENT_OTA_CMD, &o, sizeof(o), MQTT_QUEUE_TIMEOUT)) {
+    ESP_LOGE(TAG, "Cannot publish ota command");
   }
-  return serviceId;
 }
+#endif //CONFIG_MQTT_OTA
 
 #if CONFIG_MQTT_THERMOSTATS_NB > 0
 
-void handle_thermostat_mqtt_mode_cmd(signed char thermostatId, const char *payload)
+void handle_thermostat_mqtt_mode_cmd(int thermostatId, const char *payload, int payload_len)
 {
 
   struct ThermostatMessage tm;
@@ -323,14 +257,13 @@ void handle_thermostat_mqtt_mode_cmd(signed char thermostatId, const char *paylo
     return;
   }
 
-  if (xQueueSend( thermostatQueue
-                  ,( void * )&tm
-                  ,MQTT_QUEUE_TIMEOUT) != pdPASS) {
-    ESP_LOGE(TAG, "Cannot send to thermostatQueue");
+  trace_queued(&tm.trace);
+  if (!event_bus_publish(EVENT_THERMOSTAT_CMD, &tm, sizeof(tm), MQTT_QUEUE_TIMEOUT)) {
+    ESP_LOGE(TAG, "Cannot publish thermostat command");
   }
 }
 
-void handle_thermostat_mqtt_temp_cmd(signed char thermostatId, const char *payload)
+void handle_thermostat_mqtt_temp_cmd(int thermostatId, const char *payload, int payload_len)
 {
   struct ThermostatMessage tm;
   memset(&tm, 0, sizeof(struct ThermostatMessage));
@@ -338,14 +271,13 @@ void handle_thermostat_mqtt_temp_cmd(signed char thermostatId, const char *paylo
   tm.thermostatId = thermostatId;
   tm.data.targetTemperature = atof(payload) * 10;
 
-  if (xQueueSend( thermostatQueue
-                  ,( void * )&tm
-                  ,MQTT_QUEUE_TIMEOUT) != pdPASS) {
-    ESP_LOGE(TAG, "Cannot send to thermostatQueue");
+  trace_queued(&tm.trace);
+  if (!event_bus_publish(EVENT_THERMOSTAT_CMD, &tm, sizeof(tm), MQTT_QUEUE_TIMEOUT)) {
+    ESP_LOGE(TAG, "Cannot publish thermostat command");
   }
 }
 
-void handle_thermostat_mqtt_tolerance_cmd(signed char thermostatId, const char *payload)
+void handle_thermostat_mqtt_tolerance_cmd(int thermostatId, const char *payload, int payload_len)
 {
   struct ThermostatMessage tm;
   memset(&tm, 0, sizeof(struct ThermostatMessage));
@@ -353,40 +285,29 @@ void handle_thermostat_mqtt_tolerance_cmd(signed char thermostatId, const char *
   tm.thermostatId = thermostatId;
   tm.data.tolerance = atof(payload) * 10;
 
-  if (xQueueSend( thermostatQueue
-                  ,( void * )&tm
-                  ,MQTT_QUEUE_TIMEOUT) != pdPASS) {
-    ESP_LOGE(TAG, "Cannot send to thermostatQueue");
+  trace_queued(&tm.trace);
+  if (!event_bus_publish(EVENT_THERMOSTAT_CMD, &tm, sizeof(tm), MQTT_QUEUE_TIMEOUT)) {
+    ESP_LOGE(TAG, "Cannot publish thermostat command");
   }
 }
 
-void handle_thermostat_mqtt_cmd(const char* topic, int topic_len, const char* payload)
+// the report is built by the thermostat task, the payload is ignored
+void handle_thermostats_mqtt_duty_cmd(int id, const char *payload, int payload_len)
 {
-  char action[16];
-  getAction(action, topic, topic_len);
-  signed char thermostatId = getServiceId(topic, topic_len);
-  if (thermostatId != -1) {
-    if (strcmp(action, "mode") == 0) {
-      handle_thermostat_mqtt_mode_cmd(thermostatId, payload);
-      return;
-    }
-    if (strcmp(action, "temp") == 0) {
-      handle_thermostat_mqtt_temp_cmd(thermostatId, payload);
-      return;
-    }
-    if (strcmp(action, "tolerance") == 0) {
-      handle_thermostat_mqtt_tolerance_cmd(thermostatId, payload);
-      return;
-    }
+  struct ThermostatMessage tm;
+  memset(&tm, 0, sizeof(struct ThermostatMessage));
+  tm.msgType = THERMOSTAT_CMD_DUTY;
+
+  if (!event_bus_publish(EVENT_THERMOSTAT_CMD, &tm, sizeof(tm), MQTT_QUEUE_TIMEOUT)) {
+    ESP_LOGE(TAG, "Cannot publish thermostat command");
   }
-  ESP_LOGW(TAG, "unhandled water thermostat: %s", action);
 }
 
 #endif // CONFIG_MQTT_THERMOSTATS_NB > 0
 
 #if CONFIG_MQTT_RELAYS_NB
 
-void handle_relay_mqtt_status_cmd(signed char relayId, const char *payload)
+void handle_relay_mqtt_status_cmd(int relayId, const char *payload, int payload_len)
 {
   struct RelayMessage rm;
   memset(&rm, 0, sizeof(struct RelayMessage));
@@ -398,14 +319,13 @@ void handle_relay_mqtt_status_cmd(signed char relayId, const char *payload)
   else if (strcmp(payload, "OFF") == 0)
     rm.data = RELAY_STATUS_OFF;
 
-  if (xQueueSend( relayQueue
-                  ,( void * )&rm
-                  ,MQTT_QUEUE_TIMEOUT) != pdPASS) {
-    ESP_LOGE(TAG, "Cannot send to relayQueue");
+  trace_queued(&rm.trace);
+  if (!event_bus_publish(EVENT_RELAY_CMD, &rm, sizeof(rm), MQTT_QUEUE_TIMEOUT)) {
+    ESP_LOGE(TAG, "Cannot publish relay command");
   }
 }
 
-void handle_relay_mqtt_sleep_cmd(signed char relayId, const char *payload)
+void handle_relay_mqtt_sleep_cmd(int relayId, const char *payload, int payload_len)
 {
   struct RelayMessage rm;
   memset(&rm, 0, sizeof(struct RelayMessage));
@@ -414,39 +334,87 @@ void handle_relay_mqtt_sleep_cmd(signed char relayId, const char *payload)
 
   rm.data = atoi(payload);
 
-  if (xQueueSend( relayQueue
-                  ,( void * )&rm
-                  ,MQTT_QUEUE_TIMEOUT) != pdPASS) {
-    ESP_LOGE(TAG, "Cannot send to relayQueue");
+  trace_queued(&rm.trace);
+  if (!event_bus_publish(EVENT_RELAY_CMD, &rm, sizeof(rm), MQTT_QUEUE_TIMEOUT)) {
+    ESP_LOGE(TAG, "Cannot publish relay command");
   }
 }
 
-
-void handle_relay_mqtt_cmd(const char* topic, int topic_len, const char* payload)
+// {"0":"ON","2":"OFF"}, values can also be true/false or 1/0
+static bool parse_relays_json(const char *payload, int payload_len,
+                              unsigned int *mask, unsigned int *value)
 {
-  char action[16];
-  getAction(action, topic, topic_len);
-
-  signed char relayId = getServiceId(topic, topic_len);
-  if (relayId != -1) {
-    if (strcmp(action, "status") == 0) {
-      handle_relay_mqtt_status_cmd(relayId, payload);
-      return;
+  struct JsonToken tokens[JSON_MAX_TOKENS];
+  int tokensNb = json_parse(payload, payload_len, tokens, JSON_MAX_TOKENS);
+  if (tokensNb <= 0 || tokens[0].type != JSON_OBJECT) {
+    return false;
+  }
+  int t = 1;
+  for (int m = 0; m < tokens[0].size; m++, t += 2) {
+    const struct JsonToken *key = &tokens[t];
+    const struct JsonToken *val = &tokens[t + 1];
+    int keyLen = key->end - key->start;
+    if (keyLen != 1 || payload[key->start] < '0' ||
+        payload[key->start] >= '0' + CONFIG_MQTT_RELAYS_NB) {
+      return false;
     }
-    if (strcmp(action, "sleep") == 0) {
-      handle_relay_mqtt_sleep_cmd(relayId, payload);
-      return;
+    int id = payload[key->start] - '0';
+    long on;
+    if (val->type == JSON_STRING && val->end - val->start == 2 &&
+        memcmp(payload + val->start, "ON", 2) == 0) {
+      on = 1;
+    } else if (val->type == JSON_STRING && val->end - val->start == 3 &&
+               memcmp(payload + val->start, "OFF", 3) == 0) {
+      on = 0;
+    } else if (!json_token_int(payload, val, &on)) {
+      return false;
     }
-    ESP_LOGW(TAG, "unhandled relay action: %s", action);
+    *mask |= 1 << id;
+    *value |= (on ? 1 : 0) << id;
+  }
+  return true;
+}
+
+// "<mask>:<value>", each bit is a relay id, e.g. "0xf:0x5"
+static bool parse_relays_mask(const char *payload, unsigned int *mask, unsigned int *value)
+{
+  char *end;
+  *mask = strtoul(payload, &end, 0);
+  if (end == payload || *end != ':') {
+    return false;
+  }
+  const char *v = end + 1;
+  *value = strtoul(v, &end, 0);
+  return end != v && *end == '\0';
+}
+
+void handle_relays_mqtt_status_cmd(int id, const char *payload, int payload_len)
+{
+  unsigned int mask = 0;
+  unsigned int value = 0;
+  bool parsed = payload[0] == '{' ?
+    parse_relays_json(payload, payload_len, &mask, &value) :
+    parse_relays_mask(payload, &mask, &value);
+  if (!parsed || mask == 0 || mask >= (1 << CONFIG_MQTT_RELAYS_NB)) {
+    ESP_LOGE(TAG, "bad relays command: %.*s", payload_len, payload);
     return;
   }
-  ESP_LOGW(TAG, "unhandled relay id: %d", relayId);
+
+  struct RelayMessage rm;
+  memset(&rm, 0, sizeof(struct RelayMessage));
+  rm.msgType = RELAY_CMD_STATUS_ALL;
+  rm.data = RELAY_STATUS_ALL(mask, value & mask);
+
+  trace_queued(&rm.trace);
+  if (!event_bus_publish(EVENT_RELAY_CMD, &rm, sizeof(rm), MQTT_QUEUE_TIMEOUT)) {
+    ESP_LOGE(TAG, "Cannot publish relay command");
+  }
 }
 
 #endif // CONFIG_MQTT_RELAYS_NB
 
 #if CONFIG_MQTT_THERMOSTATS_MQTT_SENSORS > 0
-void thermostat_publish_data(int thermostat_id, const char * payload)
+void thermostat_publish_data(int thermostat_id, const char * payload, int payload_len)
 {
   struct ThermostatMessage tm;
   memset(&tm, 0, sizeof(struct ThermostatMessage));
@@ -454,125 +422,103 @@ void thermostat_publish_data(int thermostat_id, const char * payload)
   tm.thermostatId = thermostat_id;
   tm.data.currentTemperature = atof(payload) * 10;
 
-  if (xQueueSend( thermostatQueue
-                  ,( void * )&tm
-                  ,MQTT_QUEUE_TIMEOUT) != pdPASS) {
-    ESP_LOGE(TAG, "Cannot send to thermostatQueue");
+  trace_queued(&tm.trace);
+  if (!event_bus_publish(EVENT_THERMOSTAT_CMD, &tm, sizeof(tm), MQTT_QUEUE_TIMEOUT)) {
+    ESP_LOGE(TAG, "Cannot publish thermostat command");
   }
 }
+#endif // CONFIG_MQTT_THERMOSTATS_MQTT_SENSORS > 0
 
-bool handleThermostatMqttSensor(esp_mqtt_event_handle_t event)
-{
-  char payload[16];
-  memcpy(payload, event->data, event->data_len);
-  payload[event->data_len] = 0;
-
+// '+' segments in routes are parsed as numeric ids, so the relay and
+// thermostat subscriptions expand to one route per action
+const struct MqttRoute ROUTES[] =
+  {
+#ifdef CONFIG_MQTT_OTA
+    {OTA_TOPIC, handle_ota_mqtt_cmd, 0, 0},
+#endif //CONFIG_MQTT_OTA
+#ifdef CONFIG_MQTT_SCHEDULERS
+    {SCHEDULER_CFG_TOPIC "+", handle_scheduler_mqtt_cfg, 0, MAX_SCHEDULER_NB},
+#endif // CONFIG_MQTT_SCHEDULERS
+#if CONFIG_MQTT_RELAYS_NB
+    {CMD_TOPIC_PREFIX "status/relay/+", handle_relay_mqtt_status_cmd, 0, CONFIG_MQTT_RELAYS_NB},
+    {CMD_TOPIC_PREFIX "sleep/relay/+", handle_relay_mqtt_sleep_cmd, 0, CONFIG_MQTT_RELAYS_NB},
+    {CMD_RELAYS_TOPIC, handle_relays_mqtt_status_cmd, 0, 0},
+#endif //CONFIG_MQTT_RELAYS_NB
+#if CONFIG_MQTT_THERMOSTATS_NB > 0
+    {CMD_TOPIC_PREFIX "mode/thermostat/+", handle_thermostat_mqtt_mode_cmd, 0, CONFIG_MQTT_THERMOSTATS_NB},
+    {CMD_TOPIC_PREFIX "temp/thermostat/+", handle_thermostat_mqtt_temp_cmd, 0, CONFIG_MQTT_THERMOSTATS_NB},
+    {CMD_TOPIC_PREFIX "tolerance/thermostat/+", handle_thermostat_mqtt_tolerance_cmd, 0, CONFIG_MQTT_THERMOSTATS_NB},
+    {CMD_THERMOSTATS_DUTY_TOPIC, handle_thermostats_mqtt_duty_cmd, 0, 0},
+#endif // CONFIG_MQTT_THERMOSTATS_NB > 0
 #ifdef CONFIG_MQTT_THERMOSTATS_NB0_SENSOR_TYPE_MQTT
-  if (strncmp(event->topic, CONFIG_MQTT_THERMOSTATS_NB0_MQTT_SENSOR_TOPIC, strlen(CONFIG_MQTT_THERMOSTATS_NB0_MQTT_SENSOR_TOPIC)) == 0) {
-    thermostat_publish_data(0, payload);
-    return true;
-  }
+    {CONFIG_MQTT_THERMOSTATS_NB0_MQTT_SENSOR_TOPIC, thermostat_publish_data, 0, 0},
 #endif //CONFIG_MQTT_THERMOSTATS_NB0_SENSOR_TYPE_MQTT
-
 #ifdef CONFIG_MQTT_THERMOSTATS_NB1_SENSOR_TYPE_MQTT
-  if (strncmp(event->topic, CONFIG_MQTT_THERMOSTATS_NB1_MQTT_SENSOR_TOPIC, strlen(CONFIG_MQTT_THERMOSTATS_NB1_MQTT_SENSOR_TOPIC)) == 0) {
-    thermostat_publish_data(1, payload);
-    return true;
-  }
+    {CONFIG_MQTT_THERMOSTATS_NB1_MQTT_SENSOR_TOPIC, thermostat_publish_data, 1, 0},
 #endif //CONFIG_MQTT_THERMOSTATS_NB1_SENSOR_TYPE_MQTT
-
 #ifdef CONFIG_MQTT_THERMOSTATS_NB2_SENSOR_TYPE_MQTT
-  if (strncmp(event->topic, CONFIG_MQTT_THERMOSTATS_NB2_MQTT_SENSOR_TOPIC, strlen(CONFIG_MQTT_THERMOSTATS_NB2_MQTT_SENSOR_TOPIC)) == 0) {
-    thermostat_publish_data(2, payload);
-    return true;
-  }
+    {CONFIG_MQTT_THERMOSTATS_NB2_MQTT_SENSOR_TOPIC, thermostat_publish_data, 2, 0},
 #endif //CONFIG_MQTT_THERMOSTATS_NB2_SENSOR_TYPE_MQTT
-
 #ifdef CONFIG_MQTT_THERMOSTATS_NB3_SENSOR_TYPE_MQTT
-  if (strncmp(event->topic, CONFIG_MQTT_THERMOSTATS_NB3_MQTT_SENSOR_TOPIC, strlen(CONFIG_MQTT_THERMOSTATS_NB3_MQTT_SENSOR_TOPIC)) == 0) {
-    thermostat_publish_data(3, payload);
-    return true;
-  }
+    {CONFIG_MQTT_THERMOSTATS_NB3_MQTT_SENSOR_TOPIC, thermostat_publish_data, 3, 0},
 #endif //CONFIG_MQTT_THERMOSTATS_NB3_SENSOR_TYPE_MQTT
+#ifdef CONFIG_MQTT_THERMOSTATS_ZONE_SENSOR_TOPIC
+    {CONFIG_MQTT_THERMOSTATS_ZONE_SENSOR_TOPIC "+", thermostat_publish_data, 0, CONFIG_MQTT_THERMOSTATS_NB},
+#endif //CONFIG_MQTT_THERMOSTATS_ZONE_SENSOR_TOPIC
+  };
 
-  return false;
-}
-#endif // CONFIG_MQTT_THERMOSTATS_MQTT_SENSORS > 0
+#define NB_ROUTES (sizeof(ROUTES) / sizeof(ROUTES[0]))
 
+// esp-mqtt hands messages bigger than its buffer over in several
+// MQTT_EVENT_DATA events, only the first one carries the topic
+char payloadArena[MQTT_PAYLOAD_MAX_SIZE + 1];
+const struct MqttRoute *payloadRoute = NULL;
+int payloadId;
+int payloadLen;
+int payloadReceived;
 
 void dispatch_mqtt_event(esp_mqtt_event_handle_t event)
 {
-  //FIXME this check should be generic and 16 should get a define
-  if (event->data_len > 16 - 1) { //including '\0'
-    ESP_LOGE(TAG, "payload to big");
-    return;
-  }
-#if CONFIG_MQTT_THERMOSTATS_MQTT_SENSORS > 0
-  if (handleThermostatMqttSensor(event)){
-    return;
-  }
-#endif // CONFIG_MQTT_THERMOSTATS_MQTT_SENSORS > 0
-
-  char actionType[16];
-  getActionType(actionType, event->topic, event->topic_len);
-
-  if (getActionType(actionType, event->topic, event->topic_len) && strcmp(actionType, "cmd") == 0) {
-    char payload[16];
-
-    memcpy(payload, event->data, event->data_len);
-    payload[event->data_len] = 0;
-
-    char service[16];
-    getService(service, event->topic, event->topic_len);
-
-#if CONFIG_MQTT_THERMOSTATS_NB > 0
-    if (strcmp(service, "thermostat") == 0) {
-      handle_thermostat_mqtt_cmd(event->topic, event->topic_len, payload);
+  if (event->current_data_offset == 0) {
+    payloadReceivedAt = latency_now();
+    payloadRoute = NULL;
+    const struct MqttRoute *route = mqtt_router_lookup(event->topic, event->topic_len, &payloadId);
+    if (!route) {
+      ESP_LOGW(TAG, "unhandled topic: %.*s", event->topic_len, event->topic);
       return;
     }
-#endif //CONFIG_MQTT_THERMOSTATS_NB > 0
-
-#if CONFIG_MQTT_RELAYS_NB
-    if (strcmp(service, "relay") == 0) {
-      handle_relay_mqtt_cmd(event->topic, event->topic_len, payload);
+    if (route->idsNb && payloadId >= route->idsNb) {
+      ESP_LOGW(TAG, "unhandled id: %d", payloadId);
       return;
     }
-#endif // CONFIG_MQTT_RELAYS_NB
-
+    if (event->total_data_len > MQTT_PAYLOAD_MAX_SIZE) {
+      ESP_LOGE(TAG, "payload too big: %d", event->total_data_len);
+      return;
+    }
+    payloadRoute = route;
+    payloadLen = event->total_data_len;
+    payloadReceived = 0;
+  } else if (!payloadRoute) {
+    // rest of a dropped message
+    return;
   }
 
-  if (handle_scheduler_mqtt_event(event))
+  if (event->current_data_offset != payloadReceived ||
+      payloadReceived + event->data_len > payloadLen) {
+    ESP_LOGE(TAG, "unexpected data at offset %d, dropping message", event->current_data_offset);
+    payloadRoute = NULL;
     return;
-  if (handle_ota_mqtt_event(event))
+  }
+  memcpy(payloadArena + payloadReceived, event->data, event->data_len);
+  payloadReceived += event->data_len;
+  if (payloadReceived < payloadLen) {
     return;
-}
-
-void mqtt_publish_data(const char * topic,
-                       const char * data,
-                       int qos, int retain)
-{
-  if (xEventGroupGetBits(mqtt_event_group) & MQTT_INIT_FINISHED_BIT) {
-    if (( xSemaphore != NULL ) && xSemaphoreTake( xSemaphore, 2 * MQTT_FLAG_TIMEOUT ) == pdTRUE) {
-      xEventGroupClearBits(mqtt_event_group, MQTT_PUBLISHED_BIT);
-      int msg_id = esp_mqtt_client_publish(client, topic, data, strlen(data), qos, retain);
-      if (qos == QOS_0) {
-        ESP_LOGI(TAG, "published qos0 data, topic: %s", topic);
-      } else if (msg_id > 0) {
-        ESP_LOGI(TAG, "published qos1 data, msg_id=%d, topic=%s", msg_id, topic);
-        EventBits_t bits = xEventGroupWaitBits(mqtt_event_group, MQTT_PUBLISHED_BIT, false, true, MQTT_FLAG_TIMEOUT);
-        if (bits & MQTT_PUBLISHED_BIT) {
-          ESP_LOGI(TAG, "publish ack received, msg_id=%d", msg_id);
-        } else {
-          ESP_LOGW(TAG, "publish ack not received, msg_id=%d", msg_id);
-        }
-      } else {
-        ESP_LOGW(TAG, "failed to publish qos1, msg_id=%d", msg_id);
-      }
-      xSemaphoreGive( xSemaphore );
-    } else {
-      ESP_LOGW(TAG, "cannot get semaphore");
-    }
   }
+
+  const struct MqttRoute *route = payloadRoute;
+  payloadRoute = NULL;
+  payloadArena[payloadLen] = 0;
+  route->handler(payloadId, payloadArena, payloadLen);
 }
 
 void publish_config_msg()
@@ -592,10 +538,17 @@ void publish_available_msg()
 }
 
 
+// reconnect cost, most of it is the tls handshake
+unsigned int connectStartedAt;
+unsigned int connectedAt;
+
 static esp_err_t mqtt_event_handler(esp_mqtt_event_handle_t event)
 {
   switch (event->event_id) {
   case MQTT_EVENT_CONNECTED:
+    connectedAt = latency_now();
+    latency_record(LATENCY_MQTT_CONNECT, connectStartedAt, connectedAt);
+    connectStartedAt = 0;
     xEventGroupSetBits(mqtt_event_group, MQTT_CONNECTED_BIT);
     void * unused;
     if (xQueueSend( mqttQueue
@@ -604,32 +557,26 @@ static esp_err_t mqtt_event_handler(esp_mqtt_event_handle_t event)
       ESP_LOGE(TAG, "Cannot send to mqttQueue");
     }
     ESP_LOGI(TAG, "MQTT_EVENT_CONNECTED");
-    mqtt_reconnect_counter=0;
+    conn_post(CONN_EVENT_MQTT_UP, 0);
     break;
   case MQTT_EVENT_DISCONNECTED:
     ESP_LOGI(TAG, "MQTT_EVENT_DISCONNECTED");
     connect_reason=mqtt_disconnect;
     xEventGroupClearBits(mqtt_event_group, MQTT_CONNECTED_BIT | MQTT_SUBSCRIBED_BIT | MQTT_PUBLISHED_BIT | MQTT_INIT_FINISHED_BIT);
-    mqtt_reconnect_counter += 1; //one reconnect each 10 seconds
-    ESP_LOGI(TAG, "mqtt_reconnect_counter: %d", mqtt_reconnect_counter);
-    if (mqtt_reconnect_counter  > (6 * 5)) //5 mins, force wifi reconnect
-      {
-        esp_wifi_stop();
-        vTaskDelay(10000 / portTICK_PERIOD_MS);
-        esp_wifi_start();
-        mqtt_reconnect_counter = 0;
-      }
+    mqtt_publish_inflight_release();
+    // reconnecting is up to the connection task, nothing blocks here
+    conn_post(CONN_EVENT_MQTT_DOWN, 0);
     break;
 
   case MQTT_EVENT_SUBSCRIBED:
-    xEventGroupSetBits(mqtt_event_group, MQTT_SUBSCRIBED_BIT);
+    mqtt_subscribe_acked(event->msg_id);
     ESP_LOGI(TAG, "MQTT_EVENT_SUBSCRIBED, msg_id=%d", event->msg_id);
     break;
   case MQTT_EVENT_UNSUBSCRIBED:
     ESP_LOGI(TAG, "MQTT_EVENT_UNSUBSCRIBED, msg_id=%d", event->msg_id);
     break;
   case MQTT_EVENT_PUBLISHED:
-    xEventGroupSetBits(mqtt_event_group, MQTT_PUBLISHED_BIT);
+    mqtt_publish_acked(event->msg_id);
     ESP_LOGI(TAG, "MQTT_EVENT_PUBLISHED, msg_id=%d", event->msg_id);
     break;
   case MQTT_EVENT_DATA:
@@ -643,6 +590,7 @@ static esp_err_t mqtt_event_handler(esp_mqtt_event_handle_t event)
     break;
   case MQTT_EVENT_BEFORE_CONNECT:
     ESP_LOGI(TAG, "MQTT_EVENT_BEFORE_CONNECT");
+    connectStartedAt = latency_now();
     break;
 #ifdef CONFIG_TARGET_DEVICE_ESP32
   case MQTT_EVENT_ANY:
@@ -653,25 +601,76 @@ static esp_err_t mqtt_event_handler(esp_mqtt_event_handle_t event)
   return ESP_OK;
 }
 
-static void mqtt_subscribe(esp_mqtt_client_handle_t client)
+// SUBACK msg_ids, written by the mqtt event handler while
+// mqtt_subscribe waits for them
+volatile int subscribeAcks[NB_SUBSCRIPTIONS];
+volatile unsigned char subscribeAcksNext = 0;
+
+void mqtt_subscribe_acked(int msg_id)
+{
+  subscribeAcks[subscribeAcksNext] = msg_id;
+  subscribeAcksNext = (subscribeAcksNext + 1) % NB_SUBSCRIPTIONS;
+  xEventGroupSetBits(mqtt_event_group, MQTT_SUBSCRIBED_BIT);
+}
+
+static bool subscribe_ack_received(int msg_id)
+{
+  for (int i = 0; i < NB_SUBSCRIPTIONS; i++) {
+    if (subscribeAcks[i] == msg_id) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// all subscriptions are sent back to back, then SUBACKs are matched by
+// msg_id so reconnecting costs about one round trip
+bool mqtt_subscribe(esp_mqtt_client_handle_t client)
 {
-  int msg_id;
+  int msgIds[NB_SUBSCRIPTIONS];
+  int pending = 0;
 
   for (int i = 0; i < NB_SUBSCRIPTIONS; i++) {
-    xEventGroupClearBits(mqtt_event_group, MQTT_SUBSCRIBED_BIT);
-    msg_id = esp_mqtt_client_subscribe(client, SUBSCRIPTIONS[i], 1);
-    if (msg_id > 0) {
-      ESP_LOGI(TAG, "sent subscribe %s successful, msg_id=%d", SUBSCRIPTIONS[i], msg_id);
-      EventBits_t bits = xEventGroupWaitBits(mqtt_event_group, MQTT_SUBSCRIBED_BIT, false, true, MQTT_FLAG_TIMEOUT);
-      if (bits & MQTT_SUBSCRIBED_BIT) {
-        ESP_LOGI(TAG, "subscribe ack received, msg_id=%d", msg_id);
-      } else {
-        ESP_LOGW(TAG, "subscribe ack not received, msg_id=%d", msg_id);
+    subscribeAcks[i] = 0;
+  }
+  xEventGroupClearBits(mqtt_event_group, MQTT_SUBSCRIBED_BIT);
+  for (int i = 0; i < NB_SUBSCRIPTIONS; i++) {
+    msgIds[i] = esp_mqtt_client_subscribe(client, SUBSCRIPTIONS[i], 1);
+    if (msgIds[i] > 0) {
+      ESP_LOGI(TAG, "sent subscribe %s successful, msg_id=%d", SUBSCRIPTIONS[i], msgIds[i]);
+      pending++;
+    } else {
+      ESP_LOGW(TAG, "failed to subscribe %s, msg_id=%d", SUBSCRIPTIONS[i], msgIds[i]);
+    }
+  }
+
+  TickType_t start = xTaskGetTickCount();
+  while (pending) {
+    pending = 0;
+    for (int i = 0; i < NB_SUBSCRIPTIONS; i++) {
+      if (msgIds[i] > 0 && !subscribe_ack_received(msgIds[i])) {
+        pending++;
       }
+    }
+    TickType_t elapsed = xTaskGetTickCount() - start;
+    if (pending == 0 || elapsed >= MQTT_FLAG_TIMEOUT) {
+      break;
+    }
+    xEventGroupWaitBits(mqtt_event_group, MQTT_SUBSCRIBED_BIT, true, true, MQTT_FLAG_TIMEOUT - elapsed);
+  }
+
+  bool subscribed = true;
+  for (int i = 0; i < NB_SUBSCRIPTIONS; i++) {
+    if (msgIds[i] <= 0) {
+      subscribed = false;
+    } else if (subscribe_ack_received(msgIds[i])) {
+      ESP_LOGI(TAG, "subscribe ack received, msg_id=%d", msgIds[i]);
     } else {
-      ESP_LOGW(TAG, "failed to subscribe %s, msg_id=%d", SUBSCRIPTIONS[i], msg_id);
+      ESP_LOGW(TAG, "subscribe ack not received, msg_id=%d", msgIds[i]);
+      subscribed = false;
     }
   }
+  return subscribed;
 }
 
 void mqtt_init_and_start()
@@ -690,6 +689,9 @@ void mqtt_init_and_start()
     .keepalive = MQTT_TIMEOUT
   };
 
+  mqtt_router_init(ROUTES, NB_ROUTES);
+  mqtt_topics_size();
+
   ESP_LOGI(TAG, "[APP] Free memory: %d bytes", esp_get_free_heap_size());
   client = esp_mqtt_client_init(&mqtt_cfg);
   esp_mqtt_client_start(client);
@@ -706,14 +708,27 @@ void handle_mqtt_sub_pub(void* pvParameters)
         xEventGroupClearBits(mqtt_event_group, MQTT_INIT_FINISHED_BIT);
         mqtt_subscribe(client);
         xEventGroupSetBits(mqtt_event_group, MQTT_INIT_FINISHED_BIT);
+        latency_record(LATENCY_MQTT_INIT, connectedAt, latency_now());
+        connectedAt = 0;
         publish_available_msg();
         publish_config_msg();
+        publish_connection_report();
 #if CONFIG_MQTT_RELAYS_NB
+#ifdef CONFIG_MQTT_STATE_SNAPSHOT
+        publish_relays_snapshot();
+#endif //CONFIG_MQTT_STATE_SNAPSHOT
+#if MQTT_STATE_FIELD_TOPICS
         publish_all_relays_status();
         publish_all_relays_timeout();
+#endif //MQTT_STATE_FIELD_TOPICS
 #endif//CONFIG_MQTT_RELAYS_NB
 #if CONFIG_MQTT_THERMOSTATS_NB > 0
+#ifdef CONFIG_MQTT_STATE_SNAPSHOT
+        publish_thermostats_snapshot();
+#endif //CONFIG_MQTT_STATE_SNAPSHOT
+#if MQTT_STATE_FIELD_TOPICS
         publish_thermostat_data();
+#endif //MQTT_STATE_FIELD_TOPICS
 #endif // CONFIG_MQTT_THERMOSTATS_NB > 0
 #ifdef CONFIG_MQTT_OTA
         publish_ota_data(OTA_READY);
@@ -721,6 +736,9 @@ void handle_mqtt_sub_pub(void* pvParameters)
 #ifdef CONFIG_MQTT_SENSOR
         publish_sensors_data();
 #endif//
+#ifdef CONFIG_MQTT_OUTBOX
+        mqtt_outbox_replay();
+#endif //CONFIG_MQTT_OUTBOX
       }
   }
 }
@@ -4,13 +4,16 @@
 /* some useful values for relay Json exchanges */
 #define MAX_MQTT_DATA_LEN_RELAY 32
 #define MAX_MQTT_DATA_THERMOSTAT 64
-#define MAX_MQTT_DATA_SCHEDULER 96
 #define MAX_MQTT_DATA_SENSORS 256
+#define MAX_MQTT_DATA_RELAY_STATE 48
+#define MAX_MQTT_DATA_THERMOSTAT_STATE 96
+#define MAX_MQTT_DATA_LATENCY 1024
 #define JSON_BAD_RELAY_VALUE 255
 #define JSON_BAD_TOPIC_ID 255
 
 void mqtt_init_and_start();
 void handle_mqtt_sub_pub(void* pvParameters);
+void mqtt_subscribe_acked(int msg_id);
 
 
 #define MQTT_TIMEOUT 60
@@ -18,6 +21,12 @@ void handle_mqtt_sub_pub(void* pvParameters);
 #define MQTT_QUEUE_TIMEOUT (MQTT_TIMEOUT * 1000 / portTICK_PERIOD_MS)
 #define MQTT_MAX_TOPIC_LEN 64
 
+#ifdef CONFIG_MQTT_PAYLOAD_MAX_SIZE
+#define MQTT_PAYLOAD_MAX_SIZE CONFIG_MQTT_PAYLOAD_MAX_SIZE
+#else //CONFIG_MQTT_PAYLOAD_MAX_SIZE
+#define MQTT_PAYLOAD_MAX_SIZE 256
+#endif //CONFIG_MQTT_PAYLOAD_MAX_SIZE
+
 
 #define QOS_0 0
 #define QOS_1 1
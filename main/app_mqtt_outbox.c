@@ -0,0 +1,265 @@
+#include "esp_system.h"
+#include "esp_log.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "app_mqtt.h"
+#include "app_mqtt_publisher.h"
+#include "app_mqtt_topics.h"
+#include "app_mqtt_outbox.h"
+
+extern SemaphoreHandle_t xSemaphore;
+
+static const char *TAG = "MQTT_OUTBOX";
+
+struct MqttOutboxStats mqttOutboxStats;
+
+#ifdef CONFIG_MQTT_BINARY_PAYLOAD
+// binary payloads are replayed as hex strings inside the json batch,
+// returns the encoded length, out may be NULL to only measure it
+static int entry_encode(char *out, const char *data, int data_len)
+{
+  if (out) {
+    for (int i = 0; i < data_len; i++) {
+      sprintf(out + 2 * i, "%02x", (unsigned char)data[i]);
+    }
+  }
+  return 2 * data_len;
+}
+#else //CONFIG_MQTT_BINARY_PAYLOAD
+// text payloads are replayed as escaped json strings, returns the
+// encoded length, out may be NULL to only measure it
+static int entry_encode(char *out, const char *data, int data_len)
+{
+  int len = 0;
+  for (int i = 0; i < data_len; i++) {
+    unsigned char c = data[i];
+    if (c == '"' || c == '\\') {
+      if (out) {
+        out[len] = '\\';
+        out[len + 1] = c;
+      }
+      len += 2;
+    } else if (c < 0x20) {
+      if (out) {
+        sprintf(out + len, "\\u%04x", c);
+      }
+      len += 6;
+    } else {
+      if (out) {
+        out[len] = c;
+      }
+      len += 1;
+    }
+  }
+  return len;
+}
+#endif //CONFIG_MQTT_BINARY_PAYLOAD
+
+#define OUTBOX_ALIGN(x) (((x) + sizeof(time_t) - 1) & ~(sizeof(time_t) - 1))
+#define OUTBOX_BATCH_ENTRY "%s{\"ts\":%ld,\"topic\":\"%s\",\"data\":\"%s\"}"
+
+// time_t keeps entries aligned for their ts
+time_t outboxRing[MQTT_OUTBOX_RING_SIZE / sizeof(time_t)];
+
+// entries are stored in [tail, head) or, once head wrapped,
+// in [tail, wrapAt) followed by [0, head), seq keeps increasing so
+// replay can release exactly what it published even if entries were
+// evicted meanwhile
+unsigned int outboxHead = 0;
+unsigned int outboxTail = 0;
+unsigned int outboxWrapAt = MQTT_OUTBOX_RING_SIZE;
+unsigned int outboxCount = 0;
+bool outboxWrapped = false;
+unsigned int outboxSeq = 0;
+
+static struct MqttOutboxEntry * outbox_entry(unsigned int offset)
+{
+  return (struct MqttOutboxEntry *)((char *)outboxRing + offset);
+}
+
+static const char * entry_topic(const struct MqttOutboxEntry *e)
+{
+  return (const char *)(e + 1);
+}
+
+static const char * entry_data(const struct MqttOutboxEntry *e)
+{
+  return entry_topic(e) + e->topicLen + 1;
+}
+
+static unsigned int outbox_next(unsigned int offset)
+{
+  offset += outbox_entry(offset)->size;
+  if (outboxWrapped && offset == outboxWrapAt) {
+    offset = 0;
+  }
+  return offset;
+}
+
+void mqtt_outbox_reset()
+{
+  outboxHead = 0;
+  outboxTail = 0;
+  outboxWrapAt = MQTT_OUTBOX_RING_SIZE;
+  outboxCount = 0;
+  outboxWrapped = false;
+}
+
+static void outbox_pop()
+{
+  outboxTail += outbox_entry(outboxTail)->size;
+  outboxCount -= 1;
+  if (outboxWrapped && outboxTail == outboxWrapAt) {
+    outboxTail = 0;
+    outboxWrapAt = MQTT_OUTBOX_RING_SIZE;
+    outboxWrapped = false;
+  }
+  if (outboxCount == 0) {
+    mqtt_outbox_reset();
+  }
+}
+
+static int outbox_reserve(unsigned int size)
+{
+  int offset = -1;
+  if (!outboxWrapped) {
+    if (MQTT_OUTBOX_RING_SIZE - outboxHead >= size) {
+      offset = outboxHead;
+    } else if (outboxTail >= size) {
+      outboxWrapAt = outboxHead;
+      outboxWrapped = true;
+      offset = 0;
+    }
+  } else if (outboxTail - outboxHead >= size) {
+    offset = outboxHead;
+  }
+  if (offset >= 0) {
+    outboxHead = offset + size;
+    outboxCount += 1;
+  }
+  return offset;
+}
+
+bool mqtt_outbox_store(const char * topic, const char * data, int data_len)
+{
+  time_t ts;
+  time(&ts);
+  int topic_len = strlen(topic);
+  int encoded_len = entry_encode(NULL, data, data_len);
+  unsigned int size = OUTBOX_ALIGN(sizeof(struct MqttOutboxEntry) + topic_len + 1 + encoded_len + 1);
+  // an entry must fit in a batch of its own, with its separator and brackets
+  int batch_len = snprintf(NULL, 0, OUTBOX_BATCH_ENTRY, ",", (long)ts, topic, "") + encoded_len + 2;
+  if (size > MQTT_OUTBOX_RING_SIZE || batch_len >= MAX_MQTT_DATA_OUTBOX) {
+    mqttOutboxStats.rejected += 1;
+    ESP_LOGW(TAG, "message too big for outbox, topic: %s", topic);
+    return false;
+  }
+  if (xSemaphoreTake(xSemaphore, MQTT_PUBLISH_LOCK_TIMEOUT) != pdTRUE) {
+    mqttOutboxStats.rejected += 1;
+    ESP_LOGW(TAG, "cannot get semaphore");
+    return false;
+  }
+  int offset;
+  while ((offset = outbox_reserve(size)) < 0) {
+#ifdef CONFIG_MQTT_OUTBOX_DROP_NEWEST
+    mqttOutboxStats.evicted += 1;
+    xSemaphoreGive(xSemaphore);
+    ESP_LOGW(TAG, "outbox full, dropping topic: %s", topic);
+    return false;
+#else //CONFIG_MQTT_OUTBOX_DROP_NEWEST
+    // oldest samples go first, the newest ones describe the current state
+    outbox_pop();
+    mqttOutboxStats.evicted += 1;
+#endif //CONFIG_MQTT_OUTBOX_DROP_NEWEST
+  }
+  struct MqttOutboxEntry *e = outbox_entry(offset);
+  e->ts = ts;
+  e->seq = ++outboxSeq;
+  e->size = size;
+  e->topicLen = topic_len;
+  char *p = (char *)entry_topic(e);
+  memcpy(p, topic, topic_len + 1);
+  p = (char *)entry_data(e);
+  entry_encode(p, data, data_len);
+  p[encoded_len] = 0;
+  mqttOutboxStats.stored += 1;
+  xSemaphoreGive(xSemaphore);
+  return true;
+}
+
+int mqtt_outbox_count()
+{
+  return outboxCount;
+}
+
+// formats the oldest entries as one json array, lastSeq is set to
+// the seq of the last entry written, returns the number of entries
+int mqtt_outbox_format(char *buf, int size, unsigned int *lastSeq)
+{
+  int nb = 0;
+  int len = 1;
+  buf[0] = '[';
+  if (xSemaphoreTake(xSemaphore, MQTT_PUBLISH_LOCK_TIMEOUT) != pdTRUE) {
+    ESP_LOGW(TAG, "cannot get semaphore");
+    return 0;
+  }
+  unsigned int offset = outboxTail;
+  for (; nb < (int)outboxCount; nb++) {
+    const struct MqttOutboxEntry *e = outbox_entry(offset);
+    // keep room for the closing bracket
+    int l = snprintf(buf + len, size - len - 1, OUTBOX_BATCH_ENTRY,
+                     nb ? "," : "", (long)e->ts, entry_topic(e), entry_data(e));
+    if (l >= size - len - 1) {
+      break;
+    }
+    len += l;
+    *lastSeq = e->seq;
+    offset = outbox_next(offset);
+  }
+  xSemaphoreGive(xSemaphore);
+  buf[len] = ']';
+  buf[len + 1] = 0;
+  return nb;
+}
+
+void mqtt_outbox_release(unsigned int lastSeq)
+{
+  if (xSemaphoreTake(xSemaphore, MQTT_PUBLISH_LOCK_TIMEOUT) != pdTRUE) {
+    ESP_LOGW(TAG, "cannot get semaphore");
+    return;
+  }
+  while (outboxCount && (int)(lastSeq - outbox_entry(outboxTail)->seq) >= 0) {
+    outbox_pop();
+    mqttOutboxStats.replayed += 1;
+  }
+  xSemaphoreGive(xSemaphore);
+}
+
+// publishes stored entries in batches on evt/outbox, entries stay in the
+// outbox until their batch made it into the publish ring
+int mqtt_outbox_replay()
+{
+  static char data[MAX_MQTT_DATA_OUTBOX];
+  const char * topic = MQTT_EVT_TOPIC("outbox");
+  int replayed = 0;
+  unsigned int lastSeq;
+  int nb;
+  while ((nb = mqtt_outbox_format(data, sizeof(data), &lastSeq)) > 0) {
+    if (!mqtt_publish_data_cb(topic, data, strlen(data), QOS_1, NO_RETAIN, NULL, NULL)) {
+      ESP_LOGW(TAG, "replay stopped, %d entries left", mqtt_outbox_count());
+      break;
+    }
+    mqtt_outbox_release(lastSeq);
+    replayed += nb;
+  }
+  if (replayed) {
+    ESP_LOGI(TAG, "replayed %d entries, stored: %u, evicted: %u, rejected: %u",
+             replayed, mqttOutboxStats.stored, mqttOutboxStats.evicted, mqttOutboxStats.rejected);
+  }
+  return replayed;
+}
@@ -0,0 +1,43 @@
+#ifndef APP_MQTT_OUTBOX_H
+#define APP_MQTT_OUTBOX_H
+
+#include <stdbool.h>
+#include <time.h>
+
+#ifdef CONFIG_MQTT_OUTBOX_RING_SIZE
+#define MQTT_OUTBOX_RING_SIZE CONFIG_MQTT_OUTBOX_RING_SIZE
+#else //CONFIG_MQTT_OUTBOX_RING_SIZE
+#define MQTT_OUTBOX_RING_SIZE 2048
+#endif //CONFIG_MQTT_OUTBOX_RING_SIZE
+
+/* biggest replay message, entries are batched until it is full and
+   entries that would not fit in a batch on their own are rejected */
+#define MAX_MQTT_DATA_OUTBOX 512
+
+/* non retained message published while the broker was unreachable,
+   topic and data follow the entry in the ring, both '\0' terminated,
+   data is kept as a json string (escaped or hex encoded) */
+struct MqttOutboxEntry {
+  time_t ts;
+  unsigned int seq;
+  unsigned short size;
+  unsigned short topicLen;
+};
+
+struct MqttOutboxStats {
+  unsigned int stored;
+  unsigned int replayed;
+  unsigned int evicted;  // lost to the eviction policy, outbox was full
+  unsigned int rejected; // too big for a batch or outbox locked
+};
+
+extern struct MqttOutboxStats mqttOutboxStats;
+
+bool mqtt_outbox_store(const char * topic, const char * data, int data_len);
+int mqtt_outbox_count();
+int mqtt_outbox_format(char *buf, int size, unsigned int *lastSeq);
+void mqtt_outbox_release(unsigned int lastSeq);
+int mqtt_outbox_replay();
+void mqtt_outbox_reset();
+
+#endif /* APP_MQTT_OUTBOX_H */
@@ -0,0 +1,420 @@
+#include "esp_system.h"
+#include "esp_log.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/event_groups.h"
+#include "freertos/semphr.h"
+
+#include <string.h>
+
+#include "mqtt_client.h"
+
+#include "app_mqtt.h"
+#include "app_mqtt_publisher.h"
+#ifdef CONFIG_MQTT_OUTBOX
+#include "app_mqtt_outbox.h"
+#endif //CONFIG_MQTT_OUTBOX
+
+extern esp_mqtt_client_handle_t client;
+extern EventGroupHandle_t mqtt_event_group;
+extern const int MQTT_PUBLISHED_BIT;
+extern const int MQTT_INIT_FINISHED_BIT;
+extern const int MQTT_PUBLISH_PENDING_BIT;
+
+extern SemaphoreHandle_t xSemaphore;
+
+static const char *TAG = "MQTT_PUBLISHER";
+
+struct MqttPublishStats mqttPublishStats;
+
+// void * keeps records aligned for their pointer members
+void * publishRing[MQTT_PUBLISH_RING_SIZE / sizeof(void *)];
+
+// records are stored in [tail, head) or, once head wrapped,
+// in [tail, wrapAt) followed by [0, head)
+unsigned int publishRingHead = 0;
+unsigned int publishRingTail = 0;
+unsigned int publishRingWrapAt = MQTT_PUBLISH_RING_SIZE;
+unsigned int publishRingCount = 0;
+bool publishRingWrapped = false;
+// next record to send, records from tail up to it are sent or done
+unsigned int publishRingNext = 0;
+unsigned int publishRingPending = 0;
+
+struct MqttInflight publishInflight[MQTT_PUBLISH_INFLIGHT_WINDOW];
+// PUBACKs received before their msg_id made it into publishInflight
+int publishEarlyAcks[MQTT_PUBLISH_INFLIGHT_WINDOW];
+unsigned char publishEarlyAcksNext = 0;
+
+#define RING_ALIGN(x) (((x) + sizeof(void *) - 1) & ~(sizeof(void *) - 1))
+
+static struct MqttPublishRecord * ring_record(unsigned int offset)
+{
+  return (struct MqttPublishRecord *)((char *)publishRing + offset);
+}
+
+const char * mqtt_publish_record_topic(const struct MqttPublishRecord *r)
+{
+  return (const char *)(r + 1);
+}
+
+const char * mqtt_publish_record_data(const struct MqttPublishRecord *r)
+{
+  return mqtt_publish_record_topic(r) + r->topicLen + 1;
+}
+
+void mqtt_publish_ring_reset()
+{
+  publishRingHead = 0;
+  publishRingTail = 0;
+  publishRingWrapAt = MQTT_PUBLISH_RING_SIZE;
+  publishRingCount = 0;
+  publishRingWrapped = false;
+  publishRingNext = 0;
+  publishRingPending = 0;
+}
+
+static int ring_reserve(unsigned int size)
+{
+  if (publishRingCount == 0) {
+    mqtt_publish_ring_reset();
+  }
+  int offset = -1;
+  if (!publishRingWrapped) {
+    if (MQTT_PUBLISH_RING_SIZE - publishRingHead >= size) {
+      offset = publishRingHead;
+    } else if (publishRingTail >= size) {
+      publishRingWrapAt = publishRingHead;
+      publishRingWrapped = true;
+      if (publishRingNext == publishRingWrapAt) {
+        publishRingNext = 0;
+      }
+      offset = 0;
+    }
+  } else if (publishRingTail - publishRingHead >= size) {
+    offset = publishRingHead;
+  }
+  if (offset >= 0) {
+    publishRingHead = offset + size;
+    publishRingCount += 1;
+    publishRingPending += 1;
+  }
+  return offset;
+}
+
+bool mqtt_publish_ring_push(const char * topic,
+                            const char * data, int data_len,
+                            int qos, int retain,
+                            mqtt_publish_cb_t cb, void *ctx)
+{
+  int topic_len = strlen(topic);
+  unsigned int size = RING_ALIGN(sizeof(struct MqttPublishRecord) + topic_len + 1 + data_len + 1);
+  if (size > MQTT_PUBLISH_RING_SIZE) {
+    mqttPublishStats.overflow += 1;
+    ESP_LOGE(TAG, "message too big for publish ring, topic: %s", topic);
+    return false;
+  }
+
+  if (xSemaphoreTake(xSemaphore, MQTT_PUBLISH_LOCK_TIMEOUT) != pdTRUE) {
+    mqttPublishStats.dropped += 1;
+    ESP_LOGW(TAG, "cannot get semaphore");
+    return false;
+  }
+  int offset = ring_reserve(size);
+  if (offset < 0) {
+    mqttPublishStats.dropped += 1;
+    xSemaphoreGive(xSemaphore);
+    ESP_LOGW(TAG, "publish ring full, dropping topic: %s", topic);
+    return false;
+  }
+
+  struct MqttPublishRecord *r = ring_record(offset);
+  r->size = size;
+  r->topicLen = topic_len;
+  r->dataLen = data_len;
+  r->qos = qos;
+  r->retain = retain;
+  r->state = MQTT_PUBLISH_RECORD_QUEUED;
+  r->cb = cb;
+  r->ctx = ctx;
+  char *p = (char *)mqtt_publish_record_topic(r);
+  memcpy(p, topic, topic_len + 1);
+  p = (char *)mqtt_publish_record_data(r);
+  memcpy(p, data, data_len);
+  p[data_len] = 0;
+  mqttPublishStats.queued += 1;
+  xSemaphoreGive(xSemaphore);
+  return true;
+}
+
+static void ring_lock()
+{
+  while (xSemaphoreTake(xSemaphore, MQTT_PUBLISH_LOCK_TIMEOUT) != pdTRUE) {
+    ESP_LOGW(TAG, "cannot get semaphore");
+  }
+}
+
+// only the publisher task consumes the ring, records stay in place
+// until they are marked done
+struct MqttPublishRecord * mqtt_publish_ring_peek()
+{
+  struct MqttPublishRecord *r = NULL;
+  ring_lock();
+  if (publishRingPending) {
+    r = ring_record(publishRingNext);
+  }
+  xSemaphoreGive(xSemaphore);
+  return r;
+}
+
+void mqtt_publish_ring_sent(struct MqttPublishRecord *r)
+{
+  ring_lock();
+  r->state = MQTT_PUBLISH_RECORD_SENT;
+  publishRingNext += r->size;
+  publishRingPending -= 1;
+  if (publishRingWrapped && publishRingNext == publishRingWrapAt) {
+    publishRingNext = 0;
+  }
+  xSemaphoreGive(xSemaphore);
+}
+
+// records complete out of order, space is given back from the tail
+// as soon as the oldest ones are done
+void mqtt_publish_ring_done(struct MqttPublishRecord *r)
+{
+  ring_lock();
+  r->state = MQTT_PUBLISH_RECORD_DONE;
+  while (publishRingCount &&
+         ring_record(publishRingTail)->state == MQTT_PUBLISH_RECORD_DONE) {
+    publishRingTail += ring_record(publishRingTail)->size;
+    publishRingCount -= 1;
+    if (publishRingWrapped && publishRingTail == publishRingWrapAt) {
+      publishRingTail = 0;
+      publishRingWrapAt = MQTT_PUBLISH_RING_SIZE;
+      publishRingWrapped = false;
+    }
+  }
+  if (publishRingCount == 0) {
+    mqtt_publish_ring_reset();
+  }
+  xSemaphoreGive(xSemaphore);
+}
+
+bool mqtt_publish_data_cb(const char * topic,
+                          const char * data, int data_len,
+                          int qos, int retain,
+                          mqtt_publish_cb_t cb, void *ctx)
+{
+  if (!(xEventGroupGetBits(mqtt_event_group) & MQTT_INIT_FINISHED_BIT)) {
+#ifdef CONFIG_MQTT_OUTBOX
+    // retained state is published again on connect, only samples and
+    // events nobody asked a callback for are kept for replay
+    if (!retain && !cb) {
+      return mqtt_outbox_store(topic, data, data_len);
+    }
+#endif //CONFIG_MQTT_OUTBOX
+    return false;
+  }
+  if (!mqtt_publish_ring_push(topic, data, data_len, qos, retain, cb, ctx)) {
+    return false;
+  }
+  xEventGroupSetBits(mqtt_event_group, MQTT_PUBLISH_PENDING_BIT);
+  return true;
+}
+
+void mqtt_publish_data(const char * topic,
+                       const char * data,
+                       int qos, int retain)
+{
+  mqtt_publish_data_cb(topic, data, strlen(data), qos, retain, NULL, NULL);
+}
+
+// called from the mqtt event handler, only flags the message so the
+// callbacks run in the publisher task
+bool mqtt_publish_acked(int msg_id)
+{
+  bool found = false;
+  ring_lock();
+  for (int i = 0; i < MQTT_PUBLISH_INFLIGHT_WINDOW; i++) {
+    if (publishInflight[i].record && publishInflight[i].msgId == msg_id) {
+      publishInflight[i].acked = true;
+      found = true;
+      break;
+    }
+  }
+  if (!found) {
+    publishEarlyAcks[publishEarlyAcksNext] = msg_id;
+    publishEarlyAcksNext = (publishEarlyAcksNext + 1) % MQTT_PUBLISH_INFLIGHT_WINDOW;
+  }
+  xSemaphoreGive(xSemaphore);
+  xEventGroupSetBits(mqtt_event_group, MQTT_PUBLISHED_BIT);
+  return found;
+}
+
+bool mqtt_publish_inflight_add(struct MqttPublishRecord *r, int msg_id)
+{
+  bool added = false;
+  ring_lock();
+  for (int i = 0; i < MQTT_PUBLISH_INFLIGHT_WINDOW; i++) {
+    if (publishInflight[i].record == NULL) {
+      publishInflight[i].record = r;
+      publishInflight[i].msgId = msg_id;
+      publishInflight[i].sentAt = xTaskGetTickCount();
+      publishInflight[i].acked = false;
+      publishInflight[i].disconnected = false;
+      for (int j = 0; j < MQTT_PUBLISH_INFLIGHT_WINDOW; j++) {
+        if (publishEarlyAcks[j] == msg_id) {
+          publishEarlyAcks[j] = 0;
+          publishInflight[i].acked = true;
+        }
+      }
+      added = true;
+      break;
+    }
+  }
+  xSemaphoreGive(xSemaphore);
+  return added;
+}
+
+int mqtt_publish_inflight_count()
+{
+  int count = 0;
+  ring_lock();
+  for (int i = 0; i < MQTT_PUBLISH_INFLIGHT_WINDOW; i++) {
+    if (publishInflight[i].record) {
+      count++;
+    }
+  }
+  xSemaphoreGive(xSemaphore);
+  return count;
+}
+
+static void publish_finished(struct MqttPublishRecord *r, int msg_id, int result)
+{
+  if (result == MQTT_PUBLISH_OK) {
+    mqttPublishStats.published += 1;
+  } else {
+    mqttPublishStats.failed += 1;
+  }
+  if (r->cb) {
+    r->cb(msg_id, result, r->ctx);
+  }
+  mqtt_publish_ring_done(r);
+}
+
+static int publish_record(const struct MqttPublishRecord *r)
+{
+  const char *topic = mqtt_publish_record_topic(r);
+  if (!(xEventGroupGetBits(mqtt_event_group) & MQTT_INIT_FINISHED_BIT)) {
+    ESP_LOGW(TAG, "not connected, cannot publish topic: %s", topic);
+    return -1;
+  }
+  int msg_id = esp_mqtt_client_publish(client, topic, mqtt_publish_record_data(r), r->dataLen, r->qos, r->retain);
+  if (msg_id < 0 || (r->qos != QOS_0 && msg_id == 0)) {
+    ESP_LOGW(TAG, "failed to publish qos%d, msg_id=%d, topic=%s", r->qos, msg_id, topic);
+    return -1;
+  }
+  ESP_LOGI(TAG, "published qos%d data, msg_id=%d, topic=%s", r->qos, msg_id, topic);
+  return msg_id;
+}
+
+// acked messages are completed, the ones without PUBACK after
+// MQTT_PUBLISH_ACK_TIMEOUT or cut off by a disconnect are failed,
+// retransmitting is left to the client so the msg_id never changes
+void mqtt_publish_inflight_process()
+{
+  TickType_t now = xTaskGetTickCount();
+  for (int i = 0; i < MQTT_PUBLISH_INFLIGHT_WINDOW; i++) {
+    struct MqttInflight *f = &publishInflight[i];
+    ring_lock();
+    struct MqttInflight inflight = *f;
+    bool expired = inflight.record && !inflight.acked &&
+      (TickType_t)(now - inflight.sentAt) >= MQTT_PUBLISH_ACK_TIMEOUT;
+    bool finished = inflight.record &&
+      (inflight.acked || inflight.disconnected || expired);
+    if (finished) {
+      f->record = NULL;
+    }
+    xSemaphoreGive(xSemaphore);
+
+    if (!finished) {
+      continue;
+    }
+    int result = MQTT_PUBLISH_OK;
+    if (inflight.acked) {
+      ESP_LOGI(TAG, "publish ack received, msg_id=%d", inflight.msgId);
+    } else if (inflight.disconnected) {
+      ESP_LOGW(TAG, "disconnected before publish ack, msg_id=%d", inflight.msgId);
+      result = MQTT_PUBLISH_FAILED;
+    } else {
+      ESP_LOGW(TAG, "publish ack not received, msg_id=%d", inflight.msgId);
+      result = MQTT_PUBLISH_TIMEOUT;
+    }
+    publish_finished(inflight.record, inflight.msgId, result);
+  }
+}
+
+TickType_t mqtt_publish_inflight_wait()
+{
+  TickType_t wait = portMAX_DELAY;
+  TickType_t now = xTaskGetTickCount();
+  ring_lock();
+  for (int i = 0; i < MQTT_PUBLISH_INFLIGHT_WINDOW; i++) {
+    if (publishInflight[i].record) {
+      TickType_t elapsed = now - publishInflight[i].sentAt;
+      TickType_t left = elapsed < MQTT_PUBLISH_ACK_TIMEOUT ? MQTT_PUBLISH_ACK_TIMEOUT - elapsed : 0;
+      if (left < wait) {
+        wait = left;
+      }
+    }
+  }
+  xSemaphoreGive(xSemaphore);
+  return wait;
+}
+
+// called from the mqtt event handler on disconnect, the window is freed
+// by the publisher task and acks seen so far belong to the old session
+void mqtt_publish_inflight_release()
+{
+  ring_lock();
+  for (int i = 0; i < MQTT_PUBLISH_INFLIGHT_WINDOW; i++) {
+    if (publishInflight[i].record && !publishInflight[i].acked) {
+      publishInflight[i].disconnected = true;
+    }
+    publishEarlyAcks[i] = 0;
+  }
+  xSemaphoreGive(xSemaphore);
+  xEventGroupSetBits(mqtt_event_group, MQTT_PUBLISHED_BIT);
+}
+
+static void publish_pending()
+{
+  struct MqttPublishRecord *r;
+  while ((r = mqtt_publish_ring_peek()) != NULL) {
+    if (r->qos != QOS_0 && mqtt_publish_inflight_count() >= MQTT_PUBLISH_INFLIGHT_WINDOW) {
+      break;
+    }
+    mqtt_publish_ring_sent(r);
+    int msg_id = publish_record(r);
+    if (msg_id < 0) {
+      publish_finished(r, msg_id, MQTT_PUBLISH_FAILED);
+    } else if (r->qos == QOS_0) {
+      publish_finished(r, msg_id, MQTT_PUBLISH_OK);
+    } else {
+      mqtt_publish_inflight_add(r, msg_id);
+    }
+  }
+}
+
+void handle_mqtt_publish_task(void* pvParameters)
+{
+  ESP_LOGI(TAG, "handle_mqtt_publish_task started");
+  while(1) {
+    mqtt_publish_inflight_process();
+    publish_pending();
+    xEventGroupWaitBits(mqtt_event_group, MQTT_PUBLISH_PENDING_BIT | MQTT_PUBLISHED_BIT,
+                        true, false, mqtt_publish_inflight_wait());
+  }
+}
@@ -0,0 +1,91 @@
+#ifndef APP_MQTT_PUBLISHER_H
+#define APP_MQTT_PUBLISHER_H
+
+#include <stdbool.h>
+
+#ifdef CONFIG_MQTT_PUBLISH_RING_SIZE
+#define MQTT_PUBLISH_RING_SIZE CONFIG_MQTT_PUBLISH_RING_SIZE
+#else //CONFIG_MQTT_PUBLISH_RING_SIZE
+#define MQTT_PUBLISH_RING_SIZE 1024
+#endif //CONFIG_MQTT_PUBLISH_RING_SIZE
+
+#ifdef CONFIG_MQTT_PUBLISH_INFLIGHT_WINDOW
+#define MQTT_PUBLISH_INFLIGHT_WINDOW CONFIG_MQTT_PUBLISH_INFLIGHT_WINDOW
+#else //CONFIG_MQTT_PUBLISH_INFLIGHT_WINDOW
+#define MQTT_PUBLISH_INFLIGHT_WINDOW 8
+#endif //CONFIG_MQTT_PUBLISH_INFLIGHT_WINDOW
+
+#define MQTT_PUBLISH_LOCK_TIMEOUT (1000 / portTICK_PERIOD_MS)
+// the client retransmits unacked messages itself with the same msg_id,
+// this only bounds how long a slot waits for the PUBACK
+#define MQTT_PUBLISH_ACK_TIMEOUT (30 * 1000 / portTICK_PERIOD_MS)
+
+/* result passed to publish callbacks */
+#define MQTT_PUBLISH_OK 0
+#define MQTT_PUBLISH_FAILED -1
+#define MQTT_PUBLISH_TIMEOUT -2
+
+typedef void (*mqtt_publish_cb_t)(int msg_id, int result, void *ctx);
+
+#define MQTT_PUBLISH_RECORD_QUEUED 0
+#define MQTT_PUBLISH_RECORD_SENT 1
+#define MQTT_PUBLISH_RECORD_DONE 2
+
+/* topic and data follow the record in the ring, both '\0' terminated */
+struct MqttPublishRecord {
+  unsigned short size;
+  unsigned short topicLen;
+  unsigned short dataLen;
+  unsigned char qos;
+  unsigned char retain;
+  unsigned char state;
+  mqtt_publish_cb_t cb;
+  void *ctx;
+};
+
+/* qos1 message waiting for its PUBACK, record is NULL for a free slot */
+struct MqttInflight {
+  struct MqttPublishRecord *record;
+  int msgId;
+  TickType_t sentAt;
+  bool acked;
+  bool disconnected; // connection lost before the PUBACK
+};
+
+struct MqttPublishStats {
+  unsigned int queued;
+  unsigned int published;
+  unsigned int failed;
+  unsigned int dropped;  // ring was full
+  unsigned int overflow; // message bigger than the ring
+};
+
+extern struct MqttPublishStats mqttPublishStats;
+
+bool mqtt_publish_data_cb(const char * topic,
+                          const char * data, int data_len,
+                          int qos, int retain,
+                          mqtt_publish_cb_t cb, void *ctx);
+bool mqtt_publish_acked(int msg_id);
+
+bool mqtt_publish_ring_push(const char * topic,
+                            const char * data, int data_len,
+                            int qos, int retain,
+                            mqtt_publish_cb_t cb, void *ctx);
+struct MqttPublishRecord * mqtt_publish_ring_peek();
+void mqtt_publish_ring_sent(struct MqttPublishRecord *r);
+void mqtt_publish_ring_done(struct MqttPublishRecord *r);
+void mqtt_publish_ring_reset();
+
+const char * mqtt_publish_record_topic(const struct MqttPublishRecord *r);
+const char * mqtt_publish_record_data(const struct MqttPublishRecord *r);
+
+bool mqtt_publish_inflight_add(struct MqttPublishRecord *r, int msg_id);
+int mqtt_publish_inflight_count();
+void mqtt_publish_inflight_process();
+TickType_t mqtt_publish_inflight_wait();
+void mqtt_publish_inflight_release();
+
+void handle_mqtt_publish_task(void* pvParameters);
+
+#endif /* APP_MQTT_PUBLISHER_H */
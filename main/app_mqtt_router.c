@@ -0,0 +1,142 @@
+#include "esp_system.h"
+#include "esp_log.h"
+
+#include <string.h>
+
+#include "app_mqtt_router.h"
+
+static const char *TAG = "MQTT_ROUTER";
+
+// node 0 is the root, it holds no segment
+struct MqttRouterNode routerNodes[MQTT_ROUTER_MAX_NODES];
+unsigned char routerNodesNb = 0;
+
+const struct MqttRoute *routerRoutes = NULL;
+
+static unsigned char find_child(unsigned char node, const char *segment, int segmentLen)
+{
+  unsigned char child = routerNodes[node].child;
+  while (child != MQTT_ROUTER_NO_NODE) {
+    if (routerNodes[child].segmentLen == segmentLen &&
+        memcmp(routerNodes[child].segment, segment, segmentLen) == 0) {
+      return child;
+    }
+    child = routerNodes[child].sibling;
+  }
+  return MQTT_ROUTER_NO_NODE;
+}
+
+static unsigned char add_child(unsigned char node, const char *segment, int segmentLen)
+{
+  if (routerNodesNb >= MQTT_ROUTER_MAX_NODES) {
+    return MQTT_ROUTER_NO_NODE;
+  }
+  unsigned char child = routerNodesNb++;
+  routerNodes[child].segment = segment;
+  routerNodes[child].segmentLen = segmentLen;
+  routerNodes[child].child = MQTT_ROUTER_NO_NODE;
+  routerNodes[child].route = MQTT_ROUTER_NO_NODE;
+  routerNodes[child].sibling = routerNodes[node].child;
+  routerNodes[node].child = child;
+  return child;
+}
+
+bool mqtt_router_init(const struct MqttRoute *routes, int routesNb)
+{
+  routerRoutes = routes;
+  routerNodesNb = 1;
+  routerNodes[0].segment = NULL;
+  routerNodes[0].segmentLen = 0;
+  routerNodes[0].child = MQTT_ROUTER_NO_NODE;
+  routerNodes[0].sibling = MQTT_ROUTER_NO_NODE;
+  routerNodes[0].route = MQTT_ROUTER_NO_NODE;
+
+  for (int i = 0; i < routesNb && i < MQTT_ROUTER_NO_NODE; i++) {
+    const char *segment = routes[i].topic;
+    unsigned char node = 0;
+    while (node != MQTT_ROUTER_NO_NODE) {
+      const char *end = strchr(segment, '/');
+      int segmentLen = end ? end - segment : strlen(segment);
+      unsigned char child = find_child(node, segment, segmentLen);
+      if (child == MQTT_ROUTER_NO_NODE) {
+        child = add_child(node, segment, segmentLen);
+      }
+      node = child;
+      if (!end) {
+        break;
+      }
+      segment = end + 1;
+    }
+    if (node == MQTT_ROUTER_NO_NODE) {
+      ESP_LOGE(TAG, "no room left for route %s", routes[i].topic);
+      return false;
+    }
+    if (routerNodes[node].route != MQTT_ROUTER_NO_NODE) {
+      ESP_LOGW(TAG, "duplicated route %s", routes[i].topic);
+    }
+    routerNodes[node].route = i;
+  }
+  ESP_LOGI(TAG, "%d routes using %d nodes", routesNb, routerNodesNb);
+  return true;
+}
+
+static bool is_id_node(unsigned char node)
+{
+  return routerNodes[node].segmentLen == 1 && routerNodes[node].segment[0] == MQTT_ROUTER_ID_SEGMENT[0];
+}
+
+const struct MqttRoute * mqtt_router_lookup(const char *topic, int topic_len, int *id)
+{
+  if (topic == NULL || routerRoutes == NULL)
+    return NULL;
+
+  unsigned char node = 0;
+  int routeId = -1;
+  int start = 0;
+  while (node != MQTT_ROUTER_NO_NODE && start <= topic_len) {
+    const char *segment = topic + start;
+    int segmentLen = 0;
+    int value = 0;
+    bool numeric = true;
+    while (start + segmentLen < topic_len && segment[segmentLen] != '/') {
+      char c = segment[segmentLen];
+      if (c < '0' || c > '9' || segmentLen >= 4) {
+        numeric = false;
+      } else {
+        value = value * 10 + (c - '0');
+      }
+      segmentLen++;
+    }
+    numeric = numeric && segmentLen > 0;
+
+    unsigned char next = MQTT_ROUTER_NO_NODE;
+    unsigned char wildcard = MQTT_ROUTER_NO_NODE;
+    unsigned char child = routerNodes[node].child;
+    while (child != MQTT_ROUTER_NO_NODE) {
+      if (routerNodes[child].segmentLen == segmentLen &&
+          memcmp(routerNodes[child].segment, segment, segmentLen) == 0) {
+        next = child;
+        break;
+      }
+      if (numeric && is_id_node(child)) {
+        wildcard = child;
+      }
+      child = routerNodes[child].sibling;
+    }
+    if (next == MQTT_ROUTER_NO_NODE && wildcard != MQTT_ROUTER_NO_NODE) {
+      next = wildcard;
+      routeId = value;
+    }
+    node = next;
+    start += segmentLen + 1;
+  }
+
+  if (node == MQTT_ROUTER_NO_NODE || routerNodes[node].route == MQTT_ROUTER_NO_NODE) {
+    return NULL;
+  }
+  const struct MqttRoute *route = &routerRoutes[routerNodes[node].route];
+  if (id) {
+    *id = (routeId == -1) ? route->id : routeId;
+  }
+  return route;
+}
@@ -0,0 +1,33 @@
+#ifndef APP_MQTT_ROUTER_H
+#define APP_MQTT_ROUTER_H
+
+#include <stdbool.h>
+
+/* max segments stored in the trie for all routes together */
+#define MQTT_ROUTER_MAX_NODES 64
+#define MQTT_ROUTER_NO_NODE 255
+
+/* single level wildcard, in routes it matches a numeric id */
+#define MQTT_ROUTER_ID_SEGMENT "+"
+
+typedef void (*mqtt_route_handler_t)(int id, const char *data, int data_len);
+
+struct MqttRoute {
+  const char *topic;
+  mqtt_route_handler_t handler;
+  int id; // reported when topic has no id segment
+  int idsNb; // ids parsed from topic must be below it, 0 means no check
+};
+
+struct MqttRouterNode {
+  const char *segment;
+  unsigned char segmentLen;
+  unsigned char child;
+  unsigned char sibling;
+  unsigned char route;
+};
+
+bool mqtt_router_init(const struct MqttRoute *routes, int routesNb);
+const struct MqttRoute * mqtt_router_lookup(const char *topic, int topic_len, int *id);
+
+#endif /* APP_MQTT_ROUTER_H */
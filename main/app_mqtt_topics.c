@@ -0,0 +1,65 @@
+#include "esp_system.h"
+#include "esp_log.h"
+
+#include <string.h>
+
+#include "app_mqtt_topics.h"
+
+static const char *TAG = "MQTT_TOPICS";
+
+#if CONFIG_MQTT_RELAYS_NB > MQTT_TOPIC_IDS_NB
+#error "relay topics table too small"
+#endif //CONFIG_MQTT_RELAYS_NB > MQTT_TOPIC_IDS_NB
+
+#if CONFIG_MQTT_THERMOSTATS_NB > MQTT_TOPIC_IDS_NB
+#error "thermostat topics table too small"
+#endif //CONFIG_MQTT_THERMOSTATS_NB > MQTT_TOPIC_IDS_NB
+
+#if MQTT_TOPIC_IDS_NB > 4
+#define ID_TOPICS_HIGH(path)                    \
+    MQTT_EVT_TOPIC(path "/4"),                  \
+    MQTT_EVT_TOPIC(path "/5"),                  \
+    MQTT_EVT_TOPIC(path "/6"),                  \
+    MQTT_EVT_TOPIC(path "/7"),                  \
+    MQTT_EVT_TOPIC(path "/8"),                  \
+    MQTT_EVT_TOPIC(path "/9"),                  \
+    MQTT_EVT_TOPIC(path "/10"),                 \
+    MQTT_EVT_TOPIC(path "/11"),                 \
+    MQTT_EVT_TOPIC(path "/12"),                 \
+    MQTT_EVT_TOPIC(path "/13"),                 \
+    MQTT_EVT_TOPIC(path "/14"),                 \
+    MQTT_EVT_TOPIC(path "/15"),
+#else //MQTT_TOPIC_IDS_NB > 4
+#define ID_TOPICS_HIGH(path)
+#endif //MQTT_TOPIC_IDS_NB > 4
+
+#define ID_TOPICS(path) {                       \
+    MQTT_EVT_TOPIC(path "/0"),                  \
+    MQTT_EVT_TOPIC(path "/1"),                  \
+    MQTT_EVT_TOPIC(path "/2"),                  \
+    MQTT_EVT_TOPIC(path "/3"),                  \
+    ID_TOPICS_HIGH(path)                        \
+  }
+
+const char * const mqttIdTopics[MQTT_ID_TOPICS_NB][MQTT_TOPIC_IDS_NB] = {
+  [MQTT_TOPIC_RELAY_STATUS] = ID_TOPICS("status/relay"),
+  [MQTT_TOPIC_RELAY_SLEEP] = ID_TOPICS("sleep/relay"),
+  [MQTT_TOPIC_THERMOSTAT_CTEMP] = ID_TOPICS("ctemp/thermostat"),
+  [MQTT_TOPIC_THERMOSTAT_TEMP] = ID_TOPICS("temp/thermostat"),
+  [MQTT_TOPIC_THERMOSTAT_TOLERANCE] = ID_TOPICS("tolerance/thermostat"),
+  [MQTT_TOPIC_THERMOSTAT_MODE] = ID_TOPICS("mode/thermostat"),
+  [MQTT_TOPIC_THERMOSTAT_ACTION] = ID_TOPICS("action/thermostat"),
+};
+
+// bytes used by the table, strings included
+int mqtt_topics_size()
+{
+  int size = sizeof(mqttIdTopics);
+  for (int t = 0; t < MQTT_ID_TOPICS_NB; t++) {
+    for (int id = 0; id < MQTT_TOPIC_IDS_NB; id++) {
+      size += strlen(mqttIdTopics[t][id]) + 1;
+    }
+  }
+  ESP_LOGI(TAG, "outbound topics use %d bytes", size);
+  return size;
+}
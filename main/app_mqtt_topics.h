@@ -0,0 +1,31 @@
+#ifndef APP_MQTT_TOPICS_H
+#define APP_MQTT_TOPICS_H
+
+#define MQTT_EVT_TOPIC(path) CONFIG_MQTT_DEVICE_TYPE "/" CONFIG_MQTT_CLIENT_ID "/evt/" path
+
+/* relays are limited to 4 in Kconfig, thermostats to 16 */
+#if CONFIG_MQTT_THERMOSTATS_NB > 4
+#define MQTT_TOPIC_IDS_NB 16
+#else //CONFIG_MQTT_THERMOSTATS_NB > 4
+#define MQTT_TOPIC_IDS_NB 4
+#endif //CONFIG_MQTT_THERMOSTATS_NB > 4
+
+enum MqttIdTopic {
+  MQTT_TOPIC_RELAY_STATUS = 0,
+  MQTT_TOPIC_RELAY_SLEEP,
+  MQTT_TOPIC_THERMOSTAT_CTEMP,
+  MQTT_TOPIC_THERMOSTAT_TEMP,
+  MQTT_TOPIC_THERMOSTAT_TOLERANCE,
+  MQTT_TOPIC_THERMOSTAT_MODE,
+  MQTT_TOPIC_THERMOSTAT_ACTION,
+  MQTT_ID_TOPICS_NB
+};
+
+/* outbound topics ending with a relay or thermostat id, built at compile time */
+extern const char * const mqttIdTopics[MQTT_ID_TOPICS_NB][MQTT_TOPIC_IDS_NB];
+
+#define MQTT_ID_TOPIC(topic, id) (mqttIdTopics[topic][id])
+
+int mqtt_topics_size();
+
+#endif /* APP_MQTT_TOPICS_H */
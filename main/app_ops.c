@@ -11,22 +11,105 @@
 #include "app_ops.h"
 
 #include "app_mqtt.h"
+#include "app_mqtt_publisher.h"
+#include "app_latency.h"
+#ifdef CONFIG_MQTT_BINARY_PAYLOAD
+#include "app_binary.h"
+#endif //CONFIG_MQTT_BINARY_PAYLOAD
+#ifdef CONFIG_MQTT_OUTBOX
+#include "app_mqtt_outbox.h"
+#endif //CONFIG_MQTT_OUTBOX
+#ifdef CONFIG_MQTT_SENSOR_DEADBAND
+#include "app_sensors_deadband.h"
+#endif //CONFIG_MQTT_SENSOR_DEADBAND
 
 static const char *TAG = "MQTTS_OPS";
 
+#ifdef CONFIG_MQTT_OPS_LATENCY
+// histograms cover the time since the previous report, each stage is
+// reported as [max, <100us, <1ms, <10ms, <100ms, <1s, >=1s], always as
+// json so on its own topic, evt/ops may carry binary payloads
+void publish_ops_latency()
+{
+  const char * topic = CONFIG_MQTT_DEVICE_TYPE "/" CONFIG_MQTT_CLIENT_ID "/evt/ops/latency";
+  static struct LatencyHistogram histograms[LATENCY_STAGES_NB];
+  static char data[MAX_MQTT_DATA_LATENCY];
+  int len = 0;
+
+  latency_snapshot(histograms);
+  len += sprintf(data + len, "{\"latency_us\":{");
+  for (int s = 0; s < LATENCY_STAGES_NB; s++) {
+    struct LatencyHistogram *h = &histograms[s];
+    len += sprintf(data + len, "%s\"%s\":[%u,%u,%u,%u,%u,%u,%u]",
+                   s ? "," : "", latencyStageNames[s], h->max,
+                   h->buckets[0], h->buckets[1], h->buckets[2],
+                   h->buckets[3], h->buckets[4], h->buckets[5]);
+  }
+  sprintf(data + len, "}}");
+
+  mqtt_publish_data(topic, data, QOS_0, NO_RETAIN);
+}
+#endif //CONFIG_MQTT_OPS_LATENCY
+
+#ifdef CONFIG_MQTT_BINARY_PAYLOAD
+void publish_ops_data()
+{
+  const char * topic = CONFIG_MQTT_DEVICE_TYPE "/" CONFIG_MQTT_CLIENT_ID "/evt/ops";
+  unsigned int fields[BINARY_OPS_FIELDS_NB];
+  unsigned char data[BINARY_OPS_LEN];
+  memset(fields,0,sizeof(fields));
+
+  fields[BINARY_OPS_FREE_HEAP] = esp_get_free_heap_size();
+  fields[BINARY_OPS_MIN_FREE_HEAP] = esp_get_minimum_free_heap_size();
+  fields[BINARY_OPS_PUB_FAILED] = mqttPublishStats.failed;
+  fields[BINARY_OPS_PUB_DROPPED] = mqttPublishStats.dropped;
+  fields[BINARY_OPS_PUB_OVERFLOW] = mqttPublishStats.overflow;
+#ifdef CONFIG_MQTT_OUTBOX
+  fields[BINARY_OPS_OUTBOX_EVICTED] = mqttOutboxStats.evicted;
+  fields[BINARY_OPS_OUTBOX_REJECTED] = mqttOutboxStats.rejected;
+#endif //CONFIG_MQTT_OUTBOX
+#ifdef CONFIG_MQTT_SENSOR_DEADBAND
+  fields[BINARY_OPS_SENSOR_FILTERED] = sensorSamplesFiltered;
+#endif //CONFIG_MQTT_SENSOR_DEADBAND
+  int len = binary_encode_ops(data, fields);
+
+  mqtt_publish_data_cb(topic, (const char *)data, len, QOS_0, NO_RETAIN, NULL, NULL);
+#ifdef CONFIG_MQTT_OPS_LATENCY
+  publish_ops_latency();
+#endif //CONFIG_MQTT_OPS_LATENCY
+}
+#else //CONFIG_MQTT_BINARY_PAYLOAD
 void publish_ops_data()
 {
   const char * topic = CONFIG_MQTT_DEVICE_TYPE "/" CONFIG_MQTT_CLIENT_ID "/evt/ops";
-  char data[64];
-  memset(data,0,64);
+  char data[224];
+  memset(data,0,224);
+  int len = 0;
 
-  sprintf(data, "{\"free_heap\":%d, \"min_free_heap\":%d}",
-          esp_get_free_heap_size(),
-          esp_get_minimum_free_heap_size()
-          );
+  len += sprintf(data, "{\"free_heap\":%d, \"min_free_heap\":%d, \"pub_failed\":%u, \"pub_dropped\":%u, \"pub_overflow\":%u",
+                 esp_get_free_heap_size(),
+                 esp_get_minimum_free_heap_size(),
+                 mqttPublishStats.failed,
+                 mqttPublishStats.dropped,
+                 mqttPublishStats.overflow
+                 );
+#ifdef CONFIG_MQTT_OUTBOX
+  len += sprintf(data + len, ", \"outbox_evicted\":%u, \"outbox_rejected\":%u",
+                 mqttOutboxStats.evicted,
+                 mqttOutboxStats.rejected
+                 );
+#endif //CONFIG_MQTT_OUTBOX
+#ifdef CONFIG_MQTT_SENSOR_DEADBAND
+  len += sprintf(data + len, ", \"sensor_filtered\":%u", sensorSamplesFiltered);
+#endif //CONFIG_MQTT_SENSOR_DEADBAND
+  sprintf(data + len, "}");
 
   mqtt_publish_data(topic, data, QOS_0, NO_RETAIN);
+#ifdef CONFIG_MQTT_OPS_LATENCY
+  publish_ops_latency();
+#endif //CONFIG_MQTT_OPS_LATENCY
 }
+#endif //CONFIG_MQTT_BINARY_PAYLOAD
 
 
 void ops_pub_task(void* pvParameters)
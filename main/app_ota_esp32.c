@@ -22,7 +22,7 @@
 
 static const char *TAG = "MQTTS_OTA";
 
-extern QueueHandle_t otaQueue;
+#include "app_event_bus.h"
 
 extern const uint8_t server_cert_pem_start[] asm("_binary_sw_iot_cipex_ro_pem_start");
 
@@ -68,12 +68,15 @@ void handle_ota_update_task(void* pvParameters)
   }
   ESP_LOGI(TAG, "Running partition type %d subtype %d (offset 0x%08x)",
            running->type, running->subtype, running->address);
-  struct OtaMessage o;
+  QueueHandle_t inbox = (QueueHandle_t)pvParameters;
+  struct AppEvent *e;
   char * url = "https://sw.iot.cipex.ro:8911/" CONFIG_MQTT_CLIENT_ID ".bin";
 
   while(1) {
-    if( xQueueReceive( otaQueue, &o , portMAX_DELAY) )
+    if( xQueueReceive( inbox, &e , portMAX_DELAY) )
       {
+        // the command carries nothing used here
+        event_bus_release(e);
 
         /* esp_wifi_stop(); */
         /* vTaskDelay(60000 / portTICK_PERIOD_MS); */
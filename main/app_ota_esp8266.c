@@ -20,7 +20,7 @@
 #include "freertos/event_groups.h"
 #include "freertos/queue.h"
 
-extern QueueHandle_t otaQueue;
+#include "app_event_bus.h"
 
 #include "esp_wifi.h"
 #include "esp_event_loop.h"
@@ -325,11 +325,14 @@ void handle_ota_update_task(void *pvParameters)
   }
   ESP_LOGI(TAG, "Running partition type %d subtype %d (offset 0x%08x)",
            running->type, running->subtype, running->address);
-  struct OtaMessage o;
+  QueueHandle_t inbox = (QueueHandle_t)pvParameters;
+  struct AppEvent *e;
   while(1) {
 
-    if( xQueueReceive( otaQueue, &o , portMAX_DELAY) )
+    if( xQueueReceive( inbox, &e , portMAX_DELAY) )
       {
+        // the command carries nothing used here
+        event_bus_release(e);
         ESP_LOGI(TAG, "OTA cmd received....");
         publish_ota_data(OTA_ONGOING);
 
@@ -1,3 +1,4 @@
+#include "esp_system.h"
 #include "esp_log.h"
 
 #include "driver/gpio.h"
@@ -12,14 +13,17 @@
 #include "app_main.h"
 #include "app_relay.h"
 #include "app_nvs.h"
+#include "app_event_bus.h"
+#include "app_timer_wheel.h"
 
 #include "app_mqtt.h"
+#include "app_mqtt_topics.h"
 
 #if CONFIG_MQTT_RELAYS_NB
 
 int relayStatus[CONFIG_MQTT_RELAYS_NB];
 int relaySleepTimeout[CONFIG_MQTT_RELAYS_NB];
-TimerHandle_t relaySleepTimer[CONFIG_MQTT_RELAYS_NB];
+struct TimerWheelEntry relaySleepTimer[CONFIG_MQTT_RELAYS_NB];
 
 const int relayToGpioMap[CONFIG_MQTT_RELAYS_NB] = {
   CONFIG_MQTT_RELAYS_NB0_GPIO,
@@ -34,6 +38,25 @@ const int relayToGpioMap[CONFIG_MQTT_RELAYS_NB] = {
 #endif //CONFIG_MQTT_RELAYS_NB > 1
 };
 
+// relays are switched through the set/clear registers, they cover
+// GPIOs 0 to 15 on the esp8266 (GPIO16 is an RTC pad) and 0 to 31 on the esp32
+#ifdef CONFIG_TARGET_DEVICE_ESP8266
+#define RELAY_OUTPUT_GPIO_NB 16
+#else //CONFIG_TARGET_DEVICE_ESP8266
+#define RELAY_OUTPUT_GPIO_NB 32
+#endif //CONFIG_TARGET_DEVICE_ESP8266
+
+#if CONFIG_MQTT_RELAYS_NB0_GPIO >= RELAY_OUTPUT_GPIO_NB || \
+  CONFIG_MQTT_RELAYS_NB1_GPIO >= RELAY_OUTPUT_GPIO_NB || \
+  CONFIG_MQTT_RELAYS_NB2_GPIO >= RELAY_OUTPUT_GPIO_NB || \
+  CONFIG_MQTT_RELAYS_NB3_GPIO >= RELAY_OUTPUT_GPIO_NB
+#error "relay GPIOs must be reachable through the output set/clear registers"
+#endif //CONFIG_MQTT_RELAYS_NBx_GPIO >= RELAY_OUTPUT_GPIO_NB
+
+// shadow of the relay output levels, bit n is the level of GPIO n, the
+// hardware is written but never read back
+static unsigned int relayOutputLevels;
+
 const char * relaySleepTag[CONFIG_MQTT_RELAYS_NB] = {
   "relaySleep0",
 #if CONFIG_MQTT_RELAYS_NB > 1
@@ -48,78 +71,75 @@ const char * relaySleepTag[CONFIG_MQTT_RELAYS_NB] = {
 };
 
 
-const char * relayTimerName[CONFIG_MQTT_RELAYS_NB] = {
-  "relayTimer0",
-#if CONFIG_MQTT_RELAYS_NB > 1
-  "relayTimer1",
-#if CONFIG_MQTT_RELAYS_NB > 2
-  "relayTimer2",
-#if CONFIG_MQTT_RELAYS_NB > 3
-  "relayTimer3",
-#endif //CONFIG_MQTT_RELAYS_NB > 3
-#endif //CONFIG_MQTT_RELAYS_NB > 2
-#endif //CONFIG_MQTT_RELAYS_NB > 1
-};
+static const char *TAG = "MQTTS_RELAY";
 
+static void relay_output_mask(int id, unsigned int *setMask, unsigned int *clearMask)
+{
+  if (relayStatus[id]) {
+    *setMask |= 1 << relayToGpioMap[id];
+  } else {
+    *clearMask |= 1 << relayToGpioMap[id];
+  }
+}
 
-static const char *TAG = "MQTTS_RELAY";
+// every relay in the masks switches in the same register write
+static void relay_output_commit(unsigned int setMask, unsigned int clearMask)
+{
+  if (setMask || clearMask) {
+    gpio_output_set(setMask, clearMask, 0, 0);
+    relayOutputLevels = (relayOutputLevels | setMask) & ~clearMask;
+  }
+}
 
-extern QueueHandle_t relayQueue;
+unsigned int relay_output_levels()
+{
+  return relayOutputLevels;
+}
 
-void vTimerCallback( TimerHandle_t xTimer )
+static void relay_sleep_expired(struct TimerWheelEntry *entry)
 {
-  int id = (int)pvTimerGetTimerID( xTimer );
+  int id = entry->id;
   ESP_LOGI(TAG, "timer %d expired, sending stop msg", id);
   struct RelayMessage r = {RELAY_CMD_STATUS, id, RELAY_STATUS_OFF};
-  if (xQueueSend( relayQueue
-                  ,( void * )&r
-                  ,MQTT_QUEUE_TIMEOUT) != pdPASS) {
-    ESP_LOGE(TAG, "Cannot send to relayQueue");
+  if (!event_bus_publish(EVENT_RELAY_CMD, &r, sizeof(r), 0)) {
+    // the relay must not stay on, try again next wheel tick
+    ESP_LOGE(TAG, "Cannot publish relay command, retrying");
+    timer_wheel_start(entry, TIMER_WHEEL_TICK_MS, 0);
   }
 }
 
 void relays_init()
 {
   esp_err_t err;
+  unsigned int setMask = 0;
+  unsigned int clearMask = 0;
   for(int i = 0; i < CONFIG_MQTT_RELAYS_NB; i++) {
     relayStatus[i] = RELAY_OFF;
     gpio_pad_select_gpio(relayToGpioMap[i]);
     gpio_set_direction(relayToGpioMap[i], GPIO_MODE_OUTPUT);
-    gpio_set_level(relayToGpioMap[i], relayStatus[i]);
+    relay_output_mask(i, &setMask, &clearMask);
     
     err=read_nvs_integer(relaySleepTag[i], &relaySleepTimeout[i]);
     ESP_ERROR_CHECK( err );
 
-    relaySleepTimer[i] = NULL;
+    timer_wheel_entry_init(&relaySleepTimer[i], relay_sleep_expired, i);
   }
+  relay_output_commit(setMask, clearMask);
 }
 
 void publish_relay_status(int id)
 {
-  const char * relays_topic = CONFIG_MQTT_DEVICE_TYPE"/"CONFIG_MQTT_CLIENT_ID"/evt/status/relay";
-  char data[16];
-  memset(data,0,16);
-  sprintf(data, "%s", relayStatus[id] == RELAY_ON ? "ON" : "OFF");
-
-  char topic[MQTT_MAX_TOPIC_LEN];
-  memset(topic,0,MQTT_MAX_TOPIC_LEN);
-  sprintf(topic, "%s/%d", relays_topic, id);
-
-  mqtt_publish_data(topic, data, QOS_1, RETAIN);
+  const char * data = relayStatus[id] == RELAY_ON ? "ON" : "OFF";
+  mqtt_publish_data(MQTT_ID_TOPIC(MQTT_TOPIC_RELAY_STATUS, id), data, QOS_1, RETAIN);
 }
 
 void publish_relay_timeout(int id)
 {
-  const char * relays_topic = CONFIG_MQTT_DEVICE_TYPE"/"CONFIG_MQTT_CLIENT_ID"/evt/sleep/relay";
   char data[16];
   memset(data,0,16);
   sprintf(data, "%d", relaySleepTimeout[id]);
 
-  char topic[MQTT_MAX_TOPIC_LEN];
-  memset(topic,0,MQTT_MAX_TOPIC_LEN);
-  sprintf(topic, "%s/%d", relays_topic, id);
-
-  mqtt_publish_data(topic, data, QOS_1, RETAIN);
+  mqtt_publish_data(MQTT_ID_TOPIC(MQTT_TOPIC_RELAY_SLEEP, id), data, QOS_1, RETAIN);
 }
 
 
@@ -139,51 +159,88 @@ void publish_all_relays_timeout()
   }
 }
 
+#ifdef CONFIG_MQTT_STATE_SNAPSHOT
+void publish_relays_snapshot()
+{
+  const char * topic = CONFIG_MQTT_DEVICE_TYPE"/"CONFIG_MQTT_CLIENT_ID"/evt/state/relays";
+  char data[MAX_MQTT_DATA_RELAY_STATE * CONFIG_MQTT_RELAYS_NB + 4];
+  int len = 0;
+
+  len += sprintf(data + len, "[");
+  for(int id = 0; id < CONFIG_MQTT_RELAYS_NB; id++) {
+    len += sprintf(data + len, "%s{\"status\":\"%s\",\"sleep\":%d}",
+                   id ? "," : "",
+                   relayStatus[id] == RELAY_ON ? "ON" : "OFF",
+                   relaySleepTimeout[id]);
+  }
+  sprintf(data + len, "]");
+
+  mqtt_publish_data(topic, data, QOS_1, RETAIN);
+}
+#endif //CONFIG_MQTT_STATE_SNAPSHOT
+
+// reply to cmd/status/relays, status of every relay in one message
+void publish_relays_status()
+{
+  // ,"N":"OFF" per relay, braces and nul
+  char data[10 * CONFIG_MQTT_RELAYS_NB + 3];
+  int len = 0;
+
+  len += snprintf(data + len, sizeof(data) - len, "{");
+  for(int id = 0; id < CONFIG_MQTT_RELAYS_NB; id++) {
+    len += snprintf(data + len, sizeof(data) - len, "%s\"%d\":\"%s\"", id ? "," : "", id,
+                    relayStatus[id] == RELAY_ON ? "ON" : "OFF");
+  }
+  snprintf(data + len, sizeof(data) - len, "}");
+
+  mqtt_publish_data(MQTT_EVT_TOPIC("status/relays"), data, QOS_1, RETAIN);
+}
+
 void update_timer(int id)
 {
   ESP_LOGI(TAG, "update_timer for %d, timeout: %d", id, relaySleepTimeout[id]);
-  if (relaySleepTimer[id] != NULL) {
-    if (xTimerIsTimerActive(relaySleepTimer[id]) != pdFALSE){
-      ESP_LOGI(TAG, "Found started timer, stopping");
-      xTimerStop( relaySleepTimer[id], portMAX_DELAY );
-    }
+  if (timer_wheel_active(&relaySleepTimer[id])) {
+    ESP_LOGI(TAG, "Found started timer, stopping");
+    timer_wheel_cancel(&relaySleepTimer[id]);
   }
   if ((relayStatus[id] == RELAY_ON) && relaySleepTimeout[id] != 0) {
-    if (relaySleepTimer[id] == NULL) {
-      ESP_LOGI(TAG, "No Timer found for %d, creating one", id);
-      relaySleepTimer[id] =
-        xTimerCreate( relayTimerName[id],           /* Text name. */
-                      pdMS_TO_TICKS(relaySleepTimeout[id]*1000),  /* Period. */
-                      pdFALSE,                /* Autoreload. */
-                      (void *)id,                  /* ID. */
-                      vTimerCallback );  /* Callback function. */
-    }
-    if (relaySleepTimer[id] == NULL) {
-      ESP_LOGE(TAG, "No Timer found for %d, cannot handle timeout", id);
-      return;
-    }
-    if (xTimerChangePeriod(relaySleepTimer[id], pdMS_TO_TICKS(relaySleepTimeout[id]*1000), portMAX_DELAY) != pdPASS) {
-      ESP_LOGE(TAG, "Cannot change period for relay %d timer", id);
-    }
+    timer_wheel_start(&relaySleepTimer[id], relaySleepTimeout[id]*1000, 0);
   }
 }
 
-void update_relay_status(int id, char value)
+// only updates relayStatus, the caller writes the gpio and updates the timer
+static bool change_relay_status(int id, char value)
 {
   ESP_LOGI(TAG, "update_relay_status: id: %d, value: %d", id, value);
   ESP_LOGI(TAG, "relayStatus[%d] = %d", id, relayStatus[id] == RELAY_ON);
-  if (value != (relayStatus[id] == RELAY_ON)) {
-    if (value == RELAY_STATUS_ON) {
-      relayStatus[id] = RELAY_ON;
-      ESP_LOGI(TAG, "enabling GPIO %d", relayToGpioMap[id]);
-    }
-    if (value == RELAY_STATUS_OFF) {
-      relayStatus[id] = RELAY_OFF;
-      ESP_LOGI(TAG, "disabling GPIO %d", relayToGpioMap[id]);
-    }
-    gpio_set_level(relayToGpioMap[id], relayStatus[id]);
+  if (value == (relayStatus[id] == RELAY_ON)) {
+    return false;
+  }
+  if (value == RELAY_STATUS_ON) {
+    relayStatus[id] = RELAY_ON;
+    ESP_LOGI(TAG, "enabling GPIO %d", relayToGpioMap[id]);
+  }
+  if (value == RELAY_STATUS_OFF) {
+    relayStatus[id] = RELAY_OFF;
+    ESP_LOGI(TAG, "disabling GPIO %d", relayToGpioMap[id]);
+  }
+  return true;
+}
+
+static void set_relay_status(int id, char value)
+{
+  if (change_relay_status(id, value)) {
+    unsigned int setMask = 0;
+    unsigned int clearMask = 0;
+    relay_output_mask(id, &setMask, &clearMask);
+    relay_output_commit(setMask, clearMask);
     update_timer(id);
   }
+}
+
+void update_relay_status(int id, char value)
+{
+  set_relay_status(id, value);
   publish_relay_status(id);
 }
 
@@ -202,22 +259,130 @@ void update_relay_sleep(int id, int onTimeout)
   publish_relay_timeout(id);
 }
 
+void relay_batch_reset(struct RelayBatch *b)
+{
+  for(int id = 0; id < CONFIG_MQTT_RELAYS_NB; id++) {
+    b->status[id] = RELAY_BATCH_UNSET;
+    b->sleep[id] = RELAY_BATCH_UNSET;
+  }
+  b->allMask = 0;
+  b->all = false;
+  b->dequeued = latency_now();
+}
+
+// last writer wins, older commands for the same relay are dropped
+void relay_batch_add(struct RelayBatch *b, const struct RelayMessage *r)
+{
+  if (r->msgType == RELAY_CMD_STATUS_ALL) {
+    unsigned int mask = RELAY_STATUS_ALL_MASK(r->data);
+    unsigned int value = RELAY_STATUS_ALL_VALUE(r->data);
+    for(int id = 0; id < CONFIG_MQTT_RELAYS_NB; id++) {
+      if (mask & (1 << id)) {
+        b->status[id] = (value & (1 << id)) ? RELAY_STATUS_ON : RELAY_STATUS_OFF;
+        b->allMask |= 1 << id;
+      }
+    }
+    b->all = true;
+    b->allTrace = r->trace;
+    return;
+  }
+  if (r->relayId >= CONFIG_MQTT_RELAYS_NB) {
+    ESP_LOGE(TAG, "bad relay id: %d", r->relayId);
+    return;
+  }
+  if (r->msgType == RELAY_CMD_STATUS) {
+    b->status[r->relayId] = r->data;
+    b->trace[r->relayId] = r->trace;
+    b->allMask &= ~(1 << r->relayId);
+  }
+  if (r->msgType == RELAY_CMD_SLEEP) {
+    b->sleep[r->relayId] = r->data;
+  }
+}
+
+static void record_relay_latency(const struct LatencyTrace *t, unsigned int dequeued,
+                                 unsigned int gpio, unsigned int published)
+{
+  if (t->received) {
+    latency_record(LATENCY_RELAY_DISPATCH, t->received, t->queued);
+    latency_record(LATENCY_RELAY_QUEUE, t->queued, dequeued);
+    latency_record(LATENCY_RELAY_GPIO, dequeued, gpio);
+    latency_record(LATENCY_RELAY_PUBLISH, gpio, published);
+    latency_record(LATENCY_RELAY_TOTAL, t->received, published);
+  }
+}
+
+// sleep timeouts go first so a relay switched on in the same batch
+// starts its timer with the new timeout, then all changed relays are
+// switched in a single gpio write before any timer or status is touched
+void relay_batch_apply(struct RelayBatch *b)
+{
+  bool changed[CONFIG_MQTT_RELAYS_NB];
+  unsigned int setMask = 0;
+  unsigned int clearMask = 0;
+
+  for(int id = 0; id < CONFIG_MQTT_RELAYS_NB; id++) {
+    if (b->sleep[id] != RELAY_BATCH_UNSET) {
+      update_relay_sleep(id, b->sleep[id]);
+    }
+  }
+
+  for(int id = 0; id < CONFIG_MQTT_RELAYS_NB; id++) {
+    changed[id] = b->status[id] != RELAY_BATCH_UNSET &&
+      change_relay_status(id, b->status[id]);
+    if (changed[id]) {
+      relay_output_mask(id, &setMask, &clearMask);
+    }
+  }
+  relay_output_commit(setMask, clearMask);
+  unsigned int gpio = latency_now();
+  for(int id = 0; id < CONFIG_MQTT_RELAYS_NB; id++) {
+    if (changed[id]) {
+      update_timer(id);
+    }
+  }
+
+  // relays switched by cmd/status/relays get the combined reply only
+  for(int id = 0; id < CONFIG_MQTT_RELAYS_NB; id++) {
+    if (b->status[id] != RELAY_BATCH_UNSET && !(b->allMask & (1 << id))) {
+      publish_relay_status(id);
+    }
+  }
+  if (b->all) {
+    publish_relays_status();
+  }
+  unsigned int published = latency_now();
+
+  for(int id = 0; id < CONFIG_MQTT_RELAYS_NB; id++) {
+    if (b->status[id] != RELAY_BATCH_UNSET && !(b->allMask & (1 << id))) {
+      record_relay_latency(&b->trace[id], b->dequeued, gpio, published);
+    }
+  }
+  if (b->all) {
+    record_relay_latency(&b->allTrace, b->dequeued, gpio, published);
+  }
+}
+
+// pvParameters is the inbox subscribed to EVENT_RELAY_CMD
 void handle_relay_task(void* pvParameters)
 {
   ESP_LOGI(TAG, "handle_relay_cmd_task started");
 
-  struct RelayMessage r;
+  QueueHandle_t inbox = (QueueHandle_t)pvParameters;
+  struct RelayBatch batch;
+  struct AppEvent *e;
   while(1) {
-    if( xQueueReceive( relayQueue, &r , portMAX_DELAY) )
+    if( xQueueReceive( inbox, &e , portMAX_DELAY) )
       {
-        if (r.msgType == RELAY_CMD_STATUS) {
-          update_relay_status(r.relayId, r.data);
-          continue;
-        }
-        if (r.msgType == RELAY_CMD_SLEEP) {
-          update_relay_sleep(r.relayId, r.data);
-          continue;
-        }
+        // drain what is already queued, a burst is applied as one batch
+        int nb = 0;
+        relay_batch_reset(&batch);
+        do {
+          relay_batch_add(&batch, EVENT_DATA(e));
+          event_bus_release(e);
+        } while (++nb < RELAY_BATCH_MAX && xQueueReceive( inbox, &e, 0));
+        ESP_LOGI(TAG, "applying %d relay commands", nb);
+        relay_batch_apply(&batch);
       }
   }
 }
@@ -1,9 +1,20 @@
 #ifndef APP_RELAY_H
 #define APP_RELAY_H
 
+#include <stdbool.h>
+
+#include "app_latency.h"
+
 
 #define RELAY_CMD_STATUS 1
 #define RELAY_CMD_SLEEP  2
+#define RELAY_CMD_STATUS_ALL 3
+
+/* data of RELAY_CMD_STATUS_ALL, bit n of mask selects relay n and
+   bit n of value is its new status */
+#define RELAY_STATUS_ALL(mask, value) (((mask) << 8) | (value))
+#define RELAY_STATUS_ALL_MASK(data) (((data) >> 8) & 0xff)
+#define RELAY_STATUS_ALL_VALUE(data) ((data) & 0xff)
 
 #define RELAY_STATUS_OFF   0
 #define RELAY_STATUS_ON    1
@@ -12,12 +23,41 @@ struct RelayMessage {
   unsigned char msgType;
   unsigned char relayId;
   int data;
+  struct LatencyTrace trace;
+};
+
+/* relay commands drained from the relay inbox in one go, the latest status
+   and sleep timeout of each relay, RELAY_BATCH_UNSET when none */
+#define RELAY_BATCH_MAX 32
+#define RELAY_BATCH_UNSET -1
+
+#if CONFIG_MQTT_RELAYS_NB
+struct RelayBatch {
+  int status[CONFIG_MQTT_RELAYS_NB];
+  int sleep[CONFIG_MQTT_RELAYS_NB];
+  struct LatencyTrace trace[CONFIG_MQTT_RELAYS_NB];
+  unsigned int allMask; // relays whose latest status came from RELAY_CMD_STATUS_ALL
+  bool all;
+  struct LatencyTrace allTrace;
+  unsigned int dequeued;
 };
 
+void relay_batch_reset(struct RelayBatch *b);
+void relay_batch_add(struct RelayBatch *b, const struct RelayMessage *r);
+void relay_batch_apply(struct RelayBatch *b);
+
+/* shadow of the relay outputs, bit n is the level last written to GPIO n */
+unsigned int relay_output_levels(void);
+#endif //CONFIG_MQTT_RELAYS_NB
+
 void publish_all_relays_status();
 
+void publish_relays_status();
+
 void publish_all_relays_timeout();
 
+void publish_relays_snapshot();
+
 
 void relays_init(void);
 
@@ -7,17 +7,16 @@
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/queue.h"
-#include "freertos/timers.h"
 #include "lwip/apps/sntp.h"
 
 #include "string.h"
 
 #include "app_main.h"
 #include "app_scheduler.h"
+#include "app_event_bus.h"
+#include "app_timer_wheel.h"
 
 static const char *TAG = "SCHEDULER";
-extern QueueHandle_t schedulerCfgQueue;
-extern QueueHandle_t relayQueue;
 
 void update_time_from_ntp()
 {
@@ -39,7 +38,9 @@ void update_time_from_ntp()
     ESP_LOGI(TAG, "Current time after ntp update: %s", strftime_buf);
 }
 
-void vSchedulerCallback( TimerHandle_t xTimer )
+static struct TimerWheelEntry schedulerTick;
+
+static void scheduler_tick_expired(struct TimerWheelEntry *entry)
 {
 
   ESP_LOGI(TAG, "timer scheduler expired, checking scheduled actions");
@@ -47,12 +48,12 @@ void vSchedulerCallback( TimerHandle_t xTimer )
 
   //trigerring
   struct SchedulerCfgMessage s;
+  memset(&s, 0, sizeof(struct SchedulerCfgMessage));
   s.actionId = TRIGGER_ACTION;
   time(&s.data.triggerActionData.now);
-  if (xQueueSend(schedulerCfgQueue
-                 ,( void * )&s
-                 ,SCHEDULE_QUEUE_TIMEOUT) != pdPASS) {
-    ESP_LOGE(TAG, "Cannot send to scheduleCfgQueue");
+  // schedules due in the missed minute still fire on the next one
+  if (!event_bus_publish(EVENT_SCHEDULER_CFG, &s, sizeof(s), 0)) {
+    ESP_LOGE(TAG, "Cannot publish scheduler cfg");
   }
 
 }
@@ -67,18 +68,8 @@ void start_scheduler_timer()
 
   update_time_from_ntp();
 
-  TimerHandle_t th =
-    xTimerCreate( "schedulerTimer",           /* Text name. */
-                  pdMS_TO_TICKS(60000),  /* Period. */
-                  pdTRUE,                /* Autoreload. */
-                  (void *)0,                  /* No ID. */
-                  vSchedulerCallback );  /* Callback function. */
-  if( th != NULL ) {
-    ESP_LOGI(TAG, "timer is created");
-    if (xTimerStart(th, portMAX_DELAY) != pdFALSE){
-      ESP_LOGI(TAG, "timer is active");
-    }
-  }
+  timer_wheel_entry_init(&schedulerTick, scheduler_tick_expired, 0);
+  timer_wheel_start(&schedulerTick, 60000, 60000);
 }
 
 void log_scheduler(const struct SchedulerCfgMessage *msg)
@@ -104,10 +95,8 @@ void handle_relay_action_trigger(struct SchedulerCfgMessage *msg, int nowMinutes
     ESP_LOGI(TAG, "Executing scheduleId: %d",
              msg->schedulerId);
     struct RelayMessage r=msg->data.relayActionData;
-    if (xQueueSend( relayQueue,
-                    ( void * )&r,
-                    RELAY_QUEUE_TIMEOUT) != pdPASS) {
-      ESP_LOGE(TAG, "Cannot send to relayQueue");
+    if (!event_bus_publish(EVENT_RELAY_CMD, &r, sizeof(r), RELAY_QUEUE_TIMEOUT)) {
+      ESP_LOGE(TAG, "Cannot publish relay command");
     }
   }
 
@@ -130,6 +119,7 @@ void handle_action_trigger(struct SchedulerCfgMessage *schedulerCfg, int nowMinu
   }
 }
 
+// pvParameters is the inbox subscribed to EVENT_SCHEDULER_CFG
 void handle_scheduler(void* pvParameters)
 {
   ESP_LOGI(TAG, "handle_scheduler task started");
@@ -138,9 +128,14 @@ void handle_scheduler(void* pvParameters)
 
   struct SchedulerCfgMessage schedulerCfg[MAX_SCHEDULER_NB];
   memset (schedulerCfg, 0, MAX_SCHEDULER_NB * sizeof(struct SchedulerCfgMessage));
+  QueueHandle_t inbox = (QueueHandle_t)pvParameters;
   struct SchedulerCfgMessage tempSchedulerCfg;
+  struct AppEvent *e;
   while(1) {
-    if( xQueueReceive(schedulerCfgQueue, &tempSchedulerCfg, portMAX_DELAY)) {
+    if( xQueueReceive(inbox, &e, portMAX_DELAY)) {
+      // kept in schedulerCfg, so copied out of the event
+      memcpy(&tempSchedulerCfg, EVENT_DATA(e), sizeof(tempSchedulerCfg));
+      event_bus_release(e);
       if (tempSchedulerCfg.actionId == TRIGGER_ACTION) {
         struct tm timeinfo = { 0 };
         localtime_r(&tempSchedulerCfg.data.triggerActionData.now, &timeinfo);
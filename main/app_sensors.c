@@ -2,6 +2,7 @@
 #ifdef CONFIG_MQTT_SENSOR
 
 #include <limits.h>
+#include <stdlib.h>
 #include <string.h>
 #include "esp_log.h"
 
@@ -9,18 +10,24 @@
 #include "rom/gpio.h"
 
 #include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #include "freertos/event_groups.h"
 #include "freertos/queue.h"
+#include "freertos/semphr.h"
 
 #include "app_main.h"
 #include "app_sensors.h"
 
-#if CONFIG_MQTT_THERMOSTATS_NB > 0
-#include "app_thermostat.h"
-extern QueueHandle_t thermostatQueue;
-#endif // CONFIG_MQTT_THERMOSTATS_NB > 0
-
+#include "app_event_bus.h"
 #include "app_mqtt.h"
+#include "app_mqtt_topics.h"
+#ifdef CONFIG_MQTT_SENSOR_DEADBAND
+#include "app_sensors_deadband.h"
+#endif //CONFIG_MQTT_SENSOR_DEADBAND
+#ifdef CONFIG_MQTT_BINARY_PAYLOAD
+#include "app_mqtt_publisher.h"
+#include "app_binary.h"
+#endif //CONFIG_MQTT_BINARY_PAYLOAD
 
 #ifdef CONFIG_MQTT_SENSOR_DHT22
 #include "dht.h"
@@ -48,6 +55,10 @@ static const gpio_num_t SENSOR_GPIO = CONFIG_MQTT_SENSOR_DS18X20_GPIO;
 ds18x20_addr_t addrs[MAX_SENSORS];
 float temps[MAX_SENSORS];
 int sensor_count = 0;
+// topics are only rebuilt when a scan finds another sensor at an index
+#define DS18X20_TOPIC_LEN sizeof(MQTT_EVT_TOPIC("temperature/") "0011223344556677")
+ds18x20_addr_t topicAddrs[MAX_SENSORS];
+char ds18x20Topics[MAX_SENSORS][DS18X20_TOPIC_LEN];
 #endif // CONFIG_MQTT_SENSOR_DS18X20
 
 
@@ -57,64 +68,38 @@ int sensor_count = 0;
 int32_t bme280_pressure;
 int32_t bme280_temperature;
 int32_t bme280_humidity;
+bool bme280Read = false;
 #endif //CONFIG_MQTT_SENSOR_BME280
 
 static const char *TAG = "app_sensors";
 
-#if CONFIG_MQTT_THERMOSTATS_NB > 0
-void thermostat_publish_local_data(int thermostat_id, int value)
-{
-  struct ThermostatMessage tm;
-  memset(&tm, 0, sizeof(struct ThermostatMessage));
-  tm.msgType = THERMOSTAT_CURRENT_TEMPERATURE;
-  tm.thermostatId = thermostat_id;
-  tm.data.currentTemperature = value;
-
-  if (xQueueSend( thermostatQueue
-                  ,( void * )&tm
-                  ,MQTT_QUEUE_TIMEOUT) != pdPASS) {
-    ESP_LOGE(TAG, "Cannot send to thermostatQueue");
-  }
-}
-#endif // CONFIG_MQTT_THERMOSTATS_NB > 0
-
-void publish_data_to_thermostat(const char * topic, int value)
+void publish_sensor_data(const char * topic, int value)
 {
-#ifdef CONFIG_MQTT_THERMOSTATS_NB0_SENSOR_TYPE_LOCAL
-  if (strncmp(topic, CONFIG_MQTT_THERMOSTATS_NB0_LOCAL_SENSOR_TOPIC, strlen(CONFIG_MQTT_THERMOSTATS_NB0_LOCAL_SENSOR_TOPIC)) == 0) {
-    thermostat_publish_local_data(0, value);
-  }
-#endif //CONFIG_MQTT_THERMOSTATS_NB0_SENSOR_TYPE_MQTT
-
-#ifdef CONFIG_MQTT_THERMOSTATS_NB1_SENSOR_TYPE_LOCAL
-  if (strncmp(topic, CONFIG_MQTT_THERMOSTATS_NB1_LOCAL_SENSOR_TOPIC, strlen(CONFIG_MQTT_THERMOSTATS_NB1_LOCAL_SENSOR_TOPIC)) == 0) {
-    thermostat_publish_local_data(1, value);
-  }
-#endif //CONFIG_MQTT_THERMOSTATS_NB1_SENSOR_TYPE_MQTT
 
-#ifdef CONFIG_MQTT_THERMOSTATS_NB2_SENSOR_TYPE_LOCAL
-  if (strncmp(topic, CONFIG_MQTT_THERMOSTATS_NB2_LOCAL_SENSOR_TOPIC, strlen(CONFIG_MQTT_THERMOSTATS_NB2_LOCAL_SENSOR_TOPIC)) == 0) {
-    thermostat_publish_local_data(2, value);
+  // subscribers (local thermostats) get every sample, they count a
+  // sensor as lost after SENSOR_LIFETIME ticks without one
+  struct SensorSample sample = {topic, value};
+  if (!event_bus_publish(EVENT_SENSOR_SAMPLE, &sample, sizeof(sample), MQTT_QUEUE_TIMEOUT)) {
+    ESP_LOGE(TAG, "Cannot publish sensor sample");
   }
-#endif //CONFIG_MQTT_THERMOSTATS_NB2_SENSOR_TYPE_MQTT
 
-#ifdef CONFIG_MQTT_THERMOSTATS_NB3_SENSOR_TYPE_LOCAL
-  if (strncmp(topic, CONFIG_MQTT_THERMOSTATS_NB3_LOCAL_SENSOR_TOPIC, strlen(CONFIG_MQTT_THERMOSTATS_NB3_LOCAL_SENSOR_TOPIC)) == 0) {
-    thermostat_publish_local_data(3, value);
+#ifdef CONFIG_MQTT_SENSOR_DEADBAND
+  if (!sensor_deadband_publish(topic, value)) {
+    ESP_LOGD(TAG, "%s unchanged, not published", topic);
+    return;
   }
-#endif //CONFIG_MQTT_THERMOSTATS_NB3_SENSOR_TYPE_MQTT
-
-}
-
-void publish_sensor_data(const char * topic, int value)
-{
-
-  publish_data_to_thermostat(topic, value);
+#endif //CONFIG_MQTT_SENSOR_DEADBAND
 
+#ifdef CONFIG_MQTT_BINARY_PAYLOAD
+  unsigned char data[BINARY_SENSOR_LEN];
+  int len = binary_encode_sensor(data, value);
+  mqtt_publish_data_cb(topic, (const char *)data, len, QOS_0, NO_RETAIN, NULL, NULL);
+#else //CONFIG_MQTT_BINARY_PAYLOAD
   char data[16];
   memset(data,0,16);
   sprintf(data, "%d.%d", value / 10, abs(value % 10));
   mqtt_publish_data(topic, data, QOS_0, NO_RETAIN);
+#endif //CONFIG_MQTT_BINARY_PAYLOAD
 }
 
 #ifdef CONFIG_MQTT_SENSOR_DHT22
@@ -142,13 +127,16 @@ void publish_dht22_data()
 #ifdef CONFIG_MQTT_SENSOR_DS18X20
 void publish_ds18x20_temperature(int sensor_id)
 {
- const char * temperature_topic = CONFIG_MQTT_DEVICE_TYPE "/" CONFIG_MQTT_CLIENT_ID "/evt/temperature";
-
-  char topic[MQTT_MAX_TOPIC_LEN];
-  memset(topic,0,MQTT_MAX_TOPIC_LEN);
-  sprintf(topic, "%s/%08x%08x", temperature_topic,
-          (uint32_t)(addrs[sensor_id] >> 32),
-          (uint32_t)addrs[sensor_id]);
+  char *topic = ds18x20Topics[sensor_id];
+  if (topic[0] == 0 || topicAddrs[sensor_id] != addrs[sensor_id]) {
+    topicAddrs[sensor_id] = addrs[sensor_id];
+#ifdef CONFIG_MQTT_SENSOR_DEADBAND
+    sensor_deadband_forget(topic);
+#endif //CONFIG_MQTT_SENSOR_DEADBAND
+    sprintf(topic, MQTT_EVT_TOPIC("temperature/") "%08x%08x",
+            (uint32_t)(addrs[sensor_id] >> 32),
+            (uint32_t)addrs[sensor_id]);
+  }
 
   publish_sensor_data(topic, temps[sensor_id] * 10);
 }
@@ -193,10 +181,18 @@ void publish_bme280_data()
 }
 #endif // CONFIG_MQTT_SENSOR_BME280
 
+// called on (re)connect, every sensor read so far is published whatever
+// its last value
 void publish_sensors_data()
 {
+#ifdef CONFIG_MQTT_SENSOR_DEADBAND
+  sensors_deadband_reset();
+#endif //CONFIG_MQTT_SENSOR_DEADBAND
+
 #ifdef CONFIG_MQTT_SENSOR_DHT22
-  void publish_dht22_data();
+  if (dht22_mean_temperature != SHRT_MIN) {
+    publish_dht22_data();
+  }
 #endif // CONFIG_MQTT_SENSOR_DHT22
 
 #ifdef CONFIG_MQTT_SENSOR_DS18X20
@@ -204,10 +200,19 @@ void publish_sensors_data()
 #endif // CONFIG_MQTT_SENSOR_DS18X20
 
 #ifdef CONFIG_MQTT_SENSOR_BME280
-  void publish_bme280_data();
+  if (bme280Read) {
+    publish_bme280_data();
+  }
 #endif // CONFIG_MQTT_SENSOR_BME280
 }
 
+void sensors_init()
+{
+#ifdef CONFIG_MQTT_SENSOR_DEADBAND
+  sensors_deadband_init();
+#endif //CONFIG_MQTT_SENSOR_DEADBAND
+}
+
 void sensors_read(void* pvParameters)
 {
 
@@ -291,6 +296,7 @@ void sensors_read(void* pvParameters)
       if (bme_read_data(&bme280_temperature, &bme280_pressure, &bme280_humidity) == ESP_OK)
         {
           ESP_LOGI(TAG, "Temp: %d.%02dC, Pressure: %d, Humidity: %d.%03d%%, ",  bme280_temperature/100,bme280_temperature%100, bme280_pressure, bme280_humidity/1000, bme280_humidity%1000);
+          bme280Read = true;
           publish_bme280_data();
         }
       else
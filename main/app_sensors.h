@@ -1,6 +1,13 @@
 #ifndef APP_SENSORS_H
 #define APP_SENSORS_H
 
+/* one reading as published on topic, in tenths for temperatures */
+struct SensorSample {
+  const char *topic;
+  int value;
+};
+
+void sensors_init(void);
 void sensors_read(void* pvParameters);
 void publish_sensors_data();
 
@@ -0,0 +1,87 @@
+#include "esp_system.h"
+#ifdef CONFIG_MQTT_SENSOR_DEADBAND
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#include "app_sensors_deadband.h"
+
+// topics are string literals or ds18x20Topics slots so they are
+// matched by address
+struct SensorDeadband {
+  const char *topic;
+  int value;
+  TickType_t publishedAt;
+};
+
+struct SensorDeadband sensorDeadbands[SENSOR_DEADBAND_TOPICS_NB];
+unsigned int sensorSamplesFiltered = 0;
+// the sensor task and the mqtt task (on connect) both publish samples
+static SemaphoreHandle_t sensorDeadbandMutex;
+
+void sensors_deadband_init()
+{
+  sensorDeadbandMutex = xSemaphoreCreateMutex();
+}
+
+void sensors_deadband_reset()
+{
+  xSemaphoreTake(sensorDeadbandMutex, portMAX_DELAY);
+  memset(sensorDeadbands, 0, sizeof(sensorDeadbands));
+  xSemaphoreGive(sensorDeadbandMutex);
+}
+
+void sensor_deadband_forget(const char * topic)
+{
+  xSemaphoreTake(sensorDeadbandMutex, portMAX_DELAY);
+  for (int i = 0; i < SENSOR_DEADBAND_TOPICS_NB; i++) {
+    if (sensorDeadbands[i].topic == topic) {
+      sensorDeadbands[i].topic = NULL;
+    }
+  }
+  xSemaphoreGive(sensorDeadbandMutex);
+}
+
+// true when the value moved out of the deadband of the last published one
+// or the topic has been silent for the heartbeat period
+static bool sensor_deadband_check(const char * topic, int value)
+{
+  TickType_t now = xTaskGetTickCount();
+  struct SensorDeadband *d = NULL;
+  for (int i = 0; i < SENSOR_DEADBAND_TOPICS_NB; i++) {
+    if (sensorDeadbands[i].topic == topic) {
+      d = &sensorDeadbands[i];
+      break;
+    }
+    if (!d && sensorDeadbands[i].topic == NULL) {
+      d = &sensorDeadbands[i];
+    }
+  }
+  if (!d) {
+    // more topics than slots, nothing is filtered
+    return true;
+  }
+  if (d->topic == topic &&
+      abs(value - d->value) < CONFIG_MQTT_SENSOR_DEADBAND &&
+      (TickType_t)(now - d->publishedAt) < SENSOR_HEARTBEAT) {
+    sensorSamplesFiltered += 1;
+    return false;
+  }
+  d->topic = topic;
+  d->value = value;
+  d->publishedAt = now;
+  return true;
+}
+
+bool sensor_deadband_publish(const char * topic, int value)
+{
+  xSemaphoreTake(sensorDeadbandMutex, portMAX_DELAY);
+  bool publish = sensor_deadband_check(topic, value);
+  xSemaphoreGive(sensorDeadbandMutex);
+  return publish;
+}
+#endif //CONFIG_MQTT_SENSOR_DEADBAND
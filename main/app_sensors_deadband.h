@@ -0,0 +1,19 @@
+#ifndef APP_SENSORS_DEADBAND_H
+#define APP_SENSORS_DEADBAND_H
+
+#include <stdbool.h>
+
+/* last published sample per topic, samples within CONFIG_MQTT_SENSOR_DEADBAND
+   of it are not published again until the heartbeat period is over */
+
+#define SENSOR_DEADBAND_TOPICS_NB 16
+#define SENSOR_HEARTBEAT (CONFIG_MQTT_SENSOR_HEARTBEAT * 1000 / portTICK_PERIOD_MS)
+
+extern unsigned int sensorSamplesFiltered;
+
+void sensors_deadband_init();
+void sensors_deadband_reset();
+void sensor_deadband_forget(const char * topic);
+bool sensor_deadband_publish(const char * topic, int value);
+
+#endif /* APP_SENSORS_DEADBAND_H */
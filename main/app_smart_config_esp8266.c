@@ -18,6 +18,7 @@
 
 #include "app_main.h"
 #include "app_relay.h"
+#include "app_event_bus.h"
 
 static const char *TAG = "MQTTS_SMARTCONFIG";
 
@@ -44,7 +45,6 @@ EventGroupHandle_t smartconfig_event_group;
 
 #if CONFIG_MQTT_RELAYS_NB
 extern int relayStatus[CONFIG_MQTT_RELAYS_NB];
-extern QueueHandle_t relayQueue;
 #endif //CONFIG_MQTT_RELAYS_NB
 
 #define TICKS_FORMAT "%ld"
@@ -175,9 +175,7 @@ void smartconfig_cmd_task(void* pvParameters)
             if ((scm.ticks - pushTick ) < ticksToWait) {
 #if CONFIG_MQTT_RELAYS_NB
               struct RelayMessage r={RELAY_CMD_STATUS, scm.relayId, !(relayStatus[(int)scm.relayId] == RELAY_ON)};
-              xQueueSend(relayQueue,
-                         ( void * )&r,
-                         RELAY_QUEUE_TIMEOUT);
+              event_bus_publish(EVENT_RELAY_CMD, &r, sizeof(r), RELAY_QUEUE_TIMEOUT);
 #endif //CONFIG_MQTT_RELAYS_NB
             }
             else {
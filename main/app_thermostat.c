@@ -5,6 +5,8 @@
 #include <limits.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
 
 #include "esp_log.h"
 
@@ -15,245 +17,154 @@
 #include "app_main.h"
 #include "app_relay.h"
 #include "app_thermostat.h"
+#include "app_timer_wheel.h"
 #include "app_nvs.h"
 #include "app_mqtt.h"
+#include "app_mqtt_topics.h"
+#include "app_event_bus.h"
+#include "app_sensors.h"
+#include "app_mqtt_publisher.h"
+#include "app_thermostat_duty.h"
+#ifdef CONFIG_MQTT_BINARY_PAYLOAD
+#include "app_binary.h"
+#endif //CONFIG_MQTT_BINARY_PAYLOAD
 
 enum ThermostatState thermostatState = THERMOSTAT_STATE_IDLE;
 unsigned int thermostatDuration = 0;
 
 enum HeatingState heatingState = HEATING_STATE_IDLE;
 unsigned int heatingDuration = 0;
-int circuitThermostatId = -1;
 
-
-enum ThermostatMode thermostatMode[CONFIG_MQTT_THERMOSTATS_NB] = {
-  THERMOSTAT_MODE_UNSET,
-#if CONFIG_MQTT_THERMOSTATS_NB > 1
-  THERMOSTAT_MODE_UNSET,
-#if CONFIG_MQTT_THERMOSTATS_NB > 2
-  THERMOSTAT_MODE_UNSET,
-#if CONFIG_MQTT_THERMOSTATS_NB > 3
-  THERMOSTAT_MODE_UNSET,
-#endif //CONFIG_MQTT_THERMOSTATS_NB > 3
-#endif //CONFIG_MQTT_THERMOSTATS_NB > 2
-#endif //CONFIG_MQTT_THERMOSTATS_NB > 1
-};
-
-const char * thermostatModeTAG[CONFIG_MQTT_THERMOSTATS_NB] = {
-  "thermMode0",
+#if defined(CONFIG_MQTT_THERMOSTATS_NB0_TYPE_CIRCUIT)
+#define THERMOSTAT_CIRCUIT_ID 0
+#elif defined(CONFIG_MQTT_THERMOSTATS_NB1_TYPE_CIRCUIT)
+#define THERMOSTAT_CIRCUIT_ID 1
+#elif defined(CONFIG_MQTT_THERMOSTATS_NB2_TYPE_CIRCUIT)
+#define THERMOSTAT_CIRCUIT_ID 2
+#elif defined(CONFIG_MQTT_THERMOSTATS_NB3_TYPE_CIRCUIT)
+#define THERMOSTAT_CIRCUIT_ID 3
+#else
+#define THERMOSTAT_CIRCUIT_ID -1
+#endif
+
+int circuitThermostatId = THERMOSTAT_CIRCUIT_ID;
+
+// set when a reading, a setting, a sensor expiry or a toggle may change
+// the outcome of update_thermostat
+bool thermostatDirty = true;
+
+struct Thermostat thermostats[CONFIG_MQTT_THERMOSTATS_NB];
+
+// names from Kconfig, thermostats without one are named after their id
+static const char * const thermostatConfigName[CONFIG_MQTT_THERMOSTATS_NB] = {
+  [0] = CONFIG_MQTT_THERMOSTATS_NB0_FRIENDLY_NAME,
 #if CONFIG_MQTT_THERMOSTATS_NB > 1
-  "thermMode1",
-#if CONFIG_MQTT_THERMOSTATS_NB > 2
-  "thermMode2",
-#if CONFIG_MQTT_THERMOSTATS_NB > 3
-  "thermMode3",
-#endif //CONFIG_MQTT_THERMOSTATS_NB > 3
-#endif //CONFIG_MQTT_THERMOSTATS_NB > 2
+  [1] = CONFIG_MQTT_THERMOSTATS_NB1_FRIENDLY_NAME,
 #endif //CONFIG_MQTT_THERMOSTATS_NB > 1
-};
-
-short targetTemperature[CONFIG_MQTT_THERMOSTATS_NB] = {
-  21*10,
-#if CONFIG_MQTT_THERMOSTATS_NB > 1
-  21*10,
 #if CONFIG_MQTT_THERMOSTATS_NB > 2
-  21*10,
-#if CONFIG_MQTT_THERMOSTATS_NB > 3
-  21*10,
-#endif //CONFIG_MQTT_THERMOSTATS_NB > 3
+  [2] = CONFIG_MQTT_THERMOSTATS_NB2_FRIENDLY_NAME,
 #endif //CONFIG_MQTT_THERMOSTATS_NB > 2
-#endif //CONFIG_MQTT_THERMOSTATS_NB > 1
-};
-
-const char * targetTemperatureTAG[CONFIG_MQTT_THERMOSTATS_NB] = {
-  "targetTemp0",
-#if CONFIG_MQTT_THERMOSTATS_NB > 1
-  "targetTemp1",
-#if CONFIG_MQTT_THERMOSTATS_NB > 2
-  "targetTemp2",
-#if CONFIG_MQTT_THERMOSTATS_NB > 3
-  "targetTemp3",
-#endif //CONFIG_MQTT_THERMOSTATS_NB > 3
-#endif //CONFIG_MQTT_THERMOSTATS_NB > 2
-#endif //CONFIG_MQTT_THERMOSTATS_NB > 1
-};
-
-short temperatureTolerance[CONFIG_MQTT_THERMOSTATS_NB] = {
-  5,
-#if CONFIG_MQTT_THERMOSTATS_NB > 1
-  5,
-#if CONFIG_MQTT_THERMOSTATS_NB > 2
-  5,
-#if CONFIG_MQTT_THERMOSTATS_NB > 3
-  5,
-#endif //CONFIG_MQTT_THERMOSTATS_NB > 3
-#endif //CONFIG_MQTT_THERMOSTATS_NB > 2
-#endif //CONFIG_MQTT_THERMOSTATS_NB > 1
-}; //0.5
-
-const char * temperatureToleranceTAG[CONFIG_MQTT_THERMOSTATS_NB] = {
-  "tempToler0",
-#if CONFIG_MQTT_THERMOSTATS_NB > 1
-  "tempToler1",
-#if CONFIG_MQTT_THERMOSTATS_NB > 2
-  "tempToler2",
 #if CONFIG_MQTT_THERMOSTATS_NB > 3
-  "tempToler3",
+  [3] = CONFIG_MQTT_THERMOSTATS_NB3_FRIENDLY_NAME,
 #endif //CONFIG_MQTT_THERMOSTATS_NB > 3
-#endif //CONFIG_MQTT_THERMOSTATS_NB > 2
-#endif //CONFIG_MQTT_THERMOSTATS_NB > 1
 };
 
-enum ThermostatType thermostatType[CONFIG_MQTT_THERMOSTATS_NB] = {
-  THERMOSTAT_TYPE_NORMAL,
-#if CONFIG_MQTT_THERMOSTATS_NB > 1
-  THERMOSTAT_TYPE_NORMAL,
-#if CONFIG_MQTT_THERMOSTATS_NB > 2
-  THERMOSTAT_TYPE_NORMAL,
-#if CONFIG_MQTT_THERMOSTATS_NB > 3
-  THERMOSTAT_TYPE_NORMAL,
-#endif //CONFIG_MQTT_THERMOSTATS_NB > 3
-#endif //CONFIG_MQTT_THERMOSTATS_NB > 2
-#endif //CONFIG_MQTT_THERMOSTATS_NB > 1
+// topic of the local sensor feeding each thermostat, NULL when the
+// temperature comes over mqtt
+static const char * const thermostatConfigLocalSensorTopic[CONFIG_MQTT_THERMOSTATS_NB] = {
+#ifdef CONFIG_MQTT_THERMOSTATS_NB0_SENSOR_TYPE_LOCAL
+  [0] = CONFIG_MQTT_THERMOSTATS_NB0_LOCAL_SENSOR_TOPIC,
+#endif //CONFIG_MQTT_THERMOSTATS_NB0_SENSOR_TYPE_LOCAL
+#ifdef CONFIG_MQTT_THERMOSTATS_NB1_SENSOR_TYPE_LOCAL
+  [1] = CONFIG_MQTT_THERMOSTATS_NB1_LOCAL_SENSOR_TOPIC,
+#endif //CONFIG_MQTT_THERMOSTATS_NB1_SENSOR_TYPE_LOCAL
+#ifdef CONFIG_MQTT_THERMOSTATS_NB2_SENSOR_TYPE_LOCAL
+  [2] = CONFIG_MQTT_THERMOSTATS_NB2_LOCAL_SENSOR_TOPIC,
+#endif //CONFIG_MQTT_THERMOSTATS_NB2_SENSOR_TYPE_LOCAL
+#ifdef CONFIG_MQTT_THERMOSTATS_NB3_SENSOR_TYPE_LOCAL
+  [3] = CONFIG_MQTT_THERMOSTATS_NB3_LOCAL_SENSOR_TOPIC,
+#endif //CONFIG_MQTT_THERMOSTATS_NB3_SENSOR_TYPE_LOCAL
 };
 
-short currentTemperature[CONFIG_MQTT_THERMOSTATS_NB] = {
-  SHRT_MIN,
-#if CONFIG_MQTT_THERMOSTATS_NB > 1
-  SHRT_MIN,
-#if CONFIG_MQTT_THERMOSTATS_NB > 2
-  SHRT_MIN,
-#if CONFIG_MQTT_THERMOSTATS_NB > 3
-  SHRT_MIN,
-#endif //CONFIG_MQTT_THERMOSTATS_NB > 3
-#endif //CONFIG_MQTT_THERMOSTATS_NB > 2
-#endif //CONFIG_MQTT_THERMOSTATS_NB > 1
-};
+// nvs keys are the prefix followed by the thermostat id
+#define THERMOSTAT_NVS_MODE "thermMode"
+#define THERMOSTAT_NVS_TARGET_TEMPERATURE "targetTemp"
+#define THERMOSTAT_NVS_TOLERANCE "tempToler"
+#define THERMOSTAT_NVS_TAG_SIZE 16
 
-const char* thermostatFriendlyName[CONFIG_MQTT_THERMOSTATS_NB] = {
-  CONFIG_MQTT_THERMOSTATS_NB0_FRIENDLY_NAME,
-#if CONFIG_MQTT_THERMOSTATS_NB > 1
-  CONFIG_MQTT_THERMOSTATS_NB1_FRIENDLY_NAME,
-#if CONFIG_MQTT_THERMOSTATS_NB > 2
-  CONFIG_MQTT_THERMOSTATS_NB2_FRIENDLY_NAME,
-#if CONFIG_MQTT_THERMOSTATS_NB > 3
-  CONFIG_MQTT_THERMOSTATS_NB3_FRIENDLY_NAME,
-#endif //CONFIG_MQTT_THERMOSTATS_NB > 3
-#endif //CONFIG_MQTT_THERMOSTATS_NB > 2
-#endif //CONFIG_MQTT_THERMOSTATS_NB > 1
-};
+#define THERMOSTAT_REASON_SIZE 256
 
+// readings needed before the circuit trend is trusted
+#define THERMOSTAT_TREND_MIN_SAMPLES 3
 
-short currentTemperatureFlag[CONFIG_MQTT_THERMOSTATS_NB] = {0};
+#if THERMOSTAT_TREND_FALL >= THERMOSTAT_TREND_RISE
+#error "circuit idle slope must be below the heating slope"
+#endif //THERMOSTAT_TREND_FALL >= THERMOSTAT_TREND_RISE
 
-short currentTemperature_1 = SHRT_MIN;
-short currentTemperature_2 = SHRT_MIN;
-short currentTemperature_3 = SHRT_MIN;
+#if defined(CONFIG_MQTT_STATE_SNAPSHOT) && !defined(CONFIG_MQTT_BINARY_PAYLOAD)
+#if MAX_MQTT_DATA_THERMOSTAT_STATE * CONFIG_MQTT_THERMOSTATS_NB + 4 > MQTT_PUBLISH_RING_SIZE
+#error "thermostats snapshot does not fit in the publish ring, raise MQTT_PUBLISH_RING_SIZE"
+#endif //MAX_MQTT_DATA_THERMOSTAT_STATE * CONFIG_MQTT_THERMOSTATS_NB + 4 > MQTT_PUBLISH_RING_SIZE
+#endif //CONFIG_MQTT_STATE_SNAPSHOT && !CONFIG_MQTT_BINARY_PAYLOAD
 
-extern QueueHandle_t thermostatQueue;
+#if !defined(CONFIG_MQTT_BINARY_PAYLOAD) && MAX_MQTT_DATA_THERMOSTAT_DUTY > MQTT_PUBLISH_RING_SIZE
+#error "thermostat duty report does not fit in the publish ring, lower MQTT_THERMOSTAT_DUTY_TRANSITIONS"
+#endif //!CONFIG_MQTT_BINARY_PAYLOAD && MAX_MQTT_DATA_THERMOSTAT_DUTY > MQTT_PUBLISH_RING_SIZE
 
 static const char *TAG = "APP_THERMOSTAT";
 
+static void thermostat_nvs_tag(char *tag, const char *prefix, int id)
+{
+  snprintf(tag, THERMOSTAT_NVS_TAG_SIZE, "%s%d", prefix, id);
+}
+
 void publish_thermostat_current_temperature_evt(int id)
 {
-  if (currentTemperature[id] == SHRT_MIN)
+  const struct Thermostat *th = &thermostats[id];
+  if (th->currentTemperature == SHRT_MIN)
     return;
 
-  const char * thermostat_topic = CONFIG_MQTT_DEVICE_TYPE "/" CONFIG_MQTT_CLIENT_ID "/evt/ctemp/thermostat";
-
   char data[16];
   memset(data,0,16);
   sprintf(data, "%d.%d",
-          currentTemperature[id] > 0 ? currentTemperature[id] / 10 : 0,
-          currentTemperature[id] > 0 ? abs(currentTemperature[id] % 10) : 0);
+          th->currentTemperature > 0 ? th->currentTemperature / 10 : 0,
+          th->currentTemperature > 0 ? abs(th->currentTemperature % 10) : 0);
 
-  char topic[MQTT_MAX_TOPIC_LEN];
-  memset(topic,0,MQTT_MAX_TOPIC_LEN);
-  sprintf(topic, "%s/%d", thermostat_topic, id);
-
-  mqtt_publish_data(topic, data, QOS_1, RETAIN);
-}
-
-void publish_all_thermostats_current_temperature_evt()
-{
-  for(int id = 0; id < CONFIG_MQTT_THERMOSTATS_NB; id++) {
-    publish_thermostat_current_temperature_evt(id);
-    vTaskDelay(50 / portTICK_PERIOD_MS);
-  }
+  mqtt_publish_data(MQTT_ID_TOPIC(MQTT_TOPIC_THERMOSTAT_CTEMP, id), data, QOS_1, RETAIN);
 }
 
 void publish_thermostat_target_temperature_evt(int id)
 {
-  const char * thermostat_topic = CONFIG_MQTT_DEVICE_TYPE "/" CONFIG_MQTT_CLIENT_ID "/evt/temp/thermostat";
-
+  const struct Thermostat *th = &thermostats[id];
   char data[16];
   memset(data,0,16);
-  sprintf(data, "%d.%d", targetTemperature[id] / 10, abs(targetTemperature[id] % 10));
-
-  char topic[MQTT_MAX_TOPIC_LEN];
-  memset(topic,0,MQTT_MAX_TOPIC_LEN);
-  sprintf(topic, "%s/%d", thermostat_topic, id);
+  sprintf(data, "%d.%d", th->targetTemperature / 10, abs(th->targetTemperature % 10));
 
-  mqtt_publish_data(topic, data, QOS_1, RETAIN);
-}
-
-void publish_all_thermostats_target_temperature_evt()
-{
-  for(int id = 0; id < CONFIG_MQTT_THERMOSTATS_NB; id++) {
-    publish_thermostat_target_temperature_evt(id);
-    vTaskDelay(50 / portTICK_PERIOD_MS);
-  }
+  mqtt_publish_data(MQTT_ID_TOPIC(MQTT_TOPIC_THERMOSTAT_TEMP, id), data, QOS_1, RETAIN);
 }
 
 void publish_thermostat_temperature_tolerance_evt(int id)
 {
-  const char * thermostat_topic = CONFIG_MQTT_DEVICE_TYPE "/" CONFIG_MQTT_CLIENT_ID "/evt/tolerance/thermostat";
-
+  const struct Thermostat *th = &thermostats[id];
   char data[16];
   memset(data,0,16);
-  sprintf(data, "%d.%d", temperatureTolerance[id] / 10, abs(temperatureTolerance[id] % 10));
+  sprintf(data, "%d.%d", th->temperatureTolerance / 10, abs(th->temperatureTolerance % 10));
 
-  char topic[MQTT_MAX_TOPIC_LEN];
-  memset(topic,0,MQTT_MAX_TOPIC_LEN);
-  sprintf(topic, "%s/%d", thermostat_topic, id);
-
-  mqtt_publish_data(topic, data, QOS_1, RETAIN);
-}
-
-void publish_all_thermostats_temperature_tolerance_evt()
-{
-  for(int id = 0; id < CONFIG_MQTT_THERMOSTATS_NB; id++) {
-    publish_thermostat_temperature_tolerance_evt(id);
-    vTaskDelay(50 / portTICK_PERIOD_MS);
-  }
+  mqtt_publish_data(MQTT_ID_TOPIC(MQTT_TOPIC_THERMOSTAT_TOLERANCE, id), data, QOS_1, RETAIN);
 }
 
 void publish_thermostat_mode_evt(int id)
 {
-  const char * thermostat_topic = CONFIG_MQTT_DEVICE_TYPE "/" CONFIG_MQTT_CLIENT_ID "/evt/mode/thermostat";
-
   char data[16];
   memset(data,0,16);
-  sprintf(data, "%s", thermostatMode[id] == THERMOSTAT_MODE_HEAT ? "heat" : "off");
-
-  char topic[MQTT_MAX_TOPIC_LEN];
-  memset(topic,0,MQTT_MAX_TOPIC_LEN);
-  sprintf(topic, "%s/%d", thermostat_topic, id);
+  sprintf(data, "%s", thermostats[id].mode == THERMOSTAT_MODE_HEAT ? "heat" : "off");
 
-  mqtt_publish_data(topic, data, QOS_1, RETAIN);
-}
-
-void publish_all_thermostats_mode_evt()
-{
-  for(int id = 0; id < CONFIG_MQTT_THERMOSTATS_NB; id++) {
-    publish_thermostat_mode_evt(id);
-    vTaskDelay(50 / portTICK_PERIOD_MS);
-  }
+  mqtt_publish_data(MQTT_ID_TOPIC(MQTT_TOPIC_THERMOSTAT_MODE, id), data, QOS_1, RETAIN);
 }
 
 void get_normal_thermostat_action(char * data, int id)
 {
-  if (thermostatMode[id] == THERMOSTAT_MODE_HEAT) {
+  if (thermostats[id].mode == THERMOSTAT_MODE_HEAT) {
     switch(thermostatState) {
     case THERMOSTAT_STATE_IDLE:
       sprintf(data, "idle");
@@ -270,7 +181,7 @@ void get_normal_thermostat_action(char * data, int id)
 }
 void get_circuit_thermostat_action(char * data, int id)
 {
-    if (thermostatMode[id] == THERMOSTAT_MODE_HEAT) {
+    if (thermostats[id].mode == THERMOSTAT_MODE_HEAT) {
     switch(heatingState) {
     case HEATING_STATE_IDLE:
       sprintf(data, "idle");
@@ -288,59 +199,176 @@ void get_circuit_thermostat_action(char * data, int id)
 
 void publish_thermostat_action_evt(int id)
 {
-  const char * thermostat_topic = CONFIG_MQTT_DEVICE_TYPE "/" CONFIG_MQTT_CLIENT_ID "/evt/action/thermostat";
-
   char data[16];
   memset(data,0,16);
-  if (thermostatType[id] == THERMOSTAT_TYPE_NORMAL) {
+  if (thermostats[id].type == THERMOSTAT_TYPE_NORMAL) {
     get_normal_thermostat_action(data, id);
   } else {
     get_circuit_thermostat_action(data, id);
   }
 
-  char topic[MQTT_MAX_TOPIC_LEN];
-  memset(topic,0,MQTT_MAX_TOPIC_LEN);
-  sprintf(topic, "%s/%d", thermostat_topic, id);
-
-  mqtt_publish_data(topic, data, QOS_1, RETAIN);
+  mqtt_publish_data(MQTT_ID_TOPIC(MQTT_TOPIC_THERMOSTAT_ACTION, id), data, QOS_1, RETAIN);
 }
 
-void publish_all_normal_thermostats_action_evt()
+// the publish ring paces the messages, no need to sleep between them
+void publish_thermostats_action_evt(enum ThermostatType type)
 {
   for(int id = 0; id < CONFIG_MQTT_THERMOSTATS_NB; id++) {
-    if (thermostatType[id] == THERMOSTAT_TYPE_NORMAL) {
+    if (thermostats[id].type == type) {
       publish_thermostat_action_evt(id);
-      vTaskDelay(50 / portTICK_PERIOD_MS);
     }
   }
 }
 
-void publish_all_circuit_thermostats_action_evt()
+// all the fields of a thermostat go out together, the delay between
+// thermostats lets the publisher task drain the ring
+void publish_thermostat_data()
 {
   for(int id = 0; id < CONFIG_MQTT_THERMOSTATS_NB; id++) {
-    if (thermostatType[id] == THERMOSTAT_TYPE_CIRCUIT) {
-      publish_thermostat_action_evt(id);
-      vTaskDelay(50 / portTICK_PERIOD_MS);
-    }
+    publish_thermostat_current_temperature_evt(id);
+    publish_thermostat_target_temperature_evt(id);
+    publish_thermostat_temperature_tolerance_evt(id);
+    publish_thermostat_mode_evt(id);
+    publish_thermostat_action_evt(id);
+    vTaskDelay(50 / portTICK_PERIOD_MS);
+  }
+}
+
+#ifdef CONFIG_MQTT_STATE_SNAPSHOT
+#ifdef CONFIG_MQTT_BINARY_PAYLOAD
+static unsigned char binary_thermostat_action(const struct Thermostat *th)
+{
+  if (th->mode != THERMOSTAT_MODE_HEAT) {
+    return BINARY_ACTION_OFF;
+  }
+  if (th->type == THERMOSTAT_TYPE_NORMAL) {
+    return thermostatState == THERMOSTAT_STATE_HEATING ? BINARY_ACTION_HEATING : BINARY_ACTION_IDLE;
   }
+  return heatingState == HEATING_STATE_ENABLED ? BINARY_ACTION_HEATING : BINARY_ACTION_IDLE;
 }
 
-void publish_all_thermostats_action_evt()
+void publish_thermostats_snapshot()
 {
+  const char * topic = CONFIG_MQTT_DEVICE_TYPE "/" CONFIG_MQTT_CLIENT_ID "/evt/state/thermostats";
+  struct BinaryThermostat binary[CONFIG_MQTT_THERMOSTATS_NB];
+  unsigned char data[BINARY_THERMOSTATS_LEN(CONFIG_MQTT_THERMOSTATS_NB)];
+
   for(int id = 0; id < CONFIG_MQTT_THERMOSTATS_NB; id++) {
-    publish_thermostat_action_evt(id);
-    vTaskDelay(50 / portTICK_PERIOD_MS);
+    const struct Thermostat *th = &thermostats[id];
+    binary[id].currentTemperature = th->currentTemperature;
+    binary[id].targetTemperature = th->targetTemperature;
+    binary[id].temperatureTolerance = th->temperatureTolerance;
+    binary[id].mode = th->mode;
+    binary[id].action = binary_thermostat_action(th);
   }
+  int len = binary_encode_thermostats(data, binary, CONFIG_MQTT_THERMOSTATS_NB);
+
+  mqtt_publish_data_cb(topic, (const char *)data, len, QOS_1, RETAIN, NULL, NULL);
 }
+#else //CONFIG_MQTT_BINARY_PAYLOAD
+void publish_thermostats_snapshot()
+{
+  const char * topic = CONFIG_MQTT_DEVICE_TYPE "/" CONFIG_MQTT_CLIENT_ID "/evt/state/thermostats";
+  char data[MAX_MQTT_DATA_THERMOSTAT_STATE * CONFIG_MQTT_THERMOSTATS_NB + 4];
+  char action[16];
+  char ctemp[16];
+  int len = 0;
 
-void publish_thermostat_data()
+  len += sprintf(data + len, "[");
+  for(int id = 0; id < CONFIG_MQTT_THERMOSTATS_NB; id++) {
+    const struct Thermostat *th = &thermostats[id];
+    if (th->type == THERMOSTAT_TYPE_NORMAL) {
+      get_normal_thermostat_action(action, id);
+    } else {
+      get_circuit_thermostat_action(action, id);
+    }
+    if (th->currentTemperature == SHRT_MIN) {
+      sprintf(ctemp, "null");
+    } else {
+      sprintf(ctemp, "%d.%d",
+              th->currentTemperature > 0 ? th->currentTemperature / 10 : 0,
+              th->currentTemperature > 0 ? abs(th->currentTemperature % 10) : 0);
+    }
+    len += sprintf(data + len, "%s{\"ctemp\":%s,\"temp\":%d.%d,\"tolerance\":%d.%d,\"mode\":\"%s\",\"action\":\"%s\"}",
+                   id ? "," : "", ctemp,
+                   th->targetTemperature / 10, abs(th->targetTemperature % 10),
+                   th->temperatureTolerance / 10, abs(th->temperatureTolerance % 10),
+                   th->mode == THERMOSTAT_MODE_HEAT ? "heat" : "off",
+                   action);
+  }
+  sprintf(data + len, "]");
+
+  mqtt_publish_data(topic, data, QOS_1, RETAIN);
+}
+#endif //CONFIG_MQTT_BINARY_PAYLOAD
+#endif //CONFIG_MQTT_STATE_SNAPSHOT
+
+#ifdef CONFIG_MQTT_BINARY_PAYLOAD
+void publish_thermostat_duty()
+{
+  const char * topic = CONFIG_MQTT_DEVICE_TYPE "/" CONFIG_MQTT_CLIENT_ID "/evt/duty/thermostats";
+  struct ThermostatDutyReport report;
+  struct BinaryDutyTransition transitions[THERMOSTAT_DUTY_TRANSITIONS_NB];
+  unsigned char duty[(THERMOSTAT_DUTY_HOURS_NB + THERMOSTAT_DUTY_DAYS_NB) * THERMOSTAT_DUTY_CHANNELS_NB];
+  unsigned char data[BINARY_DUTY_LEN(THERMOSTAT_DUTY_HOURS_NB + THERMOSTAT_DUTY_DAYS_NB,
+                                     THERMOSTAT_DUTY_TRANSITIONS_NB)];
+
+  thermostat_duty_report(&report);
+  memcpy(duty, report.hours, sizeof(report.hours));
+  memcpy(duty + sizeof(report.hours), report.days, sizeof(report.days));
+  for (int i = 0; i < report.transitionsNb; i++) {
+    transitions[i].ts = report.transitions[i].ts;
+    transitions[i].thermostatId = report.transitions[i].thermostatId;
+    transitions[i].channel = report.transitions[i].channel;
+    transitions[i].on = report.transitions[i].on;
+    transitions[i].reason = report.transitions[i].reason;
+  }
+  int len = binary_encode_duty(data, duty, THERMOSTAT_DUTY_HOURS_NB, THERMOSTAT_DUTY_DAYS_NB,
+                               report.total, transitions, report.transitionsNb);
+
+  mqtt_publish_data_cb(topic, (const char *)data, len, QOS_1, NO_RETAIN, NULL, NULL);
+}
+#else //CONFIG_MQTT_BINARY_PAYLOAD
+static int sprintf_duty(char *data, const unsigned char *duty)
+{
+  if (duty[THERMOSTAT_DUTY_RELAY] == THERMOSTAT_DUTY_UNKNOWN) {
+    return sprintf(data, "null");
+  }
+  return sprintf(data, "[%u,%u]", duty[THERMOSTAT_DUTY_RELAY], duty[THERMOSTAT_DUTY_HEATING]);
+}
+
+// {"tick":<s>,"total":<nb>,"hours":[[relay%,heating%],..],"days":[..],
+//  "transitions":[[ts,id,channel,on,reason],..]}, buckets oldest first
+void publish_thermostat_duty()
 {
-  publish_all_thermostats_current_temperature_evt();
-  publish_all_thermostats_target_temperature_evt();
-  publish_all_thermostats_temperature_tolerance_evt();
-  publish_all_thermostats_mode_evt();
-  publish_all_thermostats_action_evt();
+  const char * topic = CONFIG_MQTT_DEVICE_TYPE "/" CONFIG_MQTT_CLIENT_ID "/evt/duty/thermostats";
+  static struct ThermostatDutyReport report;
+  static char data[MAX_MQTT_DATA_THERMOSTAT_DUTY];
+  int len = 0;
+
+  thermostat_duty_report(&report);
+  len += sprintf(data + len, "{\"tick\":%d,\"total\":%u,\"hours\":[",
+                 CONFIG_MQTT_THERMOSTATS_TICK_PERIOD, report.total);
+  for (int i = 0; i < THERMOSTAT_DUTY_HOURS_NB; i++) {
+    len += sprintf(data + len, "%s", i ? "," : "");
+    len += sprintf_duty(data + len, report.hours[i]);
+  }
+  len += sprintf(data + len, "],\"days\":[");
+  for (int i = 0; i < THERMOSTAT_DUTY_DAYS_NB; i++) {
+    len += sprintf(data + len, "%s", i ? "," : "");
+    len += sprintf_duty(data + len, report.days[i]);
+  }
+  len += sprintf(data + len, "],\"transitions\":[");
+  for (int i = 0; i < report.transitionsNb; i++) {
+    const struct ThermostatTransition *t = &report.transitions[i];
+    len += sprintf(data + len, "%s[%u,%u,%u,%u,%u]", i ? "," : "",
+                   t->ts, t->thermostatId, t->channel, t->on, t->reason);
+  }
+  sprintf(data + len, "]}");
+
+  mqtt_publish_data(topic, data, QOS_1, NO_RETAIN);
 }
+#endif //CONFIG_MQTT_BINARY_PAYLOAD
 
 #if CONFIG_MQTT_THERMOSTAT_ENABLE_NOTIFICATIONS
 void publish_thermostat_notification_evt(const char* msg)
@@ -364,34 +392,6 @@ void publish_normal_thermostat_notification(enum ThermostatState state,
 }
 #endif // CONFIG_MQTT_THERMOSTAT_ENABLE_NOTIFICATIONS
 
-void disableThermostat(const char * reason)
-{
-  thermostatState=THERMOSTAT_STATE_IDLE;
-  update_relay_status(CONFIG_MQTT_THERMOSTAT_RELAY_ID, RELAY_STATUS_OFF);
-
-  publish_all_normal_thermostats_action_evt();
-#if CONFIG_MQTT_THERMOSTAT_ENABLE_NOTIFICATIONS
-  publish_normal_thermostat_notification(thermostatState, thermostatDuration, reason);
-#endif // CONFIG_MQTT_THERMOSTAT_ENABLE_NOTIFICATIONS
-
-  thermostatDuration = 0;
-  ESP_LOGI(TAG, "thermostat disabled");
-}
-
-void enableThermostat(const char * reason)
-{
-  thermostatState=THERMOSTAT_STATE_HEATING;
-  update_relay_status(CONFIG_MQTT_THERMOSTAT_RELAY_ID, RELAY_STATUS_ON);
-
-  publish_all_normal_thermostats_action_evt();
-#if CONFIG_MQTT_THERMOSTAT_ENABLE_NOTIFICATIONS
-  publish_normal_thermostat_notification(thermostatState, thermostatDuration, reason);
-#endif // CONFIG_MQTT_THERMOSTAT_ENABLE_NOTIFICATIONS
-
-  thermostatDuration = 0;
-  ESP_LOGI(TAG, "thermostat enabled");
-}
-
 #if CONFIG_MQTT_THERMOSTAT_ENABLE_NOTIFICATIONS
 void publish_circuit_thermostat_notification(enum HeatingState state,
                                              unsigned int duration)
@@ -409,9 +409,12 @@ void publish_circuit_thermostat_notification(enum HeatingState state,
 
 void enableHeating()
 {
+  thermostatDirty = true;
   heatingState = HEATING_STATE_ENABLED;
+  thermostat_duty_transition(THERMOSTAT_DUTY_HEATING, true, circuitThermostatId,
+                             THERMOSTAT_REASON_CIRCUIT_RISE, time(NULL));
 
-  publish_all_circuit_thermostats_action_evt();
+  publish_thermostats_action_evt(THERMOSTAT_TYPE_CIRCUIT);
 #if CONFIG_MQTT_THERMOSTAT_ENABLE_NOTIFICATIONS
   publish_circuit_thermostat_notification(heatingState, heatingDuration);
 #endif // CONFIG_MQTT_THERMOSTAT_ENABLE_NOTIFICATIONS
@@ -422,9 +425,12 @@ void enableHeating()
 
 void disableHeating()
 {
+  thermostatDirty = true;
   heatingState = HEATING_STATE_IDLE;
+  thermostat_duty_transition(THERMOSTAT_DUTY_HEATING, false, circuitThermostatId,
+                             THERMOSTAT_REASON_CIRCUIT_FALL, time(NULL));
 
-  publish_all_circuit_thermostats_action_evt();
+  publish_thermostats_action_evt(THERMOSTAT_TYPE_CIRCUIT);
 #if CONFIG_MQTT_THERMOSTAT_ENABLE_NOTIFICATIONS
   publish_circuit_thermostat_notification(heatingState, heatingDuration);
 #endif // CONFIG_MQTT_THERMOSTAT_ENABLE_NOTIFICATIONS
@@ -433,22 +439,41 @@ void disableHeating()
   ESP_LOGI(TAG, "heating2 disabled");
 }
 
+// reading from age samples ago, 0 is the current one
+static short thermostat_history(const struct Thermostat *th, int age)
+{
+  if (age == 0)
+    return th->currentTemperature;
+  return th->history[(th->historyNext + THERMOSTAT_HISTORY_NB - age) % THERMOSTAT_HISTORY_NB];
+}
+
+// the current reading moves to the history ring, true when it changed
+bool thermostat_add_reading(int id, short temperature)
+{
+  struct Thermostat *th = &thermostats[id];
+  th->history[th->historyNext] = th->currentTemperature;
+  th->historyNext = (th->historyNext + 1) % THERMOSTAT_HISTORY_NB;
+  if (th->currentTemperature == temperature)
+    return false;
+  th->currentTemperature = temperature;
+  return true;
+}
+
 void dump_data()
 {
   ESP_LOGI(TAG, "thermostat state is %d", thermostatState);
   ESP_LOGI(TAG, "heating state is %d", heatingState);
   for(int id = 0; id < CONFIG_MQTT_THERMOSTATS_NB; id++) {
-    ESP_LOGI(TAG, "thermostatMode[%d] is %d", id, thermostatMode[id]);
-    ESP_LOGI(TAG, "currentTemperature[%d] is %d", id, currentTemperature[id]);
-    ESP_LOGI(TAG, "currentTemperatureFlag[%d] is %d", id, currentTemperatureFlag[id]);
-    ESP_LOGI(TAG, "targetTemperature[%d] is %d", id, targetTemperature[id]);
-    if (thermostatType[id] == THERMOSTAT_TYPE_NORMAL) {
-      ESP_LOGI(TAG, "temperatureTolerance[%d] is %d", id, temperatureTolerance[id]);
+    const struct Thermostat *th = &thermostats[id];
+    ESP_LOGD(TAG, "thermostat[%d] mode %d, ctemp %d, flag %d, temp %d",
+             id, th->mode, th->currentTemperature, th->currentTemperatureFlag, th->targetTemperature);
+    if (th->type == THERMOSTAT_TYPE_NORMAL) {
+      ESP_LOGD(TAG, "thermostat[%d] tolerance %d", id, th->temperatureTolerance);
     }
-    if (thermostatType[id] == THERMOSTAT_TYPE_CIRCUIT) {
-      ESP_LOGI(TAG, "currentTemperature_1[%d] is %d", id, currentTemperature_1);
-      ESP_LOGI(TAG, "currentTemperature_2[%d] is %d", id, currentTemperature_2);
-      ESP_LOGI(TAG, "currentTemperature_3[%d] is %d", id, currentTemperature_3);
+    if (th->type == THERMOSTAT_TYPE_CIRCUIT) {
+      for (int age = 1; age < THERMOSTAT_TREND_SAMPLES; age++) {
+        ESP_LOGD(TAG, "thermostat[%d] ctemp -%d is %d", id, age, thermostat_history(th, age));
+      }
     }
   }
 }
@@ -457,7 +482,7 @@ bool sensor_reporting()
 {
   bool sensorReporting = false;
   for(int id = 0; id < CONFIG_MQTT_THERMOSTATS_NB; id++) {
-    if (thermostatType[id] == THERMOSTAT_TYPE_NORMAL && currentTemperatureFlag[id] != 0) {
+    if (thermostats[id].type == THERMOSTAT_TYPE_NORMAL && thermostats[id].currentTemperatureFlag != 0) {
       sensorReporting = true;
       break;
     }
@@ -465,34 +490,62 @@ bool sensor_reporting()
   return sensorReporting;
 }
 
+static bool thermostat_heat_active(const struct Thermostat *th)
+{
+  return th->currentTemperatureFlag > 0 && th->mode == THERMOSTAT_MODE_HEAT;
+}
+
+// least squares fit of the last circuit readings, x is the reading
+// index and y the temperature relative to the oldest known reading so
+// the sums fit in an int. The slope in hundredths of a degree per
+// reading is *num / *den, with *den > 0. Missing readings are skipped.
+static bool circuit_trend(const struct Thermostat *th, int *num, int *den)
+{
+  int n = 0, sx = 0, sy = 0, sxy = 0, sxx = 0;
+  short y0 = SHRT_MIN;
+  for (int x = 0; x < THERMOSTAT_TREND_SAMPLES; x++) {
+    short y = thermostat_history(th, THERMOSTAT_TREND_SAMPLES - 1 - x);
+    if (y == SHRT_MIN)
+      continue;
+    if (y0 == SHRT_MIN)
+      y0 = y;
+    int dy = y - y0;
+    n++;
+    sx += x;
+    sy += dy;
+    sxy += x * dy;
+    sxx += x * x;
+  }
+  if (n < THERMOSTAT_TREND_MIN_SAMPLES)
+    return false;
+  *num = 10 * (n * sxy - sx * sy);
+  *den = n * sxx - sx * sx;
+  ESP_LOGD(TAG, "circuit slope is %d/%d", *num, *den);
+  return true;
+}
+
+// circuit temperature rises faster than THERMOSTAT_TREND_RISE
 bool heating()
 {
   if (circuitThermostatId == -1)
     return false;
-  bool heating = false;
-  if ((currentTemperatureFlag[circuitThermostatId] > 0) && thermostatMode[circuitThermostatId] == THERMOSTAT_MODE_HEAT) {
-    if (currentTemperature_3 < currentTemperature_2 &&
-        currentTemperature_2 < currentTemperature_1 &&
-        currentTemperature_1 < currentTemperature[circuitThermostatId]) {
-      heating = true;
-    }
-  }
-  return heating;
+  const struct Thermostat *th = &thermostats[circuitThermostatId];
+  int num, den;
+  if (!thermostat_heat_active(th) || !circuit_trend(th, &num, &den))
+    return false;
+  return num >= THERMOSTAT_TREND_RISE * den;
 }
 
+// circuit temperature is flat or falling, below THERMOSTAT_TREND_FALL
 bool not_heating()
 {
   if (circuitThermostatId == -1)
     return false;
-  bool not_heating = false;
-  if ((currentTemperatureFlag[circuitThermostatId] > 0) && thermostatMode[circuitThermostatId] == THERMOSTAT_MODE_HEAT) {
-    if (currentTemperature_3 >= currentTemperature_2 &&
-        currentTemperature_2 >= currentTemperature_1 &&
-        currentTemperature_1 >= currentTemperature[circuitThermostatId]) {
-      not_heating = true;
-    }
-  }
-  return not_heating;
+  const struct Thermostat *th = &thermostats[circuitThermostatId];
+  int num, den;
+  if (!thermostat_heat_active(th) || !circuit_trend(th, &num, &den))
+    return false;
+  return num <= THERMOSTAT_TREND_FALL * den;
 }
 
 bool circuitColdEnough()
@@ -500,76 +553,134 @@ bool circuitColdEnough()
   ESP_LOGI(TAG, "checking circuit %d cold enough", circuitThermostatId);
   if (circuitThermostatId == -1)
     return true;
-  if ((currentTemperatureFlag[circuitThermostatId] > 0) && thermostatMode[circuitThermostatId] == THERMOSTAT_MODE_HEAT)
-    return  (currentTemperature[circuitThermostatId] <= targetTemperature[circuitThermostatId]);
+  const struct Thermostat *th = &thermostats[circuitThermostatId];
+  if (thermostat_heat_active(th))
+    return  (th->currentTemperature <= th->targetTemperature);
   else
     return true;
 }
 
-bool tooHot(char* reason)
+// every active normal thermostat is above its target, also true when
+// none is active
+bool tooHot()
 {
-  bool tooHot = true;
-  char tstr[64];
-  bool reasonUpdated = false;
-
   for(int id = 0; id < CONFIG_MQTT_THERMOSTATS_NB; id++) {
-    if ((currentTemperatureFlag[id] > 0) && thermostatMode[id] == THERMOSTAT_MODE_HEAT) {
-      if (thermostatType[id] == THERMOSTAT_TYPE_NORMAL) {
-        if (currentTemperature[id] > (targetTemperature[id] + temperatureTolerance[id])) {
-          ESP_LOGI(TAG, "thermostat[%d] is hot enough", id);
-          sprintf(tstr, "%s thermostat is hot enough, ", thermostatFriendlyName[id]);
-          strcat(reason, tstr);
-          reasonUpdated = true;
-        } else {
-          tooHot = false;
-          ESP_LOGI(TAG, "thermostat[%d] is not too hot", id);
-          break;
-        }
-      }
+    const struct Thermostat *th = &thermostats[id];
+    if (thermostat_heat_active(th) && th->type == THERMOSTAT_TYPE_NORMAL &&
+        th->currentTemperature <= (th->targetTemperature + th->temperatureTolerance)) {
+      ESP_LOGD(TAG, "thermostat[%d] is not too hot", id);
+      return false;
     }
   }
-  if (tooHot && strlen(reason) == 0) {
-    strcat(reason, "No normal thermostat is enabled");
-  } else if (reasonUpdated) {
-    reason[strlen(reason)-2] = 0;
-  }
-  return tooHot;
+  return true;
 }
 
-bool tooCold(char* reason)
+// first active normal thermostat below its target, -1 when none
+int tooCold()
 {
-  bool tooCold = false;
-  char tstr[64];
   for(int id = 0; id < CONFIG_MQTT_THERMOSTATS_NB; id++) {
-    if ((currentTemperatureFlag[id] > 0) && thermostatMode[id] == THERMOSTAT_MODE_HEAT) {
-      if (thermostatType[id] == THERMOSTAT_TYPE_NORMAL) {
-        if (currentTemperature[id] < (targetTemperature[id] - temperatureTolerance[id])) {
-          ESP_LOGI(TAG, "thermostat[%d] is too cold", id);
-          sprintf(tstr, "%s thermostat is too cold, ", thermostatFriendlyName[id]);
-          strcat(reason, tstr);
-          tooCold = true;
-          break;
-        } else {
-          ESP_LOGI(TAG, "thermostat[%d] is good", id);
-        }
-      }
+    const struct Thermostat *th = &thermostats[id];
+    if (thermostat_heat_active(th) && th->type == THERMOSTAT_TYPE_NORMAL &&
+        th->currentTemperature < (th->targetTemperature - th->temperatureTolerance)) {
+      ESP_LOGD(TAG, "thermostat[%d] is too cold", id);
+      return id;
     }
   }
-  if (tooCold) {
-    reason[strlen(reason)-2] = 0;
+  return -1;
+}
+
+#if CONFIG_MQTT_THERMOSTAT_ENABLE_NOTIFICATIONS
+// reasons are only formatted for notifications
+static void too_hot_reason(char *reason, int size)
+{
+  int len = 0;
+  reason[0] = 0;
+  for(int id = 0; id < CONFIG_MQTT_THERMOSTATS_NB && len < size; id++) {
+    const struct Thermostat *th = &thermostats[id];
+    if (thermostat_heat_active(th) && th->type == THERMOSTAT_TYPE_NORMAL) {
+      len += snprintf(reason + len, size - len, "%s%s thermostat is hot enough",
+                      len ? ", " : "", th->friendlyName);
+    }
   }
-  return tooCold;
+  if (len == 0) {
+    snprintf(reason, size, "No normal thermostat is enabled");
+  }
+}
+
+static void too_cold_reason(char *reason, int size, int id)
+{
+  snprintf(reason, size, "%s thermostat is too cold", thermostats[id].friendlyName);
 }
 
+static void publish_thermostat_reason_notification(enum ThermostatReason reason, int id)
+{
+  char text[THERMOSTAT_REASON_SIZE];
+  switch (reason) {
+  case THERMOSTAT_REASON_TOO_COLD:
+    too_cold_reason(text, sizeof(text), id);
+    break;
+  case THERMOSTAT_REASON_HOT_ENOUGH:
+    too_hot_reason(text, sizeof(text));
+    break;
+  case THERMOSTAT_REASON_NO_SENSOR:
+    snprintf(text, sizeof(text), "No live sensor is reporting");
+    break;
+  default:
+    snprintf(text, sizeof(text), "Heating is toggled off");
+    break;
+  }
+  publish_normal_thermostat_notification(thermostatState, thermostatDuration, text);
+}
+#endif // CONFIG_MQTT_THERMOSTAT_ENABLE_NOTIFICATIONS
+
+// id is the thermostat behind the decision, -1 when there is none
+void disableThermostat(enum ThermostatReason reason, int id)
+{
+  thermostatDirty = true;
+  thermostatState=THERMOSTAT_STATE_IDLE;
+  update_relay_status(CONFIG_MQTT_THERMOSTAT_RELAY_ID, RELAY_STATUS_OFF);
+  thermostat_duty_transition(THERMOSTAT_DUTY_RELAY, false, id, reason, time(NULL));
+
+  publish_thermostats_action_evt(THERMOSTAT_TYPE_NORMAL);
+#if CONFIG_MQTT_THERMOSTAT_ENABLE_NOTIFICATIONS
+  publish_thermostat_reason_notification(reason, id);
+#endif // CONFIG_MQTT_THERMOSTAT_ENABLE_NOTIFICATIONS
+
+  thermostatDuration = 0;
+  ESP_LOGI(TAG, "thermostat disabled, reason %d", reason);
+}
+
+void enableThermostat(enum ThermostatReason reason, int id)
+{
+  thermostatDirty = true;
+  thermostatState=THERMOSTAT_STATE_HEATING;
+  update_relay_status(CONFIG_MQTT_THERMOSTAT_RELAY_ID, RELAY_STATUS_ON);
+  thermostat_duty_transition(THERMOSTAT_DUTY_RELAY, true, id, reason, time(NULL));
+
+  publish_thermostats_action_evt(THERMOSTAT_TYPE_NORMAL);
+#if CONFIG_MQTT_THERMOSTAT_ENABLE_NOTIFICATIONS
+  publish_thermostat_reason_notification(reason, id);
+#endif // CONFIG_MQTT_THERMOSTAT_ENABLE_NOTIFICATIONS
+
+  thermostatDuration = 0;
+  ESP_LOGI(TAG, "thermostat enabled, reason %d", reason);
+}
+
+// the outcome only depends on the readings, the settings and the
+// current states, a tick with none of them changed is skipped
 void update_thermostat()
 {
+  if (!thermostatDirty) {
+    return;
+  }
+  thermostatDirty = false;
   dump_data();
 
   if (!sensor_reporting()) {
     ESP_LOGI(TAG, "no live sensor is reporting => no thermostat handling");
     if (thermostatState==THERMOSTAT_STATE_HEATING) {
       ESP_LOGI(TAG, "stop thermostat as no live sensor is reporting");
-      disableThermostat("No live sensor is reporting");
+      disableThermostat(THERMOSTAT_REASON_NO_SENSOR, -1);
     }
     return;
   }
@@ -586,146 +697,162 @@ void update_thermostat()
   if (thermostatState == THERMOSTAT_STATE_HEATING &&
       heatingToggledOff) {
     ESP_LOGI(TAG, "reason: Heating is toggled off");
-    disableThermostat("Heating is toggled off");
+    disableThermostat(THERMOSTAT_REASON_HEATING_OFF, circuitThermostatId);
   }
 
-
-  char reason[256];
-  memset(reason,0,256);
-
   if (thermostatState == THERMOSTAT_STATE_HEATING) {
-    if (tooHot(reason)) {
-      ESP_LOGI(TAG, "Turning thermostat off, reason: %s", reason);
-      disableThermostat(reason);
+    if (tooHot()) {
+      ESP_LOGI(TAG, "Turning thermostat off, every thermostat is hot enough");
+      disableThermostat(THERMOSTAT_REASON_HOT_ENOUGH, -1);
     }
   } else if (circuitColdEnough()) {
-    if (tooCold(reason)) {
-      ESP_LOGI(TAG, "Turning thermostat on, reason: %s", reason);
-      enableThermostat(reason);
+    int id = tooCold();
+    if (id >= 0) {
+      ESP_LOGI(TAG, "Turning thermostat on, thermostat %d is too cold", id);
+      enableThermostat(THERMOSTAT_REASON_TOO_COLD, id);
     }
   }
 }
 
-void vThermostatTimerCallback( TimerHandle_t xTimer )
+static struct TimerWheelEntry thermostatLifeTick;
+
+static void thermostat_life_tick_expired(struct TimerWheelEntry *entry)
 {
   ESP_LOGI(TAG, "Thermostat timer expired");
   struct ThermostatMessage t;
+  memset(&t, 0, sizeof(struct ThermostatMessage));
   t.msgType = THERMOSTAT_LIFE_TICK;
-  if (xQueueSend( thermostatQueue,
-                  ( void * )&t,
-                  MQTT_QUEUE_TIMEOUT) != pdPASS) {
+  // a missed life tick is made up by the next one
+  if (!event_bus_publish(EVENT_THERMOSTAT_CMD, &t, sizeof(t), 0)) {
+    ESP_LOGE(TAG, "Cannot publish thermostat command");
   }
 }
 
-void handle_thermostat_cmd_task(void* pvParameters)
+// commands and readings addressed to one thermostat
+static void handle_thermostat_update(struct Thermostat *th, const struct ThermostatMessage *t)
 {
-  //init remaining variables
-#ifdef CONFIG_MQTT_THERMOSTATS_NB0_TYPE_CIRCUIT
-  thermostatType[0]=THERMOSTAT_TYPE_CIRCUIT;
-  circuitThermostatId=0;
-#endif // CONFIG_MQTT_THERMOSTATS_NB0_TYPE_CIRCUIT
-
-#ifdef CONFIG_MQTT_THERMOSTATS_NB1_TYPE_CIRCUIT
-  thermostatType[1]=THERMOSTAT_TYPE_CIRCUIT;
-  circuitThermostatId=1;
-#endif // CONFIG_MQTT_THERMOSTATS_NB1_TYPE_CIRCUIT
-
-#ifdef CONFIG_MQTT_THERMOSTATS_NB2_TYPE_CIRCUIT
-  thermostatType[2]=THERMOSTAT_TYPE_CIRCUIT;
-  circuitThermostatId=2;
-#endif // CONFIG_MQTT_THERMOSTATS_NB2_TYPE_CIRCUIT
-
-#ifdef CONFIG_MQTT_THERMOSTATS_NB3_TYPE_CIRCUIT
-  thermostatType[3]=THERMOSTAT_TYPE_CIRCUIT;
-  circuitThermostatId=3;
-#endif // CONFIG_MQTT_THERMOSTATS_NB3_TYPE_CIRCUIT
-
-  //create period read timer
-  TimerHandle_t th =
-    xTimerCreate( "thermostatLifeTickTimer",           /* Text name. */
-                  pdMS_TO_TICKS(CONFIG_MQTT_THERMOSTATS_TICK_PERIOD * 1000),  /* Period. */
-                  pdTRUE,                /* Autoreload. */
-                  (void *)0,                  /* No ID. */
-                  vThermostatTimerCallback );  /* Callback function. */
-  if( th != NULL ) {
-    ESP_LOGI(TAG, "timer is created");
-    if (xTimerStart(th, portMAX_DELAY) != pdFALSE){
-      ESP_LOGI(TAG, "timer is active");
+  char tag[THERMOSTAT_NVS_TAG_SIZE];
+
+  if (t->msgType == THERMOSTAT_CURRENT_TEMPERATURE) {
+    ESP_LOGI(TAG, "Update temperature for thermostat %d", t->thermostatId);
+    if (t->data.currentTemperature != SHRT_MIN) {
+      th->currentTemperatureFlag = SENSOR_LIFETIME;
+    }
+
+    thermostatDirty = true;
+    if (thermostat_add_reading(t->thermostatId, t->data.currentTemperature)) {
+      publish_thermostat_current_temperature_evt(t->thermostatId);
     }
   }
-  struct ThermostatMessage t;
-  while(1) {
-    if( xQueueReceive( thermostatQueue, &t , portMAX_DELAY) )
-      {
-        if (t.msgType == THERMOSTAT_LIFE_TICK) {
-          thermostatDuration += 1;
-          heatingDuration += 1; //fixme heatingControlStillNotClear4Me
-
-          for(int id = 0; id < CONFIG_MQTT_THERMOSTATS_NB; id++) {
-            if (currentTemperatureFlag[id] > 0) {
-              currentTemperatureFlag[id] -= 1;
-              if (currentTemperatureFlag[id] == 0) {
-                publish_thermostat_current_temperature_evt(id);
-              }
-            }
-          }
-          update_thermostat();
-        }
 
-        //new messages
-        if (t.msgType == THERMOSTAT_CURRENT_TEMPERATURE) {
-          ESP_LOGI(TAG, "Update temperature for thermostat %d", t.thermostatId);
-          if (t.data.currentTemperature != SHRT_MIN) {
-            currentTemperatureFlag[t.thermostatId] = SENSOR_LIFETIME;
-          }
-
-          if (circuitThermostatId == t.thermostatId) {
-            if (currentTemperature_3 != currentTemperature_2) {
-              currentTemperature_3 = currentTemperature_2;
-            }
-            if (currentTemperature_2 != currentTemperature_1) {
-              currentTemperature_2 = currentTemperature_1;
-            }
-            if (currentTemperature_1 != currentTemperature[t.thermostatId]) {
-              currentTemperature_1 = currentTemperature[t.thermostatId];
-            }
-          }
-          if (currentTemperature[t.thermostatId] != t.data.currentTemperature) {
-            currentTemperature[t.thermostatId] = t.data.currentTemperature;
-            publish_thermostat_current_temperature_evt(t.thermostatId);
-          }
-        }
+  if (t->msgType == THERMOSTAT_CMD_MODE) {
+    if (th->mode != t->data.thermostatMode) {
+      th->mode = t->data.thermostatMode;
+      thermostatDirty = true;
+      thermostat_nvs_tag(tag, THERMOSTAT_NVS_MODE, t->thermostatId);
+      esp_err_t err = write_nvs_short(tag, th->mode);
+      ESP_ERROR_CHECK( err );
+    }
+    publish_thermostat_mode_evt(t->thermostatId);
+    publish_thermostat_action_evt(t->thermostatId);
+  }
 
-        if (t.msgType == THERMOSTAT_CMD_MODE) {
-          if (thermostatMode[t.thermostatId] != t.data.thermostatMode) {
-            thermostatMode[t.thermostatId] = t.data.thermostatMode;
-            esp_err_t err = write_nvs_short(thermostatModeTAG[t.thermostatId],
-                                            thermostatMode[t.thermostatId]);
-            ESP_ERROR_CHECK( err );
-          }
-          publish_thermostat_mode_evt(t.thermostatId);
-          publish_thermostat_action_evt(t.thermostatId);
-        }
+  if (t->msgType == THERMOSTAT_CMD_TARGET_TEMPERATURE) {
+    if (th->targetTemperature != t->data.targetTemperature) {
+      th->targetTemperature = t->data.targetTemperature;
+      thermostatDirty = true;
+      thermostat_nvs_tag(tag, THERMOSTAT_NVS_TARGET_TEMPERATURE, t->thermostatId);
+      esp_err_t err = write_nvs_short(tag, th->targetTemperature);
+      ESP_ERROR_CHECK( err );
+    }
+    publish_thermostat_target_temperature_evt(t->thermostatId);
+  }
+
+  if (t->msgType == THERMOSTAT_CMD_TOLERANCE) {
+    if (th->temperatureTolerance != t->data.tolerance) {
+      th->temperatureTolerance = t->data.tolerance;
+      thermostatDirty = true;
+      thermostat_nvs_tag(tag, THERMOSTAT_NVS_TOLERANCE, t->thermostatId);
+      esp_err_t err = write_nvs_short(tag, th->temperatureTolerance);
+      ESP_ERROR_CHECK( err );
+    }
+    publish_thermostat_temperature_tolerance_evt(t->thermostatId);
+  }
+}
 
-        if (t.msgType == THERMOSTAT_CMD_TARGET_TEMPERATURE) {
-          if (targetTemperature[t.thermostatId] != t.data.targetTemperature) {
-            targetTemperature[t.thermostatId] = t.data.thermostatMode;
-            esp_err_t err = write_nvs_short(targetTemperatureTAG[t.thermostatId],
-                                            targetTemperature[t.thermostatId]);
-            ESP_ERROR_CHECK( err );
-          }
-          publish_thermostat_target_temperature_evt(t.thermostatId);
+static void handle_thermostat_message(const struct ThermostatMessage *t, unsigned int dequeued)
+{
+  if (t->msgType == THERMOSTAT_LIFE_TICK) {
+    thermostatDuration += 1;
+    heatingDuration += 1; //fixme heatingControlStillNotClear4Me
+    thermostat_duty_tick(thermostatState == THERMOSTAT_STATE_HEATING,
+                         heatingState == HEATING_STATE_ENABLED);
+
+    for(int id = 0; id < CONFIG_MQTT_THERMOSTATS_NB; id++) {
+      struct Thermostat *th = &thermostats[id];
+      if (th->currentTemperatureFlag > 0) {
+        th->currentTemperatureFlag -= 1;
+        if (th->currentTemperatureFlag == 0) {
+          thermostatDirty = true;
+          publish_thermostat_current_temperature_evt(id);
         }
+      }
+    }
+    update_thermostat();
+  } else if (t->msgType == THERMOSTAT_CMD_DUTY) {
+    publish_thermostat_duty();
+  } else if (t->thermostatId < CONFIG_MQTT_THERMOSTATS_NB) {
+    handle_thermostat_update(&thermostats[t->thermostatId], t);
+  } else {
+    ESP_LOGE(TAG, "bad thermostat id %d", t->thermostatId);
+  }
+
+  if (t->trace.received) {
+    latency_record(LATENCY_THERMOSTAT_DISPATCH, t->trace.received, t->trace.queued);
+    latency_record(LATENCY_THERMOSTAT_QUEUE, t->trace.queued, dequeued);
+    latency_record(LATENCY_THERMOSTAT_HANDLE, dequeued, latency_now());
+  }
+}
+
+// the temperature of local sensors arrives as plain samples, the
+// thermostats fed by their topic take it as a current temperature
+static void handle_sensor_sample(const struct SensorSample *s, unsigned int dequeued)
+{
+  for(int id = 0; id < CONFIG_MQTT_THERMOSTATS_NB; id++) {
+    const char *topic = thermostats[id].localSensorTopic;
+    if (topic && strncmp(s->topic, topic, strlen(topic)) == 0) {
+      struct ThermostatMessage t;
+      memset(&t, 0, sizeof(struct ThermostatMessage));
+      t.msgType = THERMOSTAT_CURRENT_TEMPERATURE;
+      t.thermostatId = id;
+      t.data.currentTemperature = s->value;
+      handle_thermostat_message(&t, dequeued);
+    }
+  }
+}
 
-        if (t.msgType == THERMOSTAT_CMD_TOLERANCE) {
-          if (temperatureTolerance[t.thermostatId] != t.data.tolerance) {
-            temperatureTolerance[t.thermostatId]=t.data.tolerance;
-            esp_err_t err = write_nvs_short(temperatureToleranceTAG[t.thermostatId],
-                                            temperatureTolerance[t.thermostatId]);
-            ESP_ERROR_CHECK( err );
-          }
-          publish_thermostat_temperature_tolerance_evt(t.thermostatId);
+// pvParameters is the inbox subscribed to EVENT_THERMOSTAT_CMD and
+// EVENT_SENSOR_SAMPLE
+void handle_thermostat_cmd_task(void* pvParameters)
+{
+  //start period life tick
+  timer_wheel_entry_init(&thermostatLifeTick, thermostat_life_tick_expired, 0);
+  timer_wheel_start(&thermostatLifeTick,
+                    CONFIG_MQTT_THERMOSTATS_TICK_PERIOD * 1000,
+                    CONFIG_MQTT_THERMOSTATS_TICK_PERIOD * 1000);
+  QueueHandle_t inbox = (QueueHandle_t)pvParameters;
+  struct AppEvent *e;
+  while(1) {
+    if( xQueueReceive( inbox, &e , portMAX_DELAY) )
+      {
+        unsigned int dequeued = latency_now();
+        if (e->id == EVENT_THERMOSTAT_CMD) {
+          handle_thermostat_message(EVENT_DATA(e), dequeued);
         }
+        if (e->id == EVENT_SENSOR_SAMPLE) {
+          handle_sensor_sample(EVENT_DATA(e), dequeued);
+        }
+        event_bus_release(e);
       }
   }
 }
@@ -733,20 +860,48 @@ void handle_thermostat_cmd_task(void* pvParameters)
 void read_nvs_thermostat_data()
 {
   esp_err_t err;
+  char tag[THERMOSTAT_NVS_TAG_SIZE];
 
   for(int id = 0; id < CONFIG_MQTT_THERMOSTATS_NB; id++) {
-    err=read_nvs_short(thermostatModeTAG[id], (short*) &thermostatMode[id]);
+    struct Thermostat *th = &thermostats[id];
+    short mode = th->mode;
+    thermostat_nvs_tag(tag, THERMOSTAT_NVS_MODE, id);
+    err=read_nvs_short(tag, &mode);
     ESP_ERROR_CHECK( err );
-  }
+    th->mode = mode;
 
-  for(int id = 0; id < CONFIG_MQTT_THERMOSTATS_NB; id++) {
-    err=read_nvs_short(targetTemperatureTAG[id], (short*) &targetTemperature[id]);
+    thermostat_nvs_tag(tag, THERMOSTAT_NVS_TARGET_TEMPERATURE, id);
+    err=read_nvs_short(tag, &th->targetTemperature);
+    ESP_ERROR_CHECK( err );
+
+    thermostat_nvs_tag(tag, THERMOSTAT_NVS_TOLERANCE, id);
+    err=read_nvs_short(tag, &th->temperatureTolerance);
     ESP_ERROR_CHECK( err );
   }
+}
 
+void thermostats_init()
+{
   for(int id = 0; id < CONFIG_MQTT_THERMOSTATS_NB; id++) {
-    err=read_nvs_short(temperatureToleranceTAG[id], (short*) &temperatureTolerance[id]);
-    ESP_ERROR_CHECK( err );
+    struct Thermostat *th = &thermostats[id];
+    memset(th, 0, sizeof(struct Thermostat));
+    th->mode = THERMOSTAT_MODE_UNSET;
+    th->type = id == circuitThermostatId ? THERMOSTAT_TYPE_CIRCUIT : THERMOSTAT_TYPE_NORMAL;
+    th->targetTemperature = 21*10;
+    th->temperatureTolerance = 5; //0.5
+    th->currentTemperature = SHRT_MIN;
+    for (int i = 0; i < THERMOSTAT_HISTORY_NB; i++) {
+      th->history[i] = SHRT_MIN;
+    }
+    if (thermostatConfigName[id]) {
+      snprintf(th->friendlyName, sizeof(th->friendlyName), "%s", thermostatConfigName[id]);
+    } else {
+      snprintf(th->friendlyName, sizeof(th->friendlyName), "t%d", id);
+    }
+    th->localSensorTopic = thermostatConfigLocalSensorTopic[id];
   }
+  read_nvs_thermostat_data();
+  thermostat_duty_init();
+  thermostatDirty = true;
 }
 #endif // CONFIG_MQTT_THERMOSTATS_NB > 0
@@ -3,6 +3,8 @@
 
 #include "freertos/FreeRTOS.h"
 
+#include "app_latency.h"
+
 #define BIT_THERMOSTAT 1
 #define BIT_HEAT (1 << 1)
 
@@ -76,14 +78,58 @@ union ThermostatData {
 
 
 #define THERMOSTAT_CURRENT_TEMPERATURE 14
+#define THERMOSTAT_CMD_DUTY 15
 
 struct ThermostatMessage {
   unsigned char msgType;
   unsigned char thermostatId;
   union ThermostatData data;
+  struct LatencyTrace trace;
+};
+
+/* readings the circuit trend is fitted on, the current one included */
+#ifdef CONFIG_MQTT_THERMOSTATS_CIRCUIT_SAMPLES
+#define THERMOSTAT_TREND_SAMPLES CONFIG_MQTT_THERMOSTATS_CIRCUIT_SAMPLES
+#else //CONFIG_MQTT_THERMOSTATS_CIRCUIT_SAMPLES
+#define THERMOSTAT_TREND_SAMPLES 3
+#endif //CONFIG_MQTT_THERMOSTATS_CIRCUIT_SAMPLES
+
+/* slopes in hundredths of a degree per reading */
+#ifdef CONFIG_MQTT_THERMOSTATS_CIRCUIT_RISE
+#define THERMOSTAT_TREND_RISE CONFIG_MQTT_THERMOSTATS_CIRCUIT_RISE
+#else //CONFIG_MQTT_THERMOSTATS_CIRCUIT_RISE
+#define THERMOSTAT_TREND_RISE 20
+#endif //CONFIG_MQTT_THERMOSTATS_CIRCUIT_RISE
+
+#ifdef CONFIG_MQTT_THERMOSTATS_CIRCUIT_FALL
+#define THERMOSTAT_TREND_FALL CONFIG_MQTT_THERMOSTATS_CIRCUIT_FALL
+#else //CONFIG_MQTT_THERMOSTATS_CIRCUIT_FALL
+#define THERMOSTAT_TREND_FALL 0
+#endif //CONFIG_MQTT_THERMOSTATS_CIRCUIT_FALL
+
+/* previous readings kept per thermostat */
+#define THERMOSTAT_HISTORY_NB (THERMOSTAT_TREND_SAMPLES - 1)
+#define THERMOSTAT_FRIENDLY_NAME_SIZE 16
+
+/* temperatures are in tenths of a degree */
+struct Thermostat {
+  enum ThermostatMode mode;
+  enum ThermostatType type;
+  short targetTemperature;
+  short temperatureTolerance;
+  short currentTemperature;
+  short currentTemperatureFlag; // life ticks left before the reading is stale
+  short history[THERMOSTAT_HISTORY_NB];
+  unsigned char historyNext;
+  char friendlyName[THERMOSTAT_FRIENDLY_NAME_SIZE];
+  const char *localSensorTopic; // NULL when the reading comes over mqtt
 };
 
+void thermostats_init(void);
+bool thermostat_add_reading(int id, short temperature);
 void publish_thermostat_data();
+void publish_thermostats_snapshot();
+void publish_thermostat_duty();
 
 esp_err_t read_thermostat_nvs(const char * tag, int * value);
 
@@ -0,0 +1,115 @@
+#include "esp_system.h"
+
+#if CONFIG_MQTT_THERMOSTATS_NB > 0
+
+#include <limits.h>
+#include <string.h>
+
+#include "app_thermostat_duty.h"
+
+#if CONFIG_MQTT_THERMOSTATS_TICK_PERIOD > 3600
+#error "thermostat duty needs at least one life tick per hour"
+#endif //CONFIG_MQTT_THERMOSTATS_TICK_PERIOD > 3600
+
+#if THERMOSTAT_DUTY_TICKS_PER_HOUR * 24 > USHRT_MAX
+#error "thermostat duty day buckets overflow, raise MQTT_THERMOSTATS_TICK_PERIOD"
+#endif //THERMOSTAT_DUTY_TICKS_PER_HOUR * 24 > USHRT_MAX
+
+struct ThermostatDutyBucket {
+  unsigned short ticks;
+  unsigned short on[THERMOSTAT_DUTY_CHANNELS_NB];
+};
+
+// only the thermostat task records and reports, no locking
+static struct ThermostatTransition dutyTransitions[THERMOSTAT_DUTY_TRANSITIONS_NB];
+static unsigned int dutyTransitionsNb;
+static struct ThermostatDutyBucket dutyHours[THERMOSTAT_DUTY_HOURS_NB];
+static struct ThermostatDutyBucket dutyDays[THERMOSTAT_DUTY_DAYS_NB];
+static unsigned int dutyTicks;
+
+void thermostat_duty_init()
+{
+  memset(dutyTransitions, 0, sizeof(dutyTransitions));
+  memset(dutyHours, 0, sizeof(dutyHours));
+  memset(dutyDays, 0, sizeof(dutyDays));
+  dutyTransitionsNb = 0;
+  dutyTicks = 0;
+}
+
+void thermostat_duty_transition(enum ThermostatDutyChannel channel, bool on,
+                                int thermostatId, enum ThermostatReason reason,
+                                unsigned int ts)
+{
+  struct ThermostatTransition *t = &dutyTransitions[dutyTransitionsNb % THERMOSTAT_DUTY_TRANSITIONS_NB];
+  t->ts = ts;
+  t->thermostatId = thermostatId < 0 ? THERMOSTAT_DUTY_NO_ID : thermostatId;
+  t->channel = channel;
+  t->on = on;
+  t->reason = reason;
+  dutyTransitionsNb++;
+}
+
+static void duty_count(struct ThermostatDutyBucket *b, bool relayOn, bool heatingOn)
+{
+  b->ticks++;
+  b->on[THERMOSTAT_DUTY_RELAY] += relayOn;
+  b->on[THERMOSTAT_DUTY_HEATING] += heatingOn;
+}
+
+// buckets follow the life ticks rather than the wall clock, which may
+// not be set yet
+void thermostat_duty_tick(bool relayOn, bool heatingOn)
+{
+  unsigned int hour = dutyTicks / THERMOSTAT_DUTY_TICKS_PER_HOUR;
+  unsigned int day = hour / 24;
+  if (dutyTicks % THERMOSTAT_DUTY_TICKS_PER_HOUR == 0) {
+    memset(&dutyHours[hour % THERMOSTAT_DUTY_HOURS_NB], 0, sizeof(struct ThermostatDutyBucket));
+    if (hour % 24 == 0) {
+      memset(&dutyDays[day % THERMOSTAT_DUTY_DAYS_NB], 0, sizeof(struct ThermostatDutyBucket));
+    }
+  }
+  duty_count(&dutyHours[hour % THERMOSTAT_DUTY_HOURS_NB], relayOn, heatingOn);
+  duty_count(&dutyDays[day % THERMOSTAT_DUTY_DAYS_NB], relayOn, heatingOn);
+  dutyTicks++;
+}
+
+static void duty_percent(unsigned char *duty, const struct ThermostatDutyBucket *b)
+{
+  for (int c = 0; c < THERMOSTAT_DUTY_CHANNELS_NB; c++) {
+    duty[c] = b->ticks ? b->on[c] * 100 / b->ticks : THERMOSTAT_DUTY_UNKNOWN;
+  }
+}
+
+// buckets past the ones counted since boot are reported unknown
+void thermostat_duty_report(struct ThermostatDutyReport *report)
+{
+  int hours = (dutyTicks + THERMOSTAT_DUTY_TICKS_PER_HOUR - 1) / THERMOSTAT_DUTY_TICKS_PER_HOUR;
+  int days = (hours + 23) / 24;
+
+  for (int i = 0; i < THERMOSTAT_DUTY_HOURS_NB; i++) {
+    int age = THERMOSTAT_DUTY_HOURS_NB - i;
+    if (age > hours) {
+      memset(report->hours[i], THERMOSTAT_DUTY_UNKNOWN, THERMOSTAT_DUTY_CHANNELS_NB);
+    } else {
+      duty_percent(report->hours[i], &dutyHours[(hours - age) % THERMOSTAT_DUTY_HOURS_NB]);
+    }
+  }
+  for (int i = 0; i < THERMOSTAT_DUTY_DAYS_NB; i++) {
+    int age = THERMOSTAT_DUTY_DAYS_NB - i;
+    if (age > days) {
+      memset(report->days[i], THERMOSTAT_DUTY_UNKNOWN, THERMOSTAT_DUTY_CHANNELS_NB);
+    } else {
+      duty_percent(report->days[i], &dutyDays[(days - age) % THERMOSTAT_DUTY_DAYS_NB]);
+    }
+  }
+
+  unsigned int first = dutyTransitionsNb > THERMOSTAT_DUTY_TRANSITIONS_NB ?
+    dutyTransitionsNb - THERMOSTAT_DUTY_TRANSITIONS_NB : 0;
+  report->transitionsNb = dutyTransitionsNb - first;
+  for (int i = 0; i < report->transitionsNb; i++) {
+    report->transitions[i] = dutyTransitions[(first + i) % THERMOSTAT_DUTY_TRANSITIONS_NB];
+  }
+  report->total = dutyTransitionsNb;
+}
+
+#endif // CONFIG_MQTT_THERMOSTATS_NB > 0
@@ -0,0 +1,69 @@
+#ifndef APP_THERMOSTAT_DUTY_H
+#define APP_THERMOSTAT_DUTY_H
+
+#include <stdbool.h>
+
+/* transitions of the thermostat relay and of the circuit heating kept
+   on the device, with the share of life ticks each one was on per hour
+   and per day, queried on demand instead of parsed from notifications */
+
+#ifdef CONFIG_MQTT_THERMOSTAT_DUTY_TRANSITIONS
+#define THERMOSTAT_DUTY_TRANSITIONS_NB CONFIG_MQTT_THERMOSTAT_DUTY_TRANSITIONS
+#else //CONFIG_MQTT_THERMOSTAT_DUTY_TRANSITIONS
+#define THERMOSTAT_DUTY_TRANSITIONS_NB 16
+#endif //CONFIG_MQTT_THERMOSTAT_DUTY_TRANSITIONS
+
+#define THERMOSTAT_DUTY_HOURS_NB 24
+#define THERMOSTAT_DUTY_DAYS_NB 7
+#define THERMOSTAT_DUTY_TICKS_PER_HOUR (3600 / CONFIG_MQTT_THERMOSTATS_TICK_PERIOD)
+
+/* text report, a duty pair per bucket and a tuple per transition */
+#define MAX_MQTT_DATA_THERMOSTAT_DUTY \
+  (64 + (THERMOSTAT_DUTY_HOURS_NB + THERMOSTAT_DUTY_DAYS_NB) * 10 + THERMOSTAT_DUTY_TRANSITIONS_NB * 24)
+
+/* duty of a bucket with no tick counted yet */
+#define THERMOSTAT_DUTY_UNKNOWN 0xff
+/* transition not decided by a single thermostat */
+#define THERMOSTAT_DUTY_NO_ID 0xff
+
+enum ThermostatDutyChannel {
+  THERMOSTAT_DUTY_RELAY = 0, // thermostatState, drives CONFIG_MQTT_THERMOSTAT_RELAY_ID
+  THERMOSTAT_DUTY_HEATING,   // heatingState, detected on the circuit
+  THERMOSTAT_DUTY_CHANNELS_NB
+};
+
+enum ThermostatReason {
+  THERMOSTAT_REASON_TOO_COLD = 1,
+  THERMOSTAT_REASON_HOT_ENOUGH,
+  THERMOSTAT_REASON_NO_SENSOR,
+  THERMOSTAT_REASON_HEATING_OFF,
+  THERMOSTAT_REASON_CIRCUIT_RISE,
+  THERMOSTAT_REASON_CIRCUIT_FALL,
+};
+
+struct ThermostatTransition {
+  unsigned int ts; // seconds since epoch
+  unsigned char thermostatId;
+  unsigned char channel;
+  unsigned char on;
+  unsigned char reason;
+};
+
+/* duties in percent, oldest bucket first and the current partial one
+   last, transitions oldest first */
+struct ThermostatDutyReport {
+  unsigned char hours[THERMOSTAT_DUTY_HOURS_NB][THERMOSTAT_DUTY_CHANNELS_NB];
+  unsigned char days[THERMOSTAT_DUTY_DAYS_NB][THERMOSTAT_DUTY_CHANNELS_NB];
+  struct ThermostatTransition transitions[THERMOSTAT_DUTY_TRANSITIONS_NB];
+  int transitionsNb;
+  unsigned int total; // transitions recorded since boot, older ones are lost
+};
+
+void thermostat_duty_init(void);
+void thermostat_duty_transition(enum ThermostatDutyChannel channel, bool on,
+                                int thermostatId, enum ThermostatReason reason,
+                                unsigned int ts);
+void thermostat_duty_tick(bool relayOn, bool heatingOn);
+void thermostat_duty_report(struct ThermostatDutyReport *report);
+
+#endif /* APP_THERMOSTAT_DUTY_H */
@@ -0,0 +1,172 @@
+#include "esp_system.h"
+#include "esp_log.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "freertos/semphr.h"
+
+#include <string.h>
+
+#include "app_timer_wheel.h"
+
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_SHIFT(level) ((level) * TIMER_WHEEL_SLOT_BITS)
+
+static const char *TAG = "TIMER_WHEEL";
+
+// slot i of level l holds the entries expiring when bits of the tick
+// from l * TIMER_WHEEL_SLOT_BITS up are i, level 0 slots expire as is
+static struct TimerWheelEntry *timerWheel[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+static unsigned int timerWheelNow;
+static SemaphoreHandle_t timerWheelMutex;
+
+static void wheel_link(struct TimerWheelEntry **head, struct TimerWheelEntry *entry)
+{
+  entry->next = *head;
+  if (entry->next) {
+    entry->next->pprev = &entry->next;
+  }
+  *head = entry;
+  entry->pprev = head;
+}
+
+static void wheel_unlink(struct TimerWheelEntry *entry)
+{
+  *entry->pprev = entry->next;
+  if (entry->next) {
+    entry->next->pprev = entry->pprev;
+  }
+  entry->next = NULL;
+  entry->pprev = NULL;
+}
+
+// the lowest level whose slots span the time left
+static void wheel_insert(struct TimerWheelEntry *entry)
+{
+  int left = (int)(entry->expiry - timerWheelNow);
+  if (left <= 0) {
+    wheel_link(&timerWheel[0][(timerWheelNow + 1) & TIMER_WHEEL_MASK], entry);
+    return;
+  }
+  for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+    if (left < 1 << TIMER_WHEEL_SHIFT(level + 1)) {
+      int slot = (entry->expiry >> TIMER_WHEEL_SHIFT(level)) & TIMER_WHEEL_MASK;
+      wheel_link(&timerWheel[level][slot], entry);
+      return;
+    }
+  }
+  // beyond the wheel, the last slot to come up on the top level
+  int top = TIMER_WHEEL_LEVELS - 1;
+  int slot = ((timerWheelNow >> TIMER_WHEEL_SHIFT(top)) - 1) & TIMER_WHEEL_MASK;
+  wheel_link(&timerWheel[top][slot], entry);
+}
+
+// entries of the slot coming up move down to the lower levels
+static void wheel_cascade(int level)
+{
+  struct TimerWheelEntry **head =
+    &timerWheel[level][(timerWheelNow >> TIMER_WHEEL_SHIFT(level)) & TIMER_WHEEL_MASK];
+  struct TimerWheelEntry *entry = *head;
+  *head = NULL;
+  while (entry) {
+    struct TimerWheelEntry *next = entry->next;
+    wheel_insert(entry);
+    entry = next;
+  }
+}
+
+static unsigned int wheel_ticks(unsigned int ms)
+{
+  return (ms + TIMER_WHEEL_TICK_MS - 1) / TIMER_WHEEL_TICK_MS;
+}
+
+static void timer_wheel_callback(TimerHandle_t xTimer)
+{
+  timer_wheel_advance(1);
+}
+
+// entries still armed from before are left unarmed
+void timer_wheel_init()
+{
+  for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+    for (int slot = 0; slot < TIMER_WHEEL_SLOTS; slot++) {
+      while (timerWheel[level][slot]) {
+        wheel_unlink(timerWheel[level][slot]);
+      }
+    }
+  }
+  timerWheelNow = 0;
+  timerWheelMutex = xSemaphoreCreateMutex();
+
+  TimerHandle_t th =
+    xTimerCreate( "timerWheel",                         /* Text name. */
+                  pdMS_TO_TICKS(TIMER_WHEEL_TICK_MS),   /* Period. */
+                  pdTRUE,                               /* Autoreload. */
+                  (void *)0,                            /* No ID. */
+                  timer_wheel_callback );               /* Callback function. */
+  if (th == NULL || xTimerStart(th, portMAX_DELAY) != pdPASS) {
+    ESP_LOGE(TAG, "cannot start the wheel timer");
+  }
+}
+
+void timer_wheel_entry_init(struct TimerWheelEntry *entry, timer_wheel_cb_t callback, int id)
+{
+  memset(entry, 0, sizeof(struct TimerWheelEntry));
+  entry->callback = callback;
+  entry->id = id;
+}
+
+void timer_wheel_start(struct TimerWheelEntry *entry, unsigned int timeoutMs, unsigned int periodMs)
+{
+  xSemaphoreTake(timerWheelMutex, portMAX_DELAY);
+  if (entry->pprev) {
+    wheel_unlink(entry);
+  }
+  unsigned int timeout = wheel_ticks(timeoutMs);
+  entry->expiry = timerWheelNow + (timeout ? timeout : 1);
+  entry->period = wheel_ticks(periodMs);
+  wheel_insert(entry);
+  xSemaphoreGive(timerWheelMutex);
+}
+
+void timer_wheel_cancel(struct TimerWheelEntry *entry)
+{
+  xSemaphoreTake(timerWheelMutex, portMAX_DELAY);
+  if (entry->pprev) {
+    wheel_unlink(entry);
+  }
+  xSemaphoreGive(timerWheelMutex);
+}
+
+bool timer_wheel_active(const struct TimerWheelEntry *entry)
+{
+  return entry->pprev != NULL;
+}
+
+// callbacks run unlocked so they can start or cancel entries, periodic
+// entries are armed again before their callback runs
+void timer_wheel_advance(unsigned int ticks)
+{
+  xSemaphoreTake(timerWheelMutex, portMAX_DELAY);
+  while (ticks--) {
+    timerWheelNow++;
+    for (int level = TIMER_WHEEL_LEVELS - 1; level > 0; level--) {
+      if ((timerWheelNow & ((1 << TIMER_WHEEL_SHIFT(level)) - 1)) == 0) {
+        wheel_cascade(level);
+      }
+    }
+    struct TimerWheelEntry **slot = &timerWheel[0][timerWheelNow & TIMER_WHEEL_MASK];
+    while (*slot) {
+      struct TimerWheelEntry *entry = *slot;
+      wheel_unlink(entry);
+      if (entry->period) {
+        entry->expiry += entry->period;
+        wheel_insert(entry);
+      }
+      xSemaphoreGive(timerWheelMutex);
+      entry->callback(entry);
+      xSemaphoreTake(timerWheelMutex, portMAX_DELAY);
+    }
+  }
+  xSemaphoreGive(timerWheelMutex);
+}
@@ -0,0 +1,49 @@
+#ifndef APP_TIMER_WHEEL_H
+#define APP_TIMER_WHEEL_H
+
+#include <stdbool.h>
+
+/* deadlines of every module share one kernel timer, entries are kept
+   in a hierarchical timing wheel with constant time start and cancel.
+   Callbacks run in the timer service task, like kernel timer callbacks,
+   and must not block: a callback waiting on a full inbox would delay
+   every other deadline. They publish with a zero timeout, events that
+   cannot be queued are counted in eventBusStats.dropped */
+
+#ifdef CONFIG_MQTT_TIMER_WHEEL_TICK_MS
+#define TIMER_WHEEL_TICK_MS CONFIG_MQTT_TIMER_WHEEL_TICK_MS
+#else //CONFIG_MQTT_TIMER_WHEEL_TICK_MS
+#define TIMER_WHEEL_TICK_MS 100
+#endif //CONFIG_MQTT_TIMER_WHEEL_TICK_MS
+
+/* 3 levels of 64 slots cover 2^18 ticks, longer timeouts wait in the
+   last slot and are placed again when it comes up */
+#define TIMER_WHEEL_SLOT_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_SLOT_BITS)
+#define TIMER_WHEEL_LEVELS 3
+
+struct TimerWheelEntry;
+
+typedef void (*timer_wheel_cb_t)(struct TimerWheelEntry *entry);
+
+/* owned by the caller, zero initialized or set up by timer_wheel_entry_init */
+struct TimerWheelEntry {
+  struct TimerWheelEntry *next;
+  struct TimerWheelEntry **pprev; // NULL when not armed
+  unsigned int expiry;            // in wheel ticks
+  unsigned int period;            // in wheel ticks, 0 for one shot
+  timer_wheel_cb_t callback;
+  int id;
+};
+
+void timer_wheel_init(void);
+void timer_wheel_entry_init(struct TimerWheelEntry *entry, timer_wheel_cb_t callback, int id);
+/* (re)arms the entry, periodMs 0 fires once */
+void timer_wheel_start(struct TimerWheelEntry *entry, unsigned int timeoutMs, unsigned int periodMs);
+void timer_wheel_cancel(struct TimerWheelEntry *entry);
+bool timer_wheel_active(const struct TimerWheelEntry *entry);
+/* moves the wheel by ticks and runs what expired, driven by the kernel
+   timer, called directly by the host tests */
+void timer_wheel_advance(unsigned int ticks);
+
+#endif /* APP_TIMER_WHEEL_H */
@@ -11,6 +11,7 @@
 
 #include "app_wifi.h"
 #include "app_nvs.h"
+#include "app_connection.h"
 
 EventGroupHandle_t wifi_event_group;
 const int WIFI_CONNECTED_BIT = BIT0;
@@ -30,15 +31,17 @@ static void event_handler(void* arg, esp_event_base_t event_base,
 {
   if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
     ESP_LOGW(TAG, "Wifi: SYSTEM_EVENT_STA_START");
-    esp_wifi_connect();
+    conn_post(CONN_EVENT_WIFI_START, 0);
   } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
-    ESP_LOGW(TAG, "SYSTEM_EVENT_STA_DISCONNECTED");
+    wifi_event_sta_disconnected_t* event = (wifi_event_sta_disconnected_t*) event_data;
+    ESP_LOGW(TAG, "SYSTEM_EVENT_STA_DISCONNECTED, reason: %d", event->reason);
     xEventGroupClearBits(wifi_event_group, WIFI_CONNECTED_BIT);
-    esp_wifi_connect();
+    conn_post(CONN_EVENT_WIFI_DOWN, event->reason);
   } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
     ip_event_got_ip_t* event = (ip_event_got_ip_t*) event_data;
     xEventGroupSetBits(wifi_event_group, WIFI_CONNECTED_BIT);
     ESP_LOGI(TAG, "got ip:" IPSTR, IP2STR(&event->ip_info.ip));
+    conn_post(CONN_EVENT_IP_UP, 0);
   }
 }
 
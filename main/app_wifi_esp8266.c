@@ -11,6 +11,7 @@
 
 #include "app_wifi.h"
 #include "app_nvs.h"
+#include "app_connection.h"
 
 EventGroupHandle_t wifi_event_group;
 const int WIFI_CONNECTED_BIT = BIT0;
@@ -29,16 +30,17 @@ static esp_err_t wifi_event_handler(void *ctx, system_event_t *event)
   switch (event->event_id) {
   case SYSTEM_EVENT_STA_START:
     ESP_LOGW(TAG, "Wifi: SYSTEM_EVENT_STA_START");
-    esp_wifi_connect();
+    conn_post(CONN_EVENT_WIFI_START, 0);
     break;
   case SYSTEM_EVENT_STA_GOT_IP:
     ESP_LOGW(TAG, "SYSTEM_EVENT_STA_GOT_IP");
     xEventGroupSetBits(wifi_event_group, WIFI_CONNECTED_BIT);
+    conn_post(CONN_EVENT_IP_UP, 0);
     break;
   case SYSTEM_EVENT_STA_DISCONNECTED:
-    ESP_LOGW(TAG, "SYSTEM_EVENT_STA_DISCONNECTED");
-    esp_wifi_connect();
+    ESP_LOGW(TAG, "SYSTEM_EVENT_STA_DISCONNECTED, reason: %d", event->event_info.disconnected.reason);
     xEventGroupClearBits(wifi_event_group, WIFI_CONNECTED_BIT);
+    conn_post(CONN_EVENT_WIFI_DOWN, event->event_info.disconnected.reason);
     break;
   default:
     break;
@@ -0,0 +1,225 @@
+#include "esp_system.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+extern "C" {
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "freertos/task.h"
+#include "mqtt_client.h"
+#include "app_mqtt.h"
+#include "app_mqtt_publisher.h"
+#include "app_thermostat.h"
+#include "app_timer_wheel.h"
+#include "app_event_bus.h"
+#include "sim.h"
+
+  void mqtt_init_and_start();
+  void dispatch_mqtt_event(esp_mqtt_event_handle_t event);
+  void publish_thermostats_snapshot();
+  extern EventBits_t stubEventGroupBits;
+  extern enum ThermostatState thermostatState;
+  extern struct Thermostat thermostats[];
+}
+
+/* allocator interposition, the program is linked with
+   -Wl,--wrap=malloc,--wrap=free,... so calls from the firmware
+   sources land here */
+static unsigned long mallocCalls = 0;
+static unsigned long freeCalls = 0;
+
+extern "C" {
+  void *__real_malloc(size_t size);
+  void __real_free(void *ptr);
+  void *__real_calloc(size_t nmemb, size_t size);
+  void *__real_realloc(void *ptr, size_t size);
+
+  void *__wrap_malloc(size_t size)
+  {
+    mallocCalls++;
+    return __real_malloc(size);
+  }
+
+  void __wrap_free(void *ptr)
+  {
+    if (ptr) {
+      freeCalls++;
+    }
+    __real_free(ptr);
+  }
+
+  void *__wrap_calloc(size_t nmemb, size_t size)
+  {
+    mallocCalls++;
+    return __real_calloc(nmemb, size);
+  }
+
+  void *__wrap_realloc(void *ptr, size_t size)
+  {
+    mallocCalls++;
+    return __real_realloc(ptr, size);
+  }
+}
+
+struct BenchMessage {
+  const char *topic;
+  const char *data;
+};
+
+static const struct BenchMessage RELAY_MESSAGES[] = {
+  {"device_type/client_id/cmd/status/relay/0", "ON"},
+  {"device_type/client_id/cmd/status/relay/1", "OFF"},
+  {"device_type/client_id/cmd/sleep/relay/0", "120"},
+  {"device_type/client_id/cmd/status/relays", "0x3:0x1"},
+};
+
+static const struct BenchMessage THERMOSTAT_MESSAGES[] = {
+  {"device_type/client_id/cmd/temp/thermostat/0", "21.5"},
+  {"device_type/client_id/cmd/mode/thermostat/1", "heat"},
+  {"device_type/client_id/cmd/tolerance/thermostat/2", "0.5"},
+};
+
+static const struct BenchMessage SCHEDULER_MESSAGES[] = {
+  {"device_type/client_id/cfg/scheduler/0",
+   "{\"ts\":1546300800,\"aId\":1,\"aState\":1,\"data\":{\"relayId\":1,\"relayValue\":1}}"},
+  {"device_type/client_id/cfg/scheduler/7",
+   "{\"ts\":1546387200,\"aId\":1,\"aState\":0,\"data\":{\"relayId\":0,\"relayValue\":0}}"},
+};
+
+static const struct BenchMessage SENSOR_MESSAGES[] = {
+  {"some/fake/sensor/topic", "19.5"},
+  {"some/fake/sensor/topic", "-2.5"},
+};
+
+static const struct BenchMessage MIXED_MESSAGES[] = {
+  {"device_type/client_id/cmd/status/relay/0", "ON"},
+  {"some/fake/sensor/topic", "19.5"},
+  {"device_type/client_id/cmd/temp/thermostat/0", "21.5"},
+  {"some/fake/sensor/topic", "19.6"},
+  {"device_type/client_id/cfg/scheduler/0",
+   "{\"ts\":1546300800,\"aId\":1,\"aState\":1,\"data\":{\"relayId\":1,\"relayValue\":1}}"},
+  {"some/fake/sensor/topic", "19.7"},
+  {"device_type/client_id/cmd/status/fan/1", "ON"},
+};
+
+#define NB(a) (sizeof(a) / sizeof(a[0]))
+
+static double now_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void report(const char *name, unsigned long count, double elapsed,
+                   unsigned long mallocs, unsigned long frees)
+{
+  printf("%-16s %10lu %14.0f %10.1f %12.3f %10.3f\n", name, count,
+         count / (elapsed / 1e9), elapsed / count,
+         (double)mallocs / count, (double)frees / count);
+}
+
+static void bench_dispatch(const char *name, const struct BenchMessage *messages,
+                           int messagesNb, unsigned long iterations)
+{
+  esp_mqtt_event_t events[16];
+  for (int i = 0; i < messagesNb; i++) {
+    memset(&events[i], 0, sizeof(events[i]));
+    events[i].event_id = MQTT_EVENT_DATA;
+    events[i].topic = (char *)messages[i].topic;
+    events[i].topic_len = strlen(messages[i].topic);
+    events[i].data = (char *)messages[i].data;
+    events[i].data_len = strlen(messages[i].data);
+    events[i].total_data_len = events[i].data_len;
+  }
+
+  unsigned long mallocs = mallocCalls;
+  unsigned long frees = freeCalls;
+  double start = now_ns();
+  for (unsigned long n = 0; n < iterations; n++) {
+    dispatch_mqtt_event(&events[n % messagesNb]);
+  }
+  double elapsed = now_ns() - start;
+  report(name, iterations, elapsed, mallocCalls - mallocs, freeCalls - frees);
+}
+
+typedef void (*bench_publish_t)();
+
+static void bench_publish(const char *name, bench_publish_t publish,
+                          unsigned long iterations)
+{
+  unsigned long mallocs = mallocCalls;
+  unsigned long frees = freeCalls;
+  double start = now_ns();
+  for (unsigned long n = 0; n < iterations; n++) {
+    publish();
+    // nobody drains the ring here, only formatting and queueing is measured
+    mqtt_publish_ring_reset();
+  }
+  double elapsed = now_ns() - start;
+  report(name, iterations, elapsed, mallocCalls - mallocs, freeCalls - frees);
+}
+
+// room model of the simulated month, reports every minute and warms up
+// while the thermostat is heating
+static void bench_room_task(void *pvParameters)
+{
+  short temperature = 180;
+  for (;;) {
+    vTaskDelay(60 * 1000);
+    temperature += thermostatState == THERMOSTAT_STATE_HEATING ? 4 : -3;
+    struct ThermostatMessage t;
+    memset(&t, 0, sizeof(t));
+    t.msgType = THERMOSTAT_CURRENT_TEMPERATURE;
+    t.data.currentTemperature = temperature;
+    event_bus_publish(EVENT_THERMOSTAT_CMD, &t, sizeof(t), portMAX_DELAY);
+    mqtt_publish_ring_reset();
+  }
+}
+
+// one life tick per CONFIG_MQTT_THERMOSTATS_TICK_PERIOD of virtual time,
+// the cost per tick includes the readings handled in between
+static void bench_thermostat_tick(const char *name, unsigned int days)
+{
+  sim_start();
+  event_bus_init();
+  timer_wheel_init();
+  thermostats_init();
+  thermostats[0].mode = THERMOSTAT_MODE_HEAT;
+  QueueHandle_t inbox = xQueueCreate(6, sizeof(struct AppEvent *));
+  event_bus_subscribe(EVENT_THERMOSTAT_CMD, inbox);
+  event_bus_subscribe(EVENT_SENSOR_SAMPLE, inbox);
+  xTaskCreate(handle_thermostat_cmd_task, "thermostat", 0, inbox, 2, NULL);
+  xTaskCreate(bench_room_task, "room", 0, NULL, 1, NULL);
+
+  unsigned long mallocs = mallocCalls;
+  unsigned long frees = freeCalls;
+  double start = now_ns();
+  sim_run_for(days * 24 * 3600 * 1000U);
+  double elapsed = now_ns() - start;
+  report(name, days * 24 * 3600 / CONFIG_MQTT_THERMOSTATS_TICK_PERIOD, elapsed, mallocCalls - mallocs, freeCalls - frees);
+  sim_stop();
+}
+
+int main(int argc, char **argv)
+{
+  unsigned long iterations = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+
+  mqtt_init_and_start();
+  stubEventGroupBits = 0xff; // connected and initialized, publishes are queued
+
+  printf("%-16s %10s %14s %10s %12s %10s\n",
+         "bench", "msgs", "msgs/s", "ns/msg", "malloc/msg", "free/msg");
+  bench_dispatch("relay_cmd", RELAY_MESSAGES, NB(RELAY_MESSAGES), iterations);
+  bench_dispatch("thermostat_cmd", THERMOSTAT_MESSAGES, NB(THERMOSTAT_MESSAGES), iterations);
+  bench_dispatch("scheduler_cfg", SCHEDULER_MESSAGES, NB(SCHEDULER_MESSAGES), iterations);
+  bench_dispatch("sensor", SENSOR_MESSAGES, NB(SENSOR_MESSAGES), iterations);
+  bench_dispatch("mixed", MIXED_MESSAGES, NB(MIXED_MESSAGES), iterations);
+  bench_publish("thermostat_data", publish_thermostat_data, iterations / 20);
+  bench_publish("thermostat_snap", publish_thermostats_snapshot, iterations / 20);
+  bench_thermostat_tick("thermostat_tick", 30);
+  return 0;
+}
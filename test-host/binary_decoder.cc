@@ -0,0 +1,94 @@
+#include <string.h>
+
+#include "binary_decoder.h"
+
+static unsigned short get_u16(const unsigned char *p)
+{
+  return p[0] | (p[1] << 8);
+}
+
+static unsigned int get_u32(const unsigned char *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+static bool check_header(const unsigned char *buf, int len, enum BinaryPayloadType type)
+{
+  return len >= BINARY_HEADER_LEN && buf[0] == BINARY_PAYLOAD_VERSION && buf[1] == type;
+}
+
+bool binary_decode_sensor(const unsigned char *buf, int len, short *value)
+{
+  if (!check_header(buf, len, BINARY_PAYLOAD_SENSOR) || len != BINARY_SENSOR_LEN) {
+    return false;
+  }
+  *value = (short)get_u16(buf + BINARY_HEADER_LEN);
+  return true;
+}
+
+// returns the number of thermostats in the payload, -1 when it is not valid
+int binary_decode_thermostats(const unsigned char *buf, int len,
+                              struct BinaryThermostat *thermostats, int nb)
+{
+  if (!check_header(buf, len, BINARY_PAYLOAD_THERMOSTATS) || len < BINARY_THERMOSTATS_LEN(0)) {
+    return -1;
+  }
+  int count = buf[BINARY_HEADER_LEN];
+  if (len != BINARY_THERMOSTATS_LEN(count) || count > nb) {
+    return -1;
+  }
+  const unsigned char *p = buf + BINARY_THERMOSTATS_LEN(0);
+  for (int i = 0; i < count; i++, p += BINARY_THERMOSTAT_LEN) {
+    thermostats[i].currentTemperature = (short)get_u16(p);
+    thermostats[i].targetTemperature = (short)get_u16(p + 2);
+    thermostats[i].temperatureTolerance = (short)get_u16(p + 4);
+    thermostats[i].mode = p[6];
+    thermostats[i].action = p[7];
+  }
+  return count;
+}
+
+bool binary_decode_ops(const unsigned char *buf, int len, unsigned int *fields)
+{
+  if (!check_header(buf, len, BINARY_PAYLOAD_OPS) || len != BINARY_OPS_LEN) {
+    return false;
+  }
+  for (int i = 0; i < BINARY_OPS_FIELDS_NB; i++) {
+    fields[i] = get_u32(buf + BINARY_HEADER_LEN + 4 * i);
+  }
+  return true;
+}
+
+// returns the number of transitions in the payload, -1 when it is not
+// valid, duty receives the 2 percents of each hour then of each day
+int binary_decode_duty(const unsigned char *buf, int len, unsigned char *duty, int dutyNb,
+                       int *hoursNb, int *daysNb, unsigned int *total,
+                       struct BinaryDutyTransition *transitions, int nb)
+{
+  if (!check_header(buf, len, BINARY_PAYLOAD_THERMOSTAT_DUTY) || len < BINARY_DUTY_LEN(0, 0)) {
+    return -1;
+  }
+  *hoursNb = buf[BINARY_HEADER_LEN];
+  *daysNb = buf[BINARY_HEADER_LEN + 1];
+  int buckets = *hoursNb + *daysNb;
+  if (len < BINARY_DUTY_LEN(buckets, 0) || buckets > dutyNb) {
+    return -1;
+  }
+  const unsigned char *p = buf + BINARY_HEADER_LEN + 2;
+  memcpy(duty, p, buckets * 2);
+  p += buckets * 2;
+  *total = get_u32(p);
+  int count = p[4];
+  if (len != BINARY_DUTY_LEN(buckets, count) || count > nb) {
+    return -1;
+  }
+  p += 5;
+  for (int i = 0; i < count; i++, p += BINARY_DUTY_TRANSITION_LEN) {
+    transitions[i].ts = get_u32(p);
+    transitions[i].thermostatId = p[4];
+    transitions[i].channel = p[5];
+    transitions[i].on = p[6];
+    transitions[i].reason = p[7];
+  }
+  return count;
+}
@@ -0,0 +1,19 @@
+#ifndef BINARY_DECODER_H
+#define BINARY_DECODER_H
+
+/* host side decoder for the payloads of ../main/app_binary.h, what a
+   broker side consumer of CONFIG_MQTT_BINARY_PAYLOAD devices does */
+
+extern "C" {
+#include "app_binary.h"
+}
+
+bool binary_decode_sensor(const unsigned char *buf, int len, short *value);
+int binary_decode_thermostats(const unsigned char *buf, int len,
+                              struct BinaryThermostat *thermostats, int nb);
+bool binary_decode_ops(const unsigned char *buf, int len, unsigned int *fields);
+int binary_decode_duty(const unsigned char *buf, int len, unsigned char *duty, int dutyNb,
+                       int *hoursNb, int *daysNb, unsigned int *total,
+                       struct BinaryDutyTransition *transitions, int nb);
+
+#endif /* BINARY_DECODER_H */
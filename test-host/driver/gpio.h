@@ -0,0 +1,15 @@
+#ifndef GPIO_H
+#define GPIO_H
+
+typedef int gpio_num_t;
+
+typedef enum {
+  GPIO_MODE_INPUT = 1,
+  GPIO_MODE_OUTPUT = 2,
+} gpio_mode_t;
+
+void gpio_pad_select_gpio(int gpio_num);
+int gpio_set_direction(gpio_num_t gpio_num, gpio_mode_t mode);
+int gpio_set_level(gpio_num_t gpio_num, unsigned int level);
+
+#endif /* GPIO_H */
@@ -12,8 +12,31 @@
 #define CONFIG_MQTT_THERMOSTATS_NB1_FRIENDLY_NAME "t1"
 #define CONFIG_MQTT_THERMOSTATS_NB2_FRIENDLY_NAME "t2"
 #define CONFIG_MQTT_THERMOSTATS_NB3_FRIENDLY_NAME "t3"
+#define CONFIG_MQTT_THERMOSTATS_TICK_PERIOD 60
+#define CONFIG_MQTT_THERMOSTAT_ENABLE_NOTIFICATIONS 1
 
-/* #define CONFIG_MQTT_RELAYS_NB 1 */
+#define CONFIG_MQTT_RELAYS_NB 2
+#define CONFIG_MQTT_RELAYS_NB0_GPIO 12
+#define CONFIG_MQTT_RELAYS_NB1_GPIO 5
+
+#define CONFIG_MQTT_STATE_SNAPSHOT 1
+
+#define CONFIG_MQTT_SCHEDULERS 1
+
+#define CONFIG_MQTT_OPS_LATENCY 1
+
+#define CONFIG_MQTT_SENSOR_DEADBAND 2
+#define CONFIG_MQTT_SENSOR_HEARTBEAT 300
+
+#define CONFIG_MQTT_OUTBOX 1
+#define CONFIG_MQTT_OUTBOX_RING_SIZE 512
+
+#define CONFIG_MQTT_EVENT_BUS_POOL_SIZE 8
+
+#define CONFIG_MQTT_TIMER_WHEEL_TICK_MS 1000
+
+#define CONFIG_MQTT_THERMOSTATS_NB1_SENSOR_TYPE_MQTT 1
+#define CONFIG_MQTT_THERMOSTATS_NB1_MQTT_SENSOR_TOPIC "some/fake/sensor/topic"
 
 #define CONFIG_MQTT_USERNAME "username"
 #define CONFIG_MQTT_PASSWORD "pass"
@@ -23,4 +46,5 @@
 
 
 int esp_get_free_heap_size();
+unsigned int esp_random();
 
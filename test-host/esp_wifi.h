@@ -1,2 +1,4 @@
 void esp_wifi_stop();
 void esp_wifi_start();
+void esp_wifi_connect();
+void esp_wifi_disconnect();
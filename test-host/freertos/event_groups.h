@@ -10,9 +10,9 @@ typedef unsigned int UBaseType_t;
 typedef void (*TimerCallbackFunction_t)( TimerHandle_t xTimer );
 
 #define portTICK_PERIOD_MS 1234
-#define pdPASS 0
+#define pdPASS 1
 #define pdTRUE 1
-#define pdFALSE 1
+#define pdFALSE 0
 #define portMAX_DELAY 9876
 
 #define ESP_OK 0
@@ -25,6 +25,10 @@ TimerHandle_t xTimerCreate(	const char * const pcTimerName,
 
 #define pdMS_TO_TICKS( xTimeInMs ) xTimeInMs
 BaseType_t xTimerStart( TimerHandle_t xTimer, const TickType_t xTicksToWait );
+BaseType_t xTimerStop( TimerHandle_t xTimer, const TickType_t xTicksToWait );
+BaseType_t xTimerIsTimerActive( TimerHandle_t xTimer );
+BaseType_t xTimerChangePeriod( TimerHandle_t xTimer, const TickType_t xNewPeriod, const TickType_t xTicksToWait );
+void * pvTimerGetTimerID( TimerHandle_t xTimer );
 
 
 
@@ -63,6 +67,7 @@ BaseType_t xTimerStart( TimerHandle_t xTimer, const TickType_t xTicksToWait );
 
 
 typedef TickType_t EventBits_t;
+EventGroupHandle_t xEventGroupCreate( void );
 EventBits_t xEventGroupGetBits( EventGroupHandle_t xEventGroup );
 EventBits_t xEventGroupClearBits( EventGroupHandle_t xEventGroup, const EventBits_t uxBitsToClear );
 EventBits_t xEventGroupWaitBits( EventGroupHandle_t xEventGroup, const EventBits_t uxBitsToWaitFor, const BaseType_t xClearOnExit, const BaseType_t xWaitForAllBits, TickType_t xTicksToWait );
@@ -6,6 +6,10 @@
 
 typedef void * QueueHandle_t;
 
+#define errQUEUE_EMPTY 0
+#define errQUEUE_FULL 0
+
+QueueHandle_t xQueueCreate( UBaseType_t uxQueueLength, UBaseType_t uxItemSize );
 
 int xQueueSend( QueueHandle_t xQueue, const void * const pvItemToQueue, TickType_t xTicksToWait);
 BaseType_t xQueueReceive( QueueHandle_t xQueue, void * const pvBuffer, TickType_t xTicksToWait);
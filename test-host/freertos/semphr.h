@@ -0,0 +1,14 @@
+
+#ifndef SEMPHR_H
+#define SEMPHR_H
+
+#include "queue.h"
+
+typedef void * SemaphoreHandle_t;
+
+SemaphoreHandle_t xSemaphoreCreateMutex();
+SemaphoreHandle_t xSemaphoreCreateCounting( UBaseType_t uxMaxCount, UBaseType_t uxInitialCount );
+BaseType_t xSemaphoreTake( SemaphoreHandle_t xSemaphore, TickType_t xTicksToWait );
+BaseType_t xSemaphoreGive( SemaphoreHandle_t xSemaphore );
+
+#endif /* SEMPHR_H */
@@ -0,0 +1,22 @@
+
+#ifndef TASK_H
+#define TASK_H
+
+#include <stdint.h>
+
+#include "event_groups.h"
+
+typedef void * TaskHandle_t;
+typedef void (*TaskFunction_t)( void * );
+
+#define configMINIMAL_STACK_SIZE 768
+
+BaseType_t xTaskCreate( TaskFunction_t pvTaskCode,
+                        const char * const pcName,
+                        const uint32_t usStackDepth,
+                        void * const pvParameters,
+                        UBaseType_t uxPriority,
+                        TaskHandle_t * const pvCreatedTask );
+TickType_t xTaskGetTickCount( void );
+
+#endif /* TASK_H */
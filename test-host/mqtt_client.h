@@ -14,6 +14,7 @@ typedef enum {
     MQTT_EVENT_UNSUBSCRIBED,
     MQTT_EVENT_PUBLISHED,
     MQTT_EVENT_DATA,
+    MQTT_EVENT_BEFORE_CONNECT,
 } esp_mqtt_event_id_t;
 
 
@@ -78,5 +79,6 @@ typedef struct {
 
 esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t *config);
 esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t client);
+esp_err_t esp_mqtt_client_stop(esp_mqtt_client_handle_t client);
 
 #endif /* MQTT_CLIENT_H */
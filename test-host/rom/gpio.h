@@ -0,0 +1,8 @@
+#ifndef ROM_GPIO_H
+#define ROM_GPIO_H
+
+#include <stdint.h>
+
+void gpio_output_set(uint32_t set_mask, uint32_t clear_mask, uint32_t enable_mask, uint32_t disable_mask);
+
+#endif /* ROM_GPIO_H */
@@ -0,0 +1,566 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ucontext.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+
+#include "sim.h"
+
+enum SimTaskState {
+  SIM_TASK_FREE = 0,
+  SIM_TASK_READY,
+  SIM_TASK_BLOCKED,
+  SIM_TASK_DONE,
+};
+
+struct SimTask {
+  enum SimTaskState state;
+  TaskFunction_t code;
+  void *parameters;
+  UBaseType_t priority;
+  unsigned long readySince; // round robin between equal priorities
+  const void *waitingOn;    // queue or event group, NULL for a delay
+  bool forever;
+  TickType_t wakeAt;
+  bool woken;               // by the object rather than by the clock
+  ucontext_t context;
+  char *stack;
+};
+
+struct SimQueue {
+  bool used;
+  UBaseType_t length;
+  UBaseType_t itemSize;
+  UBaseType_t count;
+  UBaseType_t head;
+  unsigned char *items;
+};
+
+struct SimTimer {
+  bool used;
+  bool active;
+  bool autoReload;
+  TickType_t period;
+  TickType_t expiry;
+  void *id;
+  TimerCallbackFunction_t callback;
+};
+
+struct SimEventGroup {
+  bool used;
+  EventBits_t bits;
+};
+
+// counting semaphores only, tasks are never preempted so mutexes are
+// left to the stubs
+struct SimSemaphore {
+  bool used;
+  UBaseType_t max;
+  UBaseType_t count;
+};
+
+struct SimStats simStats;
+
+// bits of the event groups not created by the simulation
+EventBits_t stubEventGroupBits = 0;
+
+static bool simActive = false;
+static TickType_t simNow = 0;
+static unsigned long simSequence = 0;
+static ucontext_t simScheduler;
+static struct SimTask *simCurrent = NULL;
+
+static struct SimTask simTasks[SIM_MAX_TASKS];
+static struct SimQueue simQueues[SIM_MAX_QUEUES];
+static struct SimTimer simTimers[SIM_MAX_TIMERS];
+static struct SimEventGroup simEventGroups[SIM_MAX_EVENT_GROUPS];
+static struct SimSemaphore simSemaphores[SIM_MAX_SEMAPHORES];
+
+#define SIM_LOOKUP(pool, nb, handle) ({                                 \
+      uintptr_t h = (uintptr_t)(handle);                                \
+      uintptr_t first = (uintptr_t)&pool[0];                            \
+      (h >= first && h < (uintptr_t)&pool[nb] &&                        \
+       (h - first) % sizeof(pool[0]) == 0 && pool[(h - first) / sizeof(pool[0])].used) \
+        ? &pool[(h - first) / sizeof(pool[0])] : NULL;                  \
+    })
+
+static struct SimQueue *sim_queue(QueueHandle_t handle)
+{
+  return SIM_LOOKUP(simQueues, SIM_MAX_QUEUES, handle);
+}
+
+static struct SimTimer *sim_timer(TimerHandle_t handle)
+{
+  return SIM_LOOKUP(simTimers, SIM_MAX_TIMERS, handle);
+}
+
+static struct SimEventGroup *sim_event_group(EventGroupHandle_t handle)
+{
+  return SIM_LOOKUP(simEventGroups, SIM_MAX_EVENT_GROUPS, handle);
+}
+
+static struct SimSemaphore *sim_semaphore(SemaphoreHandle_t handle)
+{
+  return SIM_LOOKUP(simSemaphores, SIM_MAX_SEMAPHORES, handle);
+}
+
+void sim_start()
+{
+  sim_stop();
+  simActive = true;
+}
+
+void sim_stop()
+{
+  for (int i = 0; i < SIM_MAX_TASKS; i++) {
+    free(simTasks[i].stack);
+  }
+  for (int i = 0; i < SIM_MAX_QUEUES; i++) {
+    free(simQueues[i].items);
+  }
+  memset(simTasks, 0, sizeof(simTasks));
+  memset(simQueues, 0, sizeof(simQueues));
+  memset(simTimers, 0, sizeof(simTimers));
+  memset(simEventGroups, 0, sizeof(simEventGroups));
+  memset(simSemaphores, 0, sizeof(simSemaphores));
+  memset(&simStats, 0, sizeof(simStats));
+  simActive = false;
+  simNow = 0;
+  simSequence = 0;
+  simCurrent = NULL;
+}
+
+bool sim_active()
+{
+  return simActive;
+}
+
+static void sim_ready(struct SimTask *t)
+{
+  t->state = SIM_TASK_READY;
+  t->readySince = ++simSequence;
+}
+
+// parks the running task on object until sim_wake or the deadline,
+// false on timeout
+static bool sim_block(const void *object, bool forever, TickType_t deadline)
+{
+  struct SimTask *t = simCurrent;
+  if (t == NULL || (!forever && simNow >= deadline)) {
+    return false;
+  }
+  t->state = SIM_TASK_BLOCKED;
+  t->waitingOn = object;
+  t->forever = forever;
+  t->wakeAt = deadline;
+  t->woken = false;
+  swapcontext(&t->context, &simScheduler);
+  return t->woken;
+}
+
+static void sim_wake(const void *object)
+{
+  for (int i = 0; i < SIM_MAX_TASKS; i++) {
+    struct SimTask *t = &simTasks[i];
+    if (t->state == SIM_TASK_BLOCKED && t->waitingOn == object && object != NULL) {
+      t->woken = true;
+      sim_ready(t);
+    }
+  }
+}
+
+static void sim_task_entry(int index)
+{
+  struct SimTask *t = &simTasks[index];
+  t->code(t->parameters);
+  // back to the scheduler through uc_link
+  t->state = SIM_TASK_DONE;
+}
+
+static struct SimTask *sim_next_ready()
+{
+  struct SimTask *next = NULL;
+  for (int i = 0; i < SIM_MAX_TASKS; i++) {
+    struct SimTask *t = &simTasks[i];
+    if (t->state != SIM_TASK_READY) {
+      continue;
+    }
+    if (next == NULL || t->priority > next->priority ||
+        (t->priority == next->priority && t->readySince < next->readySince)) {
+      next = t;
+    }
+  }
+  return next;
+}
+
+static void sim_run_ready()
+{
+  struct SimTask *t;
+  while ((t = sim_next_ready()) != NULL) {
+    simCurrent = t;
+    simStats.switches++;
+    swapcontext(&simScheduler, &t->context);
+    simCurrent = NULL;
+  }
+}
+
+// earliest timer expiry or task timeout, false when nothing is pending
+static bool sim_next_event(TickType_t *next)
+{
+  bool found = false;
+  for (int i = 0; i < SIM_MAX_TIMERS; i++) {
+    if (simTimers[i].used && simTimers[i].active &&
+        (!found || simTimers[i].expiry < *next)) {
+      *next = simTimers[i].expiry;
+      found = true;
+    }
+  }
+  for (int i = 0; i < SIM_MAX_TASKS; i++) {
+    if (simTasks[i].state == SIM_TASK_BLOCKED && !simTasks[i].forever &&
+        (!found || simTasks[i].wakeAt < *next)) {
+      *next = simTasks[i].wakeAt;
+      found = true;
+    }
+  }
+  return found;
+}
+
+// timer callbacks run outside of any task, like in the timer daemon
+// they must not block
+static void sim_fire_due()
+{
+  for (int i = 0; i < SIM_MAX_TIMERS; i++) {
+    struct SimTimer *timer = &simTimers[i];
+    if (timer->used && timer->active && timer->expiry <= simNow) {
+      if (timer->autoReload) {
+        timer->expiry += timer->period;
+      } else {
+        timer->active = false;
+      }
+      simStats.timersFired++;
+      timer->callback(timer);
+    }
+  }
+  for (int i = 0; i < SIM_MAX_TASKS; i++) {
+    struct SimTask *t = &simTasks[i];
+    if (t->state == SIM_TASK_BLOCKED && !t->forever && t->wakeAt <= simNow) {
+      sim_ready(t);
+    }
+  }
+}
+
+void sim_run_for(TickType_t ticks)
+{
+  TickType_t end = simNow + ticks;
+  for (;;) {
+    sim_run_ready();
+    TickType_t next;
+    if (!sim_next_event(&next) || next > end) {
+      simNow = end;
+      break;
+    }
+    simNow = next;
+    sim_fire_due();
+  }
+}
+
+BaseType_t xTaskCreate( TaskFunction_t pvTaskCode,
+                        const char * const pcName,
+                        const uint32_t usStackDepth,
+                        void * const pvParameters,
+                        UBaseType_t uxPriority,
+                        TaskHandle_t * const pvCreatedTask )
+{
+  if (!simActive) {
+    return pdFALSE;
+  }
+  for (int i = 0; i < SIM_MAX_TASKS; i++) {
+    struct SimTask *t = &simTasks[i];
+    if (t->state != SIM_TASK_FREE) {
+      continue;
+    }
+    t->code = pvTaskCode;
+    t->parameters = pvParameters;
+    t->priority = uxPriority;
+    t->stack = malloc(SIM_STACK_SIZE);
+    getcontext(&t->context);
+    t->context.uc_stack.ss_sp = t->stack;
+    t->context.uc_stack.ss_size = SIM_STACK_SIZE;
+    t->context.uc_link = &simScheduler;
+    makecontext(&t->context, (void (*)(void))sim_task_entry, 1, i);
+    sim_ready(t);
+    if (pvCreatedTask) {
+      *pvCreatedTask = t;
+    }
+    return pdPASS;
+  }
+  return pdFALSE;
+}
+
+void vTaskDelay(int ticks)
+{
+  if (simCurrent == NULL) {
+    return;
+  }
+  if (ticks <= 0) {
+    sim_ready(simCurrent);
+    swapcontext(&simCurrent->context, &simScheduler);
+    return;
+  }
+  sim_block(NULL, false, simNow + ticks);
+}
+
+TickType_t xTaskGetTickCount( void )
+{
+  return simNow;
+}
+
+int64_t esp_timer_get_time(void)
+{
+  return (int64_t)simNow * 1000;
+}
+
+QueueHandle_t xQueueCreate( UBaseType_t uxQueueLength, UBaseType_t uxItemSize )
+{
+  if (!simActive) {
+    return NULL;
+  }
+  for (int i = 0; i < SIM_MAX_QUEUES; i++) {
+    struct SimQueue *q = &simQueues[i];
+    if (!q->used) {
+      q->used = true;
+      q->length = uxQueueLength;
+      q->itemSize = uxItemSize;
+      q->items = malloc(uxQueueLength * uxItemSize);
+      return q;
+    }
+  }
+  return NULL;
+}
+
+int xQueueSend( QueueHandle_t xQueue, const void * const pvItemToQueue, TickType_t xTicksToWait)
+{
+  struct SimQueue *q = sim_queue(xQueue);
+  if (q == NULL) {
+    return pdPASS;
+  }
+  TickType_t deadline = simNow + xTicksToWait;
+  while (q->count == q->length) {
+    if (!sim_block(q, xTicksToWait == portMAX_DELAY, deadline)) {
+      return errQUEUE_FULL;
+    }
+  }
+  memcpy(q->items + ((q->head + q->count) % q->length) * q->itemSize, pvItemToQueue, q->itemSize);
+  q->count++;
+  sim_wake(q);
+  return pdPASS;
+}
+
+BaseType_t xQueueReceive( QueueHandle_t xQueue, void * const pvBuffer, TickType_t xTicksToWait)
+{
+  struct SimQueue *q = sim_queue(xQueue);
+  if (q == NULL) {
+    return errQUEUE_EMPTY;
+  }
+  TickType_t deadline = simNow + xTicksToWait;
+  while (q->count == 0) {
+    if (!sim_block(q, xTicksToWait == portMAX_DELAY, deadline)) {
+      return errQUEUE_EMPTY;
+    }
+  }
+  memcpy(pvBuffer, q->items + q->head * q->itemSize, q->itemSize);
+  q->head = (q->head + 1) % q->length;
+  q->count--;
+  sim_wake(q);
+  return pdTRUE;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex()
+{
+  return NULL;
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting( UBaseType_t uxMaxCount, UBaseType_t uxInitialCount )
+{
+  if (!simActive) {
+    return NULL;
+  }
+  for (int i = 0; i < SIM_MAX_SEMAPHORES; i++) {
+    struct SimSemaphore *sem = &simSemaphores[i];
+    if (!sem->used) {
+      sem->used = true;
+      sem->max = uxMaxCount;
+      sem->count = uxInitialCount;
+      return sem;
+    }
+  }
+  return NULL;
+}
+
+BaseType_t xSemaphoreTake( SemaphoreHandle_t xSemaphore, TickType_t xTicksToWait )
+{
+  struct SimSemaphore *sem = sim_semaphore(xSemaphore);
+  if (sem == NULL) {
+    return pdTRUE;
+  }
+  TickType_t deadline = simNow + xTicksToWait;
+  while (sem->count == 0) {
+    if (!sim_block(sem, xTicksToWait == portMAX_DELAY, deadline)) {
+      return pdFALSE;
+    }
+  }
+  sem->count--;
+  return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive( SemaphoreHandle_t xSemaphore )
+{
+  struct SimSemaphore *sem = sim_semaphore(xSemaphore);
+  if (sem == NULL) {
+    return pdTRUE;
+  }
+  if (sem->count == sem->max) {
+    return pdFALSE;
+  }
+  sem->count++;
+  sim_wake(sem);
+  return pdTRUE;
+}
+
+TimerHandle_t xTimerCreate(	const char * const pcTimerName,
+                            const TickType_t xTimerPeriodInTicks,
+                            const UBaseType_t uxAutoReload,
+                            void * const pvTimerID,
+                            TimerCallbackFunction_t pxCallbackFunction )
+{
+  if (!simActive) {
+    return NULL;
+  }
+  for (int i = 0; i < SIM_MAX_TIMERS; i++) {
+    struct SimTimer *timer = &simTimers[i];
+    if (!timer->used) {
+      timer->used = true;
+      timer->active = false;
+      timer->autoReload = uxAutoReload != pdFALSE;
+      timer->period = xTimerPeriodInTicks;
+      timer->id = pvTimerID;
+      timer->callback = pxCallbackFunction;
+      return timer;
+    }
+  }
+  return NULL;
+}
+
+BaseType_t xTimerStart( TimerHandle_t xTimer, const TickType_t xTicksToWait )
+{
+  struct SimTimer *timer = sim_timer(xTimer);
+  if (timer) {
+    timer->active = true;
+    timer->expiry = simNow + timer->period;
+  }
+  return pdPASS;
+}
+
+BaseType_t xTimerStop( TimerHandle_t xTimer, const TickType_t xTicksToWait )
+{
+  struct SimTimer *timer = sim_timer(xTimer);
+  if (timer) {
+    timer->active = false;
+  }
+  return pdPASS;
+}
+
+BaseType_t xTimerIsTimerActive( TimerHandle_t xTimer )
+{
+  struct SimTimer *timer = sim_timer(xTimer);
+  return timer && timer->active ? pdTRUE : pdFALSE;
+}
+
+// like FreeRTOS, a dormant timer is started by a period change
+BaseType_t xTimerChangePeriod( TimerHandle_t xTimer, const TickType_t xNewPeriod, const TickType_t xTicksToWait )
+{
+  struct SimTimer *timer = sim_timer(xTimer);
+  if (timer) {
+    timer->period = xNewPeriod;
+    timer->active = true;
+    timer->expiry = simNow + xNewPeriod;
+  }
+  return pdPASS;
+}
+
+void * pvTimerGetTimerID( TimerHandle_t xTimer )
+{
+  struct SimTimer *timer = sim_timer(xTimer);
+  return timer ? timer->id : NULL;
+}
+
+EventGroupHandle_t xEventGroupCreate( void )
+{
+  if (!simActive) {
+    return NULL;
+  }
+  for (int i = 0; i < SIM_MAX_EVENT_GROUPS; i++) {
+    if (!simEventGroups[i].used) {
+      simEventGroups[i].used = true;
+      simEventGroups[i].bits = 0;
+      return &simEventGroups[i];
+    }
+  }
+  return NULL;
+}
+
+EventBits_t xEventGroupGetBits( EventGroupHandle_t xEventGroup )
+{
+  struct SimEventGroup *group = sim_event_group(xEventGroup);
+  return group ? group->bits : stubEventGroupBits;
+}
+
+EventBits_t xEventGroupClearBits( EventGroupHandle_t xEventGroup, const EventBits_t uxBitsToClear )
+{
+  struct SimEventGroup *group = sim_event_group(xEventGroup);
+  if (group == NULL) {
+    return stubEventGroupBits;
+  }
+  EventBits_t bits = group->bits;
+  group->bits &= ~uxBitsToClear;
+  return bits;
+}
+
+EventBits_t xEventGroupSetBits( EventGroupHandle_t xEventGroup, const EventBits_t uxBitsToSet )
+{
+  struct SimEventGroup *group = sim_event_group(xEventGroup);
+  if (group == NULL) {
+    return stubEventGroupBits;
+  }
+  group->bits |= uxBitsToSet;
+  sim_wake(group);
+  return group->bits;
+}
+
+EventBits_t xEventGroupWaitBits( EventGroupHandle_t xEventGroup, const EventBits_t uxBitsToWaitFor, const BaseType_t xClearOnExit, const BaseType_t xWaitForAllBits, TickType_t xTicksToWait )
+{
+  struct SimEventGroup *group = sim_event_group(xEventGroup);
+  if (group == NULL) {
+    return stubEventGroupBits;
+  }
+  TickType_t deadline = simNow + xTicksToWait;
+  for (;;) {
+    EventBits_t bits = group->bits;
+    bool set = xWaitForAllBits ? (bits & uxBitsToWaitFor) == uxBitsToWaitFor
+      : (bits & uxBitsToWaitFor) != 0;
+    if (set) {
+      if (xClearOnExit) {
+        group->bits &= ~uxBitsToWaitFor;
+      }
+      return bits;
+    }
+    if (!sim_block(group, xTicksToWait == portMAX_DELAY, deadline)) {
+      return group->bits;
+    }
+  }
+}
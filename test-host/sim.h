@@ -0,0 +1,36 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+
+/* deterministic FreeRTOS simulation: tasks are coroutines run one at a
+   time on the calling thread, time only moves when every task is blocked
+   and jumps to the next timer expiry or timeout. One tick is one ms.
+
+   Outside of sim_start/sim_stop the FreeRTOS calls keep the behaviour of
+   the plain stubs, handles not created by the simulation are ignored. */
+
+#define SIM_MAX_TASKS 8
+#define SIM_MAX_QUEUES 16
+#define SIM_MAX_TIMERS 16
+#define SIM_MAX_EVENT_GROUPS 4
+#define SIM_MAX_SEMAPHORES 4
+#define SIM_STACK_SIZE (128 * 1024)
+
+struct SimStats {
+  unsigned long switches;    // task resumes
+  unsigned long timersFired;
+};
+
+extern struct SimStats simStats;
+
+void sim_start();
+void sim_stop();
+bool sim_active();
+
+/* runs the tasks until the virtual clock reaches now + ticks */
+void sim_run_for(TickType_t ticks);
+
+#endif /* SIM_H */
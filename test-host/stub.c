@@ -2,25 +2,25 @@
 #include "esp_system.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
 
 
-void update_relay_status(int id, char value)
-{}
-
-int xQueueSend( QueueHandle_t xQueue, const void * const pvItemToQueue, TickType_t xTicksToWait)
-{}
+#include "driver/gpio.h"
+#include "rom/gpio.h"
 
-TimerHandle_t xTimerCreate(	const char * const pcTimerName,
-								const TickType_t xTimerPeriodInTicks,
-								const UBaseType_t uxAutoReload,
-								void * const pvTimerID,
-                            TimerCallbackFunction_t pxCallbackFunction )
+void gpio_pad_select_gpio(int gpio_num)
 {}
-
-BaseType_t xTimerStart( TimerHandle_t xTimer, const TickType_t xTicksToWait )
-{}
-
-BaseType_t xQueueReceive( QueueHandle_t xQueue, void * const pvBuffer, TickType_t xTicksToWait)
+int gpio_set_direction(gpio_num_t gpio_num, gpio_mode_t mode)
+{
+  return ESP_OK;
+}
+int gpio_set_level(gpio_num_t gpio_num, unsigned int level)
+{
+  return ESP_OK;
+}
+void gpio_output_set(uint32_t set_mask, uint32_t clear_mask, uint32_t enable_mask, uint32_t disable_mask)
 {}
 
 esp_err_t write_nvs_integer(const char * tag, int value)
@@ -41,16 +41,6 @@ void ESP_ERROR_CHECK(int a)
   while (0);
 }
 
-EventBits_t xEventGroupGetBits( EventGroupHandle_t xEventGroup )
-{}
-EventBits_t xEventGroupClearBits( EventGroupHandle_t xEventGroup, const EventBits_t uxBitsToClear )
-{}
-EventBits_t xEventGroupWaitBits( EventGroupHandle_t xEventGroup, const EventBits_t uxBitsToWaitFor, const BaseType_t xClearOnExit, const BaseType_t xWaitForAllBits, TickType_t xTicksToWait )
-{}
-EventBits_t xEventGroupSetBits( EventGroupHandle_t xEventGroup, const EventBits_t uxBitsToSet )
-{}
-
-
 int esp_mqtt_client_publish(esp_mqtt_client_handle_t client, const char *topic, const char *data, int len, int qos, int retain)
 {}
 esp_err_t esp_mqtt_client_subscribe(esp_mqtt_client_handle_t client, const char *topic, int qos)
@@ -59,22 +49,34 @@ esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t *co
 {}
 esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t client)
 {}
+esp_err_t esp_mqtt_client_stop(esp_mqtt_client_handle_t client)
+{}
 
 void esp_wifi_stop()
 {}
 void esp_wifi_start()
 {}
-
-int esp_get_free_heap_size()
+void esp_wifi_connect()
+{}
+void esp_wifi_disconnect()
 {}
 
+unsigned int esp_random()
+{
+  return 0;
+}
 
-void vTaskDelay(int a)
+int esp_get_free_heap_size()
 {}
 
+
 int esp_reset_reason()
 {}
 
 void * thermostatQueue;
 void * mqttQueue;
+void * connectionQueue;
+void * relayQueue;
+void * schedulerCfgQueue;
+void * xSemaphore;
 void * _binary_mqtt_iot_cipex_ro_pem_start;
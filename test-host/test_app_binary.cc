@@ -0,0 +1,101 @@
+#include "catch.hpp"
+
+#include <limits.h>
+#include <string.h>
+
+#include "binary_decoder.h"
+
+TEST_CASE("binary_sensor_roundtrip", "[binary]" ) {
+  unsigned char buf[BINARY_SENSOR_LEN];
+  short value;
+
+  REQUIRE(binary_encode_sensor(buf, 195) == BINARY_SENSOR_LEN);
+  REQUIRE(buf[0] == BINARY_PAYLOAD_VERSION);
+  REQUIRE(buf[1] == BINARY_PAYLOAD_SENSOR);
+  REQUIRE(buf[2] == 195);
+  REQUIRE(buf[3] == 0);
+  REQUIRE(binary_decode_sensor(buf, sizeof(buf), &value));
+  REQUIRE(value == 195);
+
+  binary_encode_sensor(buf, -25);
+  REQUIRE(binary_decode_sensor(buf, sizeof(buf), &value));
+  REQUIRE(value == -25);
+}
+
+TEST_CASE("binary_thermostats_roundtrip", "[binary]" ) {
+  struct BinaryThermostat in[2] = {
+    {205, 210, 5, 3, BINARY_ACTION_HEATING},
+    {SHRT_MIN, 225, 10, 1, BINARY_ACTION_OFF},
+  };
+  struct BinaryThermostat out[4];
+  unsigned char buf[BINARY_THERMOSTATS_LEN(2)];
+
+  REQUIRE(binary_encode_thermostats(buf, in, 2) == (int)sizeof(buf));
+  REQUIRE(binary_decode_thermostats(buf, sizeof(buf), out, 4) == 2);
+  REQUIRE(out[0].currentTemperature == 205);
+  REQUIRE(out[0].targetTemperature == 210);
+  REQUIRE(out[0].temperatureTolerance == 5);
+  REQUIRE(out[0].mode == 3);
+  REQUIRE(out[0].action == BINARY_ACTION_HEATING);
+  REQUIRE(out[1].currentTemperature == SHRT_MIN);
+  REQUIRE(out[1].targetTemperature == 225);
+  REQUIRE(out[1].action == BINARY_ACTION_OFF);
+
+  // truncated payloads and payloads with more thermostats than expected
+  REQUIRE(binary_decode_thermostats(buf, sizeof(buf) - 1, out, 4) == -1);
+  REQUIRE(binary_decode_thermostats(buf, sizeof(buf), out, 1) == -1);
+}
+
+TEST_CASE("binary_ops_roundtrip", "[binary]" ) {
+  unsigned int in[BINARY_OPS_FIELDS_NB];
+  unsigned int out[BINARY_OPS_FIELDS_NB];
+  unsigned char buf[BINARY_OPS_LEN];
+  for (int i = 0; i < BINARY_OPS_FIELDS_NB; i++) {
+    in[i] = 0x01020304 * (i + 1);
+  }
+  in[BINARY_OPS_FREE_HEAP] = 0xfffffffe;
+
+  REQUIRE(binary_encode_ops(buf, in) == BINARY_OPS_LEN);
+  REQUIRE(binary_decode_ops(buf, sizeof(buf), out));
+  REQUIRE(memcmp(in, out, sizeof(in)) == 0);
+}
+
+TEST_CASE("binary_duty_roundtrip", "[binary]" ) {
+  unsigned char in[3 * 2] = {50, 0, 100, 25, 0xff, 0xff};
+  struct BinaryDutyTransition transitions[2] = {
+    {1546300800, 0, 0, 1, 1},
+    {1546300920, 0xff, 1, 0, 6},
+  };
+  unsigned char out[8 * 2];
+  struct BinaryDutyTransition outTransitions[4];
+  unsigned char buf[BINARY_DUTY_LEN(3, 2)];
+  int hoursNb, daysNb;
+  unsigned int total;
+
+  REQUIRE(binary_encode_duty(buf, in, 2, 1, 42, transitions, 2) == (int)sizeof(buf));
+  REQUIRE(binary_decode_duty(buf, sizeof(buf), out, 8, &hoursNb, &daysNb, &total, outTransitions, 4) == 2);
+  REQUIRE(hoursNb == 2);
+  REQUIRE(daysNb == 1);
+  REQUIRE(total == 42);
+  REQUIRE(memcmp(in, out, sizeof(in)) == 0);
+  REQUIRE(outTransitions[0].ts == 1546300800);
+  REQUIRE(outTransitions[0].on == 1);
+  REQUIRE(outTransitions[1].ts == 1546300920);
+  REQUIRE(outTransitions[1].thermostatId == 0xff);
+  REQUIRE(outTransitions[1].channel == 1);
+  REQUIRE(outTransitions[1].reason == 6);
+
+  REQUIRE(binary_decode_duty(buf, sizeof(buf) - 1, out, 8, &hoursNb, &daysNb, &total, outTransitions, 4) == -1);
+  REQUIRE(binary_decode_duty(buf, sizeof(buf), out, 8, &hoursNb, &daysNb, &total, outTransitions, 1) == -1);
+}
+
+TEST_CASE("binary_bad_header", "[binary]" ) {
+  unsigned char buf[BINARY_OPS_LEN];
+  unsigned int fields[BINARY_OPS_FIELDS_NB];
+  short value;
+
+  binary_encode_sensor(buf, 195);
+  REQUIRE_FALSE(binary_decode_ops(buf, BINARY_OPS_LEN, fields));
+  buf[0] = BINARY_PAYLOAD_VERSION + 1;
+  REQUIRE_FALSE(binary_decode_sensor(buf, BINARY_SENSOR_LEN, &value));
+}
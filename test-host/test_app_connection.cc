@@ -0,0 +1,141 @@
+#include "esp_system.h"
+#include "catch.hpp"
+#include "hippomocks.h"
+
+#include <string.h>
+
+using HippoMocks::CString;
+
+extern "C" {
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "app_mqtt.h"
+#include "app_connection.h"
+}
+
+static enum ConnAction post(struct ConnManager *m, unsigned char type, TickType_t now,
+                            unsigned char reason = 0, unsigned int random = 0)
+{
+  struct ConnEvent e = {type, reason};
+  return conn_step(m, &e, now, random);
+}
+
+// booted, connected once, mqtt reconnects are now handled by the manager
+static void boot(struct ConnManager *m)
+{
+  memset(m, 0, sizeof(*m));
+  REQUIRE(post(m, CONN_EVENT_WIFI_START, 1) == CONN_ACTION_WIFI_CONNECT);
+  REQUIRE(post(m, CONN_EVENT_IP_UP, 2) == CONN_ACTION_NONE);
+  REQUIRE(m->pending == CONN_ACTION_NONE);
+  REQUIRE(post(m, CONN_EVENT_MQTT_UP, 3) == CONN_ACTION_NONE);
+  REQUIRE(m->mqttManaged);
+  REQUIRE_FALSE(m->reportReady);
+}
+
+TEST_CASE("conn_backoff_delay", "[connection]" ) {
+  REQUIRE(conn_backoff_delay(1, 0) == CONN_BACKOFF_MIN / 2);
+  REQUIRE(conn_backoff_delay(1, CONN_BACKOFF_MIN / 2) == CONN_BACKOFF_MIN);
+  REQUIRE(conn_backoff_delay(3, 0) == CONN_BACKOFF_MIN * 2);
+  REQUIRE(conn_backoff_delay(3, 12345) <= CONN_BACKOFF_MIN * 4);
+  // capped, and never overflows
+  REQUIRE(conn_backoff_delay(40, 0) == CONN_BACKOFF_MAX / 2);
+  REQUIRE(conn_backoff_delay(40, 0xffffffff) <= CONN_BACKOFF_MAX);
+}
+
+TEST_CASE("conn_mqtt_down_backoff", "[connection]" ) {
+  struct ConnManager m;
+  boot(&m);
+
+  REQUIRE(post(&m, CONN_EVENT_MQTT_DOWN, 100) == CONN_ACTION_MQTT_STOP);
+  REQUIRE(m.pending == CONN_ACTION_MQTT_START);
+  REQUIRE(conn_timeout(&m, m.deadline - 1) == CONN_ACTION_NONE);
+  REQUIRE(conn_timeout(&m, m.deadline) == CONN_ACTION_MQTT_START);
+  REQUIRE(m.state == CONN_STATE_MQTT_CONNECTING);
+  REQUIRE(conn_timeout(&m, 10000) == CONN_ACTION_NONE);
+
+  // the disconnect caused by our own stop is not counted
+  REQUIRE(post(&m, CONN_EVENT_MQTT_DOWN, 200) == CONN_ACTION_MQTT_STOP);
+  REQUIRE(post(&m, CONN_EVENT_MQTT_DOWN, 201) == CONN_ACTION_NONE);
+  REQUIRE(m.mqttFailures == 2);
+  REQUIRE(m.deadline - 200 == conn_backoff_delay(2, 0) / portTICK_PERIOD_MS);
+
+  REQUIRE(conn_timeout(&m, m.deadline) == CONN_ACTION_MQTT_START);
+  REQUIRE(post(&m, CONN_EVENT_MQTT_UP, 300) == CONN_ACTION_NONE);
+  REQUIRE(m.reportReady);
+  REQUIRE(m.report.cause == CONN_EVENT_MQTT_DOWN);
+  REQUIRE(m.report.mqttAttempts == 2);
+  REQUIRE(m.report.wifiAttempts == 0);
+  REQUIRE(m.report.downMs == 200 * portTICK_PERIOD_MS);
+  REQUIRE(m.report.wifiMs == 0);
+  REQUIRE(m.mqttFailures == 0);
+}
+
+TEST_CASE("conn_mqtt_failures_restart_wifi", "[connection]" ) {
+  struct ConnManager m;
+  boot(&m);
+
+  TickType_t now = 100;
+  for (int i = 1; i < CONN_MQTT_FAILURES_WIFI_RESTART; i++) {
+    REQUIRE(post(&m, CONN_EVENT_MQTT_DOWN, now) == CONN_ACTION_MQTT_STOP);
+    REQUIRE(conn_timeout(&m, m.deadline) == CONN_ACTION_MQTT_START);
+    now = m.deadline + 1;
+  }
+  REQUIRE(post(&m, CONN_EVENT_MQTT_DOWN, now) == CONN_ACTION_MQTT_STOP);
+  REQUIRE(conn_timeout(&m, now) == CONN_ACTION_WIFI_RESTART);
+
+  REQUIRE(post(&m, CONN_EVENT_WIFI_DOWN, now + 1, 8) == CONN_ACTION_MQTT_STOP);
+  REQUIRE(m.pending == CONN_ACTION_WIFI_CONNECT);
+  // the outage started with mqtt, the wifi restart is part of it
+  REQUIRE(m.report.cause == CONN_EVENT_MQTT_DOWN);
+  REQUIRE(m.report.mqttAttempts == CONN_MQTT_FAILURES_WIFI_RESTART);
+  REQUIRE(m.report.wifiAttempts == 1);
+}
+
+TEST_CASE("conn_wifi_down_report", "[connection]" ) {
+  struct ConnManager m;
+  boot(&m);
+
+  REQUIRE(post(&m, CONN_EVENT_WIFI_DOWN, 100, 201) == CONN_ACTION_MQTT_STOP);
+  REQUIRE(m.state == CONN_STATE_WIFI_DOWN);
+  REQUIRE(conn_timeout(&m, m.deadline) == CONN_ACTION_WIFI_CONNECT);
+  REQUIRE(post(&m, CONN_EVENT_WIFI_DOWN, 110, 201) == CONN_ACTION_MQTT_STOP);
+  // mqtt disconnects while wifi is down do not schedule anything
+  REQUIRE(post(&m, CONN_EVENT_MQTT_DOWN, 111) == CONN_ACTION_NONE);
+  REQUIRE(m.pending == CONN_ACTION_WIFI_CONNECT);
+  REQUIRE(conn_timeout(&m, m.deadline) == CONN_ACTION_WIFI_CONNECT);
+
+  // mqtt start is only jittered once ip is back
+  REQUIRE(post(&m, CONN_EVENT_IP_UP, 150, 0, 12345678) == CONN_ACTION_NONE);
+  REQUIRE(m.pending == CONN_ACTION_MQTT_START);
+  REQUIRE(m.deadline - 150 < CONN_BACKOFF_MIN / portTICK_PERIOD_MS + 1);
+  REQUIRE(conn_timeout(&m, m.deadline) == CONN_ACTION_MQTT_START);
+  REQUIRE(post(&m, CONN_EVENT_MQTT_UP, 160) == CONN_ACTION_NONE);
+
+  REQUIRE(m.reportReady);
+  REQUIRE(m.report.cause == CONN_EVENT_WIFI_DOWN);
+  REQUIRE(m.report.wifiReason == 201);
+  REQUIRE(m.report.wifiAttempts == 2);
+  REQUIRE(m.report.downMs == 60 * portTICK_PERIOD_MS);
+  REQUIRE(m.report.wifiMs == 50 * portTICK_PERIOD_MS);
+  REQUIRE(m.report.mqttMs == 10 * portTICK_PERIOD_MS);
+}
+
+TEST_CASE("publish_connection_report", "[connection]" ) {
+  MockRepository mocks;
+  const char *topic = "device_type/client_id/evt/connection";
+  const char *data = "{\"cause\":\"wifi\",\"wifi_reason\":201,\"wifi_attempts\":2,\"mqtt_attempts\":0,"
+    "\"down_ms\":3000,\"wifi_ms\":2000,\"mqtt_ms\":1000}";
+  memset(&connManager, 0, sizeof(connManager));
+  connManager.report.cause = CONN_EVENT_WIFI_DOWN;
+  connManager.report.wifiReason = 201;
+  connManager.report.wifiAttempts = 2;
+  connManager.report.downMs = 3000;
+  connManager.report.wifiMs = 2000;
+  connManager.report.mqttMs = 1000;
+  connManager.reportReady = true;
+
+  mocks.ExpectCallFunc(mqtt_publish_data).With(CString(topic), CString(data), QOS_1, NO_RETAIN);
+  publish_connection_report();
+  // published once per outage
+  publish_connection_report();
+}
@@ -0,0 +1,162 @@
+#include "esp_system.h"
+#include "catch.hpp"
+#include "hippomocks.h"
+
+#include <string.h>
+#include <vector>
+
+extern "C" {
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "app_event_bus.h"
+#include "sim.h"
+}
+
+#define INBOX_A ((QueueHandle_t)1)
+#define INBOX_B ((QueueHandle_t)2)
+
+TEST_CASE("event_bus_fan_out", "[event_bus]" ) {
+  MockRepository mocks;
+  event_bus_init();
+  REQUIRE(event_bus_subscribe(EVENT_RELAY_CMD, INBOX_A));
+  REQUIRE(event_bus_subscribe(EVENT_RELAY_CMD, INBOX_B));
+  REQUIRE(!event_bus_subscribe(EVENT_RELAY_CMD, INBOX_B));
+
+  std::vector<QueueHandle_t> inboxes;
+  std::vector<struct AppEvent *> events;
+  mocks.OnCallFunc(xQueueSend).Do([&](QueueHandle_t q, const void * const item, TickType_t t) {
+      inboxes.push_back(q);
+      events.push_back(*(struct AppEvent * const *)item);
+      return pdPASS;
+    });
+
+  int data = 42;
+  REQUIRE(event_bus_publish(EVENT_RELAY_CMD, &data, sizeof(data), 0));
+  REQUIRE(inboxes.size() == 2);
+  REQUIRE(inboxes[0] == INBOX_A);
+  REQUIRE(inboxes[1] == INBOX_B);
+  // both subscribers share the same pooled event
+  REQUIRE(events[0] == events[1]);
+  REQUIRE(events[0]->id == EVENT_RELAY_CMD);
+  REQUIRE(*(int *)EVENT_DATA(events[0]) == 42);
+
+  REQUIRE(event_bus_pool_free() == EVENT_BUS_POOL_SIZE - 1);
+  event_bus_release(events[0]);
+  REQUIRE(event_bus_pool_free() == EVENT_BUS_POOL_SIZE - 1);
+  event_bus_release(events[1]);
+  REQUIRE(event_bus_pool_free() == EVENT_BUS_POOL_SIZE);
+}
+
+TEST_CASE("event_bus_no_subscriber", "[event_bus]" ) {
+  MockRepository mocks;
+  event_bus_init();
+  mocks.NeverCallFunc(xQueueSend);
+
+  int data = 1;
+  REQUIRE(event_bus_publish(EVENT_OTA_CMD, &data, sizeof(data), 0));
+  REQUIRE(event_bus_pool_free() == EVENT_BUS_POOL_SIZE);
+  REQUIRE(eventBusStats.published == 0);
+}
+
+TEST_CASE("event_bus_pool_empty", "[event_bus]" ) {
+  MockRepository mocks;
+  event_bus_init();
+  event_bus_subscribe(EVENT_THERMOSTAT_CMD, INBOX_A);
+  mocks.OnCallFunc(xQueueSend).Return(pdPASS);
+
+  int data = 1;
+  for (int i = 0; i < EVENT_BUS_POOL_SIZE; i++) {
+    REQUIRE(event_bus_publish(EVENT_THERMOSTAT_CMD, &data, sizeof(data), 0));
+  }
+  REQUIRE(event_bus_pool_free() == 0);
+  REQUIRE(!event_bus_publish(EVENT_THERMOSTAT_CMD, &data, sizeof(data), 0));
+  REQUIRE(eventBusStats.published == EVENT_BUS_POOL_SIZE);
+  REQUIRE(eventBusStats.dropped == 1);
+}
+
+TEST_CASE("event_bus_inbox_full", "[event_bus]" ) {
+  MockRepository mocks;
+  event_bus_init();
+  event_bus_subscribe(EVENT_SENSOR_SAMPLE, INBOX_A);
+  event_bus_subscribe(EVENT_SENSOR_SAMPLE, INBOX_B);
+  mocks.OnCallFunc(xQueueSend).Do([&](QueueHandle_t q, const void * const item, TickType_t t) {
+      return q == INBOX_A ? pdPASS : !pdPASS;
+    });
+
+  int data = 1;
+  REQUIRE(!event_bus_publish(EVENT_SENSOR_SAMPLE, &data, sizeof(data), 0));
+  // the reference of the full inbox is given back
+  REQUIRE(event_bus_pool_free() == EVENT_BUS_POOL_SIZE - 1);
+  REQUIRE(eventBusStats.dropped == 1);
+}
+
+TEST_CASE("event_bus_too_big", "[event_bus]" ) {
+  MockRepository mocks;
+  event_bus_init();
+  event_bus_subscribe(EVENT_OTA_CMD, INBOX_A);
+  mocks.NeverCallFunc(xQueueSend);
+
+  char data[EVENT_BUS_DATA_SIZE + 1];
+  memset(data, 0, sizeof(data));
+  REQUIRE(!event_bus_publish(EVENT_OTA_CMD, data, sizeof(data), 0));
+}
+
+#define POOL_WAIT_EVENTS (EVENT_BUS_POOL_SIZE + 4)
+
+static QueueHandle_t poolWaitInbox;
+static int poolWaitPublished;
+static int poolWaitReceived;
+
+static void pool_wait_producer(void *pvParameters)
+{
+  TickType_t timeout = (TickType_t)(intptr_t)pvParameters;
+  for (int i = 0; i < POOL_WAIT_EVENTS; i++) {
+    poolWaitPublished += event_bus_publish(EVENT_RELAY_CMD, &i, sizeof(i), timeout);
+  }
+  for (;;) {
+    vTaskDelay(1000);
+  }
+}
+
+// holds every event for a while before giving it back
+static void pool_wait_consumer(void *pvParameters)
+{
+  struct AppEvent *e;
+  for (;;) {
+    if (xQueueReceive(poolWaitInbox, &e, portMAX_DELAY)) {
+      vTaskDelay(10);
+      poolWaitReceived++;
+      event_bus_release(e);
+    }
+  }
+}
+
+static void pool_wait_run(TickType_t timeout)
+{
+  sim_start();
+  event_bus_init();
+  poolWaitPublished = 0;
+  poolWaitReceived = 0;
+  poolWaitInbox = xQueueCreate(POOL_WAIT_EVENTS, sizeof(struct AppEvent *));
+  event_bus_subscribe(EVENT_RELAY_CMD, poolWaitInbox);
+  xTaskCreate(pool_wait_consumer, "consumer", 0, NULL, 1, NULL);
+  xTaskCreate(pool_wait_producer, "producer", 0, (void *)(intptr_t)timeout, 2, NULL);
+  sim_run_for(10 * 1000);
+}
+
+TEST_CASE("event_bus_pool_wait", "[event_bus]" ) {
+  // publishers wait for events to be given back
+  pool_wait_run(portMAX_DELAY);
+  REQUIRE(poolWaitPublished == POOL_WAIT_EVENTS);
+  REQUIRE(poolWaitReceived == POOL_WAIT_EVENTS);
+  REQUIRE(eventBusStats.dropped == 0);
+  REQUIRE(event_bus_pool_free() == EVENT_BUS_POOL_SIZE);
+  sim_stop();
+
+  // unless they cannot wait
+  pool_wait_run(0);
+  REQUIRE(poolWaitPublished == EVENT_BUS_POOL_SIZE);
+  REQUIRE(poolWaitReceived == EVENT_BUS_POOL_SIZE);
+  REQUIRE(eventBusStats.dropped == 4);
+  sim_stop();
+}
@@ -0,0 +1,109 @@
+#include "catch.hpp"
+
+#include <stddef.h>
+#include <string.h>
+
+extern "C" {
+#include "app_json.h"
+}
+
+static int parse(const char *js, struct JsonToken *tokens)
+{
+  return json_parse(js, strlen(js), tokens, JSON_MAX_TOKENS);
+}
+
+TEST_CASE("json_parse_object", "[json]" ) {
+  struct JsonToken tokens[JSON_MAX_TOKENS];
+  const char *js = "{\"ts\": 12, \"data\": {\"relayId\": 1}, \"list\": [1, \"a\", []]}";
+
+  REQUIRE(parse(js, tokens) == 12);
+  REQUIRE(tokens[0].type == JSON_OBJECT);
+  REQUIRE(tokens[0].size == 3);
+  REQUIRE(tokens[0].start == 0);
+  REQUIRE(tokens[0].end == (int)strlen(js));
+  REQUIRE(tokens[1].type == JSON_STRING);
+  REQUIRE(std::string(js + tokens[1].start, tokens[1].end - tokens[1].start) == "ts");
+  REQUIRE(tokens[2].type == JSON_PRIMITIVE);
+  REQUIRE(tokens[4].type == JSON_OBJECT);
+  REQUIRE(tokens[4].size == 1);
+  REQUIRE(tokens[8].type == JSON_ARRAY);
+  REQUIRE(tokens[8].size == 3);
+  REQUIRE(tokens[11].type == JSON_ARRAY);
+  REQUIRE(tokens[11].size == 0);
+}
+
+TEST_CASE("json_parse_errors", "[json]" ) {
+  struct JsonToken tokens[JSON_MAX_TOKENS];
+
+  REQUIRE(parse("", tokens) == JSON_ERROR_PART);
+  REQUIRE(parse("{\"ts\": 12", tokens) == JSON_ERROR_PART);
+  REQUIRE(parse("{\"ts", tokens) == JSON_ERROR_PART);
+  REQUIRE(parse("{\"ts\": 12,}", tokens) == JSON_ERROR_INVAL);
+  REQUIRE(parse("{\"ts\" 12}", tokens) == JSON_ERROR_INVAL);
+  REQUIRE(parse("{12: 12}", tokens) == JSON_ERROR_INVAL);
+  REQUIRE(parse("[1, 2]]", tokens) == JSON_ERROR_INVAL);
+  REQUIRE(parse("{\"ts\": 12} 1", tokens) == JSON_ERROR_INVAL);
+  REQUIRE(parse("[[[[[[[[[1]]]]]]]]]", tokens) == JSON_ERROR_NOMEM);
+
+  struct JsonToken few[2];
+  REQUIRE(json_parse("[1, 2]", 6, few, 2) == JSON_ERROR_NOMEM);
+}
+
+TEST_CASE("json_parse_len", "[json]" ) {
+  struct JsonToken tokens[JSON_MAX_TOKENS];
+  const char *js = "{\"a\": 1}garbage";
+
+  REQUIRE(json_parse(js, 8, tokens, JSON_MAX_TOKENS) == 3);
+}
+
+TEST_CASE("json_object_get_path", "[json]" ) {
+  struct JsonToken tokens[JSON_MAX_TOKENS];
+  const char *js = "{\"skip\": {\"relayId\": [1, {\"x\": 2}]}, \"data\": {\"relayId\": -3, \"v\": 1.7}}";
+  int tokensNb = parse(js, tokens);
+  REQUIRE(tokensNb > 0);
+
+  long value = 0;
+  int t = json_object_get(js, tokens, tokensNb, 0, "data.relayId");
+  REQUIRE(t > 0);
+  REQUIRE(json_token_int(js, &tokens[t], &value));
+  REQUIRE(value == -3);
+
+  t = json_object_get(js, tokens, tokensNb, 0, "data.v");
+  REQUIRE(json_token_int(js, &tokens[t], &value));
+  REQUIRE(value == 1);
+
+  REQUIRE(json_object_get(js, tokens, tokensNb, 0, "data.missing") == -1);
+  REQUIRE(json_object_get(js, tokens, tokensNb, 0, "relayId") == -1);
+  REQUIRE(json_object_get(js, tokens, tokensNb, 0, "data.relayId.x") == -1);
+}
+
+struct BindTest {
+  unsigned char c;
+  short s;
+  int i;
+  long long l;
+  unsigned char untouched;
+};
+
+static const struct JsonBinding BIND_TEST_BINDINGS[] = {
+  JSON_BIND_FIELD("c", JSON_BIND_INT, struct BindTest, c),
+  JSON_BIND_FIELD("n.s", JSON_BIND_INT, struct BindTest, s),
+  JSON_BIND_FIELD("i", JSON_BIND_INT, struct BindTest, i),
+  JSON_BIND_FIELD("l", JSON_BIND_INT, struct BindTest, l),
+  JSON_BIND_FIELD("str", JSON_BIND_INT, struct BindTest, untouched),
+};
+
+TEST_CASE("json_bind_fields", "[json]" ) {
+  struct JsonToken tokens[JSON_MAX_TOKENS];
+  const char *js = "{\"c\": 200, \"n\": {\"s\": -300}, \"i\": true, \"l\": 1500000000, \"str\": \"7\"}";
+  int tokensNb = parse(js, tokens);
+  struct BindTest b;
+  memset(&b, 0, sizeof(b));
+
+  REQUIRE(json_bind(js, tokens, tokensNb, BIND_TEST_BINDINGS, 5, &b) == 4);
+  REQUIRE(b.c == 200);
+  REQUIRE(b.s == -300);
+  REQUIRE(b.i == 1);
+  REQUIRE(b.l == 1500000000);
+  REQUIRE(b.untouched == 0);
+}
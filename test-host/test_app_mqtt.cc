@@ -3,12 +3,782 @@
 #include "hippomocks.h"
 #include "cJSON.h"
 
+#include <string.h>
+#include <string>
+
 using HippoMocks::CString;
 
 extern "C" {
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "mqtt_client.h"
+#include "app_mqtt.h"
+#include "app_mqtt_router.h"
+#include "app_mqtt_publisher.h"
+#include "app_mqtt_topics.h"
+#include "app_mqtt_outbox.h"
+#include "app_relay.h"
+#include "app_thermostat.h"
+#include "app_scheduler.h"
+#include "app_latency.h"
+#include "app_event_bus.h"
+}
+
+extern "C" {
+  void mqtt_init_and_start();
+  void dispatch_mqtt_event(esp_mqtt_event_handle_t event);
+  bool mqtt_subscribe(esp_mqtt_client_handle_t client);
+}
+
+static void route_handler(int id, const char *data, int data_len)
+{}
+
+static void other_route_handler(int id, const char *data, int data_len)
+{}
+
+static const struct MqttRoute testRoutes[] = {
+  {"dev/client/cmd/status/relay/+", route_handler, 0, 4},
+  {"dev/client/cmd/sleep/relay/+", other_route_handler, 0, 4},
+  {"dev/client/cmd/ota", other_route_handler, 0, 0},
+  {"dev/client/cmd/status/relay/all", other_route_handler, 0, 0},
+  {"a/very/long/sensor/topic/which/is/longer/than/sixty/four/characters/temp", route_handler, 2, 0},
+};
+
+static const struct MqttRoute * lookup(const char *topic, int *id)
+{
+  return mqtt_router_lookup(topic, strlen(topic), id);
+}
+
+TEST_CASE("mqtt_router_lookup_id", "[router]" ) {
+  REQUIRE(mqtt_router_init(testRoutes, sizeof(testRoutes) / sizeof(testRoutes[0])));
+  int id = -1;
+
+  REQUIRE(lookup("dev/client/cmd/status/relay/3", &id) == &testRoutes[0]);
+  REQUIRE(id == 3);
+  REQUIRE(lookup("dev/client/cmd/sleep/relay/12", &id) == &testRoutes[1]);
+  REQUIRE(id == 12);
+  REQUIRE(lookup("dev/client/cmd/ota", &id) == &testRoutes[2]);
+  REQUIRE(id == 0);
+}
+
+TEST_CASE("mqtt_router_lookup_literal_before_id", "[router]" ) {
+  REQUIRE(mqtt_router_init(testRoutes, sizeof(testRoutes) / sizeof(testRoutes[0])));
+  int id = -1;
+
+  REQUIRE(lookup("dev/client/cmd/status/relay/all", &id) == &testRoutes[3]);
+  REQUIRE(id == 0);
+}
+
+TEST_CASE("mqtt_router_lookup_long_topic", "[router]" ) {
+  REQUIRE(mqtt_router_init(testRoutes, sizeof(testRoutes) / sizeof(testRoutes[0])));
+  int id = -1;
+
+  REQUIRE(lookup("a/very/long/sensor/topic/which/is/longer/than/sixty/four/characters/temp", &id) == &testRoutes[4]);
+  REQUIRE(id == 2);
+}
+
+TEST_CASE("mqtt_router_lookup_no_match", "[router]" ) {
+  REQUIRE(mqtt_router_init(testRoutes, sizeof(testRoutes) / sizeof(testRoutes[0])));
+  int id = -1;
+
+  REQUIRE(lookup("dev/client/cmd/status/relay/x", &id) == NULL);
+  REQUIRE(lookup("dev/client/cmd/status/relay/", &id) == NULL);
+  REQUIRE(lookup("dev/client/cmd/status/relay/1/2", &id) == NULL);
+  REQUIRE(lookup("dev/client/cmd/status/relay", &id) == NULL);
+  REQUIRE(lookup("dev/client/cmd/ota/", &id) == NULL);
+  REQUIRE(lookup("dev/client/cmd", &id) == NULL);
+  REQUIRE(lookup("", &id) == NULL);
+  REQUIRE(mqtt_router_lookup(NULL, 0, &id) == NULL);
+}
+
+TEST_CASE("mqtt_router_lookup_topic_len", "[router]" ) {
+  REQUIRE(mqtt_router_init(testRoutes, sizeof(testRoutes) / sizeof(testRoutes[0])));
+  int id = -1;
+  const char * topic = "dev/client/cmd/status/relay/1trailing";
+
+  REQUIRE(mqtt_router_lookup(topic, strlen(topic) - strlen("trailing"), &id) == &testRoutes[0]);
+  REQUIRE(id == 1);
+}
+
+// one fake inbox per event, the mocked xQueueSend receives the
+// pointer to the pooled event
+static void event_bus_setup()
+{
+  event_bus_init();
+  for (int id = 0; id < EVENT_ID_NB; id++) {
+    event_bus_subscribe((enum AppEventId)id, (QueueHandle_t)1);
+  }
+}
+
+static void event_data(void *dst, const void *item, size_t size)
+{
+  struct AppEvent *e = *(struct AppEvent * const *)item;
+  memcpy(dst, EVENT_DATA(e), size);
+  event_bus_release(e);
+}
+
+static esp_mqtt_event_t make_event(const char *topic, const char *data)
+{
+  esp_mqtt_event_t event;
+  memset(&event, 0, sizeof(event));
+  event.event_id = MQTT_EVENT_DATA;
+  event.topic = (char *)topic;
+  event.topic_len = strlen(topic);
+  event.data = (char *)data;
+  event.data_len = strlen(data);
+  event.total_data_len = event.data_len;
+  return event;
+}
+
+TEST_CASE("dispatch_relay_status_cmd", "[dispatch]" ) {
+  MockRepository mocks;
+  mqtt_init_and_start();
+  event_bus_setup();
+  struct RelayMessage rm;
+  memset(&rm, 0, sizeof(rm));
+  mocks.ExpectCallFunc(xQueueSend).Do([&](QueueHandle_t q, const void * const item, TickType_t t) {
+      event_data(&rm, item, sizeof(rm));
+      return pdPASS;
+    });
+
+  esp_mqtt_event_t event = make_event("device_type/client_id/cmd/status/relay/1", "ON");
+  dispatch_mqtt_event(&event);
+
+  REQUIRE(rm.msgType == RELAY_CMD_STATUS);
+  REQUIRE(rm.relayId == 1);
+  REQUIRE(rm.data == RELAY_STATUS_ON);
+  REQUIRE(rm.trace.received != 0);
+  REQUIRE(rm.trace.queued >= rm.trace.received);
+}
+
+TEST_CASE("dispatch_relay_bad_id", "[dispatch]" ) {
+  MockRepository mocks;
+  mqtt_init_and_start();
+  event_bus_setup();
+  mocks.NeverCallFunc(xQueueSend);
+
+  esp_mqtt_event_t event = make_event("device_type/client_id/cmd/status/relay/2", "ON");
+  dispatch_mqtt_event(&event);
+}
+
+static struct RelayMessage dispatch_relays(const char *data)
+{
+  MockRepository mocks;
+  mqtt_init_and_start();
+  event_bus_setup();
+  struct RelayMessage rm;
+  memset(&rm, 0, sizeof(rm));
+  mocks.OnCallFunc(xQueueSend).Do([&](QueueHandle_t q, const void * const item, TickType_t t) {
+      event_data(&rm, item, sizeof(rm));
+      return pdPASS;
+    });
+
+  esp_mqtt_event_t event = make_event("device_type/client_id/cmd/status/relays", data);
+  dispatch_mqtt_event(&event);
+  return rm;
+}
+
+TEST_CASE("dispatch_relays_status_cmd", "[dispatch]" ) {
+  struct RelayMessage rm = dispatch_relays("0x3:0x1");
+  REQUIRE(rm.msgType == RELAY_CMD_STATUS_ALL);
+  REQUIRE(RELAY_STATUS_ALL_MASK(rm.data) == 3);
+  REQUIRE(RELAY_STATUS_ALL_VALUE(rm.data) == 1);
+  REQUIRE(rm.trace.received != 0);
+
+  rm = dispatch_relays("2:3");
+  REQUIRE(RELAY_STATUS_ALL_MASK(rm.data) == 2);
+  REQUIRE(RELAY_STATUS_ALL_VALUE(rm.data) == 2);
+
+  rm = dispatch_relays("{\"1\":\"ON\",\"0\":\"OFF\"}");
+  REQUIRE(rm.msgType == RELAY_CMD_STATUS_ALL);
+  REQUIRE(RELAY_STATUS_ALL_MASK(rm.data) == 3);
+  REQUIRE(RELAY_STATUS_ALL_VALUE(rm.data) == 2);
+
+  rm = dispatch_relays("{\"0\":true}");
+  REQUIRE(RELAY_STATUS_ALL_MASK(rm.data) == 1);
+  REQUIRE(RELAY_STATUS_ALL_VALUE(rm.data) == 1);
+}
+
+TEST_CASE("dispatch_relays_bad_cmd", "[dispatch]" ) {
+  MockRepository mocks;
+  mqtt_init_and_start();
+  event_bus_setup();
+  mocks.NeverCallFunc(xQueueSend);
+
+  const char *payloads[] = {"", "3", "3:", "x:1", "0:0", "0x4:0x4",
+                            "{}", "{\"2\":\"ON\"}", "{\"0\":\"MAYBE\"}", "[1,2]"};
+  for (unsigned int i = 0; i < sizeof(payloads) / sizeof(payloads[0]); i++) {
+    esp_mqtt_event_t event = make_event("device_type/client_id/cmd/status/relays", payloads[i]);
+    dispatch_mqtt_event(&event);
+  }
+}
+
+TEST_CASE("dispatch_thermostat_temp_cmd", "[dispatch]" ) {
+  MockRepository mocks;
+  mqtt_init_and_start();
+  event_bus_setup();
+  struct ThermostatMessage tm;
+  memset(&tm, 0, sizeof(tm));
+  mocks.ExpectCallFunc(xQueueSend).Do([&](QueueHandle_t q, const void * const item, TickType_t t) {
+      event_data(&tm, item, sizeof(tm));
+      return pdPASS;
+    });
+
+  esp_mqtt_event_t event = make_event("device_type/client_id/cmd/temp/thermostat/3", "21.5");
+  dispatch_mqtt_event(&event);
+
+  REQUIRE(tm.msgType == THERMOSTAT_CMD_TARGET_TEMPERATURE);
+  REQUIRE(tm.thermostatId == 3);
+  REQUIRE(tm.data.targetTemperature == 215);
+}
+
+TEST_CASE("dispatch_thermostat_mqtt_sensor", "[dispatch]" ) {
+  MockRepository mocks;
+  mqtt_init_and_start();
+  event_bus_setup();
+  struct ThermostatMessage tm;
+  memset(&tm, 0, sizeof(tm));
+  mocks.ExpectCallFunc(xQueueSend).Do([&](QueueHandle_t q, const void * const item, TickType_t t) {
+      event_data(&tm, item, sizeof(tm));
+      return pdPASS;
+    });
+
+  esp_mqtt_event_t event = make_event("some/fake/sensor/topic", "19.5");
+  dispatch_mqtt_event(&event);
+
+  REQUIRE(tm.msgType == THERMOSTAT_CURRENT_TEMPERATURE);
+  REQUIRE(tm.thermostatId == 1);
+  REQUIRE(tm.data.currentTemperature == 195);
+}
+
+TEST_CASE("dispatch_unknown_topic", "[dispatch]" ) {
+  MockRepository mocks;
+  mqtt_init_and_start();
+  event_bus_setup();
+  mocks.NeverCallFunc(xQueueSend);
+
+  esp_mqtt_event_t event = make_event("device_type/client_id/cmd/status/fan/1", "ON");
+  dispatch_mqtt_event(&event);
+}
+
+TEST_CASE("dispatch_scheduler_cfg", "[dispatch]" ) {
+  MockRepository mocks;
+  mqtt_init_and_start();
+  event_bus_setup();
+  struct SchedulerCfgMessage s;
+  memset(&s, 0, sizeof(s));
+  mocks.ExpectCallFunc(xQueueSend).Do([&](QueueHandle_t q, const void * const item, TickType_t t) {
+      event_data(&s, item, sizeof(s));
+      return pdPASS;
+    });
+
+  esp_mqtt_event_t event = make_event("device_type/client_id/cfg/scheduler/3",
+                                      "{\"ts\":1546300800,\"aId\":1,\"aState\":1,"
+                                      "\"data\":{\"relayId\":1,\"relayValue\":1}}");
+  dispatch_mqtt_event(&event);
+
+  REQUIRE(s.schedulerId == 3);
+  REQUIRE(s.timestamp == 1546300800);
+  REQUIRE(s.actionId == ADD_RELAY_ACTION);
+  REQUIRE(s.actionState == ACTION_STATE_ENABLED);
+  REQUIRE(s.data.relayActionData.relayId == 1);
+  REQUIRE(s.data.relayActionData.data == 1);
+}
+
+TEST_CASE("dispatch_scheduler_cfg_bad_json", "[dispatch]" ) {
+  MockRepository mocks;
+  mqtt_init_and_start();
+  event_bus_setup();
+  mocks.NeverCallFunc(xQueueSend);
+
+  esp_mqtt_event_t event = make_event("device_type/client_id/cfg/scheduler/3", "{\"ts\":15463");
+  dispatch_mqtt_event(&event);
+}
+
+TEST_CASE("dispatch_fragmented_payload", "[dispatch]" ) {
+  MockRepository mocks;
+  mqtt_init_and_start();
+  event_bus_setup();
+  struct ThermostatMessage tm;
+  memset(&tm, 0, sizeof(tm));
+  mocks.ExpectCallFunc(xQueueSend).Do([&](QueueHandle_t q, const void * const item, TickType_t t) {
+      event_data(&tm, item, sizeof(tm));
+      return pdPASS;
+    });
+
+  esp_mqtt_event_t event = make_event("device_type/client_id/cmd/temp/thermostat/2", "22");
+  event.total_data_len = 4;
+  dispatch_mqtt_event(&event);
+
+  // only the first fragment carries the topic
+  event = make_event("", ".5");
+  event.topic = NULL;
+  event.current_data_offset = 2;
+  event.total_data_len = 4;
+  dispatch_mqtt_event(&event);
+
+  REQUIRE(tm.msgType == THERMOSTAT_CMD_TARGET_TEMPERATURE);
+  REQUIRE(tm.thermostatId == 2);
+  REQUIRE(tm.data.targetTemperature == 225);
+}
+
+TEST_CASE("dispatch_payload_too_big", "[dispatch]" ) {
+  MockRepository mocks;
+  mqtt_init_and_start();
+  event_bus_setup();
+  mocks.NeverCallFunc(xQueueSend);
+  static char data[MQTT_PAYLOAD_MAX_SIZE + 2];
+  memset(data, '1', sizeof(data) - 1);
+  data[sizeof(data) - 1] = 0;
+
+  esp_mqtt_event_t event = make_event("device_type/client_id/cmd/sleep/relay/0", data);
+  event.data_len = 16;
+  dispatch_mqtt_event(&event);
+
+  // the rest of the dropped message is ignored too
+  event = make_event("", data + 16);
+  event.topic = NULL;
+  event.current_data_offset = 16;
+  event.total_data_len = sizeof(data) - 1;
+  dispatch_mqtt_event(&event);
+}
+
+TEST_CASE("dispatch_unexpected_fragment", "[dispatch]" ) {
+  MockRepository mocks;
+  mqtt_init_and_start();
+  event_bus_setup();
+  mocks.NeverCallFunc(xQueueSend);
+
+  esp_mqtt_event_t event = make_event("device_type/client_id/cmd/status/relay/0", "O");
+  event.total_data_len = 2;
+  dispatch_mqtt_event(&event);
+
+  event = make_event("", "N");
+  event.topic = NULL;
+  event.current_data_offset = 3;
+  event.total_data_len = 2;
+  dispatch_mqtt_event(&event);
 }
 
-TEST_CASE("test get ", "[tag]" ) {
-  short temp=0;
-  REQUIRE(temp == 0);
+TEST_CASE("mqtt_subscribe_pipelined", "[subscribe]" ) {
+  MockRepository mocks;
+  int sent = 0;
+  int waits = 0;
+  mocks.OnCallFunc(xEventGroupSetBits).Return(0);
+  mocks.OnCallFunc(esp_mqtt_client_subscribe).Do([&](esp_mqtt_client_handle_t c, const char *topic, int qos) {
+      REQUIRE(waits == 0);
+      return 10 + sent++;
+    });
+  mocks.OnCallFunc(xEventGroupWaitBits).Do([&](EventGroupHandle_t g, const EventBits_t b, const BaseType_t c, const BaseType_t a, TickType_t t) {
+      // SUBACKs come back in any order
+      for (int i = sent - 1; i >= 0; i--) {
+        mqtt_subscribe_acked(10 + i);
+      }
+      waits++;
+      return 0;
+    });
+
+  REQUIRE(mqtt_subscribe(NULL));
+  REQUIRE(sent > 1);
+  REQUIRE(waits == 1);
+}
+
+TEST_CASE("mqtt_subscribe_ack_missing", "[subscribe]" ) {
+  MockRepository mocks;
+  TickType_t now = 0;
+  int sent = 0;
+  mocks.OnCallFunc(xEventGroupSetBits).Return(0);
+  mocks.OnCallFunc(xTaskGetTickCount).Do([&]() { return now; });
+  mocks.OnCallFunc(esp_mqtt_client_subscribe).Do([&](esp_mqtt_client_handle_t c, const char *topic, int qos) {
+      return 10 + sent++;
+    });
+  mocks.OnCallFunc(xEventGroupWaitBits).Do([&](EventGroupHandle_t g, const EventBits_t b, const BaseType_t c, const BaseType_t a, TickType_t t) {
+      // the first subscription is never acked
+      for (int i = 1; i < sent; i++) {
+        mqtt_subscribe_acked(10 + i);
+      }
+      now += t;
+      return 0;
+    });
+
+  REQUIRE_FALSE(mqtt_subscribe(NULL));
+  REQUIRE(now == MQTT_FLAG_TIMEOUT);
+}
+
+TEST_CASE("mqtt_id_topics", "[topics]" ) {
+  REQUIRE(std::string(MQTT_ID_TOPIC(MQTT_TOPIC_RELAY_STATUS, 0)) == "device_type/client_id/evt/status/relay/0");
+  REQUIRE(std::string(MQTT_ID_TOPIC(MQTT_TOPIC_RELAY_SLEEP, 3)) == "device_type/client_id/evt/sleep/relay/3");
+  REQUIRE(std::string(MQTT_ID_TOPIC(MQTT_TOPIC_THERMOSTAT_ACTION, 2)) == "device_type/client_id/evt/action/thermostat/2");
+  REQUIRE(mqtt_topics_size() > (int)sizeof(mqttIdTopics));
+}
+
+TEST_CASE("latency_histograms", "[latency]" ) {
+  struct LatencyHistogram h[LATENCY_STAGES_NB];
+  latency_snapshot(h);
+
+  latency_record(LATENCY_RELAY_QUEUE, 1000, 1050);
+  latency_record(LATENCY_RELAY_QUEUE, 1000, 1100);
+  latency_record(LATENCY_RELAY_QUEUE, 1000, 1000 + 25000);
+  latency_record(LATENCY_RELAY_QUEUE, 1000, 1000 + 5000000);
+  latency_record(LATENCY_RELAY_GPIO, 0xfffffff0, 0x10); // timer wrapped
+  latency_record(LATENCY_RELAY_TOTAL, 0, 1000); // untraced
+  latency_snapshot(h);
+
+  REQUIRE(h[LATENCY_RELAY_QUEUE].buckets[0] == 1);
+  REQUIRE(h[LATENCY_RELAY_QUEUE].buckets[1] == 1);
+  REQUIRE(h[LATENCY_RELAY_QUEUE].buckets[3] == 1);
+  REQUIRE(h[LATENCY_RELAY_QUEUE].buckets[5] == 1);
+  REQUIRE(h[LATENCY_RELAY_QUEUE].max == 5000000);
+  REQUIRE(h[LATENCY_RELAY_GPIO].buckets[0] == 1);
+  REQUIRE(h[LATENCY_RELAY_GPIO].max == 0x20);
+  REQUIRE(h[LATENCY_RELAY_TOTAL].max == 0);
+
+  // a snapshot clears the histograms
+  latency_snapshot(h);
+  REQUIRE(h[LATENCY_RELAY_QUEUE].max == 0);
+  REQUIRE(h[LATENCY_RELAY_QUEUE].buckets[0] == 0);
+}
+
+static void ring_consume(struct MqttPublishRecord *r)
+{
+  mqtt_publish_ring_sent(r);
+  mqtt_publish_ring_done(r);
+}
+
+TEST_CASE("mqtt_publish_ring_fifo", "[publisher]" ) {
+  mqtt_publish_ring_reset();
+  REQUIRE(mqtt_publish_ring_peek() == NULL);
+
+  REQUIRE(mqtt_publish_ring_push("topic/0", "ON", 2, QOS_1, RETAIN, NULL, NULL));
+  REQUIRE(mqtt_publish_ring_push("topic/1", "OFF", 3, QOS_0, NO_RETAIN, NULL, NULL));
+
+  struct MqttPublishRecord *r = mqtt_publish_ring_peek();
+  REQUIRE(r != NULL);
+  REQUIRE(std::string(mqtt_publish_record_topic(r)) == "topic/0");
+  REQUIRE(std::string(mqtt_publish_record_data(r)) == "ON");
+  REQUIRE(r->dataLen == 2);
+  REQUIRE(r->qos == QOS_1);
+  REQUIRE(r->retain == RETAIN);
+  ring_consume(r);
+
+  r = mqtt_publish_ring_peek();
+  REQUIRE(r != NULL);
+  REQUIRE(std::string(mqtt_publish_record_topic(r)) == "topic/1");
+  REQUIRE(std::string(mqtt_publish_record_data(r)) == "OFF");
+  ring_consume(r);
+
+  REQUIRE(mqtt_publish_ring_peek() == NULL);
+}
+
+TEST_CASE("mqtt_publish_ring_full_and_wrap", "[publisher]" ) {
+  mqtt_publish_ring_reset();
+  unsigned int dropped = mqttPublishStats.dropped;
+  char data[200];
+  memset(data, 'x', sizeof(data));
+
+  int pushed = 0;
+  while (mqtt_publish_ring_push("topic", data, sizeof(data), QOS_0, NO_RETAIN, NULL, NULL)) {
+    pushed++;
+  }
+  REQUIRE(pushed > 2);
+  REQUIRE(mqttPublishStats.dropped == dropped + 1);
+
+  // free the first two slots, next pushes wrap to the ring start
+  ring_consume(mqtt_publish_ring_peek());
+  ring_consume(mqtt_publish_ring_peek());
+  REQUIRE(mqtt_publish_ring_push("wrapped/0", "0", 1, QOS_0, NO_RETAIN, NULL, NULL));
+  REQUIRE(mqtt_publish_ring_push("wrapped/1", "1", 1, QOS_0, NO_RETAIN, NULL, NULL));
+
+  for (int i = 2; i < pushed; i++) {
+    struct MqttPublishRecord *r = mqtt_publish_ring_peek();
+    REQUIRE(std::string(mqtt_publish_record_topic(r)) == "topic");
+    ring_consume(r);
+  }
+  struct MqttPublishRecord *r = mqtt_publish_ring_peek();
+  REQUIRE(std::string(mqtt_publish_record_topic(r)) == "wrapped/0");
+  ring_consume(r);
+  r = mqtt_publish_ring_peek();
+  REQUIRE(std::string(mqtt_publish_record_topic(r)) == "wrapped/1");
+  ring_consume(r);
+  REQUIRE(mqtt_publish_ring_peek() == NULL);
+}
+
+TEST_CASE("mqtt_publish_ring_done_out_of_order", "[publisher]" ) {
+  mqtt_publish_ring_reset();
+  char data[200];
+  memset(data, 'x', sizeof(data));
+
+  int pushed = 0;
+  while (mqtt_publish_ring_push("topic", data, sizeof(data), QOS_1, NO_RETAIN, NULL, NULL)) {
+    pushed++;
+  }
+  struct MqttPublishRecord *first = mqtt_publish_ring_peek();
+  mqtt_publish_ring_sent(first);
+  struct MqttPublishRecord *second = mqtt_publish_ring_peek();
+  mqtt_publish_ring_sent(second);
+
+  // the second record is acked first, its space is kept until the first is done
+  mqtt_publish_ring_done(second);
+  REQUIRE_FALSE(mqtt_publish_ring_push("topic", data, sizeof(data), QOS_1, NO_RETAIN, NULL, NULL));
+  mqtt_publish_ring_done(first);
+  REQUIRE(mqtt_publish_ring_push("topic", data, sizeof(data), QOS_1, NO_RETAIN, NULL, NULL));
+  REQUIRE(mqtt_publish_ring_push("topic", data, sizeof(data), QOS_1, NO_RETAIN, NULL, NULL));
+
+  for (int i = 0; i < pushed; i++) {
+    ring_consume(mqtt_publish_ring_peek());
+  }
+  REQUIRE(mqtt_publish_ring_peek() == NULL);
+}
+
+TEST_CASE("mqtt_publish_ring_overflow", "[publisher]" ) {
+  mqtt_publish_ring_reset();
+  unsigned int overflow = mqttPublishStats.overflow;
+  static char data[MQTT_PUBLISH_RING_SIZE];
+
+  REQUIRE_FALSE(mqtt_publish_ring_push("topic", data, sizeof(data), QOS_0, NO_RETAIN, NULL, NULL));
+  REQUIRE(mqttPublishStats.overflow == overflow + 1);
+  REQUIRE(mqtt_publish_ring_peek() == NULL);
+}
+
+static int publishResults[MQTT_PUBLISH_INFLIGHT_WINDOW + 1];
+
+static void publish_cb(int msg_id, int result, void *ctx)
+{
+  publishResults[(long)ctx] = result;
+}
+
+static struct MqttPublishRecord * push_and_send(long id)
+{
+  REQUIRE(mqtt_publish_ring_push("topic", "data", 4, QOS_1, RETAIN, publish_cb, (void *)id));
+  struct MqttPublishRecord *r = mqtt_publish_ring_peek();
+  mqtt_publish_ring_sent(r);
+  return r;
+}
+
+TEST_CASE("mqtt_publish_inflight_acks", "[publisher]" ) {
+  MockRepository mocks;
+  mocks.OnCallFunc(xEventGroupSetBits).Return(0);
+  mqtt_publish_ring_reset();
+  for (int i = 0; i <= MQTT_PUBLISH_INFLIGHT_WINDOW; i++) {
+    publishResults[i] = 1;
+  }
+
+  for (int i = 0; i < MQTT_PUBLISH_INFLIGHT_WINDOW; i++) {
+    REQUIRE(mqtt_publish_inflight_add(push_and_send(i), 100 + i));
+  }
+  REQUIRE(mqtt_publish_inflight_count() == MQTT_PUBLISH_INFLIGHT_WINDOW);
+  REQUIRE_FALSE(mqtt_publish_inflight_add(push_and_send(MQTT_PUBLISH_INFLIGHT_WINDOW), 200));
+
+  // acks for unrelated msg_ids do not complete anything
+  REQUIRE_FALSE(mqtt_publish_acked(99));
+  REQUIRE(mqtt_publish_acked(103));
+  REQUIRE(mqtt_publish_acked(101));
+  mqtt_publish_inflight_process();
+
+  REQUIRE(mqtt_publish_inflight_count() == MQTT_PUBLISH_INFLIGHT_WINDOW - 2);
+  REQUIRE(publishResults[0] == 1);
+  REQUIRE(publishResults[1] == MQTT_PUBLISH_OK);
+  REQUIRE(publishResults[2] == 1);
+  REQUIRE(publishResults[3] == MQTT_PUBLISH_OK);
+
+  for (int i = 0; i < MQTT_PUBLISH_INFLIGHT_WINDOW; i++) {
+    mqtt_publish_acked(100 + i);
+  }
+  mqtt_publish_inflight_process();
+  REQUIRE(mqtt_publish_inflight_count() == 0);
+}
+
+TEST_CASE("mqtt_publish_inflight_early_ack", "[publisher]" ) {
+  MockRepository mocks;
+  mocks.OnCallFunc(xEventGroupSetBits).Return(0);
+  mqtt_publish_ring_reset();
+  publishResults[0] = 1;
+
+  REQUIRE_FALSE(mqtt_publish_acked(42));
+  REQUIRE(mqtt_publish_inflight_add(push_and_send(0), 42));
+  mqtt_publish_inflight_process();
+
+  REQUIRE(publishResults[0] == MQTT_PUBLISH_OK);
+  REQUIRE(mqtt_publish_inflight_count() == 0);
+}
+
+TEST_CASE("mqtt_publish_inflight_timeout", "[publisher]" ) {
+  MockRepository mocks;
+  TickType_t now = 1000;
+  mocks.OnCallFunc(xTaskGetTickCount).Do([&]() { return now; });
+  mocks.OnCallFunc(xEventGroupGetBits).Return(0);
+  mocks.NeverCallFunc(esp_mqtt_client_publish);
+  mqtt_publish_ring_reset();
+  publishResults[0] = 1;
+  unsigned int failed = mqttPublishStats.failed;
+
+  REQUIRE(mqtt_publish_inflight_add(push_and_send(0), 7));
+  REQUIRE(mqtt_publish_inflight_wait() == MQTT_PUBLISH_ACK_TIMEOUT);
+
+  now += MQTT_PUBLISH_ACK_TIMEOUT - 1;
+  mqtt_publish_inflight_process();
+  REQUIRE(mqtt_publish_inflight_count() == 1);
+  REQUIRE(mqtt_publish_inflight_wait() == 1);
+
+  // the slot is failed, never published again under a new msg_id
+  now += 1;
+  mqtt_publish_inflight_process();
+  REQUIRE(mqtt_publish_inflight_count() == 0);
+  REQUIRE(publishResults[0] == MQTT_PUBLISH_TIMEOUT);
+  REQUIRE(mqttPublishStats.failed == failed + 1);
+  REQUIRE(mqtt_publish_ring_peek() == NULL);
+}
+
+TEST_CASE("mqtt_publish_inflight_disconnected", "[publisher]" ) {
+  MockRepository mocks;
+  mocks.OnCallFunc(xEventGroupSetBits).Return(0);
+  mocks.NeverCallFunc(esp_mqtt_client_publish);
+  mqtt_publish_ring_reset();
+  publishResults[0] = 1;
+  publishResults[1] = 1;
+
+  REQUIRE(mqtt_publish_inflight_add(push_and_send(0), 11));
+  REQUIRE(mqtt_publish_inflight_add(push_and_send(1), 12));
+  REQUIRE(mqtt_publish_acked(12));
+  REQUIRE_FALSE(mqtt_publish_acked(13));
+  mqtt_publish_inflight_release();
+  mqtt_publish_inflight_process();
+
+  REQUIRE(mqtt_publish_inflight_count() == 0);
+  REQUIRE(publishResults[0] == MQTT_PUBLISH_FAILED);
+  REQUIRE(publishResults[1] == MQTT_PUBLISH_OK);
+  REQUIRE(mqtt_publish_ring_peek() == NULL);
+
+  // acks from before the disconnect do not complete new messages
+  publishResults[0] = 1;
+  REQUIRE(mqtt_publish_inflight_add(push_and_send(0), 13));
+  mqtt_publish_inflight_process();
+  REQUIRE(mqtt_publish_inflight_count() == 1);
+  REQUIRE(publishResults[0] == 1);
+  mqtt_publish_inflight_release();
+  mqtt_publish_inflight_process();
+  REQUIRE(publishResults[0] == MQTT_PUBLISH_FAILED);
+}
+
+TEST_CASE("mqtt_outbox_store_offline", "[outbox]" ) {
+  MockRepository mocks;
+  mocks.OnCallFunc(xEventGroupGetBits).Return(0);
+  mqtt_publish_ring_reset();
+  mqtt_outbox_reset();
+
+  mqtt_publish_data("sensors/temp", "195", QOS_0, NO_RETAIN);
+  // retained state is republished on connect, it is not kept
+  mqtt_publish_data("relay/status", "ON", QOS_1, RETAIN);
+  REQUIRE(mqtt_outbox_count() == 1);
+  REQUIRE(mqtt_publish_ring_peek() == NULL);
+}
+
+TEST_CASE("mqtt_outbox_evicts_oldest", "[outbox]" ) {
+  MockRepository mocks;
+  mqtt_outbox_reset();
+  unsigned int evicted = mqttOutboxStats.evicted;
+  unsigned int rejected = mqttOutboxStats.rejected;
+  char data[MAX_MQTT_DATA_OUTBOX];
+  memset(data, 'x', sizeof(data));
+
+  // fill the ring until the first eviction
+  int stored = 0;
+  char value[12];
+  while (mqttOutboxStats.evicted == evicted) {
+    sprintf(value, "%d", stored++);
+    REQUIRE(mqtt_outbox_store("sensors/temp", value, strlen(value)));
+  }
+  int capacity = mqtt_outbox_count();
+  REQUIRE(capacity == stored - 1);
+  sprintf(value, "%d", stored++);
+  REQUIRE(mqtt_outbox_store("sensors/temp", value, strlen(value)));
+  REQUIRE(mqtt_outbox_count() == capacity);
+  REQUIRE(mqttOutboxStats.evicted == evicted + 2);
+
+  REQUIRE_FALSE(mqtt_outbox_store("sensors/temp", data, sizeof(data)));
+  REQUIRE(mqtt_outbox_count() == capacity);
+  REQUIRE(mqttOutboxStats.rejected == rejected + 1);
+
+  static char buf[MQTT_OUTBOX_RING_SIZE * 2];
+  unsigned int lastSeq;
+  REQUIRE(mqtt_outbox_format(buf, sizeof(buf), &lastSeq) == capacity);
+  cJSON *batch = cJSON_Parse(buf);
+  REQUIRE(cJSON_GetArraySize(batch) == capacity);
+  cJSON *first = cJSON_GetArrayItem(batch, 0);
+  REQUIRE(cJSON_GetObjectItem(first, "ts") != NULL);
+  REQUIRE(std::string(cJSON_GetObjectItem(first, "topic")->valuestring) == "sensors/temp");
+  REQUIRE(std::string(cJSON_GetObjectItem(first, "data")->valuestring) == "2");
+  cJSON *last = cJSON_GetArrayItem(batch, capacity - 1);
+  REQUIRE(std::string(cJSON_GetObjectItem(last, "data")->valuestring) == value);
+  cJSON_Delete(batch);
+}
+
+TEST_CASE("mqtt_outbox_escapes_data", "[outbox]" ) {
+  MockRepository mocks;
+  mqtt_outbox_reset();
+  const char *notification = "Thermostat changed to on due to \"low\\temp\".\nIt was off for 12 minutes";
+  const char *ops = "{\"free_heap\":12345, \"min_free_heap\":12000, \"pub_failed\":0, \"pub_dropped\":0, "
+    "\"pub_overflow\":0, \"outbox_evicted\":0, \"outbox_rejected\":0}";
+
+  REQUIRE(mqtt_outbox_store("evt/notification/thermostat", notification, strlen(notification)));
+  REQUIRE(mqtt_outbox_store("evt/ops", ops, strlen(ops)));
+
+  char buf[MAX_MQTT_DATA_OUTBOX];
+  unsigned int lastSeq;
+  REQUIRE(mqtt_outbox_format(buf, sizeof(buf), &lastSeq) == 2);
+  cJSON *batch = cJSON_Parse(buf);
+  REQUIRE(batch != NULL);
+  REQUIRE(std::string(cJSON_GetObjectItem(cJSON_GetArrayItem(batch, 0), "data")->valuestring) == notification);
+  REQUIRE(std::string(cJSON_GetObjectItem(cJSON_GetArrayItem(batch, 1), "data")->valuestring) == ops);
+  cJSON_Delete(batch);
+}
+
+TEST_CASE("mqtt_outbox_locked_rejected", "[outbox]" ) {
+  MockRepository mocks;
+  mocks.OnCallFunc(xSemaphoreTake).Return(pdFALSE);
+  mqtt_outbox_reset();
+  unsigned int evicted = mqttOutboxStats.evicted;
+  unsigned int rejected = mqttOutboxStats.rejected;
+
+  REQUIRE_FALSE(mqtt_outbox_store("sensors/temp", "195", 3));
+  REQUIRE(mqtt_outbox_count() == 0);
+  REQUIRE(mqttOutboxStats.evicted == evicted);
+  REQUIRE(mqttOutboxStats.rejected == rejected + 1);
+}
+
+#define OUTBOX_REPLAY_ENTRIES 4
+
+TEST_CASE("mqtt_outbox_replay_batches", "[outbox]" ) {
+  MockRepository mocks;
+  mocks.OnCallFunc(xEventGroupGetBits).Return(0xff);
+  mocks.OnCallFunc(xEventGroupSetBits).Return(0);
+  mqtt_publish_ring_reset();
+  mqtt_outbox_reset();
+  unsigned int replayed = mqttOutboxStats.replayed;
+  for (int i = 0; i < OUTBOX_REPLAY_ENTRIES; i++) {
+    REQUIRE(mqtt_outbox_store("sensors/temp", "195", 3));
+  }
+
+  // a small buffer splits the entries in batches of two
+  char buf[128];
+  unsigned int lastSeq;
+  REQUIRE(mqtt_outbox_format(buf, sizeof(buf), &lastSeq) == 2);
+  cJSON *batch = cJSON_Parse(buf);
+  REQUIRE(cJSON_GetArraySize(batch) == 2);
+  cJSON_Delete(batch);
+  mqtt_outbox_release(lastSeq);
+  REQUIRE(mqtt_outbox_count() == OUTBOX_REPLAY_ENTRIES - 2);
+
+  REQUIRE(mqtt_outbox_replay() == OUTBOX_REPLAY_ENTRIES - 2);
+  REQUIRE(mqtt_outbox_count() == 0);
+  REQUIRE(mqttOutboxStats.replayed == replayed + OUTBOX_REPLAY_ENTRIES);
+
+  struct MqttPublishRecord *r = mqtt_publish_ring_peek();
+  REQUIRE(r != NULL);
+  REQUIRE(std::string(mqtt_publish_record_topic(r)) == "device_type/client_id/evt/outbox");
+  REQUIRE(r->qos == QOS_1);
+  REQUIRE(r->retain == NO_RETAIN);
+  ring_consume(r);
+  REQUIRE(mqtt_publish_ring_peek() == NULL);
 }
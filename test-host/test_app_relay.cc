@@ -0,0 +1,183 @@
+#include "esp_system.h"
+#include "catch.hpp"
+#include "hippomocks.h"
+
+#include <string.h>
+
+using HippoMocks::CString;
+
+extern "C" {
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "driver/gpio.h"
+#include "rom/gpio.h"
+#include "app_main.h"
+#include "app_mqtt.h"
+#include "app_relay.h"
+#include "app_nvs.h"
+#include "app_timer_wheel.h"
+#include "app_event_bus.h"
+
+  extern int relayStatus[CONFIG_MQTT_RELAYS_NB];
+  extern int relaySleepTimeout[CONFIG_MQTT_RELAYS_NB];
+  extern struct TimerWheelEntry relaySleepTimer[CONFIG_MQTT_RELAYS_NB];
+  void update_timer(int id);
+}
+
+// set and clear registers bits for a gpio written at level
+static unsigned int set_bit(int gpio, int level)
+{
+  return level ? 1 << gpio : 0;
+}
+
+static unsigned int clear_bit(int gpio, int level)
+{
+  return level ? 0 : 1 << gpio;
+}
+
+static void add(struct RelayBatch *b, unsigned char msgType, unsigned char relayId, int data)
+{
+  struct RelayMessage r;
+  memset(&r, 0, sizeof(r));
+  r.msgType = msgType;
+  r.relayId = relayId;
+  r.data = data;
+  relay_batch_add(b, &r);
+}
+
+TEST_CASE("relay_batch_last_writer_wins", "[relay]" ) {
+  MockRepository mocks;
+  struct RelayBatch b;
+  relayStatus[0] = RELAY_OFF;
+  relayStatus[1] = RELAY_OFF;
+
+  relay_batch_reset(&b);
+  add(&b, RELAY_CMD_STATUS, 0, RELAY_STATUS_ON);
+  add(&b, RELAY_CMD_STATUS, 0, RELAY_STATUS_OFF);
+  add(&b, RELAY_CMD_STATUS, 0, RELAY_STATUS_ON);
+  add(&b, RELAY_CMD_STATUS, 7, RELAY_STATUS_ON);
+  REQUIRE(b.status[0] == RELAY_STATUS_ON);
+  REQUIRE(b.status[1] == RELAY_BATCH_UNSET);
+
+  // one gpio write and one status for the three commands
+  mocks.ExpectCallFunc(gpio_output_set).With(set_bit(12, RELAY_ON), clear_bit(12, RELAY_ON), 0, 0);
+  mocks.ExpectCallFunc(mqtt_publish_data).With(CString("device_type/client_id/evt/status/relay/0"), CString("ON"), QOS_1, RETAIN);
+  relay_batch_apply(&b);
+  REQUIRE(relayStatus[0] == RELAY_ON);
+  REQUIRE(relayStatus[1] == RELAY_OFF);
+}
+
+TEST_CASE("relay_batch_gpio_before_publish", "[relay]" ) {
+  MockRepository mocks;
+  struct RelayBatch b;
+  relayStatus[0] = RELAY_OFF;
+  relayStatus[1] = RELAY_ON;
+
+  relay_batch_reset(&b);
+  add(&b, RELAY_CMD_STATUS, 1, RELAY_STATUS_OFF);
+  add(&b, RELAY_CMD_STATUS, 0, RELAY_STATUS_ON);
+
+  mocks.autoExpect = true;
+  // both relays switch in one write
+  mocks.ExpectCallFunc(gpio_output_set).With(set_bit(12, RELAY_ON) | set_bit(5, RELAY_OFF),
+                                             clear_bit(12, RELAY_ON) | clear_bit(5, RELAY_OFF), 0, 0);
+  mocks.ExpectCallFunc(mqtt_publish_data).With(CString("device_type/client_id/evt/status/relay/0"), CString("ON"), QOS_1, RETAIN);
+  mocks.ExpectCallFunc(mqtt_publish_data).With(CString("device_type/client_id/evt/status/relay/1"), CString("OFF"), QOS_1, RETAIN);
+  relay_batch_apply(&b);
+  REQUIRE(((relay_output_levels() >> 12) & 1) == RELAY_ON);
+  REQUIRE(((relay_output_levels() >> 5) & 1) == RELAY_OFF);
+}
+
+TEST_CASE("relay_batch_sleep", "[relay]" ) {
+  MockRepository mocks;
+  struct RelayBatch b;
+  relayStatus[1] = RELAY_OFF;
+  relaySleepTimeout[1] = 0;
+
+  relay_batch_reset(&b);
+  add(&b, RELAY_CMD_SLEEP, 1, 60);
+  add(&b, RELAY_CMD_SLEEP, 1, 120);
+
+  mocks.OnCallFunc(write_nvs_integer).Return(ESP_OK);
+  mocks.ExpectCallFunc(mqtt_publish_data).With(CString("device_type/client_id/evt/sleep/relay/1"), CString("120"), QOS_1, RETAIN);
+  mocks.NeverCallFunc(gpio_output_set);
+  relay_batch_apply(&b);
+  REQUIRE(relaySleepTimeout[1] == 120);
+}
+
+TEST_CASE("relay_batch_status_all", "[relay]" ) {
+  MockRepository mocks;
+  struct RelayBatch b;
+  relayStatus[0] = RELAY_OFF;
+  relayStatus[1] = RELAY_OFF;
+
+  relay_batch_reset(&b);
+  add(&b, RELAY_CMD_STATUS, 0, RELAY_STATUS_OFF);
+  add(&b, RELAY_CMD_STATUS_ALL, 0, RELAY_STATUS_ALL(3, 3));
+  add(&b, RELAY_CMD_STATUS, 1, RELAY_STATUS_ON);
+
+  // relay 1 was commanded alone after the bulk command, it keeps its ack
+  mocks.ExpectCallFunc(gpio_output_set).With(set_bit(12, RELAY_ON) | set_bit(5, RELAY_ON),
+                                             clear_bit(12, RELAY_ON) | clear_bit(5, RELAY_ON), 0, 0);
+  mocks.ExpectCallFunc(mqtt_publish_data).With(CString("device_type/client_id/evt/status/relay/1"), CString("ON"), QOS_1, RETAIN);
+  mocks.ExpectCallFunc(mqtt_publish_data).With(CString("device_type/client_id/evt/status/relays"), CString("{\"0\":\"ON\",\"1\":\"ON\"}"), QOS_1, RETAIN);
+  relay_batch_apply(&b);
+}
+
+TEST_CASE("relays_status_off", "[relay]" ) {
+  MockRepository mocks;
+  relayStatus[0] = RELAY_OFF;
+  relayStatus[1] = RELAY_OFF;
+  mocks.ExpectCallFunc(mqtt_publish_data).With(CString("device_type/client_id/evt/status/relays"), CString("{\"0\":\"OFF\",\"1\":\"OFF\"}"), QOS_1, RETAIN);
+  publish_relays_status();
+
+  relayStatus[0] = RELAY_ON;
+  mocks.ExpectCallFunc(mqtt_publish_data).With(CString("device_type/client_id/evt/status/relays"), CString("{\"0\":\"ON\",\"1\":\"OFF\"}"), QOS_1, RETAIN);
+  publish_relays_status();
+}
+
+TEST_CASE("relays_init_one_write", "[relay]" ) {
+  MockRepository mocks;
+  // sleep timers armed by the tests above
+  timer_wheel_init();
+  mocks.OnCallFunc(read_nvs_integer).Return(ESP_OK);
+  mocks.NeverCallFunc(gpio_set_level);
+  mocks.ExpectCallFunc(gpio_output_set).With(set_bit(12, RELAY_OFF) | set_bit(5, RELAY_OFF),
+                                             clear_bit(12, RELAY_OFF) | clear_bit(5, RELAY_OFF), 0, 0);
+  relays_init();
+  REQUIRE(relayStatus[0] == RELAY_OFF);
+  REQUIRE(relayStatus[1] == RELAY_OFF);
+  REQUIRE(((relay_output_levels() >> 12) & 1) == RELAY_OFF);
+  REQUIRE(((relay_output_levels() >> 5) & 1) == RELAY_OFF);
+}
+
+TEST_CASE("relay_sleep_retried_when_inbox_full", "[relay]" ) {
+  MockRepository mocks;
+  timer_wheel_init();
+  event_bus_init();
+  event_bus_subscribe(EVENT_RELAY_CMD, (QueueHandle_t)1);
+  mocks.OnCallFunc(read_nvs_integer).Return(ESP_OK);
+  relays_init();
+  relayStatus[0] = RELAY_ON;
+  relaySleepTimeout[0] = 1;
+  update_timer(0);
+
+  // the wheel callback does not wait on the full inbox, it tries again
+  int sent = 0;
+  bool full = true;
+  mocks.OnCallFunc(xQueueSend).Do([&](QueueHandle_t q, const void * const item, TickType_t t) {
+      REQUIRE(t == 0);
+      sent += !full;
+      return full ? !pdPASS : pdPASS;
+    });
+  timer_wheel_advance(1000 / TIMER_WHEEL_TICK_MS);
+  REQUIRE(eventBusStats.dropped == 1);
+  REQUIRE(timer_wheel_active(&relaySleepTimer[0]));
+
+  full = false;
+  timer_wheel_advance(1);
+  REQUIRE(sent == 1);
+  REQUIRE(!timer_wheel_active(&relaySleepTimer[0]));
+  relayStatus[0] = RELAY_OFF;
+  relaySleepTimeout[0] = 0;
+}
@@ -0,0 +1,70 @@
+#include "esp_system.h"
+#include "catch.hpp"
+#include "hippomocks.h"
+
+extern "C" {
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "app_sensors_deadband.h"
+}
+
+static const char *deadbandTopic = "device_type/client_id/evt/temperature/bme280";
+
+TEST_CASE("sensor_deadband_filters_small_changes", "[sensors]" ) {
+  MockRepository mocks;
+  TickType_t now = 1000;
+  mocks.OnCallFunc(xTaskGetTickCount).Do([&]() { return now; });
+  sensors_deadband_init();
+  sensors_deadband_reset();
+  unsigned int filtered = sensorSamplesFiltered;
+
+  REQUIRE(sensor_deadband_publish(deadbandTopic, 215));
+  now += 1;
+  REQUIRE_FALSE(sensor_deadband_publish(deadbandTopic, 215 + CONFIG_MQTT_SENSOR_DEADBAND - 1));
+  REQUIRE_FALSE(sensor_deadband_publish(deadbandTopic, 215 - CONFIG_MQTT_SENSOR_DEADBAND + 1));
+  REQUIRE(sensorSamplesFiltered == filtered + 2);
+
+  // compared to the last published value, not to the filtered ones
+  REQUIRE(sensor_deadband_publish(deadbandTopic, 215 + CONFIG_MQTT_SENSOR_DEADBAND));
+  REQUIRE_FALSE(sensor_deadband_publish(deadbandTopic, 215 + CONFIG_MQTT_SENSOR_DEADBAND));
+
+  // other topics have their own band
+  const char *otherTopic = "device_type/client_id/evt/humidity/bme280";
+  REQUIRE(sensor_deadband_publish(otherTopic, 215));
+}
+
+TEST_CASE("sensor_deadband_heartbeat", "[sensors]" ) {
+  MockRepository mocks;
+  TickType_t now = 1000;
+  mocks.OnCallFunc(xTaskGetTickCount).Do([&]() { return now; });
+  sensors_deadband_reset();
+
+  REQUIRE(sensor_deadband_publish(deadbandTopic, 215));
+  now += SENSOR_HEARTBEAT - 1;
+  REQUIRE_FALSE(sensor_deadband_publish(deadbandTopic, 215));
+  now += 1;
+  REQUIRE(sensor_deadband_publish(deadbandTopic, 215));
+  // the heartbeat restarts from the forced publish
+  now += 1;
+  REQUIRE_FALSE(sensor_deadband_publish(deadbandTopic, 215));
+}
+
+TEST_CASE("sensor_deadband_reset_on_connect", "[sensors]" ) {
+  MockRepository mocks;
+  TickType_t now = 1000;
+  mocks.OnCallFunc(xTaskGetTickCount).Do([&]() { return now; });
+  sensors_deadband_reset();
+
+  REQUIRE(sensor_deadband_publish(deadbandTopic, 215));
+  REQUIRE_FALSE(sensor_deadband_publish(deadbandTopic, 215));
+
+  // publish_sensors_data resets the bands on (re)connect so the
+  // unchanged value is published again
+  sensors_deadband_reset();
+  REQUIRE(sensor_deadband_publish(deadbandTopic, 215));
+  REQUIRE_FALSE(sensor_deadband_publish(deadbandTopic, 215));
+
+  // a ds18x20 slot taken by another sensor starts a new band
+  sensor_deadband_forget(deadbandTopic);
+  REQUIRE(sensor_deadband_publish(deadbandTopic, 215));
+}
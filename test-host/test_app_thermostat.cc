@@ -1,15 +1,25 @@
 #include <limits.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
 
 #include "catch.hpp"
 #include "hippomocks.h"
 
 #include "esp_system.h"
-#include "app_thermostat.h"
 
 using HippoMocks::CString;
 
 extern "C" {
+#include "app_thermostat.h"
 #include "app_mqtt.h"
+#include "app_relay.h"
+#include "app_event_bus.h"
+#include "app_mqtt_publisher.h"
+#include "app_thermostat_duty.h"
+#include "app_timer_wheel.h"
+#include "sim.h"
 }
 
 extern "C" {
@@ -23,14 +33,14 @@ extern "C" {
                                               const char *reason);
   void publish_circuit_thermostat_notification(enum HeatingState state,
                                                unsigned int duration);
+  bool heating();
+  bool not_heating();
+  void update_thermostat();
+  extern int circuitThermostatId;
+  extern bool thermostatDirty;
 }
 
-extern short temperatureTolerance[CONFIG_MQTT_THERMOSTATS_NB];
-extern short targetTemperature[CONFIG_MQTT_THERMOSTATS_NB];
-extern short currentTemperature[CONFIG_MQTT_THERMOSTATS_NB];
-extern short currentTemperatureFlag[CONFIG_MQTT_THERMOSTATS_NB];
-extern enum ThermostatMode thermostatMode[CONFIG_MQTT_THERMOSTATS_NB];
-extern enum ThermostatType thermostatType[CONFIG_MQTT_THERMOSTATS_NB];
+extern struct Thermostat thermostats[CONFIG_MQTT_THERMOSTATS_NB];
 extern enum ThermostatState thermostatState;
 extern enum HeatingState heatingState;
 
@@ -38,8 +48,8 @@ TEST_CASE("publish_thermostat_current_temperature_evt_valid", "[tag]" ) {
   MockRepository mocks;
   const char* topic = "device_type/client_id/evt/ctemp/thermostat/0";
   const char* mqtt_data = "10.5";
-  currentTemperature[0] = 105;
-  currentTemperatureFlag[0] = 1;
+  thermostats[0].currentTemperature = 105;
+  thermostats[0].currentTemperatureFlag = 1;
   mocks.ExpectCallFunc(mqtt_publish_data).With(CString(topic), CString(mqtt_data), QOS_1, RETAIN);
 
   publish_thermostat_current_temperature_evt(0);
@@ -47,7 +57,7 @@ TEST_CASE("publish_thermostat_current_temperature_evt_valid", "[tag]" ) {
 
 TEST_CASE("publish_thermostat_current_temperature_evt_invalid", "[tag]" ) {
   MockRepository mocks;
-  currentTemperature[0] = SHRT_MIN;
+  thermostats[0].currentTemperature = SHRT_MIN;
   mocks.NeverCallFunc(mqtt_publish_data);
 
   publish_thermostat_current_temperature_evt(0);
@@ -57,7 +67,7 @@ TEST_CASE("publish_thermostat_target_temperature_evt", "[tag]" ) {
   MockRepository mocks;
   const char* topic = "device_type/client_id/evt/temp/thermostat/0";
   const char* mqtt_data = "12.5";
-  targetTemperature[0] = 125;
+  thermostats[0].targetTemperature = 125;
   mocks.ExpectCallFunc(mqtt_publish_data).With(CString(topic), CString(mqtt_data), QOS_1, RETAIN);
 
   publish_thermostat_target_temperature_evt(0);
@@ -67,7 +77,7 @@ TEST_CASE("publish_thermostat_temperature_tolerance_evt", "[tag]" ) {
   MockRepository mocks;
   const char* topic = "device_type/client_id/evt/tolerance/thermostat/0";
   const char* mqtt_data = "0.3";
-  temperatureTolerance[0] = 3;
+  thermostats[0].temperatureTolerance = 3;
   mocks.ExpectCallFunc(mqtt_publish_data).With(CString(topic), CString(mqtt_data), QOS_1, RETAIN);
 
   publish_thermostat_temperature_tolerance_evt(0);
@@ -77,7 +87,7 @@ TEST_CASE("publish_thermostat_mode_evt_unset", "[tag]" ) {
   MockRepository mocks;
   const char* topic = "device_type/client_id/evt/mode/thermostat/0";
   const char* mqtt_data = "off";
-  thermostatMode[0] = THERMOSTAT_MODE_UNSET;
+  thermostats[0].mode = THERMOSTAT_MODE_UNSET;
   mocks.ExpectCallFunc(mqtt_publish_data).With(CString(topic), CString(mqtt_data), QOS_1, RETAIN);
 
   publish_thermostat_mode_evt(0);
@@ -87,7 +97,7 @@ TEST_CASE("publish_thermostat_mode_evt_off", "[tag]" ) {
   MockRepository mocks;
   const char* topic = "device_type/client_id/evt/mode/thermostat/0";
   const char* mqtt_data = "off";
-  thermostatMode[0] = THERMOSTAT_MODE_OFF;
+  thermostats[0].mode = THERMOSTAT_MODE_OFF;
   mocks.ExpectCallFunc(mqtt_publish_data).With(CString(topic), CString(mqtt_data), QOS_1, RETAIN);
 
   publish_thermostat_mode_evt(0);
@@ -97,7 +107,7 @@ TEST_CASE("publish_thermostat_mode_evt_heat", "[tag]" ) {
   MockRepository mocks;
   const char* topic = "device_type/client_id/evt/mode/thermostat/0";
   const char* mqtt_data = "heat";
-  thermostatMode[0] = THERMOSTAT_MODE_HEAT;
+  thermostats[0].mode = THERMOSTAT_MODE_HEAT;
   mocks.ExpectCallFunc(mqtt_publish_data).With(CString(topic), CString(mqtt_data), QOS_1, RETAIN);
 
   publish_thermostat_mode_evt(0);
@@ -107,8 +117,8 @@ TEST_CASE("publish_normal_thermostat_action_evt_unset", "[tag]" ) {
   MockRepository mocks;
   const char* topic = "device_type/client_id/evt/action/thermostat/0";
   const char* mqtt_data = "off";
-  thermostatType[0] = THERMOSTAT_TYPE_NORMAL;
-  thermostatMode[0] = THERMOSTAT_MODE_UNSET;
+  thermostats[0].type = THERMOSTAT_TYPE_NORMAL;
+  thermostats[0].mode = THERMOSTAT_MODE_UNSET;
   mocks.ExpectCallFunc(mqtt_publish_data).With(CString(topic), CString(mqtt_data), QOS_1, RETAIN);
 
   publish_thermostat_action_evt(0);
@@ -118,8 +128,8 @@ TEST_CASE("publish_normal_thermostat_action_evt_off", "[tag]" ) {
   MockRepository mocks;
   const char* topic = "device_type/client_id/evt/action/thermostat/0";
   const char* mqtt_data = "off";
-  thermostatMode[0] = THERMOSTAT_MODE_OFF;
-  thermostatType[0] = THERMOSTAT_TYPE_NORMAL;
+  thermostats[0].mode = THERMOSTAT_MODE_OFF;
+  thermostats[0].type = THERMOSTAT_TYPE_NORMAL;
   mocks.ExpectCallFunc(mqtt_publish_data).With(CString(topic), CString(mqtt_data), QOS_1, RETAIN);
 
   publish_thermostat_action_evt(0);
@@ -129,8 +139,8 @@ TEST_CASE("publish_normal_thermostat_action_evt_heat_idle", "[tag]" ) {
   MockRepository mocks;
   const char* topic = "device_type/client_id/evt/action/thermostat/0";
   const char* mqtt_data = "idle";
-  thermostatMode[0] = THERMOSTAT_MODE_HEAT;
-  thermostatType[0] = THERMOSTAT_TYPE_NORMAL;
+  thermostats[0].mode = THERMOSTAT_MODE_HEAT;
+  thermostats[0].type = THERMOSTAT_TYPE_NORMAL;
   thermostatState = THERMOSTAT_STATE_IDLE;
   mocks.ExpectCallFunc(mqtt_publish_data).With(CString(topic), CString(mqtt_data), QOS_1, RETAIN);
 
@@ -141,8 +151,8 @@ TEST_CASE("publish_normal_thermostat_action_evt_heat_heating", "[tag]" ) {
   MockRepository mocks;
   const char* topic = "device_type/client_id/evt/action/thermostat/0";
   const char* mqtt_data = "heating";
-  thermostatMode[0] = THERMOSTAT_MODE_HEAT;
-  thermostatType[0] = THERMOSTAT_TYPE_NORMAL;
+  thermostats[0].mode = THERMOSTAT_MODE_HEAT;
+  thermostats[0].type = THERMOSTAT_TYPE_NORMAL;
   thermostatState = THERMOSTAT_STATE_HEATING;
   mocks.ExpectCallFunc(mqtt_publish_data).With(CString(topic), CString(mqtt_data), QOS_1, RETAIN);
 
@@ -153,8 +163,8 @@ TEST_CASE("publish_circuit_thermostat_action_evt_unset", "[tag]" ) {
   MockRepository mocks;
   const char* topic = "device_type/client_id/evt/action/thermostat/0";
   const char* mqtt_data = "off";
-  thermostatMode[0] = THERMOSTAT_MODE_UNSET;
-  thermostatType[0] = THERMOSTAT_TYPE_CIRCUIT;
+  thermostats[0].mode = THERMOSTAT_MODE_UNSET;
+  thermostats[0].type = THERMOSTAT_TYPE_CIRCUIT;
   mocks.ExpectCallFunc(mqtt_publish_data).With(CString(topic), CString(mqtt_data), QOS_1, RETAIN);
 
   publish_thermostat_action_evt(0);
@@ -164,8 +174,8 @@ TEST_CASE("publish_circuit_thermostat_action_evt_off", "[tag]" ) {
   MockRepository mocks;
   const char* topic = "device_type/client_id/evt/action/thermostat/0";
   const char* mqtt_data = "off";
-  thermostatMode[0] = THERMOSTAT_MODE_OFF;
-  thermostatType[0] = THERMOSTAT_TYPE_CIRCUIT;
+  thermostats[0].mode = THERMOSTAT_MODE_OFF;
+  thermostats[0].type = THERMOSTAT_TYPE_CIRCUIT;
   mocks.ExpectCallFunc(mqtt_publish_data).With(CString(topic), CString(mqtt_data), QOS_1, RETAIN);
 
   publish_thermostat_action_evt(0);
@@ -175,8 +185,8 @@ TEST_CASE("publish_circuit_thermostat_action_evt_heat_idle", "[tag]" ) {
   MockRepository mocks;
   const char* topic = "device_type/client_id/evt/action/thermostat/0";
   const char* mqtt_data = "idle";
-  thermostatMode[0] = THERMOSTAT_MODE_HEAT;
-  thermostatType[0] = THERMOSTAT_TYPE_CIRCUIT;
+  thermostats[0].mode = THERMOSTAT_MODE_HEAT;
+  thermostats[0].type = THERMOSTAT_TYPE_CIRCUIT;
   heatingState = HEATING_STATE_IDLE;
   mocks.ExpectCallFunc(mqtt_publish_data).With(CString(topic), CString(mqtt_data), QOS_1, RETAIN);
 
@@ -187,22 +197,52 @@ TEST_CASE("publish_circuit_thermostat_action_evt_heat_heating", "[tag]" ) {
   MockRepository mocks;
   const char* topic = "device_type/client_id/evt/action/thermostat/0";
   const char* mqtt_data = "heating";
-  thermostatMode[0] = THERMOSTAT_MODE_HEAT;
-  thermostatType[0] = THERMOSTAT_TYPE_CIRCUIT;
+  thermostats[0].mode = THERMOSTAT_MODE_HEAT;
+  thermostats[0].type = THERMOSTAT_TYPE_CIRCUIT;
   heatingState = HEATING_STATE_ENABLED;
   mocks.ExpectCallFunc(mqtt_publish_data).With(CString(topic), CString(mqtt_data), QOS_1, RETAIN);
 
   publish_thermostat_action_evt(0);
 }
 
+TEST_CASE("publish_thermostats_snapshot", "[tag]" ) {
+  MockRepository mocks;
+  const char* topic = "device_type/client_id/evt/state/thermostats";
+  const char* mqtt_data = "["
+    "{\"ctemp\":20.5,\"temp\":21.0,\"tolerance\":0.5,\"mode\":\"heat\",\"action\":\"heating\"},"
+    "{\"ctemp\":null,\"temp\":21.0,\"tolerance\":0.5,\"mode\":\"off\",\"action\":\"off\"},"
+    "{\"ctemp\":null,\"temp\":21.0,\"tolerance\":0.5,\"mode\":\"off\",\"action\":\"off\"},"
+    "{\"ctemp\":18.0,\"temp\":22.5,\"tolerance\":1.0,\"mode\":\"heat\",\"action\":\"idle\"}"
+    "]";
+  for (int id = 0; id < CONFIG_MQTT_THERMOSTATS_NB; id++) {
+    thermostats[id].mode = THERMOSTAT_MODE_OFF;
+    thermostats[id].type = THERMOSTAT_TYPE_NORMAL;
+    thermostats[id].currentTemperature = SHRT_MIN;
+    thermostats[id].targetTemperature = 210;
+    thermostats[id].temperatureTolerance = 5;
+  }
+  thermostats[0].mode = THERMOSTAT_MODE_HEAT;
+  thermostats[0].currentTemperature = 205;
+  thermostatState = THERMOSTAT_STATE_HEATING;
+  thermostats[3].mode = THERMOSTAT_MODE_HEAT;
+  thermostats[3].type = THERMOSTAT_TYPE_CIRCUIT;
+  heatingState = HEATING_STATE_IDLE;
+  thermostats[3].currentTemperature = 180;
+  thermostats[3].targetTemperature = 225;
+  thermostats[3].temperatureTolerance = 10;
+  mocks.ExpectCallFunc(mqtt_publish_data).With(CString(topic), CString(mqtt_data), QOS_1, RETAIN);
+
+  publish_thermostats_snapshot();
+}
+
 TEST_CASE("publish_normal_thermostat_notification_on", "[tag]" ) {
   MockRepository mocks;
   const char* notification_topic = "device_type/client_id/evt/notification/thermostat";
   const char* notification_mqtt_data = "Thermostat changed to on due to some reason. It was off for 10 minutes";
   const char* action_topic = "device_type/client_id/evt/action/thermostat/0";
   const char* action_mqtt_data = "heating";
-  thermostatMode[0] = THERMOSTAT_MODE_HEAT;
-  thermostatType[0] = THERMOSTAT_TYPE_NORMAL;
+  thermostats[0].mode = THERMOSTAT_MODE_HEAT;
+  thermostats[0].type = THERMOSTAT_TYPE_NORMAL;
   thermostatState = THERMOSTAT_STATE_HEATING;
 
   mocks.ExpectCallFunc(mqtt_publish_data).With(CString(notification_topic), CString(notification_mqtt_data), QOS_0, NO_RETAIN);
@@ -218,8 +258,8 @@ TEST_CASE("publish_normal_thermostat_notification_off", "[tag]" ) {
   const char* notification_mqtt_data = "Thermostat changed to off due to some reason. It was on for 10 minutes";
   const char* action_topic = "device_type/client_id/evt/action/thermostat/0";
   const char* action_mqtt_data = "idle";
-  thermostatMode[0] = THERMOSTAT_MODE_HEAT;
-  thermostatType[0] = THERMOSTAT_TYPE_NORMAL;
+  thermostats[0].mode = THERMOSTAT_MODE_HEAT;
+  thermostats[0].type = THERMOSTAT_TYPE_NORMAL;
   thermostatState = THERMOSTAT_STATE_IDLE;
 
   mocks.ExpectCallFunc(mqtt_publish_data).With(CString(notification_topic), CString(notification_mqtt_data), QOS_0, NO_RETAIN);
@@ -236,8 +276,8 @@ TEST_CASE("publish_circuit_thermostat_notification_off", "[tag]" ) {
   const char* notification_mqtt_data = "Heating state changed to off. It was on for 10 minutes";
   const char* action_topic = "device_type/client_id/evt/action/thermostat/0";
   const char* action_mqtt_data = "idle";
-  thermostatMode[0] = THERMOSTAT_MODE_HEAT;
-  thermostatType[0] = THERMOSTAT_TYPE_CIRCUIT;
+  thermostats[0].mode = THERMOSTAT_MODE_HEAT;
+  thermostats[0].type = THERMOSTAT_TYPE_CIRCUIT;
   heatingState = HEATING_STATE_IDLE;
 
   mocks.ExpectCallFunc(mqtt_publish_data).With(CString(notification_topic), CString(notification_mqtt_data), QOS_0, NO_RETAIN);
@@ -252,8 +292,8 @@ TEST_CASE("publish_circuit_thermostat_notification_on", "[tag]" ) {
   const char* notification_mqtt_data = "Heating state changed to on. It was off for 10 minutes";
   const char* action_topic = "device_type/client_id/evt/action/thermostat/0";
   const char* action_mqtt_data = "heating";
-  thermostatMode[0] = THERMOSTAT_MODE_HEAT;
-  thermostatType[0] = THERMOSTAT_TYPE_CIRCUIT;
+  thermostats[0].mode = THERMOSTAT_MODE_HEAT;
+  thermostats[0].type = THERMOSTAT_TYPE_CIRCUIT;
   heatingState = HEATING_STATE_ENABLED;
 
   mocks.ExpectCallFunc(mqtt_publish_data).With(CString(notification_topic), CString(notification_mqtt_data), QOS_0, NO_RETAIN);
@@ -264,6 +304,273 @@ TEST_CASE("publish_circuit_thermostat_notification_on", "[tag]" ) {
 }
 
 
+TEST_CASE("thermostats_init", "[tag]" ) {
+  thermostats_init();
+
+  for (int id = 0; id < CONFIG_MQTT_THERMOSTATS_NB; id++) {
+    REQUIRE(thermostats[id].mode == THERMOSTAT_MODE_UNSET);
+    REQUIRE(thermostats[id].type == THERMOSTAT_TYPE_NORMAL);
+    REQUIRE(thermostats[id].targetTemperature == 210);
+    REQUIRE(thermostats[id].temperatureTolerance == 5);
+    REQUIRE(thermostats[id].currentTemperature == SHRT_MIN);
+    REQUIRE(thermostats[id].currentTemperatureFlag == 0);
+    REQUIRE(thermostats[id].localSensorTopic == NULL);
+  }
+  REQUIRE(std::string(thermostats[0].friendlyName) == "t0");
+  REQUIRE(std::string(thermostats[3].friendlyName) == "t3");
+}
+
+TEST_CASE("publish_thermostat_data", "[tag]" ) {
+  MockRepository mocks;
+  std::vector<std::string> topics;
+  for (int id = 0; id < CONFIG_MQTT_THERMOSTATS_NB; id++) {
+    thermostats[id].currentTemperature = 200 + id;
+  }
+  mocks.OnCallFunc(mqtt_publish_data).Do([&](const char *topic, const char *data, int qos, int retain) {
+      topics.push_back(topic);
+    });
+
+  publish_thermostat_data();
+
+  // each thermostat is published once, all its fields together
+  REQUIRE(topics.size() == 5 * CONFIG_MQTT_THERMOSTATS_NB);
+  REQUIRE(topics[0] == "device_type/client_id/evt/ctemp/thermostat/0");
+  REQUIRE(topics[4] == "device_type/client_id/evt/action/thermostat/0");
+  REQUIRE(topics[5] == "device_type/client_id/evt/ctemp/thermostat/1");
+  REQUIRE(topics[19] == "device_type/client_id/evt/action/thermostat/3");
+}
+
+// circuit readings recorded once per tick, in tenths of a degree
+static const short CIRCUIT_NOISE[] = {350, 352, 349, 351, 350, 352, 350, 349, 351};
+static const short CIRCUIT_ONSET[] = {301, 299, 300, 301, 300, 306, 313, 319, 326};
+static const short CIRCUIT_SHUTDOWN[] = {400, 407, 413, 420, 426, 427, 426, 424, 421};
+static const short CIRCUIT_GAP[] = {300, 301, SHRT_MIN, 307, 313, 320};
+
+// index of the first reading the detector fires on, -1 if it never does
+static int replay_circuit(const short *trace, int traceNb, bool (*detector)())
+{
+  thermostats_init();
+  circuitThermostatId = 3;
+  thermostats[3].type = THERMOSTAT_TYPE_CIRCUIT;
+  thermostats[3].mode = THERMOSTAT_MODE_HEAT;
+  thermostats[3].currentTemperatureFlag = SENSOR_LIFETIME;
+  int fired = -1;
+  for (int i = 0; i < traceNb && fired == -1; i++) {
+    thermostat_add_reading(3, trace[i]);
+    if (detector()) {
+      fired = i;
+    }
+  }
+  circuitThermostatId = -1;
+  thermostats[3].type = THERMOSTAT_TYPE_NORMAL;
+  return fired;
+}
+
+#define TRACE(t) t, sizeof(t) / sizeof(t[0])
+
+TEST_CASE("circuit_trend_noise", "[tag]" ) {
+  REQUIRE(replay_circuit(TRACE(CIRCUIT_NOISE), heating) == -1);
+}
+
+TEST_CASE("circuit_trend_onset", "[tag]" ) {
+  // the circuit starts warming up on reading 5
+  REQUIRE(replay_circuit(TRACE(CIRCUIT_ONSET), heating) == 5);
+  REQUIRE(replay_circuit(TRACE(CIRCUIT_ONSET), not_heating) == 2);
+}
+
+TEST_CASE("circuit_trend_shutdown", "[tag]" ) {
+  // the circuit stops warming up on reading 5
+  REQUIRE(replay_circuit(TRACE(CIRCUIT_SHUTDOWN), not_heating) == 6);
+  REQUIRE(replay_circuit(TRACE(CIRCUIT_SHUTDOWN), heating) == 2);
+}
+
+TEST_CASE("circuit_trend_gap", "[tag]" ) {
+  // the fit waits until the missing reading leaves the window
+  REQUIRE(replay_circuit(TRACE(CIRCUIT_GAP), heating) == 5);
+}
+
+TEST_CASE("circuit_trend_inactive", "[tag]" ) {
+  thermostats_init();
+  circuitThermostatId = 3;
+  thermostats[3].mode = THERMOSTAT_MODE_HEAT;
+  for (unsigned int i = 0; i < sizeof(CIRCUIT_ONSET) / sizeof(CIRCUIT_ONSET[0]); i++) {
+    thermostat_add_reading(3, CIRCUIT_ONSET[i]);
+  }
+  // no live reading
+  REQUIRE(!heating());
+  REQUIRE(!not_heating());
+  circuitThermostatId = -1;
+}
+
+TEST_CASE("publish_thermostat_duty", "[tag]" ) {
+  MockRepository mocks;
+  std::string hours, days;
+  for (int i = 0; i < THERMOSTAT_DUTY_HOURS_NB - 1; i++) {
+    hours += "null,";
+  }
+  for (int i = 0; i < THERMOSTAT_DUTY_DAYS_NB - 1; i++) {
+    days += "null,";
+  }
+  std::string data = "{\"tick\":60,\"total\":2,\"hours\":[" + hours + "[50,0]],\"days\":[" +
+    days + "[50,0]],\"transitions\":[[1000,1,0,1,1],[1060,255,0,0,2]]}";
+  thermostats_init();
+  thermostat_duty_tick(true, false);
+  thermostat_duty_tick(false, false);
+  thermostat_duty_transition(THERMOSTAT_DUTY_RELAY, true, 1, THERMOSTAT_REASON_TOO_COLD, 1000);
+  thermostat_duty_transition(THERMOSTAT_DUTY_RELAY, false, -1, THERMOSTAT_REASON_HOT_ENOUGH, 1060);
+  mocks.ExpectCallFunc(mqtt_publish_data).With(CString("device_type/client_id/evt/duty/thermostats"),
+                                               CString(data.c_str()), QOS_1, NO_RETAIN);
+
+  publish_thermostat_duty();
+}
+
+TEST_CASE("update_thermostat_only_when_dirty", "[tag]" ) {
+  std::vector<std::string> notifications;
+  thermostats_init();
+  thermostatState = THERMOSTAT_STATE_IDLE;
+  thermostats[0].mode = THERMOSTAT_MODE_HEAT;
+  thermostats[0].currentTemperature = 180;
+  thermostats[0].currentTemperatureFlag = SENSOR_LIFETIME;
+  thermostats[2].mode = THERMOSTAT_MODE_HEAT;
+  thermostats[2].currentTemperature = 250;
+  thermostats[2].currentTemperatureFlag = SENSOR_LIFETIME;
+  {
+    MockRepository mocks;
+    mocks.ExpectCallFunc(update_relay_status).With(CONFIG_MQTT_THERMOSTAT_RELAY_ID, RELAY_STATUS_ON);
+    mocks.OnCallFunc(mqtt_publish_data).Do([&](const char *topic, const char *data, int qos, int retain) {
+        if (qos == QOS_0) {
+          notifications.push_back(data);
+        }
+      });
+
+    update_thermostat();
+    REQUIRE(thermostatState == THERMOSTAT_STATE_HEATING);
+    // the toggle is checked again on the next tick
+    REQUIRE(thermostatDirty);
+    update_thermostat();
+    REQUIRE(!thermostatDirty);
+  }
+  REQUIRE(notifications.size() == 1);
+  REQUIRE(notifications[0] == "Thermostat changed to on due to t0 thermostat is too cold. It was off for 0 minutes");
+
+  {
+    MockRepository mocks;
+    mocks.NeverCallFunc(update_relay_status);
+    mocks.NeverCallFunc(mqtt_publish_data);
+    update_thermostat();
+  }
+
+  thermostats[0].currentTemperature = 220;
+  thermostatDirty = true;
+  {
+    MockRepository mocks;
+    mocks.ExpectCallFunc(update_relay_status).With(CONFIG_MQTT_THERMOSTAT_RELAY_ID, RELAY_STATUS_OFF);
+    mocks.OnCallFunc(mqtt_publish_data).Do([&](const char *topic, const char *data, int qos, int retain) {
+        if (qos == QOS_0) {
+          notifications.push_back(data);
+        }
+      });
+
+    update_thermostat();
+    REQUIRE(thermostatState == THERMOSTAT_STATE_IDLE);
+  }
+  REQUIRE(notifications.size() == 2);
+  REQUIRE(notifications[1] == "Thermostat changed to off due to t0 thermostat is hot enough, t2 thermostat is hot enough. It was on for 0 minutes");
+
+  struct ThermostatDutyReport report;
+  thermostat_duty_report(&report);
+  REQUIRE(report.transitionsNb == 2);
+  REQUIRE(report.transitions[0].thermostatId == 0);
+  REQUIRE(report.transitions[0].on == 1);
+  REQUIRE(report.transitions[0].reason == THERMOSTAT_REASON_TOO_COLD);
+  REQUIRE(report.transitions[1].thermostatId == THERMOSTAT_DUTY_NO_ID);
+  REQUIRE(report.transitions[1].on == 0);
+  REQUIRE(report.transitions[1].reason == THERMOSTAT_REASON_HOT_ENOUGH);
+}
+
+// a room that warms up while the thermostat is heating and cools down
+// otherwise, its temperature is reported every minute
+struct RoomModel {
+  short temperature;
+  short minTemperature;
+  short maxTemperature;
+  unsigned int toggles;
+  unsigned int minutes;
+  enum ThermostatState lastState;
+};
+
+static struct RoomModel room;
+
+static void room_model_task(void *pvParameters)
+{
+  for (;;) {
+    vTaskDelay(60 * 1000);
+    room.minutes++;
+    if (thermostatState != room.lastState) {
+      room.toggles++;
+      room.lastState = thermostatState;
+    }
+    room.temperature += thermostatState == THERMOSTAT_STATE_HEATING ? 4 : -3;
+    // the first hour brings the room into the band
+    if (room.minutes > 60) {
+      room.minTemperature = std::min(room.minTemperature, room.temperature);
+      room.maxTemperature = std::max(room.maxTemperature, room.temperature);
+    }
+
+    struct ThermostatMessage t;
+    memset(&t, 0, sizeof(t));
+    t.msgType = THERMOSTAT_CURRENT_TEMPERATURE;
+    t.thermostatId = 0;
+    t.data.currentTemperature = room.temperature;
+    event_bus_publish(EVENT_THERMOSTAT_CMD, &t, sizeof(t), portMAX_DELAY);
+    // nobody drains the publisher ring
+    mqtt_publish_ring_reset();
+  }
+}
+
+TEST_CASE("thermostat_simulated_month", "[tag]" ) {
+  sim_start();
+  event_bus_init();
+  timer_wheel_init();
+  thermostats_init();
+  thermostatState = THERMOSTAT_STATE_IDLE;
+  thermostats[0].mode = THERMOSTAT_MODE_HEAT;
+  room.temperature = 180;
+  room.minTemperature = SHRT_MAX;
+  room.maxTemperature = SHRT_MIN;
+  room.toggles = 0;
+  room.minutes = 0;
+  room.lastState = thermostatState;
+
+  QueueHandle_t inbox = xQueueCreate(6, sizeof(struct AppEvent *));
+  REQUIRE(event_bus_subscribe(EVENT_THERMOSTAT_CMD, inbox));
+  REQUIRE(event_bus_subscribe(EVENT_SENSOR_SAMPLE, inbox));
+  REQUIRE(xTaskCreate(handle_thermostat_cmd_task, "thermostat", 0, inbox, 2, NULL) == pdPASS);
+  REQUIRE(xTaskCreate(room_model_task, "room", 0, NULL, 1, NULL) == pdPASS);
+
+  sim_run_for(30 * 24 * 3600 * 1000U);
+
+  REQUIRE(room.minutes == 30 * 24 * 60);
+  // life ticks ride on the wheel, the only kernel timer
+  REQUIRE(simStats.timersFired == 30 * 24 * 3600 * (1000 / TIMER_WHEEL_TICK_MS));
+  // target 21.0 with 0.5 tolerance, overshoot of one reading
+  REQUIRE(room.minTemperature >= 200);
+  REQUIRE(room.maxTemperature <= 220);
+  REQUIRE(room.toggles > 1000);
+  // the room gains 0.4 and loses 0.3 per minute, heats 3/7 of the time
+  struct ThermostatDutyReport report;
+  thermostat_duty_report(&report);
+  for (int i = 0; i < THERMOSTAT_DUTY_DAYS_NB; i++) {
+    REQUIRE(report.days[i][THERMOSTAT_DUTY_RELAY] >= 40);
+    REQUIRE(report.days[i][THERMOSTAT_DUTY_RELAY] <= 45);
+  }
+  REQUIRE(report.total == room.toggles);
+  REQUIRE(eventBusStats.dropped == 0);
+  REQUIRE(event_bus_pool_free() == EVENT_BUS_POOL_SIZE);
+  sim_stop();
+  thermostatState = THERMOSTAT_STATE_IDLE;
+}
+
 // TEST_CASE("handle_room_update", "[tag]" ) {
 //   room0Temperature = SHRT_MIN;
 //   room0TemperatureFlag = 0;
@@ -0,0 +1,77 @@
+#include "esp_system.h"
+#include "catch.hpp"
+
+extern "C" {
+#include "app_thermostat_duty.h"
+}
+
+TEST_CASE("thermostat_duty_buckets", "[duty]" ) {
+  struct ThermostatDutyReport report;
+  thermostat_duty_init();
+
+  thermostat_duty_report(&report);
+  for (int i = 0; i < THERMOSTAT_DUTY_HOURS_NB; i++) {
+    REQUIRE(report.hours[i][THERMOSTAT_DUTY_RELAY] == THERMOSTAT_DUTY_UNKNOWN);
+  }
+  REQUIRE(report.transitionsNb == 0);
+
+  // first hour a quarter on, second hour half of it so far
+  for (int t = 0; t < THERMOSTAT_DUTY_TICKS_PER_HOUR; t++) {
+    thermostat_duty_tick(t < THERMOSTAT_DUTY_TICKS_PER_HOUR / 4, false);
+  }
+  for (int t = 0; t < 10; t++) {
+    thermostat_duty_tick(t < 5, true);
+  }
+  thermostat_duty_report(&report);
+  const unsigned char *current = report.hours[THERMOSTAT_DUTY_HOURS_NB - 1];
+  const unsigned char *previous = report.hours[THERMOSTAT_DUTY_HOURS_NB - 2];
+  REQUIRE(previous[THERMOSTAT_DUTY_RELAY] == 25);
+  REQUIRE(previous[THERMOSTAT_DUTY_HEATING] == 0);
+  REQUIRE(current[THERMOSTAT_DUTY_RELAY] == 50);
+  REQUIRE(current[THERMOSTAT_DUTY_HEATING] == 100);
+  REQUIRE(report.hours[THERMOSTAT_DUTY_HOURS_NB - 3][THERMOSTAT_DUTY_RELAY] == THERMOSTAT_DUTY_UNKNOWN);
+  REQUIRE(report.days[THERMOSTAT_DUTY_DAYS_NB - 1][THERMOSTAT_DUTY_HEATING] == 10 * 100 / (THERMOSTAT_DUTY_TICKS_PER_HOUR + 10));
+  REQUIRE(report.days[THERMOSTAT_DUTY_DAYS_NB - 2][THERMOSTAT_DUTY_RELAY] == THERMOSTAT_DUTY_UNKNOWN);
+
+  // a week and a half later the old buckets are reused
+  for (int t = 0; t < THERMOSTAT_DUTY_TICKS_PER_HOUR * 24 * 10; t++) {
+    thermostat_duty_tick(true, false);
+  }
+  thermostat_duty_report(&report);
+  for (int i = 0; i < THERMOSTAT_DUTY_HOURS_NB; i++) {
+    REQUIRE(report.hours[i][THERMOSTAT_DUTY_RELAY] == 100);
+    REQUIRE(report.hours[i][THERMOSTAT_DUTY_HEATING] == 0);
+  }
+  for (int i = 0; i < THERMOSTAT_DUTY_DAYS_NB; i++) {
+    REQUIRE(report.days[i][THERMOSTAT_DUTY_RELAY] == 100);
+  }
+}
+
+TEST_CASE("thermostat_duty_transitions", "[duty]" ) {
+  struct ThermostatDutyReport report;
+  thermostat_duty_init();
+
+  thermostat_duty_transition(THERMOSTAT_DUTY_RELAY, true, 2, THERMOSTAT_REASON_TOO_COLD, 1000);
+  thermostat_duty_transition(THERMOSTAT_DUTY_HEATING, true, 3, THERMOSTAT_REASON_CIRCUIT_RISE, 1060);
+  thermostat_duty_transition(THERMOSTAT_DUTY_RELAY, false, -1, THERMOSTAT_REASON_HOT_ENOUGH, 1120);
+  thermostat_duty_report(&report);
+  REQUIRE(report.total == 3);
+  REQUIRE(report.transitionsNb == 3);
+  REQUIRE(report.transitions[0].ts == 1000);
+  REQUIRE(report.transitions[0].thermostatId == 2);
+  REQUIRE(report.transitions[0].on == 1);
+  REQUIRE(report.transitions[1].channel == THERMOSTAT_DUTY_HEATING);
+  REQUIRE(report.transitions[1].reason == THERMOSTAT_REASON_CIRCUIT_RISE);
+  REQUIRE(report.transitions[2].thermostatId == THERMOSTAT_DUTY_NO_ID);
+  REQUIRE(report.transitions[2].on == 0);
+
+  // the ring keeps the last ones, oldest first
+  for (int i = 0; i < THERMOSTAT_DUTY_TRANSITIONS_NB; i++) {
+    thermostat_duty_transition(THERMOSTAT_DUTY_RELAY, i % 2, 0, THERMOSTAT_REASON_TOO_COLD, 2000 + i);
+  }
+  thermostat_duty_report(&report);
+  REQUIRE(report.total == THERMOSTAT_DUTY_TRANSITIONS_NB + 3);
+  REQUIRE(report.transitionsNb == THERMOSTAT_DUTY_TRANSITIONS_NB);
+  REQUIRE(report.transitions[0].ts == 2000);
+  REQUIRE(report.transitions[THERMOSTAT_DUTY_TRANSITIONS_NB - 1].ts == 2000 + THERMOSTAT_DUTY_TRANSITIONS_NB - 1);
+}
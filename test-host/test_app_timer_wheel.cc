@@ -0,0 +1,103 @@
+#include "esp_system.h"
+#include "catch.hpp"
+
+#include <vector>
+
+extern "C" {
+#include "app_timer_wheel.h"
+}
+
+// static, a failed test may leave them armed until the next init
+static std::vector<int> fired;
+static struct TimerWheelEntry once, every, entries[4], rearmed;
+
+static void record_expired(struct TimerWheelEntry *entry)
+{
+  fired.push_back(entry->id);
+}
+
+TEST_CASE("timer_wheel_one_shot_and_periodic", "[timer_wheel]" ) {
+  timer_wheel_init();
+  fired.clear();
+  timer_wheel_entry_init(&once, record_expired, 1);
+  timer_wheel_entry_init(&every, record_expired, 2);
+
+  // timeouts are rounded up to the wheel tick
+  timer_wheel_start(&once, 3 * TIMER_WHEEL_TICK_MS - 1, 0);
+  timer_wheel_start(&every, 2 * TIMER_WHEEL_TICK_MS, 2 * TIMER_WHEEL_TICK_MS);
+  REQUIRE(timer_wheel_active(&once));
+
+  timer_wheel_advance(2);
+  REQUIRE(fired == std::vector<int>({2}));
+  timer_wheel_advance(1);
+  REQUIRE(fired == std::vector<int>({2, 1}));
+  REQUIRE(!timer_wheel_active(&once));
+  REQUIRE(timer_wheel_active(&every));
+
+  timer_wheel_advance(7);
+  REQUIRE(fired == std::vector<int>({2, 1, 2, 2, 2, 2}));
+
+  timer_wheel_cancel(&every);
+  REQUIRE(!timer_wheel_active(&every));
+  timer_wheel_advance(10);
+  REQUIRE(fired.size() == 6);
+}
+
+TEST_CASE("timer_wheel_cascade", "[timer_wheel]" ) {
+  // next level, top level and past the top level
+  const unsigned int ticks[4] = {
+    TIMER_WHEEL_SLOTS + 5,
+    TIMER_WHEEL_SLOTS * TIMER_WHEEL_SLOTS * 3 + 17,
+    TIMER_WHEEL_SLOTS * TIMER_WHEEL_SLOTS * TIMER_WHEEL_SLOTS * 2 + 1,
+    1,
+  };
+  timer_wheel_init();
+  fired.clear();
+  // not aligned on a slot of any level
+  timer_wheel_advance(TIMER_WHEEL_SLOTS + 3);
+  for (int i = 0; i < 4; i++) {
+    timer_wheel_entry_init(&entries[i], record_expired, i);
+    timer_wheel_start(&entries[i], ticks[i] * TIMER_WHEEL_TICK_MS, 0);
+  }
+  unsigned int elapsed = 0;
+  for (int i : {3, 0, 1, 2}) {
+    timer_wheel_advance(ticks[i] - 1 - elapsed);
+    REQUIRE(timer_wheel_active(&entries[i]));
+    timer_wheel_advance(1);
+    REQUIRE(!timer_wheel_active(&entries[i]));
+    REQUIRE(fired.back() == i);
+    elapsed = ticks[i];
+  }
+  REQUIRE(fired.size() == 4);
+}
+
+static void rearm_expired(struct TimerWheelEntry *entry)
+{
+  fired.push_back(entry->id);
+  if (fired.size() < 3) {
+    timer_wheel_start(entry, TIMER_WHEEL_TICK_MS, 0);
+  }
+}
+
+TEST_CASE("timer_wheel_rearm_from_callback", "[timer_wheel]" ) {
+  timer_wheel_init();
+  fired.clear();
+  timer_wheel_entry_init(&rearmed, rearm_expired, 7);
+  timer_wheel_start(&rearmed, TIMER_WHEEL_TICK_MS, 0);
+  timer_wheel_advance(1);
+  timer_wheel_advance(1);
+  REQUIRE(fired.size() == 2);
+  // restarting an armed entry moves it
+  timer_wheel_start(&rearmed, 5 * TIMER_WHEEL_TICK_MS, 0);
+  timer_wheel_advance(4);
+  REQUIRE(fired.size() == 2);
+  timer_wheel_advance(1);
+  REQUIRE(fired.size() == 3);
+  timer_wheel_advance(100);
+  REQUIRE(fired.size() == 3);
+
+  // init leaves the entries of a previous run unarmed
+  timer_wheel_start(&rearmed, TIMER_WHEEL_TICK_MS, 0);
+  timer_wheel_init();
+  REQUIRE(!timer_wheel_active(&rearmed));
+}
@@ -0,0 +1,182 @@
+#include "esp_system.h"
+#include "catch.hpp"
+
+#include <vector>
+
+extern "C" {
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "sim.h"
+}
+
+// tasks run on their own stack, they only record what they see and
+// the checks are done once sim_run_for returns
+
+static QueueHandle_t simQueue;
+static std::vector<TickType_t> received;
+
+static void producer_task(void *pvParameters)
+{
+  for (int i = 0; i < 3; i++) {
+    vTaskDelay(10);
+    xQueueSend(simQueue, &i, portMAX_DELAY);
+  }
+  vTaskDelay(100);
+  int last = 42;
+  xQueueSend(simQueue, &last, portMAX_DELAY);
+}
+
+static void consumer_task(void *pvParameters)
+{
+  int i;
+  for (int n = 0; n < 5; n++) {
+    if (xQueueReceive(simQueue, &i, 15) == pdTRUE) {
+      received.push_back(xTaskGetTickCount() * 100 + i);
+    } else {
+      received.push_back(xTaskGetTickCount() * 100 + 99);
+    }
+  }
+}
+
+TEST_CASE("sim_queue_wait_and_timeout", "[sim]" ) {
+  sim_start();
+  received.clear();
+  simQueue = xQueueCreate(2, sizeof(int));
+  REQUIRE(simQueue != NULL);
+  REQUIRE(xTaskCreate(producer_task, "producer", 0, NULL, 1, NULL) == pdPASS);
+  REQUIRE(xTaskCreate(consumer_task, "consumer", 0, NULL, 2, NULL) == pdPASS);
+
+  sim_run_for(1000);
+
+  REQUIRE(xTaskGetTickCount() == 1000);
+  REQUIRE(esp_timer_get_time() == 1000 * 1000);
+  REQUIRE(received.size() == 5);
+  REQUIRE(received[0] == 10 * 100 + 0);
+  REQUIRE(received[1] == 20 * 100 + 1);
+  REQUIRE(received[2] == 30 * 100 + 2);
+  // the consumer gives up before the late item is sent
+  REQUIRE(received[3] == 45 * 100 + 99);
+  REQUIRE(received[4] == 60 * 100 + 99);
+  sim_stop();
+}
+
+static void filler_task(void *pvParameters)
+{
+  int i = 0;
+  while (xQueueSend(simQueue, &i, 5) == pdPASS) {
+    i++;
+  }
+  received.push_back(xTaskGetTickCount() * 100 + i);
+}
+
+TEST_CASE("sim_queue_full", "[sim]" ) {
+  sim_start();
+  received.clear();
+  simQueue = xQueueCreate(3, sizeof(int));
+  xTaskCreate(filler_task, "filler", 0, NULL, 1, NULL);
+
+  sim_run_for(100);
+  REQUIRE(received.size() == 1);
+  REQUIRE(received[0] == 5 * 100 + 3);
+
+  // no task to block, the main thread never waits
+  int i = 0;
+  REQUIRE(xQueueSend(simQueue, &i, portMAX_DELAY) == errQUEUE_FULL);
+  for (int n = 0; n < 3; n++) {
+    REQUIRE(xQueueReceive(simQueue, &i, portMAX_DELAY) == pdTRUE);
+    REQUIRE(i == n);
+  }
+  REQUIRE(xQueueReceive(simQueue, &i, portMAX_DELAY) == errQUEUE_EMPTY);
+  sim_stop();
+}
+
+static int reloadFired;
+static int oneShotFired;
+
+static void reload_callback(TimerHandle_t xTimer)
+{
+  reloadFired++;
+  if (reloadFired == 10) {
+    xTimerStop(xTimer, 0);
+  }
+}
+
+static void one_shot_callback(TimerHandle_t xTimer)
+{
+  oneShotFired += (int)(intptr_t)pvTimerGetTimerID(xTimer);
+}
+
+TEST_CASE("sim_timers", "[sim]" ) {
+  sim_start();
+  reloadFired = 0;
+  oneShotFired = 0;
+  TimerHandle_t reload = xTimerCreate("reload", 100, pdTRUE, NULL, reload_callback);
+  TimerHandle_t oneShot = xTimerCreate("oneShot", 250, pdFALSE, (void *)3, one_shot_callback);
+  xTimerStart(reload, 0);
+  xTimerStart(oneShot, 0);
+  REQUIRE(xTimerIsTimerActive(oneShot) == pdTRUE);
+
+  sim_run_for(550);
+  REQUIRE(reloadFired == 5);
+  REQUIRE(oneShotFired == 3);
+  REQUIRE(xTimerIsTimerActive(oneShot) == pdFALSE);
+
+  // a period change restarts the timer from now
+  xTimerChangePeriod(oneShot, 1000, 0);
+  sim_run_for(999);
+  REQUIRE(oneShotFired == 3);
+  sim_run_for(1);
+  REQUIRE(oneShotFired == 6);
+
+  REQUIRE(reloadFired == 10);
+  REQUIRE(xTimerIsTimerActive(reload) == pdFALSE);
+  REQUIRE(simStats.timersFired == 12);
+  sim_stop();
+}
+
+static EventGroupHandle_t simGroup;
+
+static void waiter_task(void *pvParameters)
+{
+  EventBits_t bits = xEventGroupWaitBits(simGroup, 0x3, pdTRUE, pdTRUE, portMAX_DELAY);
+  received.push_back(xTaskGetTickCount() * 100 + bits);
+  bits = xEventGroupWaitBits(simGroup, 0x4, pdFALSE, pdFALSE, 50);
+  received.push_back(xTaskGetTickCount() * 100 + bits);
+}
+
+static void setter_task(void *pvParameters)
+{
+  vTaskDelay(10);
+  xEventGroupSetBits(simGroup, 0x1);
+  vTaskDelay(10);
+  xEventGroupSetBits(simGroup, 0x2 | 0x8);
+}
+
+TEST_CASE("sim_event_group", "[sim]" ) {
+  sim_start();
+  received.clear();
+  simGroup = xEventGroupCreate();
+  xTaskCreate(waiter_task, "waiter", 0, NULL, 1, NULL);
+  xTaskCreate(setter_task, "setter", 0, NULL, 1, NULL);
+
+  sim_run_for(1000);
+  REQUIRE(received.size() == 2);
+  // woken once both bits are set, they are cleared on exit
+  REQUIRE(received[0] == 20 * 100 + 0xb);
+  REQUIRE(received[1] == 70 * 100 + 0x8);
+  REQUIRE(xEventGroupGetBits(simGroup) == 0x8);
+  sim_stop();
+}
+
+TEST_CASE("sim_inactive", "[sim]" ) {
+  REQUIRE(!sim_active());
+  REQUIRE(xQueueCreate(1, sizeof(int)) == NULL);
+  REQUIRE(xTimerCreate("t", 1, pdTRUE, NULL, reload_callback) == NULL);
+  REQUIRE(xTaskCreate(producer_task, "producer", 0, NULL, 1, NULL) == pdFALSE);
+  REQUIRE(xTaskGetTickCount() == 0);
+  // foreign handles keep the stub behaviour
+  int i = 0;
+  REQUIRE(xQueueSend((QueueHandle_t)1, &i, 0) == pdPASS);
+}